@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * automount.c - On-demand mounts through autofs
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __AUTOMOUNT_C
+#define __AUTOMOUNT_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <linux/auto_fs4.h>
+
+#include "automount.h"
+#include "evloop.h"
+#include "memstat.h"
+
+#define AUTOFS_OPTIONS_SIZE 128
+#define AUTOMOUNT_ALLOC_STEP 8
+
+/**
+ * @var struct automount **automounts
+ * @brief Armed autofs triggers, kept for a re-exec of PID 1 to take over
+ */
+struct automount **automounts = NULL;
+size_t automount_count = 0;
+static size_t automount_allocated = 0;
+
+/**
+ * @fn static void automount_handle(int fd, uint32_t events, void *data)
+ * @brief Serves a kernel request for a direct autofs mount point
+ * @details The kernel holds the accessing process until the wait token is
+ *          released with READY (after mounting the real filesystem on top
+ *          of the autofs one) or FAIL. PID 1 is the automount daemon here,
+ *          so its own access to the target does not trigger the mount.
+ */
+static void automount_handle(int fd, uint32_t events, void *data)
+{
+        struct automount *am = data;
+        union autofs_v5_packet_union pkt;
+        ssize_t ret = 0;
+        bool mounted = false;
+
+        if (events & (EVLOOP_HUP | EVLOOP_ERR)) {
+                evloop_del(fd);
+                close(fd);
+                am->pipe_fd = -1;
+                return;
+        }
+
+        ret = read(fd, &pkt, sizeof(pkt));
+        if (ret < (ssize_t) sizeof(struct autofs_packet_hdr)) {
+                return;
+        }
+
+        if (pkt.hdr.type != autofs_ptype_missing_direct) {
+                return; //no expiry timeout is set, nothing else to serve
+        }
+
+        fprintf(stdout, "cyrenit: %s accessed by pid %u, mounting it\n",
+                am->task->target, pkt.v5_packet.pid);
+
+        mounted = am->task->mounted || mount_task_mount(am->task);
+        if (ioctl(am->ioctl_fd, mounted ? AUTOFS_IOC_READY : AUTOFS_IOC_FAIL,
+                  pkt.v5_packet.wait_queue_token) != 0) {
+                perror("cyrenit: failed to release autofs waiters");
+        }
+}
+
+/**
+ * @fn static bool automount_watch(struct automount *am)
+ * @brief Serves the autofs pipe of am from the event loop and tracks it
+ */
+static bool automount_watch(struct automount *am)
+{
+        struct automount **new_list = NULL;
+        size_t new_size = 0;
+
+        if (automount_count >= automount_allocated) {
+                new_size = automount_allocated + AUTOMOUNT_ALLOC_STEP;
+                new_list = mem_reallocarray(MEM_MOUNTS, automounts, new_size,
+                                            sizeof(struct automount *));
+                if (new_list == NULL) {
+                        return false;
+                }
+                automounts = new_list;
+                automount_allocated = new_size;
+        }
+
+        fcntl(am->pipe_fd, F_SETFL, O_NONBLOCK);
+        if (!evloop_add(am->pipe_fd, EVLOOP_IN, automount_handle, am)) {
+                return false;
+        }
+
+        automounts[automount_count++] = am;
+        return true;
+}
+
+/**
+ * @fn static bool automount_arm(struct mount_task *task)
+ * @brief Mounts a direct autofs trigger on the target of task
+ */
+static bool automount_arm(struct mount_task *task)
+{
+        struct automount *am = NULL;
+        char options[AUTOFS_OPTIONS_SIZE];
+        unsigned long timeout = 0;
+        int fds[2] = { -1, -1 };
+
+        am = mem_calloc(MEM_MOUNTS, 1, sizeof(struct automount));
+        if (am == NULL) {
+                return false;
+        }
+        am->task = task;
+        am->ioctl_fd = -1;
+
+        if (mkdir(task->target, 0755) != 0 && errno != EEXIST) {
+                goto automount_fail;
+        }
+
+        if (pipe2(fds, O_CLOEXEC) != 0) {
+                goto automount_fail;
+        }
+
+        snprintf(options, sizeof(options), "fd=%d,minproto=%d,maxproto=%d,"
+                 "direct", fds[1], AUTOFS_PROTO_VERSION,
+                 AUTOFS_PROTO_VERSION);
+        if (mount("cyrenit", task->target, "autofs", 0, options) != 0) {
+                goto automount_fail;
+        }
+        close(fds[1]);
+        fds[1] = -1;
+
+        /* we are the daemon: opening the trigger does not fire it */
+        am->ioctl_fd = open(task->target, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (am->ioctl_fd == -1) {
+                umount2(task->target, MNT_DETACH);
+                goto automount_fail;
+        }
+        ioctl(am->ioctl_fd, AUTOFS_IOC_SETTIMEOUT, &timeout);
+
+        am->pipe_fd = fds[0];
+        if (!automount_watch(am)) {
+                umount2(task->target, MNT_DETACH);
+                goto automount_fail;
+        }
+
+        fprintf(stdout, "cyrenit: [%s] %s will be mounted on %s on first "
+                "access\n", mount_tier_name(task->tier), task->source,
+                task->target);
+        return true;
+
+automount_fail:
+        fprintf(stderr, "cyrenit: failed to set up autofs on %s: %s\n",
+                task->target, strerror(errno));
+        if (fds[0] != -1) {
+                close(fds[0]);
+        }
+        if (fds[1] != -1) {
+                close(fds[1]);
+        }
+        if (am->ioctl_fd != -1) {
+                close(am->ioctl_fd);
+        }
+        mem_free(MEM_MOUNTS, am);
+        return false;
+}
+
+/**
+ * @fn size_t automount_setup(struct mount_task_list *m)
+ * @brief Arms autofs triggers for every on-demand task of m
+ * @param m the mount task list, the global one if NULL
+ * @return the number of triggers armed
+ * @details Must run after the event loop is set up. The triggers are
+ *          never expired, an on-demand mount stays once it happened.
+ */
+size_t automount_setup(struct mount_task_list *m)
+{
+        struct mount_task_list *mtl_ptr = m;
+        size_t armed = 0;
+        size_t i = 0;
+
+        if (mtl_ptr == NULL) {
+                mtl_ptr = &mounts;
+        }
+
+        for (i = 0; i < mtl_ptr->count; i++) {
+                if (mtl_ptr->mount_tasks[i]->tier != MOUNT_TIER_ON_DEMAND) {
+                        continue;
+                }
+                if (automount_arm(mtl_ptr->mount_tasks[i])) {
+                        armed++;
+                }
+        }
+
+        return armed;
+}
+
+/**
+ * @fn bool automount_adopt(struct mount_task *task, int pipe_fd,
+ *                          int ioctl_fd)
+ * @brief Takes over a trigger armed before PID 1 was re-executed
+ * @param task the on-demand mount task of the trigger
+ * @param pipe_fd the read end of the autofs pipe
+ * @param ioctl_fd the descriptor opened on the trigger
+ * @return true on success or false on failure
+ */
+bool automount_adopt(struct mount_task *task, int pipe_fd, int ioctl_fd)
+{
+        struct automount *am = NULL;
+
+        if (task == NULL || pipe_fd < 0 || ioctl_fd < 0) {
+                return false;
+        }
+
+        am = mem_calloc(MEM_MOUNTS, 1, sizeof(struct automount));
+        if (am == NULL) {
+                return false;
+        }
+
+        fcntl(pipe_fd, F_SETFD, FD_CLOEXEC);
+        fcntl(ioctl_fd, F_SETFD, FD_CLOEXEC);
+        am->task = task;
+        am->pipe_fd = pipe_fd;
+        am->ioctl_fd = ioctl_fd;
+        if (!automount_watch(am)) {
+                mem_free(MEM_MOUNTS, am);
+                return false;
+        }
+
+        return true;
+}
+
+#endif//__AUTOMOUNT_C
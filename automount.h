@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * automount.h - On-demand mounts through autofs
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __AUTOMOUNT_H
+#define __AUTOMOUNT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "mounts.h"
+
+#define AUTOFS_PROTO_VERSION 5
+
+struct automount
+{
+        struct mount_task *task;
+        int pipe_fd;
+        int ioctl_fd;
+};
+
+extern struct automount **automounts;
+extern size_t automount_count;
+
+size_t automount_setup(struct mount_task_list *m);
+bool automount_adopt(struct mount_task *task, int pipe_fd, int ioctl_fd);
+
+#endif//__AUTOMOUNT_H
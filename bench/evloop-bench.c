@@ -0,0 +1,212 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * evloop-bench.c - Event loop backends under many chatty log pipes
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __EVLOOP_BENCH_C
+#define __EVLOOP_BENCH_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "evloop.h"
+
+#define BENCH_PIPES 1000
+#define BENCH_ROUNDS 200
+#define BENCH_LINE "cyrenit-bench: a line of service output, 64 bytes long..\n"
+
+struct bench_pipe
+{
+        int read_fd;
+        int write_fd;
+};
+
+static struct bench_pipe *pipes = NULL;
+static size_t pipe_count = 0;
+static size_t lines_left = 0;
+
+static double now_ns()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench_line_done()
+{
+        if (--lines_left == 0) {
+                evloop_stop();
+        }
+}
+
+static void bench_reader(int fd, const char *buffer, ssize_t length,
+                         void *data)
+{
+        (void) fd;
+        (void) buffer;
+        (void) data;
+        if (length > 0) {
+                bench_line_done();
+        }
+}
+
+/* what a callback on a plain readiness watch has to do by itself */
+static void bench_poller(int fd, uint32_t events, void *data)
+{
+        char buffer[EVLOOP_READ_SIZE];
+
+        (void) events;
+        (void) data;
+        if (read(fd, buffer, sizeof(buffer)) > 0) {
+                bench_line_done();
+        }
+}
+
+static bool bench_open(bool reader)
+{
+        int fds[2];
+        size_t i = 0;
+        bool ok = false;
+
+        for (i = 0; i < pipe_count; i++) {
+                if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) != 0) {
+                        return false;
+                }
+                pipes[i].read_fd = fds[0];
+                pipes[i].write_fd = fds[1];
+
+                ok = reader ?
+                     evloop_add_reader(fds[0], bench_reader, NULL) :
+                     evloop_add(fds[0], EVLOOP_IN, bench_poller, NULL);
+                if (!ok) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+static void bench_close()
+{
+        size_t i = 0;
+
+        for (i = 0; i < pipe_count; i++) {
+                evloop_del(pipes[i].read_fd);
+                close(pipes[i].read_fd);
+                close(pipes[i].write_fd);
+        }
+}
+
+/**
+ * @brief Every round, each pipe gets a line and the loop runs until all
+ *        of them were read. Only the loop is timed, not the writers.
+ */
+static bool bench_case(const char *label, bool reader)
+{
+        double total = 0;
+        double start = 0;
+        size_t round = 0;
+        size_t i = 0;
+
+        if (!bench_open(reader)) {
+                fprintf(stderr, "%s: failed to set up the pipes\n", label);
+                return false;
+        }
+
+        for (round = 0; round < BENCH_ROUNDS; round++) {
+                for (i = 0; i < pipe_count; i++) {
+                        if (write(pipes[i].write_fd, BENCH_LINE,
+                                  sizeof(BENCH_LINE) - 1) == -1) {
+                                return false;
+                        }
+                }
+
+                lines_left = pipe_count;
+                start = now_ns();
+                if (evloop_run() != EXIT_SUCCESS) {
+                        return false;
+                }
+                total += now_ns() - start;
+        }
+
+        printf("%-10s %-9s %6zu pipes %8.1f ns/line\n", evloop_backend_name(),
+               label, pipe_count, total / (BENCH_ROUNDS * pipe_count));
+        bench_close();
+
+        return true;
+}
+
+/* The backend is chosen once per process, each one runs in a child */
+static int bench_backend(enum evloop_backend_id id)
+{
+        if (!evloop_init_backend(id)) {
+                fprintf(stderr, "backend %d unavailable\n", id);
+                return EXIT_FAILURE;
+        }
+
+        if (!bench_case("readers", true) || !bench_case("pollers", false)) {
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+int main()
+{
+        enum evloop_backend_id ids[] = {
+                EVLOOP_BACKEND_EPOLL,
+                EVLOOP_BACKEND_URING,
+        };
+        struct rlimit rl;
+        int status = EXIT_SUCCESS;
+        int ret = 0;
+        size_t i = 0;
+        pid_t pid = 0;
+
+        /* two fds a pipe, plus some slack */
+        getrlimit(RLIMIT_NOFILE, &rl);
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        pipe_count = BENCH_PIPES;
+        if (rl.rlim_cur < pipe_count * 2 + 64) {
+                pipe_count = (rl.rlim_cur - 64) / 2;
+        }
+
+        pipes = calloc(pipe_count, sizeof(struct bench_pipe));
+        if (pipes == NULL) {
+                return EXIT_FAILURE;
+        }
+
+        for (i = 0; i < sizeof(ids) / sizeof(ids[0]); i++) {
+                fflush(stdout);
+                pid = fork();
+                if (pid == 0) {
+                        return bench_backend(ids[i]);
+                }
+                if (pid == -1 || waitpid(pid, &ret, 0) == -1 ||
+                    !WIFEXITED(ret) || WEXITSTATUS(ret) != EXIT_SUCCESS) {
+                        status = EXIT_FAILURE;
+                }
+        }
+
+        free(pipes);
+        return status;
+}
+
+#endif//__EVLOOP_BENCH_C
@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * lz-bench.c - Journal compressor throughput
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __LZ_BENCH_C
+#define __LZ_BENCH_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "journal.h"
+#include "lz.h"
+
+#define BENCH_ROUNDS 10
+
+static const char *bench_words[] = {
+        "starting", "worker", "request", "served", "in", "ms", "GET", "POST",
+        "/api/v1/items", "/health", "200", "404", "connection", "closed",
+        "retrying", "timeout", "cache", "miss", "hit", "flushed",
+};
+
+static double now_ns()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* A segment's worth of journal records holding log-like lines */
+static size_t bench_fill(char *buffer, size_t size)
+{
+        struct journal_record *record = NULL;
+        char line[256];
+        size_t offset = sizeof(struct journal_header);
+        size_t words = sizeof(bench_words) / sizeof(bench_words[0]);
+        size_t length = 0;
+        uint64_t time = 1000000000ULL;
+        int i = 0;
+
+        memset(buffer, 0, size);
+        while (offset + sizeof(struct journal_record) + sizeof(line) < size) {
+                length = 0;
+                for (i = 0; i < 8; i++) {
+                        length += (size_t) snprintf(line + length,
+                                                    sizeof(line) - length,
+                                                    "%s ",
+                                                    bench_words[rand() %
+                                                                words]);
+                }
+                length += (size_t) snprintf(line + length,
+                                            sizeof(line) - length, "%d",
+                                            rand() % 100000);
+
+                time += (uint64_t) (rand() % 100000);
+                record = (struct journal_record *) (buffer + offset);
+                record->time = time;
+                record->service = (uint32_t) (rand() % 16);
+                record->length = (uint16_t) length;
+                record->priority = JOURNAL_PRIORITY_DEFAULT;
+                memcpy(record->message, line, length);
+                offset = (offset + sizeof(struct journal_record) + length +
+                          JOURNAL_ALIGN - 1) & ~((size_t) JOURNAL_ALIGN - 1);
+        }
+
+        return offset;
+}
+
+int main()
+{
+        size_t size = JOURNAL_SEGMENT_SIZE;
+        size_t packed_size = 0;
+        double compress_ns = 0;
+        double decompress_ns = 0;
+        double start = 0;
+        char *input = malloc(size);
+        char *packed = malloc(lz_bound(size));
+        char *output = malloc(size);
+        int i = 0;
+
+        if (input == NULL || packed == NULL || output == NULL) {
+                return EXIT_FAILURE;
+        }
+
+        srand(42);
+        size = bench_fill(input, size);
+
+        for (i = 0; i < BENCH_ROUNDS; i++) {
+                start = now_ns();
+                packed_size = lz_compress(input, size, packed, lz_bound(size));
+                compress_ns += now_ns() - start;
+
+                start = now_ns();
+                if (lz_decompress(packed, packed_size, output, size) !=
+                    (ssize_t) size || memcmp(input, output, size) != 0) {
+                        fprintf(stderr, "lz-bench: round trip failed\n");
+                        return EXIT_FAILURE;
+                }
+                decompress_ns += now_ns() - start;
+        }
+
+        printf("lz: %zu KiB segment -> %zu KiB (%.1f%%)\n", size / 1024,
+               packed_size / 1024, 100.0 * packed_size / size);
+        printf("lz: compress %.0f MB/s, decompress %.0f MB/s\n",
+               size * BENCH_ROUNDS / compress_ns * 1e3,
+               size * BENCH_ROUNDS / decompress_ns * 1e3);
+
+        free(input);
+        free(packed);
+        free(output);
+        return EXIT_SUCCESS;
+}
+
+#endif//__LZ_BENCH_C
@@ -0,0 +1,371 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * micro-bench.c - Cost per call of the process and mount builders
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __MICRO_BENCH_C
+#define __MICRO_BENCH_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "cyrenit.h"
+#include "memstat.h"
+#include "mounts.h"
+#include "proc.h"
+
+/*
+ * Every benchmark runs BENCH_ROUNDS rounds and keeps the median, only the
+ * calls it is named after are timed. Allocations are the ones PID 1
+ * counts (see memstat.h), so they do not depend on the machine: going
+ * over the baseline fails, being slower than it only warns.
+ */
+#define BENCH_ROUNDS 7
+#define BENCH_ITERATIONS 2000
+#define BENCH_ARGS 8
+#define BENCH_SCALE 10000
+#define BENCH_SLOWER_PERCENT 50
+#define BENCH_NAME_MAX 48
+
+int console_fd = -1;
+
+struct bench_result
+{
+        const char *name;
+        double ns;
+        double allocs;
+};
+
+struct bench_clock
+{
+        uint64_t ns;
+        uint64_t allocs;
+        uint64_t started_ns;
+        uint64_t started_allocs;
+};
+
+static const char *bench_env[] = {
+        "PATH=/bin:/sbin", "HOME=/", "TERM=linux", "LANG=C.UTF-8",
+        "SERVICE=bench", "INSTANCE=0", "LOGLEVEL=6", "RUNTIME=/run", NULL
+};
+
+static uint64_t now_ns()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void bench_start(struct bench_clock *clock)
+{
+        clock->started_allocs = memstat_allocs();
+        clock->started_ns = now_ns();
+}
+
+static void bench_stop(struct bench_clock *clock)
+{
+        clock->ns += now_ns() - clock->started_ns;
+        clock->allocs += memstat_allocs() - clock->started_allocs;
+}
+
+static size_t bench_process_create(struct bench_clock *clock)
+{
+        struct process *proc = NULL;
+        int i = 0;
+
+        for (i = 0; i < BENCH_ITERATIONS; i++) {
+                bench_start(clock);
+                proc = process_create();
+                process_destroy(proc);
+                bench_stop(clock);
+        }
+
+        return BENCH_ITERATIONS;
+}
+
+static size_t bench_process_add_arg(struct bench_clock *clock)
+{
+        struct process *proc = NULL;
+        int i = 0;
+        int j = 0;
+
+        for (i = 0; i < BENCH_ITERATIONS; i++) {
+                proc = process_create();
+                process_set_image(proc, "/sbin/service");
+                bench_start(clock);
+                for (j = 0; j < BENCH_ARGS; j++) {
+                        process_add_arg(proc, "--argument");
+                }
+                bench_stop(clock);
+                process_destroy(proc);
+        }
+
+        return BENCH_ITERATIONS * BENCH_ARGS;
+}
+
+static size_t bench_process_set_env(struct bench_clock *clock)
+{
+        struct process *proc = NULL;
+        int i = 0;
+
+        for (i = 0; i < BENCH_ITERATIONS; i++) {
+                proc = process_create();
+                bench_start(clock);
+                process_set_env(proc, bench_env);
+                bench_stop(clock);
+                process_destroy(proc);
+        }
+
+        return BENCH_ITERATIONS;
+}
+
+static size_t bench_process_destroy(struct bench_clock *clock)
+{
+        struct process *proc = NULL;
+        int i = 0;
+        int j = 0;
+
+        for (i = 0; i < BENCH_ITERATIONS; i++) {
+                proc = process_create();
+                process_set_image(proc, "/sbin/service");
+                for (j = 0; j < BENCH_ARGS; j++) {
+                        process_add_arg(proc, "--argument");
+                }
+                process_set_env(proc, bench_env);
+                bench_start(clock);
+                process_destroy(proc);
+                bench_stop(clock);
+        }
+
+        return BENCH_ITERATIONS;
+}
+
+static size_t bench_register_process(struct bench_clock *clock)
+{
+        static struct process *procs[BENCH_SCALE];
+        int i = 0;
+
+        for (i = 0; i < BENCH_SCALE; i++) {
+                procs[i] = process_create();
+        }
+
+        bench_start(clock);
+        for (i = 0; i < BENCH_SCALE; i++) {
+                register_process(procs[i]);
+        }
+        bench_stop(clock);
+
+        /* from the end, so unregistering does not move everything */
+        for (i = BENCH_SCALE - 1; i >= 0; i--) {
+                unregister_process(procs[i]);
+                process_destroy(procs[i]);
+        }
+
+        return BENCH_SCALE;
+}
+
+static size_t bench_mount_task_create_ready(struct bench_clock *clock)
+{
+        struct mount_task *task = NULL;
+        int i = 0;
+
+        for (i = 0; i < BENCH_ITERATIONS; i++) {
+                bench_start(clock);
+                task = mount_task_create_ready("tmpfs", "/run", "tmpfs", 0,
+                                               sizeof("mode=0755"),
+                                               "mode=0755");
+                bench_stop(clock);
+                mount_task_destroy(task);
+        }
+
+        return BENCH_ITERATIONS;
+}
+
+static size_t bench_mount_task_duplicate(struct bench_clock *clock)
+{
+        struct mount_task *task = NULL;
+        struct mount_task *copy = NULL;
+        int i = 0;
+
+        task = mount_task_create_ready("tmpfs", "/run", "tmpfs", 0,
+                                       sizeof("mode=0755"), "mode=0755");
+        for (i = 0; i < BENCH_ITERATIONS; i++) {
+                bench_start(clock);
+                copy = mount_task_duplicate(task);
+                bench_stop(clock);
+                mount_task_destroy(copy);
+        }
+        mount_task_destroy(task);
+
+        return BENCH_ITERATIONS;
+}
+
+static size_t bench_add_mount_task(struct bench_clock *clock)
+{
+        struct mount_task *task = NULL;
+        int i = 0;
+
+        task = mount_task_create_ready("tmpfs", "/run", "tmpfs", 0,
+                                       sizeof("mode=0755"), "mode=0755");
+        bench_start(clock);
+        for (i = 0; i < BENCH_ITERATIONS; i++) {
+                add_mount_task(task);
+        }
+        bench_stop(clock);
+        free_mount_task_list();
+        mount_task_destroy(task);
+
+        return BENCH_ITERATIONS;
+}
+
+static struct
+{
+        const char *name;
+        size_t (*run)(struct bench_clock *clock);
+} benches[] = {
+        { "process_create", bench_process_create },
+        { "process_add_arg", bench_process_add_arg },
+        { "process_set_env", bench_process_set_env },
+        { "process_destroy", bench_process_destroy },
+        { "register_process", bench_register_process },
+        { "mount_task_create_ready", bench_mount_task_create_ready },
+        { "mount_task_duplicate", bench_mount_task_duplicate },
+        { "add_mount_task", bench_add_mount_task },
+};
+
+#define BENCH_COUNT (sizeof(benches) / sizeof(benches[0]))
+
+static int compare_double(const void *a, const void *b)
+{
+        double x = *(const double *) a;
+        double y = *(const double *) b;
+
+        return (x > y) - (x < y);
+}
+
+static void bench_run(size_t index, struct bench_result *result)
+{
+        struct bench_clock clock;
+        double ns[BENCH_ROUNDS];
+        size_t ops = 0;
+        int round = 0;
+
+        result->name = benches[index].name;
+        result->allocs = 0;
+        for (round = 0; round < BENCH_ROUNDS; round++) {
+                memset(&clock, 0, sizeof(clock));
+                ops = benches[index].run(&clock);
+                ns[round] = (double) clock.ns / ops;
+                /* the first round also pays for growing what is kept */
+                if ((double) clock.allocs / ops > result->allocs) {
+                        result->allocs = (double) clock.allocs / ops;
+                }
+        }
+
+        qsort(ns, BENCH_ROUNDS, sizeof(double), compare_double);
+        result->ns = ns[BENCH_ROUNDS / 2];
+}
+
+static bool bench_write(const char *path, struct bench_result *results)
+{
+        FILE *out = fopen(path, "w");
+        size_t i = 0;
+
+        if (out == NULL) {
+                perror("micro-bench: failed to write the baseline");
+                return false;
+        }
+
+        fprintf(out, "# name allocs/op ns/op, written by "
+                "`make -C bench micro-baseline`\n");
+        for (i = 0; i < BENCH_COUNT; i++) {
+                fprintf(out, "%s %.3f %.1f\n", results[i].name,
+                        results[i].allocs, results[i].ns);
+        }
+        fclose(out);
+
+        return true;
+}
+
+/* Compares against the baseline, false if anything allocates more */
+static bool bench_compare(const char *path, struct bench_result *results)
+{
+        char line[128];
+        char name[BENCH_NAME_MAX];
+        double allocs = 0;
+        double ns = 0;
+        bool ok = true;
+        size_t i = 0;
+        FILE *in = fopen(path, "r");
+
+        if (in == NULL) {
+                perror("micro-bench: failed to read the baseline");
+                return false;
+        }
+
+        while (fgets(line, sizeof(line), in) != NULL) {
+                if (line[0] == '#' ||
+                    sscanf(line, "%47s %lf %lf", name, &allocs, &ns) != 3) {
+                        continue;
+                }
+                for (i = 0; i < BENCH_COUNT; i++) {
+                        if (strcmp(results[i].name, name) == STRCMP_EQUAL) {
+                                break;
+                        }
+                }
+                if (i == BENCH_COUNT) {
+                        continue;
+                }
+
+                if (results[i].allocs > allocs + 0.0005) {
+                        fprintf(stderr, "micro-bench: %s allocates %.3f "
+                                "times per call, the baseline %.3f\n", name,
+                                results[i].allocs, allocs);
+                        ok = false;
+                }
+                if (results[i].ns > ns * (100 + BENCH_SLOWER_PERCENT) / 100) {
+                        fprintf(stderr, "micro-bench: warning: %s takes "
+                                "%.1f ns, the baseline %.1f\n", name,
+                                results[i].ns, ns);
+                }
+        }
+        fclose(in);
+
+        return ok;
+}
+
+int main(int argc, char **argv)
+{
+        struct bench_result results[BENCH_COUNT];
+        size_t i = 0;
+
+        for (i = 0; i < BENCH_COUNT; i++) {
+                bench_run(i, &results[i]);
+                printf("%-24s %8.1f ns/op %6.3f allocs/op\n",
+                       results[i].name, results[i].ns, results[i].allocs);
+        }
+
+        if (argc == 3 && strcmp(argv[1], "--write") == STRCMP_EQUAL) {
+                return bench_write(argv[2], results) ? EXIT_SUCCESS :
+                       EXIT_FAILURE;
+        }
+        if (argc == 2) {
+                return bench_compare(argv[1], results) ? EXIT_SUCCESS :
+                       EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+#endif//__MICRO_BENCH_C
@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * sandbox-bench.c - Cost of setting up service sandboxes at spawn time
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __SANDBOX_BENCH_C
+#define __SANDBOX_BENCH_C
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <sys/wait.h>
+
+#include "cyrenit.h"
+#include "sandbox.h"
+
+#define BENCH_SPAWNS 200
+/*
+ * What a sandbox may add to a spawn, over a plain fork(). Creating a network
+ * namespace alone takes the kernel longer than that: the cases with one are
+ * only reported, any other case over budget fails the benchmark.
+ */
+#define BENCH_BUDGET_US 500.0
+
+static const struct
+{
+        const char *label;
+        unsigned flags;
+} bench_cases[] = {
+        {"fork", 0},
+        {"mount", SANDBOX_MOUNT},
+        {"mount readonly", SANDBOX_MOUNT | SANDBOX_READONLY},
+        {"mount dev", SANDBOX_MOUNT | SANDBOX_DEV},
+        {"ipc", SANDBOX_IPC},
+        {"net", SANDBOX_NET},
+        {"pid", SANDBOX_PID | SANDBOX_MOUNT},
+        {"all", SANDBOX_MOUNT | SANDBOX_PID | SANDBOX_IPC | SANDBOX_NET |
+                SANDBOX_READONLY | SANDBOX_DEV},
+};
+
+#define BENCH_CASES (sizeof(bench_cases) / sizeof(bench_cases[0]))
+
+static double now_us()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * Time from the spawn to the child being ready to exec: the namespaces are
+ * created and its mounts set up. Tearing them down again is left out.
+ */
+static double bench_case(unsigned flags, int *pipefd)
+{
+        double total = 0;
+        double start = 0;
+        char ok = 0;
+        pid_t pid = 0;
+        int i = 0;
+
+        for (i = 0; i < BENCH_SPAWNS; i++) {
+                start = now_us();
+                pid = flags != 0 ? sandbox_fork(flags) : fork();
+                if (pid == FORK_ISCHILD) {
+                        ok = sandbox_setup(flags);
+                        _exit(write(pipefd[1], &ok, 1) == 1 ? EXIT_SUCCESS :
+                                                              EXIT_FAILURE);
+                }
+                if (pid == -1 || read(pipefd[0], &ok, 1) != 1 || !ok) {
+                        if (pid != -1) {
+                                waitpid(pid, NULL, 0);
+                        }
+                        return -1;
+                }
+                total += now_us() - start;
+                waitpid(pid, NULL, 0);
+        }
+
+        return total / BENCH_SPAWNS;
+}
+
+int main()
+{
+        double baseline = 0;
+        double cost = 0;
+        int pipefd[2] = {-1, -1};
+        int ret = EXIT_SUCCESS;
+        bool budgeted = false;
+        size_t i = 0;
+
+        if (pipe2(pipefd, O_CLOEXEC) == -1) {
+                return EXIT_FAILURE;
+        }
+
+        for (i = 0; i < BENCH_CASES; i++) {
+                cost = bench_case(bench_cases[i].flags, pipefd);
+                if (cost < 0) {
+                        printf("%-16s skipped, cannot sandbox here (needs "
+                               "root and Linux 5.12)\n", bench_cases[i].label);
+                        continue;
+                }
+                if (bench_cases[i].flags == 0) {
+                        baseline = cost;
+                        printf("%-16s %8.1f us/spawn\n", bench_cases[i].label,
+                               cost);
+                        continue;
+                }
+                budgeted = !(bench_cases[i].flags & SANDBOX_NET);
+                printf("%-16s %8.1f us/spawn %+8.1f us over fork%s\n",
+                       bench_cases[i].label, cost, cost - baseline,
+                       !budgeted ? ", not budgeted" :
+                       cost - baseline > BENCH_BUDGET_US ?
+                       ", over budget" : "");
+                if (budgeted && cost - baseline > BENCH_BUDGET_US) {
+                        ret = EXIT_FAILURE;
+                }
+        }
+
+        return ret;
+}
+
+#endif//__SANDBOX_BENCH_C
@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * stats-bench.c - Resource sampler cost benchmark
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __STATS_BENCH_C
+#define __STATS_BENCH_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "proc.h"
+#include "stats.h"
+
+#define BENCH_SERVICES 1000
+#define BENCH_ROUNDS 20
+/* rounds for every service to reach STATS_IDLE_SKIP_MAX and the interval
+ * to settle, then the rounds that are measured */
+#define BENCH_WARMUP_ROUNDS (16 * (STATS_IDLE_SKIP_MAX + 1))
+#define BENCH_IDLE_ROUNDS (16 * (STATS_IDLE_SKIP_MAX + 1))
+
+int console_fd = -1;
+
+static uint64_t cpu_ns()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/*
+ * Runs the real sampler on supervisor_timers, which has no timerfd here:
+ * the wheel jumps straight to each round, so the simulated wall time is
+ * the sum of the intervals the sampler chose. A short sleep in between
+ * lets the monotonic clock the sampler reads move on.
+ */
+static uint64_t idle_rounds(int rounds, uint64_t *ticks)
+{
+        struct timespec pause = { .tv_sec = 0, .tv_nsec = 2000000 };
+        uint64_t start = 0;
+        uint64_t cost = 0;
+        uint64_t first = supervisor_timers.current;
+        uint64_t next = 0;
+        int round = 0;
+
+        for (round = 0; round < rounds; round++) {
+                if (!timer_wheel_next(&supervisor_timers, &next)) {
+                        break;
+                }
+                nanosleep(&pause, NULL);
+                start = cpu_ns();
+                timer_wheel_advance(&supervisor_timers, next);
+                cost += cpu_ns() - start;
+        }
+
+        *ticks = supervisor_timers.current - first;
+        return cost;
+}
+
+int main()
+{
+        struct process *procs[BENCH_SERVICES];
+        uint64_t start = 0;
+        uint64_t busy = 0;
+        uint64_t interval = 0;
+        uint64_t idle = 0;
+        uint64_t ticks = 0;
+        size_t samples = 0;
+        size_t i = 0;
+        int round = 0;
+        pid_t child = -1;
+
+        /* one sleeping child stands in for every idle service */
+        child = fork();
+        if (child == -1) {
+                perror("stats-bench: fork");
+                return EXIT_FAILURE;
+        }
+        if (child == 0) {
+                for (;;) {
+                        pause();
+                }
+        }
+
+        timer_wheel_init(&supervisor_timers, false);
+        if (!stats_start_sampler()) {
+                kill(child, SIGKILL);
+                return EXIT_FAILURE;
+        }
+        for (i = 0; i < BENCH_SERVICES; i++) {
+                procs[i] = process_create();
+                procs[i]->pid = getpid();
+        }
+
+        /* every service busy: worst case, one sample each per round */
+        start = cpu_ns();
+        for (round = 0; round < BENCH_ROUNDS; round++) {
+                for (i = 0; i < BENCH_SERVICES; i++) {
+                        samples += stats_sample_process(procs[i],
+                                                        (uint64_t) round + 1);
+                }
+        }
+        busy = (cpu_ns() - start) / samples;
+
+        /* the sampler doubles its interval while over half the budget */
+        interval = STATS_INTERVAL_MIN_MS;
+        while (busy * BENCH_SERVICES / interval > STATS_BUDGET_PPM / 2 &&
+               interval < STATS_INTERVAL_MAX_MS) {
+                interval *= 2;
+        }
+
+        printf("%d services: %llu ns/sample\n", BENCH_SERVICES,
+               (unsigned long long) busy);
+        printf("all busy: settles at %llu ms, %.3f%% CPU\n",
+               (unsigned long long) interval,
+               (double) busy * BENCH_SERVICES / (interval * 1e4));
+
+        /* every service idle, sampled by the real sampler rounds */
+        for (i = 0; i < BENCH_SERVICES; i++) {
+                procs[i]->pid = child;
+                register_process(procs[i]);
+        }
+        idle_rounds(BENCH_WARMUP_ROUNDS, &ticks);
+        idle = idle_rounds(BENCH_IDLE_ROUNDS, &ticks);
+
+        kill(child, SIGKILL);
+        waitpid(child, NULL, 0);
+        for (i = 0; i < BENCH_SERVICES; i++) {
+                unregister_process(procs[i]);
+                process_destroy(procs[i]);
+        }
+
+        if (ticks == 0) {
+                fprintf(stderr, "stats-bench: the sampler did not run\n");
+                return EXIT_FAILURE;
+        }
+        printf("all idle: %d rounds over %llu ms, %.3f%% CPU\n",
+               BENCH_IDLE_ROUNDS, (unsigned long long) ticks,
+               (double) idle / (ticks * 1e4));
+        if (idle / ticks >= STATS_BUDGET_PPM) {
+                fprintf(stderr, "stats-bench: idle sampling over budget "
+                        "(%llu ppm)\n", (unsigned long long) (idle / ticks));
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+#endif//__STATS_BENCH_C
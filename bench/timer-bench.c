@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * timer-bench.c - Timer wheel microbenchmark
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __TIMER_BENCH_C
+#define __TIMER_BENCH_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "timer.h"
+
+#define BENCH_TIMERS 100000
+/* Timeouts spread from 1 ms to 10 minutes, like restart/stop/watchdog mixes */
+#define BENCH_MAX_TIMEOUT_MS (10 * 60 * 1000)
+
+static struct timer_wheel wheel;
+static struct timer *timers = NULL;
+static size_t fired = 0;
+static size_t early = 0;
+
+static double now_ns()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench_cb(struct timer *t, void *data)
+{
+        (void) data;
+        if (wheel.current - 1 < t->expires) {
+                early++;
+        }
+        fired++;
+}
+
+static void bench_round(enum timer_resolution res, const char *name)
+{
+        double start = 0;
+        double insert_ns = 0;
+        double cancel_ns = 0;
+        double next_ns = 0;
+        double expire_ns = 0;
+        uint64_t next = 0;
+        size_t cancelled = 0;
+        size_t i = 0;
+
+        timer_wheel_init(&wheel, false);
+        fired = 0;
+        early = 0;
+        srand(42);
+
+        for (i = 0; i < BENCH_TIMERS; i++) {
+                timer_init(&timers[i], bench_cb, NULL);
+        }
+
+        start = now_ns();
+        for (i = 0; i < BENCH_TIMERS; i++) {
+                timer_add(&wheel, &timers[i],
+                          1 + (uint64_t) rand() % BENCH_MAX_TIMEOUT_MS, res);
+        }
+        insert_ns = (now_ns() - start) / BENCH_TIMERS;
+
+        start = now_ns();
+        for (i = 0; i < 1000; i++) {
+                timer_wheel_next(&wheel, &next);
+        }
+        next_ns = (now_ns() - start) / 1000;
+
+        start = now_ns();
+        for (i = 0; i < BENCH_TIMERS; i += 2) {
+                timer_cancel(&timers[i]);
+                cancelled++;
+        }
+        cancel_ns = (now_ns() - start) / cancelled;
+
+        start = now_ns();
+        while (timer_wheel_next(&wheel, &next)) {
+                timer_wheel_advance(&wheel, next);
+        }
+        expire_ns = (now_ns() - start) / (BENCH_TIMERS - cancelled);
+
+        printf("%-6s %zu timers: insert %6.1f ns/op, cancel %6.1f ns/op, "
+               "next %6.1f ns/op, expire %6.1f ns/op\n", name,
+               (size_t) BENCH_TIMERS, insert_ns, cancel_ns, next_ns,
+               expire_ns);
+
+        if (fired != BENCH_TIMERS - cancelled || early != 0) {
+                fprintf(stderr, "timer-bench: %s: fired %zu of %zu, %zu "
+                        "early\n", name, fired, BENCH_TIMERS - cancelled,
+                        early);
+                exit(EXIT_FAILURE);
+        }
+
+        timer_wheel_release(&wheel);
+}
+
+int main()
+{
+        timers = calloc(BENCH_TIMERS, sizeof(struct timer));
+        if (timers == NULL) {
+                perror("timer-bench: calloc");
+                return EXIT_FAILURE;
+        }
+
+        bench_round(TIMER_FINE, "fine");
+        bench_round(TIMER_COARSE, "coarse");
+
+        free(timers);
+        return EXIT_SUCCESS;
+}
+
+#endif//__TIMER_BENCH_C
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * zygote-bench.c - Spawn latency of process_forkexec() with and without
+ *                  a zygote
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __ZYGOTE_BENCH_C
+#define __ZYGOTE_BENCH_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "cyrenit.h"
+#include "evloop.h"
+#include "proc.h"
+#include "timer.h"
+#include "zygote.h"
+
+#define BENCH_SPAWNS 500
+#define BENCH_IMAGE "/bin/true"
+/* PID 1 grows with journals, indexes and service tables; fork copies that */
+#define BENCH_BALLAST_MB 256
+
+int console_fd = -1;
+static FILE *report = NULL;
+
+static double now_us()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* The zygote answers on the loop, stand in for it */
+static void bench_spawned(struct process *proc)
+{
+        struct pollfd pfd;
+
+        while (proc->zygote.pending) {
+                pfd.fd = proc->zygote.fd;
+                pfd.events = POLLIN;
+                poll(&pfd, 1, -1);
+                evloop_dispatch(pfd.fd, EVLOOP_IN);
+        }
+}
+
+static void bench_wait(struct process *proc)
+{
+        struct pollfd pfd;
+
+        /* zygote children are our parent's, a pidfd works for both */
+        if (proc->pidfd != -1) {
+                pfd.fd = proc->pidfd;
+                pfd.events = POLLIN;
+                poll(&pfd, 1, -1);
+        }
+        waitpid(proc->pid, NULL, WNOHANG);
+        process_exited(proc, 0);
+}
+
+static void bench_spawn(const char *label, bool zygote)
+{
+        struct process *proc = NULL;
+        double spawn = 0;
+        double total = 0;
+        double start = 0;
+        int i = 0;
+
+        proc = process_create();
+        process_set_image(proc, BENCH_IMAGE);
+        process_set_envdynamic(proc);
+        proc->restart = CYRENIT_PROC_RESTART_NEVER;
+        proc->use_zygote = zygote;
+
+        /* the zygote is started by the first spawn, keep it out */
+        if (zygote) {
+                process_forkexec(proc);
+                bench_spawned(proc);
+                bench_wait(proc);
+        }
+
+        for (i = 0; i < BENCH_SPAWNS; i++) {
+                start = now_us();
+                if (!process_forkexec(proc)) {
+                        fprintf(report, "%s: spawn failed\n", label);
+                        break;
+                }
+                bench_spawned(proc);
+                spawn += now_us() - start;
+                bench_wait(proc);
+                total += now_us() - start;
+        }
+
+        fprintf(report, "%-28s %8.1f us/spawn %8.1f us spawn-to-exit\n",
+                label, spawn / BENCH_SPAWNS, total / BENCH_SPAWNS);
+        process_destroy(proc);
+}
+
+static int bench_main()
+{
+        size_t size = (size_t) BENCH_BALLAST_MB << 20;
+        char *ballast = NULL;
+        int devnull = -1;
+
+        /* keep the spawn messages of PID 1 out of the numbers' way */
+        report = fdopen(dup(STDERR_FILENO), "w");
+        if (report == NULL) {
+                return EXIT_FAILURE;
+        }
+        setvbuf(report, NULL, _IONBF, 0);
+        if (!evloop_init_backend(EVLOOP_BACKEND_EPOLL) ||
+            !timer_wheel_init(&supervisor_timers, false)) {
+                return EXIT_FAILURE;
+        }
+        devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+
+        bench_spawn("forkexec", false);
+        bench_spawn("zygote", true);
+
+        /* small pages, like a heap grown by many small allocations */
+        ballast = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ballast == MAP_FAILED) {
+                return EXIT_FAILURE;
+        }
+        madvise(ballast, size, MADV_NOHUGEPAGE);
+        memset(ballast, 1, size);
+        bench_spawn("forkexec, 256 MiB resident", false);
+        bench_spawn("zygote, 256 MiB resident", true);
+        munmap(ballast, size);
+
+        return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+        pid_t bench = 0;
+        pid_t pid = 0;
+        int status = EXIT_FAILURE;
+        int ret = 0;
+
+        if (check_command(argv[0], ZYGOTE_CMD)) {
+                return zygote_main(argc, argv);
+        }
+
+        /*
+         * Zygote children are clone(CLONE_PARENT)ed: they belong to the
+         * parent of whoever runs the zygote. This process stands in for
+         * PID 1's reaping, the benchmark runs in a child of it.
+         */
+        bench = fork();
+        if (bench == 0) {
+                return bench_main();
+        }
+
+        while ((pid = wait(&ret)) > 0) {
+                if (pid == bench) {
+                        status = WIFEXITED(ret) ? WEXITSTATUS(ret) :
+                                                  EXIT_FAILURE;
+                }
+        }
+
+        return status;
+}
+
+bool check_command(const char *cmd, const char *check)
+{
+        const char *base = strrchr(cmd, '/');
+
+        return strcmp(base == NULL ? cmd : base + 1, check) == STRCMP_EQUAL;
+}
+
+#endif//__ZYGOTE_BENCH_C
@@ -0,0 +1,1273 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * bootchart.c - Boot sampler and its SVG rendering
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __BOOTCHART_C
+#define __BOOTCHART_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <linux/limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cyrenit.h"
+#include "bootchart.h"
+#include "bootopt.h"
+#include "job.h"
+#include "kcmdline.h"
+#include "timer.h"
+
+#define BOOTCHART_ALIGN 8
+#define BOOTCHART_ALIGNED(x) \
+        (((x) + BOOTCHART_ALIGN - 1) & ~((size_t) BOOTCHART_ALIGN - 1))
+#define BOOTCHART_ALLOC_STEP 256
+/* /proc/stat grows with CPUs and interrupts, the buffer grows with it */
+#define BOOTCHART_READ_SIZE 16384
+#define BOOTCHART_STAT_SIZE 1024
+#define BOOTCHART_DISK_NAME 32
+#define BOOTCHART_SECTOR 512
+
+/*
+ * Sampling side, run by PID 1. The sampler thread owns everything but the
+ * file, which marks are written to from the main thread as well.
+ */
+
+static int chart_fd = -1;
+static int stat_fd = -1;
+static int disk_fd = -1;
+static DIR *proc_dir = NULL;
+static pthread_t sampler_thread;
+static pthread_mutex_t chart_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timer poll_timer;
+static unsigned interval_ms = BOOTCHART_INTERVAL_MS;
+static bool sampling = false;
+static atomic_bool stop_requested = false;
+static atomic_bool sampler_done = false;
+static atomic_size_t sample_count = 0;
+
+static char *read_buffer = NULL;
+static size_t read_allocated = 0;
+static uint8_t *out_buffer = NULL;
+static size_t out_allocated = 0;
+
+/* The processes of the previous sample and of this one, sorted by pid */
+static struct bootchart_proc *prev_procs = NULL;
+static size_t prev_count = 0;
+static size_t prev_allocated = 0;
+static struct bootchart_proc *cur_procs = NULL;
+static size_t cur_count = 0;
+static size_t cur_allocated = 0;
+
+static uint64_t bootchart_now_us()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_BOOTTIME, &ts);
+        return (uint64_t) ts.tv_sec * 1000000ULL +
+               (uint64_t) ts.tv_nsec / 1000;
+}
+
+/* Grows *array to hold at least count + 1 elements of size bytes */
+static bool bootchart_grow(void **array, size_t *allocated, size_t count,
+                           size_t size)
+{
+        void *new_array = NULL;
+
+        if (count < *allocated) {
+                return true;
+        }
+
+        new_array = reallocarray(*array, *allocated + BOOTCHART_ALLOC_STEP,
+                                 size);
+        if (new_array == NULL) {
+                return false;
+        }
+        *array = new_array;
+        *allocated += BOOTCHART_ALLOC_STEP;
+
+        return true;
+}
+
+static bool bootchart_write(const void *data, size_t size)
+{
+        const uint8_t *bytes = data;
+        size_t done = 0;
+        ssize_t ret = 0;
+
+        while (done < size) {
+                ret = write(chart_fd, bytes + done, size - done);
+                if (ret == -1 && errno == EINTR) {
+                        continue;
+                }
+                if (ret <= 0) {
+                        return false;
+                }
+                done += (size_t) ret;
+        }
+
+        return true;
+}
+
+/* Reads a whole /proc file into read_buffer, NUL terminated */
+static ssize_t bootchart_read(int fd)
+{
+        char *new_buffer = NULL;
+        size_t done = 0;
+        ssize_t ret = 0;
+
+        while (true) {
+                if (done + 1 >= read_allocated) {
+                        new_buffer = realloc(read_buffer, read_allocated +
+                                             BOOTCHART_READ_SIZE);
+                        if (new_buffer == NULL) {
+                                return -1;
+                        }
+                        read_buffer = new_buffer;
+                        read_allocated += BOOTCHART_READ_SIZE;
+                }
+
+                ret = pread(fd, read_buffer + done, read_allocated - done - 1,
+                            (off_t) done);
+                if (ret == -1 && errno == EINTR) {
+                        continue;
+                }
+                if (ret <= 0) {
+                        break;
+                }
+                done += (size_t) ret;
+        }
+        read_buffer[done] = '\0';
+
+        return ret == -1 ? -1 : (ssize_t) done;
+}
+
+static void bootchart_read_stat(struct bootchart_system *sys)
+{
+        unsigned long long cpu[BOOTCHART_CPU_STATES] = {0};
+        char *line = NULL;
+        size_t i = 0;
+
+        if (bootchart_read(stat_fd) <= 0) {
+                return;
+        }
+
+        sscanf(read_buffer, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+               &cpu[0], &cpu[1], &cpu[2], &cpu[3], &cpu[4], &cpu[5], &cpu[6],
+               &cpu[7]);
+        for (i = 0; i < BOOTCHART_CPU_STATES; i++) {
+                sys->cpu[i] = cpu[i];
+        }
+
+        line = strstr(read_buffer, "\nprocs_running ");
+        if (line != NULL) {
+                sys->running = (uint32_t) strtoul(line + 15, NULL, 10);
+        }
+        line = strstr(read_buffer, "\nprocs_blocked ");
+        if (line != NULL) {
+                sys->blocked = (uint32_t) strtoul(line + 15, NULL, 10);
+        }
+}
+
+static bool bootchart_virtual_disk(const char *name)
+{
+        static const char *prefixes[] = { "loop", "ram", "zram", "dm-", "md",
+                                          NULL };
+        size_t i = 0;
+
+        for (i = 0; prefixes[i] != NULL; i++) {
+                if (strncmp(name, prefixes[i], strlen(prefixes[i])) ==
+                    STRCMP_EQUAL) {
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+/*
+ * Partitions are listed right after their disk and named after it (sda1,
+ * nvme0n1p1, mmcblk0p1), which tells them apart without asking sysfs.
+ */
+static void bootchart_read_disks(struct bootchart_system *sys)
+{
+        char disk[BOOTCHART_DISK_NAME] = "";
+        char name[BOOTCHART_DISK_NAME];
+        unsigned long long read_sectors = 0;
+        unsigned long long write_sectors = 0;
+        unsigned long long io_ms = 0;
+        char *line = NULL;
+        char *next = NULL;
+
+        if (bootchart_read(disk_fd) <= 0) {
+                return;
+        }
+
+        for (line = read_buffer; line != NULL && *line != '\0'; line = next) {
+                next = strchr(line, '\n');
+                if (next != NULL) {
+                        *next++ = '\0';
+                }
+                if (sscanf(line, "%*u %*u %31s %*u %*u %llu %*u %*u %*u %llu "
+                           "%*u %*u %llu", name, &read_sectors,
+                           &write_sectors, &io_ms) != 4 ||
+                    bootchart_virtual_disk(name)) {
+                        continue;
+                }
+                if (disk[0] != '\0' &&
+                    strncmp(name, disk, strlen(disk)) == STRCMP_EQUAL) {
+                        continue;
+                }
+
+                snprintf(disk, sizeof(disk), "%s", name);
+                sys->read_sectors += read_sectors;
+                sys->write_sectors += write_sectors;
+                if (io_ms > sys->io_ms) {
+                        sys->io_ms = io_ms;
+                }
+        }
+}
+
+static bool bootchart_read_proc(const char *pid, struct bootchart_proc *proc)
+{
+        char path[NAME_MAX + 8];
+        char buffer[BOOTCHART_STAT_SIZE];
+        unsigned long utime = 0;
+        unsigned long stime = 0;
+        char *comm = NULL;
+        char *end = NULL;
+        ssize_t ret = 0;
+        int fd = -1;
+
+        snprintf(path, sizeof(path), "%s/stat", pid);
+        fd = openat(dirfd(proc_dir), path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+                return false;
+        }
+        ret = read(fd, buffer, sizeof(buffer) - 1);
+        close(fd);
+        if (ret <= 0) {
+                return false;
+        }
+        buffer[ret] = '\0';
+
+        // the name may hold spaces and parentheses
+        comm = strchr(buffer, '(');
+        end = strrchr(buffer, ')');
+        if (comm == NULL || end == NULL || end < comm) {
+                return false;
+        }
+
+        memset(proc, 0, sizeof(*proc));
+        proc->pid = (int32_t) strtol(buffer, NULL, 10);
+        snprintf(proc->comm, sizeof(proc->comm), "%.*s",
+                 (int) (end - comm - 1), comm + 1);
+        if (sscanf(end + 1, " %c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                   "%lu %lu", &proc->state, &proc->ppid, &utime,
+                   &stime) != 4) {
+                return false;
+        }
+        proc->ticks = (uint32_t) (utime + stime);
+
+        return true;
+}
+
+static int bootchart_proc_compare(const void *a, const void *b)
+{
+        const struct bootchart_proc *x = a;
+        const struct bootchart_proc *y = b;
+
+        return (x->pid > y->pid) - (x->pid < y->pid);
+}
+
+static void bootchart_read_procs()
+{
+        struct dirent *entry = NULL;
+
+        cur_count = 0;
+        rewinddir(proc_dir);
+        while ((entry = readdir(proc_dir)) != NULL) {
+                if (entry->d_name[0] < '1' || entry->d_name[0] > '9') {
+                        continue;
+                }
+                if (!bootchart_grow((void **) &cur_procs, &cur_allocated,
+                                    cur_count,
+                                    sizeof(struct bootchart_proc))) {
+                        break;
+                }
+                if (bootchart_read_proc(entry->d_name,
+                                        &cur_procs[cur_count])) {
+                        cur_count++;
+                }
+        }
+
+        qsort(cur_procs, cur_count, sizeof(struct bootchart_proc),
+              bootchart_proc_compare);
+}
+
+static bool bootchart_proc_changed(const struct bootchart_proc *prev,
+                                   const struct bootchart_proc *cur)
+{
+        return prev->ticks != cur->ticks || prev->state != cur->state ||
+               cur->state == 'D' ||
+               strcmp(prev->comm, cur->comm) != STRCMP_EQUAL;
+}
+
+static bool bootchart_out(size_t *used, const void *data, size_t size)
+{
+        uint8_t *new_buffer = NULL;
+        size_t new_size = out_allocated;
+
+        while (*used + size > new_size) {
+                new_size += BOOTCHART_READ_SIZE;
+        }
+        if (new_size != out_allocated) {
+                new_buffer = realloc(out_buffer, new_size);
+                if (new_buffer == NULL) {
+                        return false;
+                }
+                out_buffer = new_buffer;
+                out_allocated = new_size;
+        }
+
+        memcpy(out_buffer + *used, data, size);
+        *used += size;
+
+        return true;
+}
+
+/**
+ * @fn static bool bootchart_sample()
+ * @brief Records the system counters and the processes that changed
+ * @details Processes are compared with the previous sample as two sorted
+ *          lists, the ones gone from it are recorded as exited.
+ */
+static bool bootchart_sample()
+{
+        struct bootchart_record record;
+        struct bootchart_system sys;
+        struct bootchart_proc exited;
+        struct bootchart_proc *swap = NULL;
+        size_t allocated = 0;
+        size_t used = sizeof(record);
+        size_t i = 0;
+        size_t j = 0;
+        bool ok = true;
+
+        memset(&record, 0, sizeof(record));
+        memset(&sys, 0, sizeof(sys));
+        record.type = BOOTCHART_SAMPLE;
+        record.time_us = bootchart_now_us();
+        bootchart_read_stat(&sys);
+        bootchart_read_disks(&sys);
+        bootchart_read_procs();
+
+        ok = bootchart_out(&used, &sys, sizeof(sys));
+        while (ok && (i < cur_count || j < prev_count)) {
+                if (i >= cur_count ||
+                    (j < prev_count && prev_procs[j].pid < cur_procs[i].pid)) {
+                        exited = prev_procs[j++];
+                        exited.state = 'X';
+                        ok = bootchart_out(&used, &exited, sizeof(exited));
+                        continue;
+                }
+                if (j < prev_count && prev_procs[j].pid == cur_procs[i].pid) {
+                        if (bootchart_proc_changed(&prev_procs[j],
+                                                   &cur_procs[i])) {
+                                ok = bootchart_out(&used, &cur_procs[i],
+                                                   sizeof(cur_procs[i]));
+                        }
+                        i++;
+                        j++;
+                        continue;
+                }
+                ok = bootchart_out(&used, &cur_procs[i++],
+                                   sizeof(struct bootchart_proc));
+        }
+        if (!ok) {
+                return false;
+        }
+
+        record.size = (uint32_t) (used - sizeof(record));
+        memcpy(out_buffer, &record, sizeof(record));
+        pthread_mutex_lock(&chart_lock);
+        ok = bootchart_write(out_buffer, used);
+        pthread_mutex_unlock(&chart_lock);
+
+        swap = prev_procs;
+        prev_procs = cur_procs;
+        cur_procs = swap;
+        prev_count = cur_count;
+        allocated = prev_allocated;
+        prev_allocated = cur_allocated;
+        cur_allocated = allocated;
+        atomic_fetch_add(&sample_count, 1);
+
+        return ok;
+}
+
+static void *bootchart_sampler(void *arg)
+{
+        uint64_t start = bootchart_now_us();
+        struct timespec next;
+
+        (void) arg;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        while (!atomic_load(&stop_requested) &&
+               bootchart_now_us() - start < BOOTCHART_MAX_MS * 1000ULL) {
+                if (!bootchart_sample()) {
+                        break;
+                }
+
+                next.tv_nsec += (long) interval_ms * 1000000L;
+                while (next.tv_nsec >= 1000000000L) {
+                        next.tv_nsec -= 1000000000L;
+                        next.tv_sec++;
+                }
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+                                       NULL) == EINTR);
+        }
+        atomic_store(&sampler_done, true);
+
+        return NULL;
+}
+
+static void bootchart_close()
+{
+        if (chart_fd != -1) {
+                close(chart_fd);
+                chart_fd = -1;
+        }
+        if (stat_fd != -1) {
+                close(stat_fd);
+                stat_fd = -1;
+        }
+        if (disk_fd != -1) {
+                close(disk_fd);
+                disk_fd = -1;
+        }
+        if (proc_dir != NULL) {
+                closedir(proc_dir);
+                proc_dir = NULL;
+        }
+        free(read_buffer);
+        read_buffer = NULL;
+        read_allocated = 0;
+        free(out_buffer);
+        out_buffer = NULL;
+        out_allocated = 0;
+        free(prev_procs);
+        prev_procs = NULL;
+        prev_count = prev_allocated = 0;
+        free(cur_procs);
+        cur_procs = NULL;
+        cur_count = cur_allocated = 0;
+}
+
+/**
+ * @fn bool bootchart_start()
+ * @brief Starts sampling, if cyrenit.bootchart is on the kernel command
+ *        line
+ * @return true when the sampler runs
+ * @details /proc and /run must be mounted. The chart is written to
+ *          BOOTCHART_PATH, which moves along with /run on switch_root().
+ */
+bool bootchart_start()
+{
+        struct bootchart_header header;
+        char value[BOOTCHART_OPTION_SIZE];
+        char *end = NULL;
+
+        if (sampling) {
+                return true;
+        }
+        if (kcmdline_get("cyrenit.bootchart", value, sizeof(value))) {
+                interval_ms = (unsigned) strtoul(value, &end, 10);
+                if (end == value || *end != '\0' || interval_ms == 0) {
+                        fprintf(stderr, "cyrenit: invalid cyrenit.bootchart "
+                                "%s, sampling every %d ms\n", value,
+                                BOOTCHART_INTERVAL_MS);
+                        interval_ms = BOOTCHART_INTERVAL_MS;
+                }
+        }
+        else if (!kcmdline_has("cyrenit.bootchart")) {
+                return false;
+        }
+
+        mkdir(CONTROL_RUN_DIR, 0755);
+        chart_fd = open(BOOTCHART_PATH, O_WRONLY | O_CREAT | O_TRUNC |
+                        O_CLOEXEC, 0640);
+        stat_fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+        disk_fd = open("/proc/diskstats", O_RDONLY | O_CLOEXEC);
+        proc_dir = opendir("/proc");
+        if (chart_fd == -1 || stat_fd == -1 || disk_fd == -1 ||
+            proc_dir == NULL) {
+                perror("cyrenit: cannot sample a bootchart");
+                bootchart_close();
+                return false;
+        }
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, BOOTCHART_MAGIC, sizeof(header.magic));
+        header.version = BOOTCHART_VERSION;
+        header.interval_ms = interval_ms;
+        header.hz = (uint32_t) sysconf(_SC_CLK_TCK);
+        header.cpus = (uint32_t) sysconf(_SC_NPROCESSORS_ONLN);
+        atomic_store(&stop_requested, false);
+        atomic_store(&sampler_done, false);
+        atomic_store(&sample_count, 0);
+        if (!bootchart_write(&header, sizeof(header)) ||
+            pthread_create(&sampler_thread, NULL, bootchart_sampler,
+                           NULL) != 0) {
+                perror("cyrenit: cannot sample a bootchart");
+                bootchart_close();
+                return false;
+        }
+
+        sampling = true;
+        fprintf(stdout, "cyrenit: sampling a bootchart every %u ms to %s\n",
+                interval_ms, BOOTCHART_PATH);
+
+        return true;
+}
+
+/**
+ * @fn bool bootchart_active()
+ * @brief Tells whether the sampler runs
+ */
+bool bootchart_active()
+{
+        return sampling;
+}
+
+/**
+ * @fn void bootchart_mark(const char *text)
+ * @brief Records a line at the current time, drawn across the chart
+ */
+void bootchart_mark(const char *text)
+{
+        struct bootchart_record record;
+        uint8_t padding[BOOTCHART_ALIGN] = {0};
+        size_t length = 0;
+
+        if (!sampling) {
+                return;
+        }
+
+        length = strlen(text) + 1;
+        memset(&record, 0, sizeof(record));
+        record.type = BOOTCHART_MARK;
+        record.size = (uint32_t) BOOTCHART_ALIGNED(length);
+        record.time_us = bootchart_now_us();
+
+        pthread_mutex_lock(&chart_lock);
+        if (bootchart_write(&record, sizeof(record)) &&
+            bootchart_write(text, length)) {
+                bootchart_write(padding, record.size - length);
+        }
+        pthread_mutex_unlock(&chart_lock);
+}
+
+/**
+ * @fn void bootchart_stop()
+ * @brief Stops the sampler and closes the chart
+ */
+void bootchart_stop()
+{
+        if (!sampling) {
+                return;
+        }
+
+        timer_cancel(&poll_timer);
+        atomic_store(&stop_requested, true);
+        pthread_join(sampler_thread, NULL);
+        sampling = false;
+        bootchart_close();
+        fprintf(stdout, "cyrenit: bootchart of %zu samples saved to %s\n",
+                atomic_load(&sample_count), BOOTCHART_PATH);
+}
+
+static void bootchart_poll(struct timer *t, void *data)
+{
+        (void) data;
+
+        if (job_pending() > 0 && !atomic_load(&sampler_done)) {
+                timer_add(&supervisor_timers, t, BOOTCHART_POLL_MS,
+                          TIMER_COARSE);
+                return;
+        }
+
+        boot_trace("target reached");
+        bootchart_stop();
+}
+
+/**
+ * @fn void bootchart_attach()
+ * @brief Stops the sampler from the event loop once the target is reached
+ * @details That is when the jobs queued by start_services() are all done.
+ */
+void bootchart_attach()
+{
+        if (!sampling) {
+                return;
+        }
+
+        timer_init(&poll_timer, bootchart_poll, NULL);
+        timer_add(&supervisor_timers, &poll_timer, BOOTCHART_POLL_MS,
+                  TIMER_COARSE);
+}
+
+/*
+ * Rendering side, used by the CLI. The chart is mapped read-only and every
+ * record is checked against the mapping.
+ */
+
+#define CHART_PX_PER_S 100
+#define CHART_LEFT 180
+#define CHART_RIGHT 40
+#define CHART_MIN_WIDTH 800
+#define CHART_TITLE_H 50
+#define CHART_MARKS_H 150
+#define CHART_GRAPH_H 120
+#define CHART_GAP 30
+#define CHART_ROW_H 14
+
+struct chart_segment
+{
+        uint64_t start_us;
+        uint64_t end_us;
+        float load;
+        char state;
+};
+
+struct chart_proc
+{
+        struct bootchart_proc info;
+        uint64_t start_us;
+        uint64_t end_us;
+        uint32_t first_ticks;
+        bool exited;
+        bool blocked;
+        struct chart_segment *segments;
+        size_t segment_count;
+        size_t segment_allocated;
+};
+
+struct chart_sample
+{
+        uint64_t time_us;
+        struct bootchart_system sys;
+};
+
+struct chart_mark
+{
+        uint64_t time_us;
+        const char *text;
+};
+
+struct chart
+{
+        const struct bootchart_header *header;
+        struct chart_sample *samples;
+        size_t sample_count;
+        size_t sample_allocated;
+        struct chart_mark *marks;
+        size_t mark_count;
+        size_t mark_allocated;
+        struct chart_proc *procs;
+        size_t proc_count;
+        size_t proc_allocated;
+        uint64_t start_us;
+        uint64_t end_us;
+};
+
+static void chart_free(struct chart *chart)
+{
+        size_t i = 0;
+
+        for (i = 0; i < chart->proc_count; i++) {
+                free(chart->procs[i].segments);
+        }
+        free(chart->procs);
+        free(chart->samples);
+        free(chart->marks);
+}
+
+static bool chart_add_segment(struct chart_proc *proc, uint64_t start_us,
+                              uint64_t end_us, float load, char state)
+{
+        struct chart_segment *segment = NULL;
+
+        if (!bootchart_grow((void **) &proc->segments,
+                            &proc->segment_allocated, proc->segment_count,
+                            sizeof(struct chart_segment))) {
+                return false;
+        }
+
+        segment = &proc->segments[proc->segment_count++];
+        segment->start_us = start_us;
+        segment->end_us = end_us;
+        segment->load = load > 1 ? 1 : load;
+        segment->state = state;
+
+        return true;
+}
+
+/* The live process of that pid; pids are reused after an 'X' */
+static struct chart_proc *chart_find_proc(struct chart *chart, int32_t pid)
+{
+        size_t i = chart->proc_count;
+
+        while (i-- > 0) {
+                if (chart->procs[i].info.pid == pid &&
+                    !chart->procs[i].exited) {
+                        return &chart->procs[i];
+                }
+        }
+
+        return NULL;
+}
+
+/**
+ * @fn static bool chart_add_proc(struct chart *chart, uint64_t prev_us,
+ *                                uint64_t now_us,
+ *                                const struct bootchart_proc *entry)
+ * @brief Accounts a process entry of the sample taken at now_us
+ * @details The CPU time it used since the last sample, prev_us, is drawn
+ *          over that interval.
+ */
+static bool chart_add_proc(struct chart *chart, uint64_t prev_us,
+                           uint64_t now_us, const struct bootchart_proc *entry)
+{
+        struct chart_proc *proc = chart_find_proc(chart, entry->pid);
+        double seconds = (double) (now_us - prev_us) / 1e6;
+        uint32_t ticks = 0;
+
+        if (proc == NULL) {
+                if (entry->state == 'X' ||
+                    !bootchart_grow((void **) &chart->procs,
+                                    &chart->proc_allocated, chart->proc_count,
+                                    sizeof(struct chart_proc))) {
+                        return entry->state == 'X';
+                }
+                proc = &chart->procs[chart->proc_count++];
+                memset(proc, 0, sizeof(*proc));
+                proc->info = *entry;
+                proc->start_us = now_us;
+                proc->end_us = now_us;
+                proc->first_ticks = entry->ticks;
+                return true;
+        }
+
+        proc->end_us = now_us;
+        if (entry->state == 'X') {
+                proc->exited = true;
+                return true;
+        }
+
+        ticks = entry->ticks - proc->info.ticks;
+        if (ticks > 0 && seconds > 0 &&
+            !chart_add_segment(proc, prev_us, now_us,
+                               (float) (ticks / (double) chart->header->hz /
+                                        seconds), 'R')) {
+                return false;
+        }
+        if (entry->state == 'D') {
+                proc->blocked = true;
+                if (!chart_add_segment(proc, prev_us, now_us, 1, 'D')) {
+                        return false;
+                }
+        }
+        proc->info = *entry;
+
+        return true;
+}
+
+static bool chart_add_sample(struct chart *chart, uint64_t time_us,
+                             const uint8_t *payload, uint32_t size)
+{
+        const struct bootchart_proc *entries = NULL;
+        struct chart_sample *sample = NULL;
+        uint64_t prev_us = time_us;
+        size_t count = 0;
+        size_t i = 0;
+
+        if (size < sizeof(struct bootchart_system) ||
+            !bootchart_grow((void **) &chart->samples,
+                            &chart->sample_allocated, chart->sample_count,
+                            sizeof(struct chart_sample))) {
+                return false;
+        }
+
+        if (chart->sample_count > 0) {
+                prev_us = chart->samples[chart->sample_count - 1].time_us;
+        }
+        sample = &chart->samples[chart->sample_count++];
+        sample->time_us = time_us;
+        memcpy(&sample->sys, payload, sizeof(struct bootchart_system));
+
+        entries = (const void *) (payload + sizeof(struct bootchart_system));
+        count = (size - sizeof(struct bootchart_system)) /
+                sizeof(struct bootchart_proc);
+        for (i = 0; i < count; i++) {
+                if (!chart_add_proc(chart, prev_us, time_us, &entries[i])) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+static bool chart_load(struct chart *chart, const uint8_t *map, size_t size)
+{
+        const struct bootchart_record *record = NULL;
+        size_t offset = sizeof(struct bootchart_header);
+        size_t i = 0;
+
+        memset(chart, 0, sizeof(*chart));
+        chart->header = (const void *) map;
+        if (size < sizeof(struct bootchart_header) ||
+            memcmp(chart->header->magic, BOOTCHART_MAGIC,
+                   sizeof(chart->header->magic)) != 0 ||
+            chart->header->version != BOOTCHART_VERSION ||
+            chart->header->hz == 0) {
+                errno = EINVAL;
+                return false;
+        }
+
+        // a chart still being written may end with a partial record
+        while (offset + sizeof(struct bootchart_record) <= size) {
+                record = (const void *) (map + offset);
+                offset += sizeof(struct bootchart_record);
+                if (record->size > size - offset) {
+                        break;
+                }
+
+                if (record->type == BOOTCHART_SAMPLE &&
+                    !chart_add_sample(chart, record->time_us, map + offset,
+                                      record->size)) {
+                        return false;
+                }
+                if (record->type == BOOTCHART_MARK && record->size > 0 &&
+                    map[offset + record->size - 1] == '\0' &&
+                    bootchart_grow((void **) &chart->marks,
+                                   &chart->mark_allocated, chart->mark_count,
+                                   sizeof(struct chart_mark))) {
+                        chart->marks[chart->mark_count].time_us =
+                                record->time_us;
+                        chart->marks[chart->mark_count++].text =
+                                (const char *) (map + offset);
+                }
+                offset += record->size;
+        }
+
+        if (chart->sample_count < 2) {
+                errno = ENODATA;
+                return false;
+        }
+
+        // the axis starts at the second of uptime sampling started in
+        chart->start_us = chart->samples[0].time_us / 1000000 * 1000000;
+        chart->end_us = chart->samples[chart->sample_count - 1].time_us;
+        for (i = 0; i < chart->proc_count; i++) {
+                if (!chart->procs[i].exited) {
+                        chart->procs[i].end_us = chart->end_us;
+                }
+        }
+
+        return true;
+}
+
+static double chart_x(const struct chart *chart, uint64_t time_us)
+{
+        return CHART_LEFT + (double) (time_us - chart->start_us) / 1e6 *
+               CHART_PX_PER_S;
+}
+
+static void chart_escape(FILE *out, const char *text)
+{
+        for (; *text != '\0'; text++) {
+                switch (*text) {
+                case '&':
+                        fputs("&amp;", out);
+                        break;
+                case '<':
+                        fputs("&lt;", out);
+                        break;
+                case '>':
+                        fputs("&gt;", out);
+                        break;
+                case '"':
+                        fputs("&quot;", out);
+                        break;
+                default:
+                        fputc(*text, out);
+                }
+        }
+}
+
+/* Idle kernel threads would bury the processes that matter */
+static bool chart_proc_shown(const struct chart_proc *proc)
+{
+        bool kernel = proc->info.pid == 2 || proc->info.ppid == 2;
+
+        return !kernel || proc->blocked ||
+               proc->info.ticks != proc->first_ticks;
+}
+
+static void chart_graph_frame(FILE *out, const struct chart *chart, double y,
+                              const char *title, double width)
+{
+        uint64_t second = 0;
+        double x = 0;
+
+        fprintf(out, "<rect x=\"%d\" y=\"%.1f\" width=\"%.1f\" "
+                "height=\"%d\" class=\"frame\"/>\n", CHART_LEFT, y,
+                width - CHART_LEFT - CHART_RIGHT, CHART_GRAPH_H);
+        for (second = chart->start_us; second <= chart->end_us;
+             second += 1000000) {
+                x = chart_x(chart, second);
+                fprintf(out, "<line x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" "
+                        "y2=\"%.1f\" class=\"grid\"/>\n", x, y, x,
+                        y + CHART_GRAPH_H);
+        }
+        fprintf(out, "<text x=\"4\" y=\"%.1f\">%s</text>\n", y + 14, title);
+}
+
+/**
+ * @fn static void chart_cpu(FILE *out, const struct chart *chart, double y,
+ *                           double width)
+ * @brief Draws how busy the CPUs were over each interval: user, system
+ *        and I/O wait, stacked
+ */
+static void chart_cpu(FILE *out, const struct chart *chart, double y,
+                      double width)
+{
+        static const char *classes[] = { "user", "system", "iowait" };
+        const uint64_t *prev = NULL;
+        const uint64_t *cur = NULL;
+        double share[3] = {0};
+        double total = 0;
+        double x0 = 0;
+        double x1 = 0;
+        double top = 0;
+        size_t i = 0;
+        size_t k = 0;
+
+        chart_graph_frame(out, chart, y, "CPU", width);
+        for (i = 1; i < chart->sample_count; i++) {
+                prev = chart->samples[i - 1].sys.cpu;
+                cur = chart->samples[i].sys.cpu;
+                total = 0;
+                for (k = 0; k < BOOTCHART_CPU_STATES; k++) {
+                        total += (double) (cur[k] - prev[k]);
+                }
+                if (total <= 0) {
+                        continue;
+                }
+
+                share[0] = (double) (cur[BOOTCHART_CPU_USER] -
+                                     prev[BOOTCHART_CPU_USER] +
+                                     cur[BOOTCHART_CPU_NICE] -
+                                     prev[BOOTCHART_CPU_NICE]) / total;
+                share[1] = (double) (cur[BOOTCHART_CPU_SYSTEM] -
+                                     prev[BOOTCHART_CPU_SYSTEM] +
+                                     cur[BOOTCHART_CPU_IRQ] -
+                                     prev[BOOTCHART_CPU_IRQ] +
+                                     cur[BOOTCHART_CPU_SOFTIRQ] -
+                                     prev[BOOTCHART_CPU_SOFTIRQ]) / total;
+                share[2] = (double) (cur[BOOTCHART_CPU_IOWAIT] -
+                                     prev[BOOTCHART_CPU_IOWAIT]) / total;
+
+                x0 = chart_x(chart, chart->samples[i - 1].time_us);
+                x1 = chart_x(chart, chart->samples[i].time_us);
+                top = y + CHART_GRAPH_H;
+                for (k = 0; k < 3; k++) {
+                        if (share[k] <= 0) {
+                                continue;
+                        }
+                        top -= share[k] * CHART_GRAPH_H;
+                        fprintf(out, "<rect x=\"%.1f\" y=\"%.1f\" "
+                                "width=\"%.1f\" height=\"%.1f\" "
+                                "class=\"%s\"/>\n", x0, top, x1 - x0,
+                                share[k] * CHART_GRAPH_H, classes[k]);
+                }
+        }
+        fprintf(out, "<text x=\"4\" y=\"%.1f\" class=\"user\">user</text>\n"
+                "<text x=\"4\" y=\"%.1f\" class=\"system\">system</text>\n"
+                "<text x=\"4\" y=\"%.1f\" class=\"iowait\">iowait</text>\n",
+                y + 40, y + 56, y + 72);
+}
+
+/**
+ * @fn static void chart_disk(FILE *out, const struct chart *chart,
+ *                            double y, double width)
+ * @brief Draws the utilization of the busiest disk as bars, with the
+ *        throughput and the processes blocked on I/O as lines
+ */
+static void chart_disk(FILE *out, const struct chart *chart, double y,
+                       double width)
+{
+        const struct chart_sample *prev = NULL;
+        const struct chart_sample *cur = NULL;
+        double max_mbps = 0;
+        double max_blocked = 0;
+        double seconds = 0;
+        double mbps = 0;
+        double util = 0;
+        double x0 = 0;
+        double x1 = 0;
+        size_t i = 0;
+
+        chart_graph_frame(out, chart, y, "Disk", width);
+        for (i = 1; i < chart->sample_count; i++) {
+                prev = &chart->samples[i - 1];
+                cur = &chart->samples[i];
+                seconds = (double) (cur->time_us - prev->time_us) / 1e6;
+                if (seconds <= 0) {
+                        continue;
+                }
+
+                mbps = (double) (cur->sys.read_sectors -
+                                 prev->sys.read_sectors +
+                                 cur->sys.write_sectors -
+                                 prev->sys.write_sectors) *
+                       BOOTCHART_SECTOR / 1e6 / seconds;
+                max_mbps = mbps > max_mbps ? mbps : max_mbps;
+                if (cur->sys.blocked > max_blocked) {
+                        max_blocked = cur->sys.blocked;
+                }
+
+                util = (double) (cur->sys.io_ms - prev->sys.io_ms) / 1e3 /
+                       seconds;
+                util = util > 1 ? 1 : util;
+                if (util <= 0) {
+                        continue;
+                }
+                x0 = chart_x(chart, prev->time_us);
+                x1 = chart_x(chart, cur->time_us);
+                fprintf(out, "<rect x=\"%.1f\" y=\"%.1f\" width=\"%.1f\" "
+                        "height=\"%.1f\" class=\"util\"/>\n", x0,
+                        y + CHART_GRAPH_H - util * CHART_GRAPH_H, x1 - x0,
+                        util * CHART_GRAPH_H);
+        }
+
+        fputs("<polyline class=\"mbps\" points=\"", out);
+        for (i = 1; max_mbps > 0 && i < chart->sample_count; i++) {
+                prev = &chart->samples[i - 1];
+                cur = &chart->samples[i];
+                seconds = (double) (cur->time_us - prev->time_us) / 1e6;
+                mbps = seconds <= 0 ? 0 :
+                       (double) (cur->sys.read_sectors -
+                                 prev->sys.read_sectors +
+                                 cur->sys.write_sectors -
+                                 prev->sys.write_sectors) *
+                       BOOTCHART_SECTOR / 1e6 / seconds;
+                fprintf(out, "%.1f,%.1f ", chart_x(chart, cur->time_us),
+                        y + CHART_GRAPH_H - mbps / max_mbps * CHART_GRAPH_H);
+        }
+        fputs("\"/>\n<polyline class=\"blocked\" points=\"", out);
+        for (i = 0; max_blocked > 0 && i < chart->sample_count; i++) {
+                cur = &chart->samples[i];
+                fprintf(out, "%.1f,%.1f ", chart_x(chart, cur->time_us),
+                        y + CHART_GRAPH_H - cur->sys.blocked / max_blocked *
+                        CHART_GRAPH_H);
+        }
+        fprintf(out, "\"/>\n"
+                "<text x=\"4\" y=\"%.1f\" class=\"util\">utilization</text>\n"
+                "<text x=\"4\" y=\"%.1f\" class=\"mbps\">%.1f MB/s max</text>\n"
+                "<text x=\"4\" y=\"%.1f\" class=\"blocked\">%.0f blocked "
+                "max</text>\n", y + 40, y + 56, max_mbps, y + 72,
+                max_blocked);
+}
+
+static void chart_marks(FILE *out, const struct chart *chart, double y,
+                        double bottom)
+{
+        double x = 0;
+        size_t i = 0;
+
+        for (i = 0; i < chart->mark_count; i++) {
+                x = chart_x(chart, chart->marks[i].time_us);
+                fprintf(out, "<line x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" "
+                        "y2=\"%.1f\" class=\"mark\"/>\n"
+                        "<text transform=\"translate(%.1f,%.1f) rotate(-90)\" "
+                        "class=\"label\">", x, y, x, bottom, x + 3,
+                        y + CHART_MARKS_H - 4);
+                chart_escape(out, chart->marks[i].text);
+                fputs("</text>\n", out);
+        }
+}
+
+/**
+ * @fn static void chart_procs(FILE *out, const struct chart *chart,
+ *                             double y)
+ * @brief Draws a row per process: its lifetime, shaded by how much CPU it
+ *        used, and red where it was blocked on I/O
+ */
+static void chart_procs(FILE *out, const struct chart *chart, double y)
+{
+        const struct chart_proc *proc = NULL;
+        const struct chart_segment *segment = NULL;
+        double x0 = 0;
+        double x1 = 0;
+        size_t i = 0;
+        size_t k = 0;
+
+        for (i = 0; i < chart->proc_count; i++) {
+                proc = &chart->procs[i];
+                if (!chart_proc_shown(proc)) {
+                        continue;
+                }
+
+                x0 = chart_x(chart, proc->start_us);
+                x1 = chart_x(chart, proc->end_us);
+                fprintf(out, "<rect x=\"%.1f\" y=\"%.1f\" width=\"%.1f\" "
+                        "height=\"%d\" class=\"life\"/>\n", x0, y + 1,
+                        x1 - x0 > 1 ? x1 - x0 : 1, CHART_ROW_H - 2);
+                for (k = 0; k < proc->segment_count; k++) {
+                        segment = &proc->segments[k];
+                        x0 = chart_x(chart, segment->start_us);
+                        x1 = chart_x(chart, segment->end_us);
+                        fprintf(out, "<rect x=\"%.1f\" y=\"%.1f\" "
+                                "width=\"%.1f\" height=\"%d\" class=\"%s\" "
+                                "fill-opacity=\"%.2f\"/>\n", x0, y + 1,
+                                x1 - x0, CHART_ROW_H - 2,
+                                segment->state == 'D' ? "io" : "busy",
+                                segment->state == 'D' ? 0.6 :
+                                0.2 + 0.8 * segment->load);
+                }
+
+                fprintf(out, "<text x=\"4\" y=\"%.1f\" class=\"label\">",
+                        y + CHART_ROW_H - 3);
+                chart_escape(out, proc->info.comm);
+                fprintf(out, " [%d]</text>\n", proc->info.pid);
+                y += CHART_ROW_H;
+        }
+}
+
+/**
+ * @fn bool bootchart_render(const char *path, FILE *out)
+ * @brief Renders a chart written by the sampler as a self-contained SVG
+ * @param path the chart, NULL for BOOTCHART_PATH
+ * @return true on success, false with errno set otherwise
+ */
+bool bootchart_render(const char *path, FILE *out)
+{
+        struct chart chart;
+        struct stat st;
+        uint8_t *map = NULL;
+        size_t size = 0;
+        size_t rows = 0;
+        double width = 0;
+        double height = 0;
+        double y = 0;
+        size_t i = 0;
+        int fd = -1;
+        bool ok = false;
+
+        if (path == NULL) {
+                path = BOOTCHART_PATH;
+        }
+
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+                return false;
+        }
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                size = (size_t) st.st_size;
+                map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (map == NULL || map == MAP_FAILED) {
+                errno = map == NULL ? ENODATA : errno;
+                return false;
+        }
+
+        ok = chart_load(&chart, map, size);
+        if (!ok) {
+                chart_free(&chart);
+                munmap(map, size);
+                return false;
+        }
+
+        for (i = 0; i < chart.proc_count; i++) {
+                rows += chart_proc_shown(&chart.procs[i]);
+        }
+        width = chart_x(&chart, chart.end_us) + CHART_RIGHT;
+        width = width < CHART_MIN_WIDTH ? CHART_MIN_WIDTH : width;
+        height = CHART_TITLE_H + CHART_MARKS_H + 2 * (CHART_GRAPH_H +
+                 CHART_GAP) + rows * CHART_ROW_H + CHART_GAP;
+
+        fprintf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%.0f\" "
+                "height=\"%.0f\" font-family=\"sans-serif\" "
+                "font-size=\"11\">\n"
+                "<style>\n"
+                ".frame { fill: #fafafa; stroke: #999; }\n"
+                ".grid { stroke: #ddd; }\n"
+                ".mark { stroke: #b0b; stroke-dasharray: 4 3; }\n"
+                ".label { font-size: 9px; }\n"
+                ".user { fill: #36c; }\n"
+                ".system { fill: #d33; }\n"
+                ".iowait { fill: #f90; }\n"
+                ".util { fill: #a8c; }\n"
+                ".mbps { fill: #183; stroke: #183; }\n"
+                "polyline.mbps, polyline.blocked { fill: none; }\n"
+                ".blocked { fill: #d33; stroke: #d33; }\n"
+                ".life { fill: #e4e4e4; }\n"
+                ".busy { fill: #36c; }\n"
+                ".io { fill: #d33; }\n"
+                "</style>\n"
+                "<rect width=\"100%%\" height=\"100%%\" fill=\"white\"/>\n"
+                "<text x=\"4\" y=\"20\" font-size=\"16\">Cyrenit "
+                "bootchart</text>\n"
+                "<text x=\"4\" y=\"38\">%u CPUs, %zu samples every %u ms, "
+                "%.2f s to %.2f s of uptime</text>\n", width, height,
+                chart.header->cpus, chart.sample_count,
+                chart.header->interval_ms,
+                (double) chart.samples[0].time_us / 1e6,
+                (double) chart.end_us / 1e6);
+
+        for (i = 0; i * 1000000 + chart.start_us <= chart.end_us; i++) {
+                fprintf(out, "<text x=\"%.1f\" y=\"%d\" "
+                        "class=\"label\">%zus</text>\n",
+                        chart_x(&chart, chart.start_us + i * 1000000) + 2,
+                        CHART_TITLE_H - 2,
+                        (size_t) (chart.start_us / 1000000) + i);
+        }
+
+        y = CHART_TITLE_H + CHART_MARKS_H;
+        chart_cpu(out, &chart, y, width);
+        y += CHART_GRAPH_H + CHART_GAP;
+        chart_disk(out, &chart, y, width);
+        y += CHART_GRAPH_H + CHART_GAP;
+        chart_procs(out, &chart, y);
+        chart_marks(out, &chart, CHART_TITLE_H,
+                    y + rows * CHART_ROW_H);
+        fputs("</svg>\n", out);
+
+        chart_free(&chart);
+        munmap(map, size);
+
+        return !ferror(out);
+}
+
+#endif//__BOOTCHART_C
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * bootchart.h - Boot sampler and its SVG rendering
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __BOOTCHART_H
+#define __BOOTCHART_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "control.h"
+
+#define BOOTCHART_PATH CONTROL_RUN_DIR "/bootchart"
+#define BOOTCHART_MAGIC "CYRCHART"
+#define BOOTCHART_VERSION 1
+/* cyrenit.bootchart without a value samples this often */
+#define BOOTCHART_INTERVAL_MS 20
+/* sampling stops by then even if the target was not reached */
+#define BOOTCHART_MAX_MS 300000
+/* how often PID 1 checks whether the boot jobs are done */
+#define BOOTCHART_POLL_MS 100
+#define BOOTCHART_COMM_SIZE 20
+#define BOOTCHART_OPTION_SIZE 16
+
+/*
+ * cyrenit.bootchart[=<ms>] on the kernel command line starts a thread that
+ * samples /proc/stat, /proc/diskstats and /proc/<pid>/stat from early
+ * bootstrap until the jobs starting the target are done. Boot trace lines
+ * are recorded as marks, whether cyrenit.trace is on or not.
+ *
+ * The file is a struct bootchart_header followed by records, each a
+ * struct bootchart_record and size bytes of payload, in host byte order.
+ * A sample is a struct bootchart_system followed by the processes that
+ * started, exited (state 'X'), changed state or used CPU since the sample
+ * before; a mark is a NUL terminated line. `cyrenit bootchart` renders it.
+ */
+struct bootchart_header
+{
+        char magic[8];
+        uint32_t version;
+        uint32_t interval_ms;
+        /* clock ticks per second of the tick counts */
+        uint32_t hz;
+        uint32_t cpus;
+};
+
+enum bootchart_record_type
+{
+        BOOTCHART_SAMPLE = 1,
+        BOOTCHART_MARK
+};
+
+struct bootchart_record
+{
+        uint32_t type;
+        uint32_t size;
+        /* CLOCK_BOOTTIME, as the boot trace */
+        uint64_t time_us;
+};
+
+/* The first line of /proc/stat, in clock ticks */
+enum bootchart_cpu_state
+{
+        BOOTCHART_CPU_USER = 0,
+        BOOTCHART_CPU_NICE,
+        BOOTCHART_CPU_SYSTEM,
+        BOOTCHART_CPU_IDLE,
+        BOOTCHART_CPU_IOWAIT,
+        BOOTCHART_CPU_IRQ,
+        BOOTCHART_CPU_SOFTIRQ,
+        BOOTCHART_CPU_STEAL,
+        BOOTCHART_CPU_STATES
+};
+
+struct bootchart_system
+{
+        uint64_t cpu[BOOTCHART_CPU_STATES];
+        /* summed over whole disks, partitions and virtual ones left out */
+        uint64_t read_sectors;
+        uint64_t write_sectors;
+        /* of the busiest disk */
+        uint64_t io_ms;
+        uint32_t running;
+        uint32_t blocked;
+};
+
+struct bootchart_proc
+{
+        int32_t pid;
+        int32_t ppid;
+        /* user and system time */
+        uint32_t ticks;
+        char state;
+        char comm[BOOTCHART_COMM_SIZE - 1];
+};
+
+bool bootchart_start();
+bool bootchart_active();
+void bootchart_attach();
+void bootchart_mark(const char *text);
+void bootchart_stop();
+bool bootchart_render(const char *path, FILE *out);
+
+#endif//__BOOTCHART_H
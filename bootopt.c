@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * bootopt.c - Boot options taken from the kernel command line
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __BOOTOPT_C
+#define __BOOTOPT_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "bootchart.h"
+#include "bootopt.h"
+#include "console.h"
+#include "cyrenit.h"
+#include "kcmdline.h"
+
+struct boot_options boot_options = {
+        .target = BOOT_TARGET_FULL,
+        .parallel = 0,
+        .loglevel = CONSOLE_DEBUG,
+        .trace = false,
+};
+
+static const char *boot_target_names[BOOT_TARGETS] = {
+        [BOOT_TARGET_MINIMAL] = "minimal",
+        [BOOT_TARGET_RESCUE] = "rescue",
+        [BOOT_TARGET_FULL] = "full",
+};
+
+/* syslog(3) priority names, by priority */
+static const char *bootopt_level_names[] = {
+        "emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"
+};
+
+#define BOOTOPT_LEVELS \
+        (sizeof(bootopt_level_names) / sizeof(bootopt_level_names[0]))
+
+const char *boot_target_name(enum boot_target target)
+{
+        return target < BOOT_TARGETS ? boot_target_names[target] : "unknown";
+}
+
+/**
+ * @fn bool boot_target_parse(const char *name, enum boot_target *target)
+ * @brief Parses a target name
+ * @return true if name is a target
+ */
+bool boot_target_parse(const char *name, enum boot_target *target)
+{
+        int i = 0;
+
+        for (i = 0; i < BOOT_TARGETS; i++) {
+                if (strcmp(name, boot_target_names[i]) == STRCMP_EQUAL) {
+                        *target = (enum boot_target) i;
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+static bool bootopt_parse_level(const char *value, int *level)
+{
+        char *end = NULL;
+        long number = strtol(value, &end, 10);
+        size_t i = 0;
+
+        if (end != value && *end == '\0' && number >= 0 &&
+            number < (long) BOOTOPT_LEVELS) {
+                *level = (int) number;
+                return true;
+        }
+
+        for (i = 0; i < BOOTOPT_LEVELS; i++) {
+                if (strcmp(value, bootopt_level_names[i]) == STRCMP_EQUAL) {
+                        *level = (int) i;
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+/* What the kernel hands to init: the words it did not know itself */
+static void bootopt_load_argv(int argc, char **argv)
+{
+        int i = 0;
+
+        for (i = 1; i < argc && argv != NULL; i++) {
+                if (strcmp(argv[i], "single") == STRCMP_EQUAL ||
+                    strcmp(argv[i], "rescue") == STRCMP_EQUAL) {
+                        boot_options.target = BOOT_TARGET_RESCUE;
+                }
+        }
+}
+
+/**
+ * @fn void bootopt_load(int argc, char **argv)
+ * @brief Reads the cyrenit.* options of the kernel command line
+ * @param argc,argv the arguments of init, NULL when re-executed
+ * @details /proc must be mounted. Unknown values are reported and ignored,
+ *          the console log level is applied right away.
+ */
+void bootopt_load(int argc, char **argv)
+{
+        char value[BOOTOPT_VALUE_MAX];
+        char *end = NULL;
+
+        bootopt_load_argv(argc, argv);
+
+        if (kcmdline_get("cyrenit.target", value, sizeof(value)) &&
+            !boot_target_parse(value, &boot_options.target)) {
+                fprintf(stderr, "cyrenit: unknown target %s, booting %s\n",
+                        value, boot_target_name(boot_options.target));
+        }
+
+        if (kcmdline_get("cyrenit.parallel", value, sizeof(value))) {
+                boot_options.parallel = (unsigned) strtoul(value, &end, 10);
+                if (end == value || *end != '\0') {
+                        fprintf(stderr, "cyrenit: invalid cyrenit.parallel "
+                                "%s, not limiting\n", value);
+                        boot_options.parallel = 0;
+                }
+        }
+
+        if (kcmdline_has("quiet")) {
+                boot_options.loglevel = CONSOLE_WARNING;
+        }
+        if (kcmdline_get("cyrenit.loglevel", value, sizeof(value)) &&
+            !bootopt_parse_level(value, &boot_options.loglevel)) {
+                fprintf(stderr, "cyrenit: invalid cyrenit.loglevel %s\n",
+                        value);
+        }
+        console_set_level(boot_options.loglevel);
+
+        if (kcmdline_get("cyrenit.trace", value, sizeof(value))) {
+                boot_options.trace = strcmp(value, "0") != STRCMP_EQUAL &&
+                                     strcmp(value, "off") != STRCMP_EQUAL;
+        }
+        else {
+                boot_options.trace = kcmdline_has("cyrenit.trace");
+        }
+}
+
+/**
+ * @fn void boot_trace(const char *format, ...)
+ * @brief Prints a line of the boot trace, if cyrenit.trace is on
+ * @details Lines are stamped with the time since the kernel booted, as its
+ *          own messages are, and printed as notices. They are marked on the
+ *          bootchart too, if one is sampled.
+ */
+void boot_trace(const char *format, ...)
+{
+        char buffer[CONSOLE_LINE_MAX];
+        struct timespec ts;
+        va_list ap;
+
+        if (!boot_options.trace && !bootchart_active()) {
+                return;
+        }
+
+        clock_gettime(CLOCK_BOOTTIME, &ts);
+        va_start(ap, format);
+        vsnprintf(buffer, sizeof(buffer), format, ap);
+        va_end(ap);
+
+        bootchart_mark(buffer);
+        if (!boot_options.trace) {
+                return;
+        }
+        console_printf(CONSOLE_NOTICE, "cyrenit: [%5lld.%06ld] %s\n",
+                       (long long) ts.tv_sec, ts.tv_nsec / 1000, buffer);
+}
+
+#endif//__BOOTOPT_C
@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * bootopt.h - Boot options taken from the kernel command line
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __BOOTOPT_H
+#define __BOOTOPT_H
+
+#include <stdbool.h>
+
+/*
+ *   cyrenit.target=minimal|rescue|full   services started at boot (full)
+ *   cyrenit.parallel=<N>                 services starting at once (0: no
+ *                                        limit)
+ *   cyrenit.loglevel=<0-7|name>          console priorities shown (7), or
+ *                                        warning with `quiet`
+ *   cyrenit.trace                        time-stamped boot trace
+ *
+ * Without cyrenit.target, `single` or `rescue` as handed to init by the
+ * kernel select the rescue target.
+ */
+#define BOOTOPT_VALUE_MAX 32
+
+/*
+ * Targets nest: a service belongs to the smallest target it is needed in
+ * (`target =` in its file, full by default) and is started at boot when
+ * that is the booted target or a smaller one. What it requires is pulled
+ * in whatever its own target, see job.h.
+ */
+enum boot_target
+{
+        BOOT_TARGET_MINIMAL = 0,
+        BOOT_TARGET_RESCUE,
+        BOOT_TARGET_FULL,
+        BOOT_TARGETS
+};
+
+struct boot_options
+{
+        enum boot_target target;
+        unsigned parallel;
+        int loglevel;
+        bool trace;
+};
+
+extern struct boot_options boot_options;
+
+const char *boot_target_name(enum boot_target target);
+bool boot_target_parse(const char *name, enum boot_target *target);
+void bootopt_load(int argc, char **argv);
+void boot_trace(const char *format, ...)
+        __attribute__((format(printf, 1, 2)));
+
+#endif//__BOOTOPT_H
@@ -0,0 +1,555 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * console.c - Non-blocking writer for PID 1's console output
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __CONSOLE_C
+#define __CONSOLE_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <sys/uio.h>
+
+#include "console.h"
+#include "cyrenit.h"
+#include "evloop.h"
+#include "memstat.h"
+#include "timer.h"
+
+/* stdout and stderr once they feed the queue */
+struct console_stream
+{
+        int priority;
+        int fd;
+        size_t length;
+        char partial[CONSOLE_LINE_MAX];
+};
+
+static struct console_stream console_streams[] = {
+        { CONSOLE_INFO, STDOUT_FILENO, 0, "" },
+        { CONSOLE_ERR, STDERR_FILENO, 0, "" },
+};
+
+static struct console_line console_queue[CONSOLE_LINES];
+static size_t console_head = 0;
+static size_t console_count = 0;
+/* bytes of the line at the head already written */
+static size_t console_written = 0;
+static int console_out = -1;
+static bool console_watching = false;
+static bool console_forked = false;
+/* dropped since the last "lines suppressed" */
+static uint64_t console_dropped = 0;
+static uint64_t console_dropped_total = 0;
+
+static int console_level = CONSOLE_DEBUG;
+
+static struct console_line console_last;
+static bool console_has_last = false;
+static uint64_t console_repeats = 0;
+static struct timer console_repeat_timer;
+
+static bool console_drain();
+
+/* How many queued lines still let a line of priority in */
+static size_t console_limit(int priority)
+{
+        if (priority <= CONSOLE_CRIT) {
+                return CONSOLE_LINES;
+        }
+        if (priority == CONSOLE_ERR) {
+                return CONSOLE_LINES - CONSOLE_LINES / 8;
+        }
+        if (priority <= CONSOLE_NOTICE) {
+                return CONSOLE_LINES - CONSOLE_LINES / 4;
+        }
+
+        return CONSOLE_LINES / 2;
+}
+
+/* Drops the oldest line that has not been partly written yet */
+static bool console_evict()
+{
+        size_t next = (console_head + 1) % CONSOLE_LINES;
+
+        if (console_count == 0 || (console_written > 0 && console_count < 2)) {
+                return false;
+        }
+
+        if (console_written > 0) {
+                console_queue[next] = console_queue[console_head];
+        }
+        console_head = next;
+        console_count--;
+
+        return true;
+}
+
+static void console_enqueue(int priority, const char *text, size_t length)
+{
+        struct console_line *line = NULL;
+
+        if (console_count >= console_limit(priority)) {
+                console_dropped++;
+                console_dropped_total++;
+                if (priority > CONSOLE_CRIT || !console_evict()) {
+                        return;
+                }
+        }
+
+        line = &console_queue[(console_head + console_count) % CONSOLE_LINES];
+        memcpy(line->text, text, length);
+        line->text[length] = '\n';
+        line->length = (uint16_t) (length + 1);
+        line->priority = (uint8_t) priority;
+        console_count++;
+}
+
+/* Queues a line, after telling how many were dropped before it if it can */
+static void console_push(int priority, const char *text, size_t length)
+{
+        char marker[64];
+        int ret = 0;
+
+        if (console_dropped > 0 &&
+            console_count + 1 < console_limit(priority)) {
+                ret = snprintf(marker, sizeof(marker),
+                               "cyrenit: %" PRIu64 " lines suppressed",
+                               console_dropped);
+                console_dropped = 0;
+                console_enqueue(priority, marker, (size_t) ret);
+        }
+
+        console_enqueue(priority, text, length);
+}
+
+static void console_repeated()
+{
+        char summary[64];
+        int ret = 0;
+
+        if (console_repeats == 1) {
+                console_push(console_last.priority, console_last.text,
+                             console_last.length);
+        }
+        else if (console_repeats > 1) {
+                ret = snprintf(summary, sizeof(summary),
+                               "cyrenit: last message repeated %" PRIu64
+                               " times", console_repeats);
+                console_push(console_last.priority, summary, (size_t) ret);
+        }
+        console_repeats = 0;
+}
+
+static void console_repeat_timeout(struct timer *t, void *data)
+{
+        (void) t;
+        (void) data;
+        console_repeated();
+        console_has_last = false;
+        console_drain();
+}
+
+/* Queues a line of at most CONSOLE_LINE_MAX - 1 bytes, without newline */
+static void console_line(int priority, const char *text, size_t length)
+{
+        if (console_has_last && length == console_last.length &&
+            priority == console_last.priority &&
+            memcmp(text, console_last.text, length) == 0) {
+                /* the wheel is only there once the event loop is */
+                if (console_repeats++ == 0 && supervisor_timers.fd != -1) {
+                        timer_add(&supervisor_timers, &console_repeat_timer,
+                                  CONSOLE_REPEAT_MS, TIMER_COARSE);
+                }
+                return;
+        }
+
+        timer_cancel(&console_repeat_timer);
+        console_repeated();
+
+        memcpy(console_last.text, text, length);
+        console_last.length = (uint16_t) length;
+        console_last.priority = (uint8_t) priority;
+        console_has_last = true;
+
+        console_push(priority, text, length);
+}
+
+static void console_discard()
+{
+        console_dropped += console_count;
+        console_dropped_total += console_count;
+        console_head = 0;
+        console_count = 0;
+        console_written = 0;
+}
+
+/* Drops the lines (or part of the head one) writev() took */
+static void console_consume(size_t written)
+{
+        struct console_line *line = NULL;
+        size_t left = 0;
+
+        while (written > 0 && console_count > 0) {
+                line = &console_queue[console_head];
+                left = line->length - console_written;
+                if (written < left) {
+                        console_written += written;
+                        return;
+                }
+                written -= left;
+                console_written = 0;
+                console_head = (console_head + 1) % CONSOLE_LINES;
+                console_count--;
+        }
+}
+
+MEM_HOT
+static void console_handle(int fd, uint32_t events, void *data)
+{
+        (void) fd;
+        (void) events;
+        (void) data;
+        console_drain();
+}
+
+/**
+ * @fn static bool console_drain()
+ * @brief Writes as much of the queue as the console takes without blocking
+ * @return true if the queue is empty
+ * @details Lines go out in batches of CONSOLE_BATCH with a single writev().
+ *          A console that fails for any other reason than being full has
+ *          its queue discarded, and counted as suppressed.
+ */
+MEM_HOT
+static bool console_drain()
+{
+        struct iovec iov[CONSOLE_BATCH];
+        struct console_line *line = NULL;
+        ssize_t ret = 0;
+        size_t count = 0;
+        size_t i = 0;
+
+        while (console_count > 0 && console_out != -1) {
+                count = console_count < CONSOLE_BATCH ? console_count :
+                        CONSOLE_BATCH;
+                for (i = 0; i < count; i++) {
+                        line = &console_queue[(console_head + i) %
+                                              CONSOLE_LINES];
+                        iov[i].iov_base = line->text;
+                        iov[i].iov_len = line->length;
+                }
+                iov[0].iov_base = (char *) iov[0].iov_base + console_written;
+                iov[0].iov_len -= console_written;
+
+                ret = writev(console_out, iov, (int) count);
+                if (ret == -1 && errno == EINTR) {
+                        continue;
+                }
+                if (ret == -1 && errno == EAGAIN) {
+                        break;
+                }
+                if (ret == -1) {
+                        console_discard();
+                        break;
+                }
+                console_consume((size_t) ret);
+        }
+
+        if (console_count == 0 && console_watching) {
+                evloop_del(console_out);
+                console_watching = false;
+        }
+
+        return console_count == 0;
+}
+
+/*
+ * Lines written within one round of the event loop go out together once
+ * the console is writable. Before the loop, or once a quarter of the queue
+ * is used, they are written right away instead.
+ */
+static void console_kick()
+{
+        if (console_count == 0) {
+                return;
+        }
+
+        if (!console_watching) {
+                console_watching = evloop_add(console_out, EVLOOP_OUT,
+                                              console_handle, NULL);
+        }
+        if (!console_watching || console_count >= CONSOLE_LINES / 4) {
+                console_drain();
+        }
+}
+
+/**
+ * @fn void console_write(int priority, const char *text, size_t length)
+ * @brief Queues text, a line without its newline, for the console
+ * @param priority the syslog priority of the line
+ * @details Lines longer than CONSOLE_LINE_MAX are split.
+ */
+MEM_HOT
+void console_write(int priority, const char *text, size_t length)
+{
+        size_t chunk = 0;
+
+        if (priority > console_level) {
+                return;
+        }
+
+        if (console_out == -1) {
+                fprintf(priority <= CONSOLE_ERR ? stderr : stdout, "%.*s\n",
+                        (int) length, text);
+                return;
+        }
+
+        do {
+                chunk = length < CONSOLE_LINE_MAX - 1 ? length :
+                        CONSOLE_LINE_MAX - 1;
+                console_line(priority, text, chunk);
+                text += chunk;
+                length -= chunk;
+        } while (length > 0);
+
+        console_kick();
+}
+
+/**
+ * @fn void console_set_level(int level)
+ * @brief Leaves out the lines of a lower priority (higher number) than level
+ */
+void console_set_level(int level)
+{
+        console_level = level;
+}
+
+/**
+ * @fn void console_printf(int priority, const char *format, ...)
+ * @brief Formats and queues lines for the console
+ * @details As fprintf(), the last line is only cut short if it does not
+ *          end with a newline.
+ */
+void console_printf(int priority, const char *format, ...)
+{
+        char buffer[CONSOLE_LINE_MAX * 8];
+        char *start = buffer;
+        char *newline = NULL;
+        size_t length = 0;
+        va_list ap;
+        int ret = 0;
+
+        va_start(ap, format);
+        ret = vsnprintf(buffer, sizeof(buffer), format, ap);
+        va_end(ap);
+        if (ret < 0) {
+                return;
+        }
+
+        length = (size_t) ret < sizeof(buffer) ? (size_t) ret :
+                 sizeof(buffer) - 1;
+        while (length > 0) {
+                newline = memchr(start, '\n', length);
+                if (newline == NULL) {
+                        console_write(priority, start, length);
+                        break;
+                }
+                console_write(priority, start, (size_t) (newline - start));
+                length -= (size_t) (newline - start) + 1;
+                start = newline + 1;
+        }
+}
+
+/**
+ * @fn void console_flush(unsigned timeout_ms)
+ * @brief Waits up to timeout_ms for the queue to be written
+ * @details For when PID 1 is about to lose it, before re-executing.
+ */
+void console_flush(unsigned timeout_ms)
+{
+        struct pollfd pfd = { console_out, POLLOUT, 0 };
+        struct timespec ts;
+        int64_t deadline = 0;
+        int64_t now = 0;
+
+        if (console_out == -1) {
+                return;
+        }
+
+        fflush(stdout);
+        fflush(stderr);
+        timer_cancel(&console_repeat_timer);
+        console_repeated();
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now = (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+        deadline = now + timeout_ms;
+        while (!console_drain() && now < deadline) {
+                if (poll(&pfd, 1, (int) (deadline - now)) == -1 &&
+                    errno != EINTR) {
+                        break;
+                }
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                now = (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+        }
+}
+
+/**
+ * @fn uint64_t console_suppressed()
+ * @brief How many lines were dropped so far
+ */
+uint64_t console_suppressed()
+{
+        return console_dropped_total;
+}
+
+MEM_HOT
+static ssize_t console_stream_write(void *cookie, const char *buffer,
+                                    size_t size)
+{
+        struct console_stream *stream = cookie;
+        const char *newline = NULL;
+        size_t left = size;
+        size_t chunk = 0;
+
+        /* a forked child writes straight to whatever its stdout now is */
+        if (console_forked) {
+                return write(stream->fd, buffer, size);
+        }
+
+        while (left > 0) {
+                newline = memchr(buffer, '\n', left);
+                chunk = newline != NULL ? (size_t) (newline - buffer) : left;
+                if (stream->length == 0 && newline != NULL) {
+                        console_write(stream->priority, buffer, chunk);
+                }
+                else {
+                        if (chunk > sizeof(stream->partial) - stream->length) {
+                                chunk = sizeof(stream->partial) -
+                                        stream->length;
+                                newline = NULL;
+                        }
+                        memcpy(stream->partial + stream->length, buffer,
+                               chunk);
+                        stream->length += chunk;
+                        if (newline != NULL ||
+                            stream->length == sizeof(stream->partial)) {
+                                console_write(stream->priority,
+                                              stream->partial,
+                                              stream->length);
+                                stream->length = 0;
+                        }
+                }
+                if (newline != NULL) {
+                        chunk++;
+                }
+                buffer += chunk;
+                left -= chunk;
+        }
+
+        return (ssize_t) size;
+}
+
+static void console_atfork_child()
+{
+        console_forked = true;
+}
+
+static FILE *console_stream_open(struct console_stream *stream)
+{
+        cookie_io_functions_t io = { NULL, console_stream_write, NULL, NULL };
+        FILE *file = fopencookie(stream, "w", io);
+
+        if (file != NULL) {
+                setvbuf(file, NULL, _IOLBF, CONSOLE_LINE_MAX);
+        }
+
+        return file;
+}
+
+/**
+ * @fn bool console_open()
+ * @brief Takes over PID 1's stdout and stderr
+ * @return true on success or false if they are left as they were
+ * @details The console is opened again, so that it is non-blocking for PID
+ *          1 only: services on the console share the original descriptor,
+ *          left as console_fd, which stays blocking. Needs /proc or /dev to
+ *          be mounted.
+ */
+bool console_open()
+{
+        int flags = O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC;
+        FILE *out = NULL;
+        FILE *err = NULL;
+
+        if (console_out != -1) {
+                return true;
+        }
+
+        /* whatever stdout is, which the kernel made the console */
+        console_out = open("/proc/self/fd/1", flags);
+        if (console_out == -1) {
+                console_out = open(CONSOLE_PATH, flags);
+        }
+        if (console_out == -1) {
+                perror("cyrenit: failed to open the console");
+                return false;
+        }
+
+        out = console_stream_open(&console_streams[0]);
+        err = console_stream_open(&console_streams[1]);
+        if (out == NULL || err == NULL) {
+                perror("cyrenit: failed to take over stdout and stderr");
+                if (out != NULL) {
+                        fclose(out);
+                }
+                if (err != NULL) {
+                        fclose(err);
+                }
+                close(console_out);
+                console_out = -1;
+                return false;
+        }
+
+        timer_init(&console_repeat_timer, console_repeat_timeout, NULL);
+        pthread_atfork(NULL, NULL, console_atfork_child);
+        /*
+         * A background writer on a terminal with TOSTOP set would get
+         * SIGTTOU, which PID 1 cannot take; the write fails with EIO then.
+         */
+        signal(SIGTTOU, SIG_IGN);
+
+        fflush(stdout);
+        fflush(stderr);
+        stdout = out;
+        stderr = err;
+
+        /* the kernel opens the console read-write as fds 0, 1 and 2 */
+        if (console_fd == -1 &&
+            (fcntl(STDIN_FILENO, F_GETFL) & O_ACCMODE) == O_RDWR) {
+                console_fd = STDIN_FILENO;
+        }
+
+        return true;
+}
+
+#endif//__CONSOLE_C
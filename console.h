@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * console.h - Non-blocking writer for PID 1's console output
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __CONSOLE_H
+#define __CONSOLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * PID 1's stdout and stderr are replaced by streams feeding a bounded queue
+ * of lines, written to a non-blocking descriptor of the console from the
+ * event loop, so a slow UART never stalls PID 1.
+ *
+ * Priorities are the syslog ones. The fuller the queue, the fewer of them
+ * are taken: info and debug up to half of it, notice and warning up to
+ * three quarters, errors up to seven eighths, and critical lines always,
+ * dropping the oldest queued line if they must. What is dropped is counted
+ * and reported as "N lines suppressed" where the gap is. A line repeated
+ * back to back is written once, followed by how many times it repeated.
+ * Lines above the log level (cyrenit.loglevel, see bootopt.h) are not
+ * queued at all.
+ */
+#define CONSOLE_PATH "/dev/console"
+#define CONSOLE_LINES 256
+#define CONSOLE_LINE_MAX 256
+/* Lines are written in batches of at most this many */
+#define CONSOLE_BATCH 64
+/* Repeats are summarised this long after the first one */
+#define CONSOLE_REPEAT_MS 1000
+/* How long PID 1 waits for the queue to drain before re-executing */
+#define CONSOLE_FLUSH_MS 2000
+
+#define CONSOLE_CRIT 2
+#define CONSOLE_ERR 3
+#define CONSOLE_WARNING 4
+#define CONSOLE_NOTICE 5
+#define CONSOLE_INFO 6
+#define CONSOLE_DEBUG 7
+
+struct console_line
+{
+        uint16_t length;
+        uint8_t priority;
+        char text[CONSOLE_LINE_MAX];
+};
+
+bool console_open();
+void console_set_level(int level);
+void console_write(int priority, const char *text, size_t length);
+void console_printf(int priority, const char *format, ...)
+        __attribute__((format(printf, 2, 3)));
+void console_flush(unsigned timeout_ms);
+uint64_t console_suppressed();
+
+#endif//__CONSOLE_H
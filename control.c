@@ -0,0 +1,497 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * control.c - Control socket between the CLI and PID 1
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __CONTROL_C
+#define __CONTROL_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "control.h"
+#include "cyrenit.h"
+#include "evloop.h"
+#include "memstat.h"
+
+#define CONTROL_ALLOC_STEP 8
+#define CONTROL_REPLY_STEP 4096
+#define CONTROL_BACKLOG 16
+
+struct control_conn
+{
+        int fd;
+        char request[CONTROL_MAX_REQUEST];
+        size_t request_length;
+        struct control_reply reply;
+        size_t written;
+};
+
+/**
+ * @var int control_fd
+ * @brief Listening control socket of PID 1, -1 if not listening
+ */
+int control_fd = -1;
+
+static struct control_command *commands = NULL;
+static size_t command_count = 0;
+static size_t command_allocated = 0;
+
+static void control_help(int argc, char **argv, struct control_reply *reply);
+
+/**
+ * @fn bool control_register(const char *name, const char *usage,
+ *                           control_handler handler)
+ * @brief Registers a command to be served on the control socket
+ * @param name the command name, as typed on the CLI
+ * @param usage a one line usage summary shown by `cyrenit help`
+ * @param handler the function building the reply
+ * @return true on success or false on failure
+ */
+bool control_register(const char *name, const char *usage,
+                      control_handler handler)
+{
+        struct control_command *new_commands = NULL;
+        size_t new_size = 0;
+
+        if (name == NULL || handler == NULL) {
+                return false;
+        }
+
+        if (command_count >= command_allocated) {
+                new_size = command_allocated + CONTROL_ALLOC_STEP;
+                new_commands = mem_reallocarray(MEM_CONTROL, commands,
+                                                new_size,
+                                                sizeof(struct control_command));
+                if (new_commands == NULL) {
+                        return false;
+                }
+                commands = new_commands;
+                command_allocated = new_size;
+        }
+
+        commands[command_count].name = name;
+        commands[command_count].usage = usage == NULL ? "" : usage;
+        commands[command_count].handler = handler;
+        command_count++;
+
+        return true;
+}
+
+static bool control_reply_vprintf(struct control_reply *reply,
+                                  const char *fmt, va_list ap)
+{
+        va_list copy;
+        char *new_buffer = NULL;
+        size_t new_size = 0;
+        int needed = 0;
+
+        va_copy(copy, ap);
+        needed = vsnprintf(NULL, 0, fmt, copy);
+        va_end(copy);
+        if (needed < 0) {
+                return false;
+        }
+
+        if (reply->length + (size_t) needed + 1 > reply->allocated) {
+                new_size = reply->allocated;
+                while (reply->length + (size_t) needed + 1 > new_size) {
+                        new_size += CONTROL_REPLY_STEP;
+                }
+                new_buffer = mem_realloc(MEM_CONTROL, reply->buffer, new_size);
+                if (new_buffer == NULL) {
+                        return false;
+                }
+                reply->buffer = new_buffer;
+                reply->allocated = new_size;
+        }
+
+        vsnprintf(reply->buffer + reply->length,
+                  reply->allocated - reply->length, fmt, ap);
+        reply->length += (size_t) needed;
+
+        return true;
+}
+
+/**
+ * @fn bool control_reply_printf(struct control_reply *reply,
+ *                               const char *fmt, ...)
+ * @brief Appends formatted text to a reply
+ * @return true on success or false on allocation failure
+ */
+bool control_reply_printf(struct control_reply *reply, const char *fmt, ...)
+{
+        va_list ap;
+        bool ret = false;
+
+        if (reply == NULL || fmt == NULL) {
+                return false;
+        }
+
+        va_start(ap, fmt);
+        ret = control_reply_vprintf(reply, fmt, ap);
+        va_end(ap);
+
+        return ret;
+}
+
+/**
+ * @fn void control_reply_error(struct control_reply *reply,
+ *                              const char *fmt, ...)
+ * @brief Replaces the reply with an error message
+ */
+void control_reply_error(struct control_reply *reply, const char *fmt, ...)
+{
+        va_list ap;
+
+        if (reply == NULL || fmt == NULL) {
+                return;
+        }
+
+        reply->length = 0;
+        reply->failed = true;
+        control_reply_printf(reply, "error: ");
+        va_start(ap, fmt);
+        control_reply_vprintf(reply, fmt, ap);
+        va_end(ap);
+        control_reply_printf(reply, "\n");
+}
+
+static void control_conn_close(struct control_conn *conn)
+{
+        evloop_del(conn->fd);
+        close(conn->fd);
+        mem_free(MEM_CONTROL, conn->reply.buffer);
+        mem_free(MEM_CONTROL, conn);
+}
+
+static void control_dispatch(struct control_conn *conn)
+{
+        char *argv[CONTROL_MAX_ARGS + 1];
+        char *saveptr = NULL;
+        char *token = NULL;
+        int argc = 0;
+        size_t i = 0;
+
+        token = strtok_r(conn->request, " \t\n", &saveptr);
+        while (token != NULL && argc < CONTROL_MAX_ARGS) {
+                argv[argc++] = token;
+                token = strtok_r(NULL, " \t\n", &saveptr);
+        }
+        argv[argc] = NULL;
+
+        if (argc == 0) {
+                control_reply_error(&conn->reply, "empty request");
+                return;
+        }
+
+        for (i = 0; i < command_count; i++) {
+                if (strcmp(commands[i].name, argv[0]) == STRCMP_EQUAL) {
+                        commands[i].handler(argc, argv, &conn->reply);
+                        return;
+                }
+        }
+
+        control_reply_error(&conn->reply, "unknown command %s", argv[0]);
+}
+
+static void control_conn_write(struct control_conn *conn)
+{
+        ssize_t ret = 0;
+
+        while (conn->written < conn->reply.length) {
+                ret = write(conn->fd, conn->reply.buffer + conn->written,
+                            conn->reply.length - conn->written);
+                if (ret < 0) {
+                        if (errno == EAGAIN || errno == EINTR) {
+                                return; //wait for EVLOOP_OUT
+                        }
+                        break;
+                }
+                conn->written += (size_t) ret;
+        }
+
+        control_conn_close(conn);
+}
+
+static void control_conn_event(int fd, uint32_t events, void *data)
+{
+        struct control_conn *conn = data;
+        ssize_t ret = 0;
+
+        if (events & EVLOOP_OUT) {
+                control_conn_write(conn);
+                return;
+        }
+
+        ret = read(fd, conn->request + conn->request_length,
+                   CONTROL_MAX_REQUEST - 1 - conn->request_length);
+        if (ret < 0 && (errno == EAGAIN || errno == EINTR)) {
+                return;
+        }
+        if (ret <= 0) {
+                control_conn_close(conn);
+                return;
+        }
+
+        conn->request_length += (size_t) ret;
+        conn->request[conn->request_length] = '\0';
+        if (strchr(conn->request, '\n') == NULL &&
+            conn->request_length < CONTROL_MAX_REQUEST - 1) {
+                return; //incomplete line
+        }
+
+        control_dispatch(conn);
+        if (!evloop_modify(fd, EVLOOP_OUT)) {
+                control_conn_close(conn);
+                return;
+        }
+        control_conn_write(conn);
+}
+
+static void control_accept(int fd, uint32_t events, void *data)
+{
+        struct control_conn *conn = NULL;
+        int client = -1;
+
+        (void) events;
+        (void) data;
+
+        while ((client = accept4(fd, NULL, NULL,
+                                 SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+                conn = mem_calloc(MEM_CONTROL, 1, sizeof(struct control_conn));
+                if (conn == NULL) {
+                        close(client);
+                        continue;
+                }
+                conn->fd = client;
+                if (!evloop_add(client, EVLOOP_IN, control_conn_event, conn)) {
+                        close(client);
+                        mem_free(MEM_CONTROL, conn);
+                }
+        }
+}
+
+/**
+ * @fn bool control_init()
+ * @brief Starts listening on CONTROL_SOCKET_PATH from the event loop
+ * @return true on success or false on failure
+ */
+bool control_init()
+{
+        struct sockaddr_un addr;
+
+        if (mkdir(CONTROL_RUN_DIR, 0755) != 0 && errno != EEXIST) {
+                perror("cyrenit: failed to create " CONTROL_RUN_DIR);
+                return false;
+        }
+
+        control_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+                            SOCK_CLOEXEC, 0);
+        if (control_fd == -1) {
+                perror("cyrenit: failed to create the control socket");
+                return false;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, CONTROL_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+        unlink(CONTROL_SOCKET_PATH);
+
+        if (bind(control_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+            chmod(CONTROL_SOCKET_PATH, 0600) != 0 ||
+            listen(control_fd, CONTROL_BACKLOG) != 0) {
+                perror("cyrenit: failed to listen on " CONTROL_SOCKET_PATH);
+                close(control_fd);
+                control_fd = -1;
+                return false;
+        }
+
+        return control_adopt(control_fd);
+}
+
+/**
+ * @fn bool control_adopt(int fd)
+ * @brief Serves the control protocol on an already listening socket
+ * @param fd the listening socket, e.g. inherited over a re-exec of PID 1
+ * @return true on success or false on failure
+ */
+bool control_adopt(int fd)
+{
+        if (fd < 0) {
+                return false;
+        }
+
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        control_fd = fd;
+        control_register("help", "list the available commands", control_help);
+
+        return evloop_add(control_fd, EVLOOP_IN, control_accept, NULL);
+}
+
+static void control_help(int argc, char **argv, struct control_reply *reply)
+{
+        size_t i = 0;
+
+        (void) argc;
+        (void) argv;
+        for (i = 0; i < command_count; i++) {
+                control_reply_printf(reply, "%-12s %s\n", commands[i].name,
+                                     commands[i].usage);
+        }
+}
+
+/**
+ * @fn int control_client_connect()
+ * @brief Connects to the control socket of PID 1
+ * @return the connected socket or -1 on failure
+ */
+int control_client_connect()
+{
+        struct sockaddr_un addr;
+        int fd = -1;
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+                return -1;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, CONTROL_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+                close(fd);
+                return -1;
+        }
+
+        return fd;
+}
+
+static int control_client_send(int argc, char **argv)
+{
+        char request[CONTROL_MAX_REQUEST];
+        size_t length = 0;
+        int ret = 0;
+        int fd = -1;
+        int i = 0;
+
+        for (i = 0; i < argc; i++) {
+                ret = snprintf(request + length, sizeof(request) - length,
+                               "%s%s", i ? " " : "", argv[i]);
+                if (ret < 0 || (size_t) ret >= sizeof(request) - length - 1) {
+                        fprintf(stderr, "cyrenit: request too long\n");
+                        return -1;
+                }
+                length += (size_t) ret;
+        }
+        request[length++] = '\n';
+
+        fd = control_client_connect();
+        if (fd == -1) {
+                perror("cyrenit: failed to connect to " CONTROL_SOCKET_PATH);
+                return -1;
+        }
+
+        if (write(fd, request, length) != (ssize_t) length) {
+                perror("cyrenit: failed to send request");
+                close(fd);
+                return -1;
+        }
+
+        return fd;
+}
+
+/**
+ * @fn int control_client_request(int argc, char **argv, int out_fd)
+ * @brief Sends argv as a request and copies the reply to out_fd
+ * @param argc the argument count
+ * @param argv the command and its arguments
+ * @param out_fd where to write the reply
+ * @return EXIT_SUCCESS or EXIT_FAILURE if the request failed
+ */
+int control_client_request(int argc, char **argv, int out_fd)
+{
+        char buffer[CONTROL_REPLY_STEP];
+        ssize_t ret = 0;
+        bool first = true;
+        bool failed = false;
+        int fd = -1;
+
+        fd = control_client_send(argc, argv);
+        if (fd == -1) {
+                return EXIT_FAILURE;
+        }
+
+        while ((ret = read(fd, buffer, sizeof(buffer))) > 0) {
+                if (first && strncmp(buffer, "error:", 6) == STRCMP_EQUAL) {
+                        failed = true;
+                }
+                first = false;
+                if (write(out_fd, buffer, (size_t) ret) != ret) {
+                        break;
+                }
+        }
+
+        close(fd);
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * @fn char *control_client_query(int argc, char **argv)
+ * @brief Sends argv as a request and returns the whole reply
+ * @param argc the argument count
+ * @param argv the command and its arguments
+ * @return the NUL terminated reply, to be freed by the caller, or NULL on
+ *         failure (including error replies, which are printed to stderr)
+ */
+char *control_client_query(int argc, char **argv)
+{
+        struct control_reply reply;
+        char buffer[CONTROL_REPLY_STEP];
+        ssize_t ret = 0;
+        int fd = -1;
+
+        memset(&reply, 0, sizeof(reply));
+        fd = control_client_send(argc, argv);
+        if (fd == -1) {
+                return NULL;
+        }
+
+        while ((ret = read(fd, buffer, sizeof(buffer))) > 0) {
+                if (!control_reply_printf(&reply, "%.*s", (int) ret, buffer)) {
+                        break;
+                }
+        }
+        close(fd);
+
+        if (reply.buffer == NULL) {
+                return NULL;
+        }
+
+        if (strncmp(reply.buffer, "error:", 6) == STRCMP_EQUAL) {
+                fputs(reply.buffer, stderr);
+                mem_free(MEM_CONTROL, reply.buffer);
+                return NULL;
+        }
+
+        return reply.buffer;
+}
+
+#endif//__CONTROL_C
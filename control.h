@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * control.h - Control socket between the CLI and PID 1
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __CONTROL_H
+#define __CONTROL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define CONTROL_RUN_DIR "/run/cyrenit"
+#define CONTROL_SOCKET_PATH CONTROL_RUN_DIR "/control"
+#define CONTROL_MAX_REQUEST 1024
+#define CONTROL_MAX_ARGS 32
+
+/*
+ * The protocol is line based: the CLI sends a single line with the command
+ * and its space separated arguments, PID 1 writes the reply and closes the
+ * connection. Replies starting with "error:" mean the command failed.
+ */
+struct control_reply
+{
+        char *buffer;
+        size_t length;
+        size_t allocated;
+        bool failed;
+};
+
+typedef void (*control_handler)(int argc, char **argv,
+                                struct control_reply *reply);
+
+struct control_command
+{
+        const char *name;
+        const char *usage;
+        control_handler handler;
+};
+
+extern int control_fd;
+
+bool control_init();
+bool control_adopt(int fd);
+bool control_register(const char *name, const char *usage,
+                      control_handler handler);
+bool control_reply_printf(struct control_reply *reply, const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+void control_reply_error(struct control_reply *reply, const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+
+int control_client_connect();
+int control_client_request(int argc, char **argv, int out_fd);
+char *control_client_query(int argc, char **argv);
+
+#endif//__CONTROL_H
@@ -14,11 +14,336 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "bootchart.h"
+#include "control.h"
+#include "cyrenit.h"
+#include "journal.h"
+#include "memstat.h"
+
+#define TOP_DEFAULT_DELAY 2
+#define TOP_NAME_SIZE 32
+#define TOP_STATUS_SIZE 16
+
+struct top_entry
+{
+        char name[TOP_NAME_SIZE];
+        char status[TOP_STATUS_SIZE];
+        int pid;
+        unsigned cpu_permille;
+        unsigned long long rss_kb;
+        unsigned long long maxrss_kb;
+        unsigned long long exits;
+        unsigned restarts;
+};
+
+static void cli_usage(const char *name)
+{
+        fprintf(stderr, "usage: %s <command> [args...]\n"
+                "       %s top [-d seconds] [-n iterations] [-b]\n"
+                "       %s logs [service] [--since -30s|-5m|-2h|uptime]\n"
+                "       %s bootchart [-o bootchart.svg] [chart]\n"
+                "       %s help (lists the commands served by PID 1)\n",
+                name, name, name, name, name);
+}
+
+static int top_compare(const void *a, const void *b)
+{
+        const struct top_entry *ea = a;
+        const struct top_entry *eb = b;
+
+        if (ea->cpu_permille != eb->cpu_permille) {
+                return ea->cpu_permille < eb->cpu_permille ? 1 : -1;
+        }
+        if (ea->rss_kb != eb->rss_kb) {
+                return ea->rss_kb < eb->rss_kb ? 1 : -1;
+        }
+        return strcmp(ea->name, eb->name);
+}
+
+/**
+ * @fn static size_t top_parse(char *dump, struct top_entry **entries)
+ * @brief Parses the machine-readable `stats` dump into top entries
+ * @return the number of entries parsed
+ */
+static size_t top_parse(char *dump, struct top_entry **entries)
+{
+        struct top_entry *list = NULL;
+        struct top_entry *new_list = NULL;
+        struct top_entry *e = NULL;
+        size_t count = 0;
+        char *saveptr = NULL;
+        char *line = NULL;
+
+        for (line = strtok_r(dump, "\n", &saveptr); line != NULL;
+             line = strtok_r(NULL, "\n", &saveptr)) {
+                if (*line == '#') {
+                        continue;
+                }
+
+                new_list = reallocarray(list, count + 1,
+                                        sizeof(struct top_entry));
+                if (new_list == NULL) {
+                        break;
+                }
+                list = new_list;
+                e = &list[count];
+                memset(e, 0, sizeof(struct top_entry));
+
+                if (sscanf(line, "name=%31s pid=%d status=%15s "
+                           "cpu_permille=%u rss_kb=%llu maxrss_kb=%llu "
+                           "utime_us=%*u stime_us=%*u minflt=%*u "
+                           "majflt=%*u exits=%llu restarts=%u",
+                           e->name, &e->pid, e->status, &e->cpu_permille,
+                           &e->rss_kb, &e->maxrss_kb, &e->exits,
+                           &e->restarts) == 8) {
+                        count++;
+                }
+        }
+
+        *entries = list;
+        return count;
+}
+
+/**
+ * @fn static int cli_top(int argc, char **argv)
+ * @brief Live top-like view of the services supervised by PID 1
+ * @details Polls the `stats` command, so all the sampling cost stays in
+ *          PID 1's adaptive sampler and nothing extra is read here.
+ */
+static int cli_top(int argc, char **argv)
+{
+        char *request[] = { "stats", NULL };
+        struct top_entry *entries = NULL;
+        unsigned long long total_rss = 0;
+        unsigned total_cpu = 0;
+        unsigned delay = TOP_DEFAULT_DELAY;
+        long iterations = -1;
+        bool batch = false;
+        size_t count = 0;
+        size_t i = 0;
+        char *dump = NULL;
+        int opt = 0;
+
+        while ((opt = getopt(argc, argv, "d:n:b")) != -1) {
+                switch (opt) {
+                case 'd':
+                        delay = (unsigned) strtoul(optarg, NULL, 10);
+                        break;
+                case 'n':
+                        iterations = strtol(optarg, NULL, 10);
+                        break;
+                case 'b':
+                        batch = true;
+                        break;
+                default:
+                        return EXIT_FAILURE;
+                }
+        }
+
+        while (iterations != 0) {
+                dump = control_client_query(1, request);
+                if (dump == NULL) {
+                        return EXIT_FAILURE;
+                }
+
+                count = top_parse(dump, &entries);
+                qsort(entries, count, sizeof(struct top_entry), top_compare);
+
+                total_cpu = 0;
+                total_rss = 0;
+                for (i = 0; i < count; i++) {
+                        total_cpu += entries[i].cpu_permille;
+                        total_rss += entries[i].rss_kb;
+                }
+
+                if (!batch) {
+                        fputs("\033[H\033[2J", stdout);
+                }
+                printf("cyrenit top - %zu services, cpu %u.%u%%, "
+                       "rss %llu KiB\n\n", count, total_cpu / 10,
+                       total_cpu % 10, total_rss);
+                printf("%-24s %7s %-10s %6s %10s %10s %6s %8s\n", "NAME",
+                       "PID", "STATUS", "CPU%", "RSS(KiB)", "MAXRSS",
+                       "EXITS", "RESTARTS");
+                for (i = 0; i < count; i++) {
+                        printf("%-24s %7d %-10s %4u.%u %10llu %10llu %6llu "
+                               "%8u\n", entries[i].name, entries[i].pid,
+                               entries[i].status,
+                               entries[i].cpu_permille / 10,
+                               entries[i].cpu_permille % 10,
+                               entries[i].rss_kb, entries[i].maxrss_kb,
+                               entries[i].exits, entries[i].restarts);
+                }
+                fflush(stdout);
+
+                free(entries);
+                mem_free(MEM_CONTROL, dump);
+                entries = NULL;
+
+                if (iterations > 0) {
+                        iterations--;
+                }
+                if (iterations != 0) {
+                        sleep(delay);
+                }
+        }
+
+        return EXIT_SUCCESS;
+}
+
+/**
+ * @fn static bool logs_parse_since(const char *arg, uint64_t *since)
+ * @brief Parses a time either relative to now, as in "-30s", or in seconds
+ *        of uptime, into a CLOCK_MONOTONIC timestamp
+ */
+static bool logs_parse_since(const char *arg, uint64_t *since)
+{
+        uint64_t now = journal_now();
+        double seconds = 0;
+        char *end = NULL;
+
+        seconds = strtod(arg[0] == '-' ? arg + 1 : arg, &end);
+        if (end == arg || seconds < 0) {
+                return false;
+        }
+
+        switch (*end) {
+        case 'd':
+                seconds *= 24;
+                /* fall through */
+        case 'h':
+                seconds *= 60;
+                /* fall through */
+        case 'm':
+                seconds *= 60;
+                /* fall through */
+        case 's':
+                end++;
+                break;
+        }
+        if (*end != '\0') {
+                return false;
+        }
+
+        *since = (uint64_t) (seconds * 1e9);
+        if (arg[0] == '-') {
+                *since = *since < now ? now - *since : 0;
+        }
+
+        return true;
+}
+
+/**
+ * @fn static int cli_logs(int argc, char **argv)
+ * @brief Prints the journaled output of the services
+ * @details Reads the segments directly, PID 1 is not involved.
+ */
+static int cli_logs(int argc, char **argv)
+{
+        const char *service = NULL;
+        uint64_t since = 0;
+        int i = 0;
+
+        for (i = 1; i < argc; i++) {
+                if (strcmp(argv[i], "--since") == STRCMP_EQUAL) {
+                        if (i + 1 >= argc ||
+                            !logs_parse_since(argv[++i], &since)) {
+                                fprintf(stderr, "cyrenit: invalid time for "
+                                        "--since\n");
+                                return EXIT_FAILURE;
+                        }
+                }
+                else if (service == NULL) {
+                        service = argv[i];
+                }
+                else {
+                        fprintf(stderr, "cyrenit: unexpected argument %s\n",
+                                argv[i]);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        if (journal_print(service, since, stdout) < 0) {
+                perror("cyrenit: cannot read " JOURNAL_DIR);
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+/**
+ * @fn static int cli_bootchart(int argc, char **argv)
+ * @brief Renders the bootchart sampled at boot as SVG
+ * @details Reads the chart directly, PID 1 is not involved.
+ */
+static int cli_bootchart(int argc, char **argv)
+{
+        const char *path = NULL;
+        const char *output = NULL;
+        FILE *out = stdout;
+        bool ok = false;
+        int i = 0;
+
+        for (i = 1; i < argc; i++) {
+                if (strcmp(argv[i], "-o") == STRCMP_EQUAL && i + 1 < argc) {
+                        output = argv[++i];
+                }
+                else if (path == NULL && argv[i][0] != '-') {
+                        path = argv[i];
+                }
+                else {
+                        fprintf(stderr, "cyrenit: unexpected argument %s\n",
+                                argv[i]);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        if (output != NULL) {
+                out = fopen(output, "we");
+                if (out == NULL) {
+                        fprintf(stderr, "cyrenit: cannot write %s: %s\n",
+                                output, strerror(errno));
+                        return EXIT_FAILURE;
+                }
+        }
+
+        ok = bootchart_render(path, out);
+        if (!ok) {
+                fprintf(stderr, "cyrenit: cannot render %s: %s\n",
+                        path != NULL ? path : BOOTCHART_PATH,
+                        strerror(errno));
+        }
+        if (out != stdout && fclose(out) != 0) {
+                ok = false;
+        }
+
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
 int cli_mode_main(int argc, char **argv, char **envp)
 {
-        fprintf(stderr, "CLI mode not implemented yet\n");
-        return EXIT_FAILURE;
+        (void) envp;
+
+        if (argc < 2) {
+                cli_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        if (strcmp(argv[1], "top") == STRCMP_EQUAL) {
+                return cli_top(argc - 1, argv + 1);
+        }
+        if (strcmp(argv[1], "logs") == STRCMP_EQUAL) {
+                return cli_logs(argc - 1, argv + 1);
+        }
+        if (strcmp(argv[1], "bootchart") == STRCMP_EQUAL) {
+                return cli_bootchart(argc - 1, argv + 1);
+        }
+
+        return control_client_request(argc - 1, argv + 1, STDOUT_FILENO);
 }
 
-#endif//__CYRECLI_H
\ No newline at end of file
+#endif//__CYRECLI_H
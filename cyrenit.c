@@ -24,26 +24,64 @@
 #include <asm/termbits.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <sys/signalfd.h>
 
 #include <libgen.h>
 
 #include "cyrenit.h"
+#include "automount.h"
+#include "bootchart.h"
+#include "bootopt.h"
+#include "console.h"
+#include "control.h"
 #include "cyrecli.h"
+#include "evloop.h"
+#include "fdstore.h"
+#include "job.h"
+#include "kcmdline.h"
+#include "memstat.h"
+#include "modules.h"
 #include "mounts.h"
+#include "pool.h"
+#include "pressure.h"
 #include "proc.h"
+#include "readahead.h"
+#include "reexec.h"
+#include "service.h"
+#include "stats.h"
+#include "switchroot.h"
+#include "timer.h"
+#include "topology.h"
+#include "uevent.h"
+#include "zygote.h"
+
+#define CONSOLE_SHELL "/bin/bash"
+#define CONSOLE_SHELL_RESPAWN_MS 5000
 
 int console_fd = -1;
 pid_t console_pid = -1;
+int signal_fd = -1;
 
 void dump_char_array(char **arr);
 int main_loop(int argc, char **argv, char **envp);
 int bootstrap(int argc, char **argv, char **envp);
-int exec_fg(int argc, char **argv, char **envp);
+int resume(int state_fd);
+bool setup_event_loop();
+bool block_child_signals(sigset_t *mask);
+int start_console_shell();
+void start_readahead();
 int start_services();
 
 int main(int argc, char **argv, char **envp)
 {
         char *cmdline = *argv;
+        int state_fd = -1;
+
+        /* zygotes are cyrenit re-executed by a service's setup */
+        if (check_command(cmdline, ZYGOTE_CMD)) {
+                return zygote_main(argc, argv);
+        }
 
         fprintf(stdout, "cyrenit[%d]: game on! \n", getpid());
         fprintf(stderr, "cyrenit: testing writing to stdout and stderr\n");
@@ -54,7 +92,14 @@ int main(int argc, char **argv, char **envp)
         else if (check_command(cmdline, INIT_CMD)) {
                 // init mainloop
                 if (check_pid_one_semantics(cmdline)) {
-                        bootstrap(argc, argv, environ);
+                        block_child_signals(NULL);
+                        state_fd = reexec_state_fd(argc, argv);
+                        if (state_fd != -1) {
+                                resume(state_fd);
+                        }
+                        else {
+                                bootstrap(argc, argv, environ);
+                        }
                         return main_loop(argc, argv, environ);
                 }
                 fprintf(stderr, "cyrenit: ERROR: Are you fooling me? "
@@ -141,14 +186,13 @@ int bootstrap(int argc, char **argv, char **envp)
                 NULL
         };
         struct mount_task **mt_ptr = mount_list;
+        struct mount_task *root_task = NULL;
+        size_t fstab_count = 0;
+        size_t deferred_count = 0;
         int env_ret = 0;
         int svc_ret = 0;
 
         fprintf(stdout, "cyrenit: starting bootstrap process...\n");
-        fprintf(stdout, "cyrenit: dumping argv\n");
-        dump_char_array(argv);
-        fprintf(stdout, "cyrenit: dumping envp\n");
-        dump_char_array(envp);
 
         fprintf(stdout, "cyrenit[%d]: creating mount tasks\n", getpid());
         while (mt_ptr && *mt_ptr) {
@@ -160,14 +204,73 @@ int bootstrap(int argc, char **argv, char **envp)
                         (*mt_ptr)->source);
                 mt_ptr++;
         }
+        fstab_count = mounts_load_fstab(NULL);
+        fprintf(stdout, "cyrenit: loaded %zu mount tasks from %s\n",
+                fstab_count, MOUNTS_FSTAB);
         fprintf(stdout, "cyrenit: finished creating mount tasks, "
-                "mounting them!\n");
-        if (do_mounts(NULL)) {
+                "mounting the critical ones!\n");
+        if (do_mounts(NULL, MOUNT_TIER_CRITICAL)) {
                 fprintf(stdout, "cyrenit: success mounting filesystems\n");
         }
         else {
                 fprintf(stderr, "cyrenit: failed to mount filesystems\n");
         }
+        /* /dev and /proc are there to reopen it from now on */
+        bootopt_load(argc, argv);
+        console_open();
+        memstat_lean_init();
+        bootchart_start();
+        fprintf(stdout, "cyrenit: booting the %s target\n",
+                boot_target_name(boot_options.target));
+        boot_trace("critical filesystems mounted");
+        if (boot_options.trace) {
+                fprintf(stdout, "cyrenit: argv:\n");
+                dump_char_array(argv);
+                fprintf(stdout, "cyrenit: envp:\n");
+                dump_char_array(envp);
+        }
+        start_readahead();
+        /* storage drivers first, coldplug replays what they probe */
+        if (modules_load(NULL) > 0) {
+                boot_trace("kernel modules loaded");
+        }
+        /* the socket queues the replayed events for the loop */
+        uevent_coldplug();
+        boot_trace("devices coldplugged");
+
+        root_task = switch_root_task_from_cmdline();
+        if (root_task != NULL &&
+            !uevent_wait_sync(root_task->source, uevent_root_timeout())) {
+                fprintf(stderr, "cyrenit: %s did not appear\n",
+                        root_task->source);
+        }
+        if (root_task != NULL) {
+                fprintf(stdout, "cyrenit[%d]: switching root to %s\n",
+                        getpid(), root_task->source);
+                readahead_stop();
+                if (switch_root(root_task)) {
+                        fstab_count = mounts_load_fstab(NULL);
+                        fprintf(stdout, "cyrenit: loaded %zu mount tasks "
+                                "from the real root's %s\n", fstab_count,
+                                MOUNTS_FSTAB);
+                        do_mounts(NULL, MOUNT_TIER_CRITICAL);
+                        modules_load(NULL);
+                }
+                else {
+                        fprintf(stderr, "cyrenit: failed to switch root, "
+                                "staying in the initramfs\n");
+                }
+                mount_task_destroy(root_task);
+                start_readahead();
+        }
+
+        if (!topology_load()) {
+                fprintf(stderr, "cyrenit: failed to read the CPU topology\n");
+        }
+        else {
+                fprintf(stdout, "cyrenit: %u CPUs online in %u NUMA nodes\n",
+                        topology.cpu_count, topology.node_count);
+        }
 
         fprintf(stdout, "cyrenit: creating basic environment\n");
         env_ret = setenv("PATH", "/bin:/sbin", 0);
@@ -180,159 +283,333 @@ int bootstrap(int argc, char **argv, char **envp)
                         getpid());
         }
 
+        fprintf(stdout, "cyrenit[%d]: setting up event loop\n", getpid());
+        if (!setup_event_loop()) {
+                console_printf(CONSOLE_CRIT, "cyrenit: failed to set up the "
+                               "event loop, children will not be "
+                               "supervised\n");
+        }
+        if (!pool_init()) {
+                fprintf(stderr, "cyrenit: no worker threads, blocking work "
+                        "will run on the event loop or not at all\n");
+        }
+        readahead_attach();
+        if (!control_init()) {
+                fprintf(stderr, "cyrenit: control socket unavailable, "
+                        "the CLI will not be able to reach PID 1\n");
+        }
+        if (!fdstore_init()) {
+                fprintf(stderr, "cyrenit: notify socket unavailable, "
+                        "services cannot store descriptors\n");
+        }
+        if (!uevent_init()) {
+                fprintf(stderr, "cyrenit: not listening to uevents, "
+                        "device waits only time out\n");
+        }
+        if (!stats_start_sampler()) {
+                fprintf(stderr, "cyrenit: failed to start the resource "
+                        "sampler\n");
+        }
+        reexec_init();
+        services_init();
+        jobs_init();
+        memstat_init();
+        pressure_init();
+
+        fprintf(stdout, "cyrenit[%d]: armed %zu on-demand mounts\n",
+                getpid(), automount_setup(NULL));
+
+        readahead_wait();
+        boot_trace("starting services");
         fprintf(stdout, "cyrenit[%d]: starting services\n", getpid());
         svc_ret = start_services();
-        fprintf(stdout, "cyrenit[%d]: started %d services successfully\n",
+        fprintf(stdout, "cyrenit[%d]: queued %d services to start\n",
                 getpid(), svc_ret);
+        bootchart_attach();
 
-        fprintf(stdout, "cyrenit[%d]: opening console\n", getpid());
-        console_fd = open("/dev/console", O_RDWR);
-        if (console_fd == -1) {
-                perror("cyrenit: failed to open /dev/console: ");
+        deferred_count = do_mounts_deferred();
+        if (deferred_count > 0) {
+                fprintf(stdout, "cyrenit[%d]: mounting %zu deferred "
+                        "filesystems in the background\n", getpid(),
+                        deferred_count);
         }
-        else {
-                fprintf(stdout, "cyrenit[%d]: /dev/console opened with fd %d\n",
-                        getpid(), console_fd);
+
+        if (start_console_shell() != EXIT_SUCCESS) {
+                fprintf(stderr, "cyrenit: failed to start %s on the "
+                        "console\n", CONSOLE_SHELL);
         }
+        memstat_settle();
 
         return EXIT_SUCCESS;
 }
 
-int main_loop(int argc, char **argv, char **envp)
+/**
+ * int resume(int state_fd)
+ * @brief Takes over from the previous PID 1 after `cyrenit reexec`
+ * @details Nothing is mounted nor started: the services, the control
+ *          socket and the autofs triggers are adopted from the state.
+ */
+int resume(int state_fd)
 {
-        int ret = 0;
-        char *bash_cmd[] = {"/bin/bash", NULL };
-        int bashc = sizeof(bash_cmd) / sizeof(char*);
-
-        fprintf(stdout, "cyrenit: reaching main loop!\n");
-        while (1){
-                fprintf(stdout, "cyrenit: starting /bin/bash\n");
-                ret = exec_fg(bashc, bash_cmd, environ);
-                fprintf(stdout, "cyrenit: /bin/bash returned with status %d", ret);
-                sleep(5);
+        bootopt_load(0, NULL);
+        console_open();
+        memstat_lean_init();
+        fprintf(stdout, "cyrenit[%d]: resuming from state fd %d\n",
+                getpid(), state_fd);
+
+        topology_load();
+        if (!setup_event_loop()) {
+                console_printf(CONSOLE_CRIT, "cyrenit: failed to set up the "
+                               "event loop, children will not be "
+                               "supervised\n");
+        }
+        if (!pool_init()) {
+                fprintf(stderr, "cyrenit: no worker threads, blocking work "
+                        "will run on the event loop or not at all\n");
         }
+        if (!reexec_restore(state_fd)) {
+                fprintf(stderr, "cyrenit: failed to restore the state, "
+                        "services are no longer supervised\n");
+        }
+        if (control_fd == -1 && !control_init()) {
+                fprintf(stderr, "cyrenit: control socket unavailable, "
+                        "the CLI will not be able to reach PID 1\n");
+        }
+        if (fdstore_socket == -1 && !fdstore_init()) {
+                fprintf(stderr, "cyrenit: notify socket unavailable, "
+                        "services cannot store descriptors\n");
+        }
+        if (!uevent_init()) {
+                fprintf(stderr, "cyrenit: not listening to uevents, "
+                        "device waits only time out\n");
+        }
+        if (!stats_start_sampler()) {
+                fprintf(stderr, "cyrenit: failed to start the resource "
+                        "sampler\n");
+        }
+        reexec_init();
+        services_init();
+        jobs_init();
+        memstat_init();
+        pressure_init();
+        fprintf(stdout, "cyrenit[%d]: adopted %zu template instances\n",
+                getpid(), service_templates_adopt(NULL));
+
+        /* whatever exited while the new binary was loading */
+        process_reap_children();
+        fprintf(stdout, "cyrenit[%d]: resumed %zu processes\n", getpid(),
+                registered_process_count);
+        memstat_settle();
+
         return EXIT_SUCCESS;
 }
 
-int start_services()
+/**
+ * void start_readahead()
+ * @brief Starts the readahead of the current root filesystem
+ */
+void start_readahead()
 {
-        char *svc_paths[] = {
-                "/etc/cyrenit/services/l0/helloop",
-                NULL
-        };
-        const char *start_args[] = {"start", NULL};
-        char **svc_ptr = svc_paths;
-        struct process *svc_proc = NULL;
-        int ret = 0;
+        switch (readahead_start()) {
+        case READAHEAD_REPLAY:
+                fprintf(stdout, "cyrenit[%d]: replaying %s\n", getpid(),
+                        READAHEAD_TRACE);
+                break;
+        case READAHEAD_RECORD:
+                fprintf(stdout, "cyrenit[%d]: recording file accesses for "
+                        "%d s\n", getpid(), READAHEAD_RECORD_MS / 1000);
+                break;
+        default:
+                break;
+        }
+}
 
-        while (svc_ptr && *svc_ptr) {
-                fprintf(stdout, "cyrenit: starting service %s\n", *svc_ptr);
+MEM_HOT
+static void handle_timers(int fd, uint32_t events, void *data)
+{
+        (void) fd;
+        (void) events;
+        timer_wheel_handle(data);
+}
 
-                svc_proc = process_create();
-                if (svc_proc == NULL) {
-                        fprintf(stderr, "cyrenit: failed to create process for %s\n", *svc_ptr);
-                        svc_ptr++;
-                        continue;
+MEM_HOT
+static void handle_signals(int fd, uint32_t events, void *data)
+{
+        struct signalfd_siginfo info;
+        bool reap = false;
+
+        (void) events;
+        (void) data;
+        while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+                if (info.ssi_signo == SIGCHLD) {
+                        reap = true;
                 }
+        }
 
-                if (!process_set_image(svc_proc, *svc_ptr)) {
-                        fprintf(stderr, "cyrenit: failed to set image for %s\n", *svc_ptr);
-                        process_destroy(svc_proc);
-                        svc_ptr++;
-                        continue;
-                }
+        if (reap) {
+                process_reap_children();
+        }
+}
 
-                if (!process_set_args(svc_proc, start_args)) {
-                        fprintf(stderr, "cyrenit: failed to set args for %s\n", *svc_ptr);
-                        process_destroy(svc_proc);
-                        svc_ptr++;
-                        continue;
-                }
+/**
+ * bool setup_event_loop()
+ * @brief Creates the event loop, the supervisor timers and the signalfd
+ * @details SIGCHLD is blocked and delivered through a signalfd so that
+ *          children are reaped from the event loop. The loop runs on
+ *          io_uring when the kernel allows it, cyrenit.evloop=epoll or
+ *          io_uring on the kernel command line forces either.
+ */
+bool setup_event_loop()
+{
+        enum evloop_backend_id id = EVLOOP_BACKEND_AUTO;
+        char option[16];
+        sigset_t mask;
 
-                if (!process_set_envdynamic(svc_proc)) {
-                        fprintf(stderr, "cyrenit: failed to set dynamic env for %s\n", *svc_ptr);
-                        process_destroy(svc_proc);
-                        svc_ptr++;
-                        continue;
+        if (kcmdline_get("cyrenit.evloop", option, sizeof(option))) {
+                if (strcmp(option, "epoll") == STRCMP_EQUAL) {
+                        id = EVLOOP_BACKEND_EPOLL;
                 }
-
-                if (!register_process(svc_proc)) {
-                        fprintf(stderr, "cyrenit: failed to register process for %s\n", *svc_ptr);
-                        process_destroy(svc_proc);
-                        svc_ptr++;
-                        continue;
+                else if (strcmp(option, "io_uring") == STRCMP_EQUAL) {
+                        id = EVLOOP_BACKEND_URING;
                 }
+        }
 
-                if (!process_forkexec(svc_proc)) {
-                        fprintf(stderr, "cyrenit: failed to forkexec service %s\n", *svc_ptr);
-                        process_destroy(svc_proc);
-                        svc_ptr++;
-                        continue;
-                }
+        if (!evloop_init_backend(id)) {
+                return false;
+        }
+        fprintf(stdout, "cyrenit[%d]: event loop running on %s\n", getpid(),
+                evloop_backend_name());
 
-                ret++;
-                svc_ptr++;
+        if (!timer_wheel_init(&supervisor_timers, true)) {
+                return false;
+        }
+        if (!evloop_add(supervisor_timers.fd, EVLOOP_IN, handle_timers,
+                        &supervisor_timers)) {
+                return false;
         }
 
-        return ret;
+        if (!block_child_signals(&mask)) {
+                return false;
+        }
+
+        signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (signal_fd == -1) {
+                perror("cyrenit: failed to create signalfd");
+                return false;
+        }
+
+        return evloop_add(signal_fd, EVLOOP_IN, handle_signals, NULL);
 }
 
-int exec_fg(int argc, char **argv, char **envp) {
-        pid_t ret;
-        int exec_ret = 0;
-        int status;
-        int ioctl_ret = 0;
-        int dup_stdin = 0;
-        int dup_stdout = 0;
-        int dup_stderr = 0;
-
-        fprintf(stdout, "cyrenit[%d]: starting %s\n",
-                getpid(), argv[0]);
-        
-        ret = fork();
-        if (ret == -1) {
-                fprintf(stderr, "cyrenit[%d]: ", getpid());
-                perror("error forking process!");
+/**
+ * bool block_child_signals(sigset_t *mask)
+ * @brief Blocks SIGCHLD, setting mask to it if not NULL
+ * @details Done first thing in PID 1, before any thread is created: threads
+ *          inherit the mask, and one with SIGCHLD unblocked would take it
+ *          by the default action, so the signalfd would miss the exit.
+ */
+bool block_child_signals(sigset_t *mask)
+{
+        sigset_t child;
+
+        sigemptyset(&child);
+        sigaddset(&child, SIGCHLD);
+        if (mask != NULL) {
+                *mask = child;
+        }
+
+        if (sigprocmask(SIG_BLOCK, &child, NULL) != 0) {
+                perror("cyrenit: failed to block SIGCHLD");
+                return false;
+        }
+
+        return true;
+}
+
+int main_loop(int argc, char **argv, char **envp)
+{
+        fprintf(stdout, "cyrenit: reaching main loop!\n");
+        return evloop_run();
+}
+
+/**
+ * int start_console_shell()
+ * @brief Starts the console shell as a supervised process
+ * @details The shell owns /dev/console as its controlling terminal and is
+ *          respawned CONSOLE_SHELL_RESPAWN_MS after it exits.
+ */
+int start_console_shell()
+{
+        struct process *shell = NULL;
+
+        shell = process_create();
+        if (shell == NULL) {
                 return EXIT_FAILURE;
         }
-        if (ret == 0) {
-                console_pid = setsid();
-                ioctl_ret = ioctl(console_fd, TIOCSCTTY,0);
-                fprintf(stdout, "cyrenit[%d]: passing terminal control from"
-                        "pid %d to pid %d, ioctl ret %d\n", getpid(),
-                        console_pid, getpid(), ioctl_ret);
-                dup_stdin = dup2(console_fd, STDIN_FILENO);
-                dup_stdout = dup2(console_fd, STDOUT_FILENO);
-                dup_stderr = dup2(console_fd, STDERR_FILENO);
-                if (console_pid > 2) {
-                        close(console_pid);
-                }
-                fprintf(stdout, "cyrenit: duplicated console fd %d to "
-                        "stdin %d, stdout %d, stderr %d\n",
-                        console_fd, dup_stdin, dup_stdout, dup_stderr);
-                
-                exec_ret = execve(argv[0], argv, environ);
-                if (exec_ret == -1) {
-                        perror("cyrenit: error executing process:");
-                }
+
+        if (!process_set_image(shell, CONSOLE_SHELL) ||
+            !process_set_envdynamic(shell)) {
+                process_destroy(shell);
+                return EXIT_FAILURE;
         }
-        else {
-                fprintf(stdout, "cyrenit[%d]: waiting for pid %d to finish\n",
-                        getpid(), ret);
-                if (waitpid(ret, &status, 0) == EXIT_FAILURE) {
-                        perror("cyrenit: error waiting for pid:");
-                }
-                if (WIFEXITED(status)) {
-                        fprintf(stdout, "cyrenit: process exited\n");
-                }
-                if (WIFSIGNALED(status)) {
-                        fprintf(stderr, "cyrenit: /bin/bash was killed by a signal\n");
+
+        shell->console = true;
+        shell->restart = CYRENIT_PROC_RESTART_ALWAYS;
+        shell->restart_delay_ms = CONSOLE_SHELL_RESPAWN_MS;
+
+        if (!register_process(shell)) {
+                process_destroy(shell);
+                return EXIT_FAILURE;
+        }
+
+        if (!process_forkexec(shell)) {
+                process_exited(shell, W_EXITCODE(EXIT_FAILURE, 0));
+        }
+
+        return EXIT_SUCCESS;
+}
+
+/**
+ * int start_services()
+ * @brief Loads the service files of SERVICES_DIR and starts the ones of
+ *        the booted target
+ * @return the number of services queued to start, which may be more with
+ *         what they require
+ */
+int start_services()
+{
+        struct process **procs = NULL;
+        size_t loaded = 0;
+        size_t count = 0;
+        size_t i = 0;
+        int ret = 0;
+
+        loaded = services_load_dir(NULL);
+        fprintf(stdout, "cyrenit: loaded %zu services from %s\n", loaded,
+                SERVICES_DIR);
+
+        procs = calloc(registered_process_count + 1, sizeof(struct process *));
+        if (procs == NULL) {
+                return 0;
+        }
+        for (i = 0; i < registered_process_count; i++) {
+                if (registered_processes[i]->status ==
+                    CYRENIT_PROC_STATUS_UNSTARTED &&
+                    registered_processes[i]->target <= boot_options.target) {
+                        procs[count++] = registered_processes[i];
                 }
-                
-                return WEXITSTATUS(status);
         }
+        if (count < registered_process_count) {
+                fprintf(stdout, "cyrenit: %zu services are not part of the "
+                        "%s target\n", registered_process_count - count,
+                        boot_target_name(boot_options.target));
+        }
+
+        /* a single transaction, ordered by requires and after */
+        ret = (int) job_submit(procs, count, JOB_START, NULL);
+        free(procs);
 
-        return EXIT_FAILURE;
+        return ret;
 }
 
 #endif//__CYREINIT_C
\ No newline at end of file
@@ -0,0 +1,392 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * evloop.c - Supervisor event loop
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __EVLOOP_C
+#define __EVLOOP_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/epoll.h>
+
+#include "evloop.h"
+#include "memstat.h"
+#include "uring.h"
+
+#define WATCH_ALLOC_STEP 32
+
+static const struct evloop_backend *backend = NULL;
+static bool evloop_running = false;
+
+/**
+ * @var struct ev_watch *watches
+ * @brief Watch table, indexed by file descriptor
+ */
+static struct ev_watch *watches = NULL;
+static size_t watches_allocated = 0;
+
+static int epoll_fd = -1;
+/* epoll readers are read synchronously, one buffer does for all of them */
+static char epoll_read_buffer[EVLOOP_READ_SIZE];
+
+static bool evloop_reserve(int fd)
+{
+        struct ev_watch *new_watches = NULL;
+        size_t new_size = 0;
+
+        if ((size_t) fd < watches_allocated) {
+                return true;
+        }
+
+        new_size = ((size_t) fd / WATCH_ALLOC_STEP + 1) * WATCH_ALLOC_STEP;
+        new_watches = mem_reallocarray(MEM_EVENTS, watches, new_size,
+                                       sizeof(struct ev_watch));
+        if (new_watches == NULL) {
+                return false;
+        }
+
+        memset(new_watches + watches_allocated, 0,
+               (new_size - watches_allocated) * sizeof(struct ev_watch));
+        watches = new_watches;
+        watches_allocated = new_size;
+
+        return true;
+}
+
+static bool epoll_backend_init()
+{
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd == -1) {
+                perror("cyrenit: failed to create epoll instance");
+                return false;
+        }
+
+        return true;
+}
+
+static bool epoll_backend_ctl(int op, int fd, struct ev_watch *w)
+{
+        struct epoll_event ev;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = w->read_callback != NULL ? EVLOOP_IN : w->events;
+        ev.data.fd = fd;
+
+        return epoll_ctl(epoll_fd, op, fd, &ev) == 0;
+}
+
+static bool epoll_backend_add(int fd, struct ev_watch *w)
+{
+        if (!epoll_backend_ctl(EPOLL_CTL_ADD, fd, w)) {
+                perror("cyrenit: failed to add fd to the event loop");
+                return false;
+        }
+
+        return true;
+}
+
+static bool epoll_backend_modify(int fd, struct ev_watch *w)
+{
+        return epoll_backend_ctl(EPOLL_CTL_MOD, fd, w);
+}
+
+static void epoll_backend_del(int fd, struct ev_watch *w)
+{
+        (void) w;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+MEM_HOT
+static bool epoll_backend_wait()
+{
+        struct epoll_event events[EVLOOP_MAX_EVENTS];
+        int count = 0;
+        int i = 0;
+
+        count = epoll_wait(epoll_fd, events, EVLOOP_MAX_EVENTS, -1);
+        if (count == -1) {
+                if (errno == EINTR) {
+                        return true;
+                }
+                perror("cyrenit: epoll_wait failed");
+                return false;
+        }
+
+        for (i = 0; i < count; i++) {
+                evloop_dispatch(events[i].data.fd, events[i].events);
+        }
+
+        return true;
+}
+
+static const struct evloop_backend epoll_backend = {
+        .name = "epoll",
+        .init = epoll_backend_init,
+        .add = epoll_backend_add,
+        .modify = epoll_backend_modify,
+        .del = epoll_backend_del,
+        .wait = epoll_backend_wait,
+};
+
+/**
+ * @fn bool evloop_init_backend(enum evloop_backend_id id)
+ * @brief Creates the event loop on the given backend
+ * @param id the backend; EVLOOP_BACKEND_AUTO prefers io_uring and falls
+ *           back to epoll when the kernel lacks what uring.c needs
+ * @return true on success or false on failure
+ */
+bool evloop_init_backend(enum evloop_backend_id id)
+{
+        if (backend != NULL) {
+                return true;
+        }
+
+        if (id != EVLOOP_BACKEND_EPOLL && uring_backend.init()) {
+                backend = &uring_backend;
+                return true;
+        }
+        if (id == EVLOOP_BACKEND_URING) {
+                return false;
+        }
+
+        if (!epoll_backend.init()) {
+                return false;
+        }
+        backend = &epoll_backend;
+
+        return true;
+}
+
+/**
+ * @fn bool evloop_init()
+ * @brief Creates the event loop on the best backend available
+ * @return true on success or false on failure
+ */
+bool evloop_init()
+{
+        return evloop_init_backend(EVLOOP_BACKEND_AUTO);
+}
+
+/**
+ * @fn const char *evloop_backend_name()
+ * @brief Returns the name of the backend in use, or NULL before init
+ */
+const char *evloop_backend_name()
+{
+        return backend == NULL ? NULL : backend->name;
+}
+
+static bool evloop_watch_add(int fd, uint32_t events, evloop_cb callback,
+                             evloop_read_cb read_callback, void *data)
+{
+        struct ev_watch *w = NULL;
+
+        if (fd < 0 || backend == NULL) {
+                return false;
+        }
+
+        if (!evloop_reserve(fd) || watches[fd].active) {
+                return false;
+        }
+
+        w = &watches[fd];
+        w->callback = callback;
+        w->read_callback = read_callback;
+        w->data = data;
+        w->events = events;
+        w->op = NULL;
+        if (!backend->add(fd, w)) {
+                memset(w, 0, sizeof(struct ev_watch));
+                return false;
+        }
+        w->active = true;
+
+        return true;
+}
+
+/**
+ * @fn bool evloop_add(int fd, uint32_t events, evloop_cb callback, void *data)
+ * @brief Watches fd for events, calling callback when any of them happen
+ * @param fd the file descriptor to watch
+ * @param events mask of EVLOOP_* events
+ * @param callback the function to be called from the loop
+ * @param data opaque pointer handed to callback
+ * @return true on success or false on failure
+ * @details Level triggered: callback is called again for as long as the
+ *          events are pending.
+ */
+bool evloop_add(int fd, uint32_t events, evloop_cb callback, void *data)
+{
+        if (callback == NULL) {
+                return false;
+        }
+
+        return evloop_watch_add(fd, events, callback, NULL, data);
+}
+
+/**
+ * @fn bool evloop_add_reader(int fd, evloop_read_cb callback, void *data)
+ * @brief Reads fd from the loop, calling callback with what was read
+ * @param fd a non-blocking file descriptor to read from
+ * @param callback the function to be called from the loop
+ * @param data opaque pointer handed to callback
+ * @return true on success or false on failure
+ * @details Under io_uring the read is done by the kernel in the same
+ *          submission that waits for the other events, so a busy pipe
+ *          costs no extra system call. Reading stops after end of file or
+ *          an error, both of which are handed to callback.
+ */
+bool evloop_add_reader(int fd, evloop_read_cb callback, void *data)
+{
+        if (callback == NULL) {
+                return false;
+        }
+
+        return evloop_watch_add(fd, EVLOOP_IN, NULL, callback, data);
+}
+
+/**
+ * @fn bool evloop_modify(int fd, uint32_t events)
+ * @brief Changes the events watched on fd
+ * @param fd a watched file descriptor
+ * @param events the new mask of EVLOOP_* events
+ * @return true on success or false on failure
+ */
+bool evloop_modify(int fd, uint32_t events)
+{
+        struct ev_watch *w = evloop_watch(fd);
+        uint32_t old_events = 0;
+
+        if (w == NULL || w->read_callback != NULL) {
+                return false;
+        }
+
+        old_events = w->events;
+        w->events = events;
+        if (!backend->modify(fd, w)) {
+                w->events = old_events;
+                return false;
+        }
+
+        return true;
+}
+
+/**
+ * @fn bool evloop_del(int fd)
+ * @brief Stops watching fd
+ * @param fd the file descriptor, which is not closed
+ * @return true on success or false if fd was not watched
+ * @details Safe to call from within a callback, even for other fds that
+ *          still have pending events in the current iteration.
+ */
+bool evloop_del(int fd)
+{
+        struct ev_watch *w = evloop_watch(fd);
+
+        if (w == NULL) {
+                return false;
+        }
+
+        backend->del(fd, w);
+        memset(w, 0, sizeof(struct ev_watch));
+
+        return true;
+}
+
+/**
+ * @fn struct ev_watch *evloop_watch(int fd)
+ * @brief Returns the active watch of fd, or NULL
+ * @details The table may move whenever a watch is added, backends must
+ *          not keep the pointer across callbacks.
+ */
+struct ev_watch *evloop_watch(int fd)
+{
+        if (fd < 0 || (size_t) fd >= watches_allocated ||
+            !watches[fd].active) {
+                return NULL;
+        }
+
+        return &watches[fd];
+}
+
+/**
+ * @fn void evloop_dispatch(int fd, uint32_t events)
+ * @brief Hands events that happened on fd to its watch
+ * @details Readers are read here, once per call; whatever is left makes
+ *          the fd ready again on the next wait. Only the epoll backend has
+ *          readers dispatched here.
+ */
+MEM_HOT
+void evloop_dispatch(int fd, uint32_t events)
+{
+        struct ev_watch *w = evloop_watch(fd);
+        ssize_t ret = 0;
+
+        if (w == NULL) {
+                return; //removed by an earlier callback
+        }
+
+        if (w->read_callback == NULL) {
+                w->callback(fd, events, w->data);
+                return;
+        }
+
+        ret = read(fd, epoll_read_buffer, sizeof(epoll_read_buffer));
+        if (ret == -1) {
+                if (errno == EAGAIN || errno == EINTR) {
+                        return;
+                }
+                ret = -errno;
+        }
+
+        w->read_callback(fd, epoll_read_buffer, ret, w->data);
+        if (ret <= 0 && evloop_watch(fd) == w) {
+                /* stays registered, but idle, until evloop_del() */
+                epoll_backend_del(fd, w);
+        }
+}
+
+/**
+ * @fn int evloop_run()
+ * @brief Dispatches events until evloop_stop() is called
+ * @return EXIT_SUCCESS when stopped or EXIT_FAILURE on error
+ */
+MEM_HOT
+int evloop_run()
+{
+        if (backend == NULL) {
+                return EXIT_FAILURE;
+        }
+
+        evloop_running = true;
+        while (evloop_running) {
+                if (!backend->wait()) {
+                        return EXIT_FAILURE;
+                }
+        }
+
+        return EXIT_SUCCESS;
+}
+
+/**
+ * @fn void evloop_stop()
+ * @brief Makes evloop_run() return after the current iteration
+ */
+void evloop_stop()
+{
+        evloop_running = false;
+}
+
+#endif//__EVLOOP_C
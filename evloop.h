@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * evloop.h - Supervisor event loop
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __EVLOOP_H
+#define __EVLOOP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Same values as poll(2)/epoll(7), so they can be handed to either as-is */
+#define EVLOOP_IN  0x001
+#define EVLOOP_PRI 0x002
+#define EVLOOP_OUT 0x004
+#define EVLOOP_ERR 0x008
+#define EVLOOP_HUP 0x010
+
+#define EVLOOP_MAX_EVENTS 64
+/* Readers get at most this much per callback */
+#define EVLOOP_READ_SIZE 4096
+
+enum evloop_backend_id
+{
+        EVLOOP_BACKEND_AUTO = 0,
+        EVLOOP_BACKEND_EPOLL,
+        EVLOOP_BACKEND_URING
+};
+
+typedef void (*evloop_cb)(int fd, uint32_t events, void *data);
+/* length is what read(2) returned, or -errno; 0 is end of file */
+typedef void (*evloop_read_cb)(int fd, const char *buffer, ssize_t length,
+                               void *data);
+
+struct ev_watch
+{
+        evloop_cb callback;
+        evloop_read_cb read_callback;
+        void *data;
+        /* private to the backend */
+        void *op;
+        uint32_t events;
+        bool active;
+};
+
+/*
+ * A backend waits for the watched fds and hands what happened back to
+ * evloop_dispatch(), or straight to the read callback when it did the
+ * read itself. See evloop.c (epoll) and uring.c (io_uring).
+ */
+struct evloop_backend
+{
+        const char *name;
+        bool (*init)();
+        bool (*add)(int fd, struct ev_watch *w);
+        bool (*modify)(int fd, struct ev_watch *w);
+        void (*del)(int fd, struct ev_watch *w);
+        /* waits once and dispatches everything ready, false on error */
+        bool (*wait)();
+};
+
+bool evloop_init();
+bool evloop_init_backend(enum evloop_backend_id id);
+const char *evloop_backend_name();
+bool evloop_add(int fd, uint32_t events, evloop_cb callback, void *data);
+bool evloop_add_reader(int fd, evloop_read_cb callback, void *data);
+bool evloop_modify(int fd, uint32_t events);
+bool evloop_del(int fd);
+int evloop_run();
+void evloop_stop();
+
+struct ev_watch *evloop_watch(int fd);
+void evloop_dispatch(int fd, uint32_t events);
+
+#endif//__EVLOOP_H
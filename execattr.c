@@ -0,0 +1,377 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * execattr.c - Execution attributes of services
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __EXECATTR_C
+#define __EXECATTR_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <grp.h>
+#include <pwd.h>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/ioprio.h>
+#include <linux/mempolicy.h>
+
+#include "cyrenit.h"
+#include "execattr.h"
+#include "topology.h"
+
+#define IOPRIO_LEVEL_DEFAULT 4
+
+struct exec_name
+{
+        const char *name;
+        int value;
+};
+
+static const struct exec_name sched_names[] = {
+        { "other", SCHED_OTHER },
+        { "batch", SCHED_BATCH },
+        { "idle", SCHED_IDLE },
+        { "fifo", SCHED_FIFO },
+        { "rr", SCHED_RR },
+        { NULL, 0 }
+};
+
+static const struct exec_name numa_names[] = {
+        { "bind", EXEC_NUMA_BIND },
+        { "preferred", EXEC_NUMA_PREFERRED },
+        { "interleave", EXEC_NUMA_INTERLEAVE },
+        { NULL, 0 }
+};
+
+static const int numa_modes[] = {
+        [EXEC_NUMA_DEFAULT] = MPOL_DEFAULT,
+        [EXEC_NUMA_BIND] = MPOL_BIND,
+        [EXEC_NUMA_PREFERRED] = MPOL_PREFERRED,
+        [EXEC_NUMA_INTERLEAVE] = MPOL_INTERLEAVE
+};
+
+static const struct exec_name ioprio_names[] = {
+        { "rt", IOPRIO_CLASS_RT },
+        { "be", IOPRIO_CLASS_BE },
+        { "idle", IOPRIO_CLASS_IDLE },
+        { NULL, 0 }
+};
+
+static int exec_lookup(const struct exec_name *names, const char *name,
+                       size_t length)
+{
+        for (; names->name != NULL; names++) {
+                if (strlen(names->name) == length &&
+                    strncmp(names->name, name, length) == STRCMP_EQUAL) {
+                        return names->value;
+                }
+        }
+
+        return EXEC_ATTR_UNSET;
+}
+
+static bool exec_parse_int(const char *value, long min, long max, int *out)
+{
+        char *end = NULL;
+        long parsed = 0;
+
+        parsed = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || parsed < min || parsed > max) {
+                return false;
+        }
+
+        *out = (int) parsed;
+        return true;
+}
+
+/**
+ * @fn static bool exec_parse_cpus(struct exec_attrs *attrs, const char *value)
+ * @brief Parses "0-3,8" or "node:0-1" (every CPU of those nodes)
+ * @details The mask is restricted to the online CPUs, an empty result is
+ *          an error rather than a service that can never run.
+ */
+static bool exec_parse_cpus(struct exec_attrs *attrs, const char *value)
+{
+        cpu_set_t set;
+        uint64_t nodes = 0;
+        unsigned node = 0;
+
+        if (strncmp(value, "node:", 5) == STRCMP_EQUAL) {
+                if (!topology_parse_nodelist(value + 5, &nodes)) {
+                        return false;
+                }
+                CPU_ZERO(&set);
+                for (node = 0; node < TOPOLOGY_MAX_NODES; node++) {
+                        if (nodes & topology.node_mask & (1ULL << node)) {
+                                CPU_OR(&set, &set, &topology.node_cpus[node]);
+                        }
+                }
+        }
+        else if (!topology_parse_cpulist(value, &set)) {
+                return false;
+        }
+
+        CPU_AND(&attrs->affinity, &set, &topology.online);
+        if (CPU_COUNT(&attrs->affinity) == 0) {
+                return false;
+        }
+
+        attrs->has_affinity = true;
+        return true;
+}
+
+/**
+ * @fn static bool exec_parse_numa(struct exec_attrs *attrs, const char *value)
+ * @brief Parses "bind:<nodes>", "preferred:<node>" or "interleave:<nodes>",
+ *        where nodes may also be "all"
+ */
+static bool exec_parse_numa(struct exec_attrs *attrs, const char *value)
+{
+        const char *nodes = NULL;
+        int mode = 0;
+
+        nodes = strchr(value, ':');
+        if (nodes == NULL) {
+                return false;
+        }
+
+        mode = exec_lookup(numa_names, value, (size_t) (nodes - value));
+        if (mode == EXEC_ATTR_UNSET) {
+                return false;
+        }
+        nodes++;
+
+        if (strcmp(nodes, "all") == STRCMP_EQUAL) {
+                attrs->numa_nodes = topology.node_mask;
+        }
+        else if (!topology_parse_nodelist(nodes, &attrs->numa_nodes)) {
+                return false;
+        }
+
+        attrs->numa_nodes &= topology.node_mask;
+        if (attrs->numa_nodes == 0) {
+                return false;
+        }
+
+        attrs->numa = (enum exec_numa) mode;
+        return true;
+}
+
+/**
+ * @fn static bool exec_parse_ioprio(struct exec_attrs *attrs,
+ *                                   const char *value)
+ * @brief Parses "idle", "be[:level]" or "rt[:level]", levels being 0-7
+ */
+static bool exec_parse_ioprio(struct exec_attrs *attrs, const char *value)
+{
+        const char *level = NULL;
+        int class = 0;
+        int data = IOPRIO_LEVEL_DEFAULT;
+
+        level = strchr(value, ':');
+        class = exec_lookup(ioprio_names, value, level == NULL ?
+                            strlen(value) : (size_t) (level - value));
+        if (class == EXEC_ATTR_UNSET) {
+                return false;
+        }
+
+        if (class == IOPRIO_CLASS_IDLE) {
+                data = 0;
+        }
+        else if (level != NULL && !exec_parse_int(level + 1, 0, 7, &data)) {
+                return false;
+        }
+
+        attrs->ioprio = IOPRIO_PRIO_VALUE(class, data);
+        return true;
+}
+
+/**
+ * @fn static bool exec_parse_user(struct exec_attrs *attrs, const char *value)
+ * @brief Parses a user name or numeric uid; a name also sets the group
+ *        to the primary group of the user, unless set already
+ */
+static bool exec_parse_user(struct exec_attrs *attrs, const char *value)
+{
+        struct passwd *pw = NULL;
+        int id = 0;
+
+        if (exec_parse_int(value, 0, INT32_MAX, &id)) {
+                attrs->uid = (uid_t) id;
+                attrs->has_uid = true;
+                return true;
+        }
+
+        pw = getpwnam(value);
+        if (pw == NULL) {
+                return false;
+        }
+
+        attrs->uid = pw->pw_uid;
+        attrs->has_uid = true;
+        if (!attrs->has_gid) {
+                attrs->gid = pw->pw_gid;
+                attrs->has_gid = true;
+        }
+
+        return true;
+}
+
+static bool exec_parse_group(struct exec_attrs *attrs, const char *value)
+{
+        struct group *gr = NULL;
+        int id = 0;
+
+        if (exec_parse_int(value, 0, INT32_MAX, &id)) {
+                attrs->gid = (gid_t) id;
+        }
+        else if ((gr = getgrnam(value)) != NULL) {
+                attrs->gid = gr->gr_gid;
+        }
+        else {
+                return false;
+        }
+
+        attrs->has_gid = true;
+        return true;
+}
+
+/**
+ * @fn void exec_attrs_init(struct exec_attrs *attrs)
+ * @brief Leaves every attribute unset
+ */
+void exec_attrs_init(struct exec_attrs *attrs)
+{
+        memset(attrs, 0, sizeof(struct exec_attrs));
+        attrs->numa = EXEC_NUMA_DEFAULT;
+        attrs->sched_policy = EXEC_ATTR_UNSET;
+        attrs->ioprio = EXEC_ATTR_UNSET;
+}
+
+/**
+ * @fn bool exec_attrs_set(struct exec_attrs *attrs, const char *key,
+ *                         const char *value)
+ * @brief Sets an attribute from its service file form
+ * @param attrs the attributes to be modified
+ * @param key one of cpus, numa, sched, priority, nice, ioprio, user or
+ *            group
+ * @param value the value of the setting
+ * @return false for unknown keys and invalid values
+ * @details CPUs and nodes are checked against the topology, which must be
+ *          loaded by then.
+ */
+bool exec_attrs_set(struct exec_attrs *attrs, const char *key,
+                    const char *value)
+{
+        if (attrs == NULL || key == NULL || value == NULL) {
+                return false;
+        }
+
+        if (strcmp(key, "cpus") == STRCMP_EQUAL) {
+                return exec_parse_cpus(attrs, value);
+        }
+        if (strcmp(key, "numa") == STRCMP_EQUAL) {
+                return exec_parse_numa(attrs, value);
+        }
+        if (strcmp(key, "sched") == STRCMP_EQUAL) {
+                attrs->sched_policy = exec_lookup(sched_names, value,
+                                                  strlen(value));
+                return attrs->sched_policy != EXEC_ATTR_UNSET;
+        }
+        if (strcmp(key, "priority") == STRCMP_EQUAL) {
+                return exec_parse_int(value, 0, 99, &attrs->sched_priority);
+        }
+        if (strcmp(key, "nice") == STRCMP_EQUAL) {
+                attrs->has_nice = exec_parse_int(value, -20, 19, &attrs->nice);
+                return attrs->has_nice;
+        }
+        if (strcmp(key, "ioprio") == STRCMP_EQUAL) {
+                return exec_parse_ioprio(attrs, value);
+        }
+        if (strcmp(key, "user") == STRCMP_EQUAL) {
+                return exec_parse_user(attrs, value);
+        }
+        if (strcmp(key, "group") == STRCMP_EQUAL) {
+                return exec_parse_group(attrs, value);
+        }
+
+        return false;
+}
+
+/**
+ * @fn bool exec_attrs_apply(const struct exec_attrs *attrs)
+ * @brief Applies the attributes to the calling process
+ * @return true on success or false on the first failure, with errno set
+ * @details Meant for the child between fork() and execve(). Realtime
+ *          classes get at least their minimum priority. Credentials are
+ *          dropped last, everything else may need privileges.
+ */
+bool exec_attrs_apply(const struct exec_attrs *attrs)
+{
+        struct sched_param param;
+        int min = 0;
+
+        if (attrs->has_nice && setpriority(PRIO_PROCESS, 0, attrs->nice) != 0) {
+                perror("cyrenit: setpriority");
+                return false;
+        }
+
+        if (attrs->sched_policy != EXEC_ATTR_UNSET) {
+                memset(&param, 0, sizeof(param));
+                if (attrs->sched_policy == SCHED_FIFO ||
+                    attrs->sched_policy == SCHED_RR) {
+                        min = sched_get_priority_min(attrs->sched_policy);
+                        param.sched_priority = attrs->sched_priority < min ?
+                                               min : attrs->sched_priority;
+                }
+                if (sched_setscheduler(0, attrs->sched_policy, &param) != 0) {
+                        perror("cyrenit: sched_setscheduler");
+                        return false;
+                }
+        }
+
+        if (attrs->has_affinity &&
+            sched_setaffinity(0, sizeof(cpu_set_t), &attrs->affinity) != 0) {
+                perror("cyrenit: sched_setaffinity");
+                return false;
+        }
+
+        if (attrs->numa != EXEC_NUMA_DEFAULT) {
+                if (syscall(SYS_set_mempolicy, numa_modes[attrs->numa],
+                            &attrs->numa_nodes, TOPOLOGY_MAX_NODES + 1) != 0) {
+                        perror("cyrenit: set_mempolicy");
+                        return false;
+                }
+        }
+
+        if (attrs->ioprio != EXEC_ATTR_UNSET &&
+            syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, attrs->ioprio) != 0) {
+                perror("cyrenit: ioprio_set");
+                return false;
+        }
+
+        if (attrs->has_gid &&
+            (setgroups(0, NULL) != 0 || setgid(attrs->gid) != 0)) {
+                perror("cyrenit: setgid");
+                return false;
+        }
+
+        if (attrs->has_uid && setuid(attrs->uid) != 0) {
+                perror("cyrenit: setuid");
+                return false;
+        }
+
+        return true;
+}
+
+#endif//__EXECATTR_C
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * execattr.h - Execution attributes of services
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __EXECATTR_H
+#define __EXECATTR_H
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define EXEC_ATTR_UNSET -1
+
+enum exec_numa
+{
+        EXEC_NUMA_DEFAULT = 0,
+        EXEC_NUMA_BIND,
+        EXEC_NUMA_PREFERRED,
+        EXEC_NUMA_INTERLEAVE
+};
+
+/*
+ * Applied by the forked child right before execve(), so they are inherited
+ * by everything the service spawns. Unset attributes are left as inherited
+ * from PID 1.
+ */
+struct exec_attrs
+{
+        bool has_affinity;
+        cpu_set_t affinity;
+        enum exec_numa numa;
+        uint64_t numa_nodes;
+        int sched_policy;
+        int sched_priority;
+        bool has_nice;
+        int nice;
+        int ioprio;
+        bool has_uid;
+        uid_t uid;
+        bool has_gid;
+        gid_t gid;
+};
+
+void exec_attrs_init(struct exec_attrs *attrs);
+bool exec_attrs_set(struct exec_attrs *attrs, const char *key,
+                    const char *value);
+bool exec_attrs_apply(const struct exec_attrs *attrs);
+
+#endif//__EXECATTR_H
@@ -0,0 +1,525 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * fdstore.c - File descriptors kept by PID 1 across service restarts
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __FDSTORE_C
+#define __FDSTORE_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "control.h"
+#include "cyrenit.h"
+#include "evloop.h"
+#include "fdstore.h"
+#include "memstat.h"
+#include "proc.h"
+
+#define FDSTORE_ALLOC_STEP 4
+
+/**
+ * @var int fdstore_socket
+ * @brief The datagram socket services send their descriptors to
+ */
+int fdstore_socket = -1;
+
+static const char *fdstore_env_keys[] = {
+        "NOTIFY_SOCKET=", "LISTEN_FDS=", "LISTEN_PID=", "LISTEN_FDNAMES=",
+        NULL
+};
+
+static void fdstore_command(int argc, char **argv,
+                            struct control_reply *reply);
+
+static const char *fdstore_service(struct process *proc)
+{
+        return proc->name != NULL ? proc->name : proc->exec_image;
+}
+
+/* Names end up in LISTEN_FDNAMES, which is ':' separated */
+static bool fdstore_valid_name(const char *name)
+{
+        size_t length = strlen(name);
+        size_t i = 0;
+
+        if (length == 0 || length > FDSTORE_NAME_MAX) {
+                return false;
+        }
+        for (i = 0; i < length; i++) {
+                if (name[i] <= ' ' || name[i] == ':' || name[i] == 0x7f) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+/**
+ * @fn bool fdstore_add(struct process *proc, int fd, const char *name)
+ * @brief Takes fd into the store of proc
+ * @return true if stored; on failure fd is left to the caller
+ */
+bool fdstore_add(struct process *proc, int fd, const char *name)
+{
+        struct fdstore *store = &proc->fdstore;
+        struct fdstore_fd *new_fds = NULL;
+        size_t new_size = 0;
+        char *copy = NULL;
+
+        if (fd < 0 || store->count >= store->max) {
+                return false;
+        }
+
+        if (store->count >= store->allocated) {
+                new_size = store->allocated + FDSTORE_ALLOC_STEP;
+                new_fds = mem_reallocarray(MEM_PROC, store->fds, new_size,
+                                           sizeof(struct fdstore_fd));
+                if (new_fds == NULL) {
+                        return false;
+                }
+                store->fds = new_fds;
+                store->allocated = new_size;
+        }
+
+        copy = mem_strdup(MEM_PROC, name);
+        if (copy == NULL) {
+                return false;
+        }
+
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        store->fds[store->count].fd = fd;
+        store->fds[store->count].name = copy;
+        store->count++;
+
+        return true;
+}
+
+/* Closes the descriptors named name, or all of them if name is NULL */
+static size_t fdstore_remove(struct process *proc, const char *name)
+{
+        struct fdstore *store = &proc->fdstore;
+        size_t removed = 0;
+        size_t i = 0;
+
+        while (i < store->count) {
+                if (name != NULL && strcmp(store->fds[i].name, name) !=
+                    STRCMP_EQUAL) {
+                        i++;
+                        continue;
+                }
+                close(store->fds[i].fd);
+                mem_free(MEM_PROC, store->fds[i].name);
+                /* in order, it is the order of LISTEN_FDS */
+                memmove(&store->fds[i], &store->fds[i + 1],
+                        (store->count - i - 1) * sizeof(struct fdstore_fd));
+                store->count--;
+                removed++;
+        }
+
+        return removed;
+}
+
+/**
+ * @fn void fdstore_clear(struct process *proc)
+ * @brief Closes everything proc stored and frees the store
+ */
+void fdstore_clear(struct process *proc)
+{
+        if (proc->fdstore.count > 0) {
+                fprintf(stdout, "cyrenit: closing the %zu descriptors "
+                        "stored by %s\n", proc->fdstore.count,
+                        fdstore_service(proc));
+        }
+
+        fdstore_remove(proc, NULL);
+        mem_free(MEM_PROC, proc->fdstore.fds);
+        proc->fdstore.fds = NULL;
+        proc->fdstore.allocated = 0;
+}
+
+static bool fdstore_env_skip(const char *entry)
+{
+        size_t i = 0;
+
+        for (i = 0; fdstore_env_keys[i] != NULL; i++) {
+                if (strncmp(entry, fdstore_env_keys[i],
+                            strlen(fdstore_env_keys[i])) == STRCMP_EQUAL) {
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+/* Moves the stored descriptors to FDSTORE_LISTEN_FDS_START onwards */
+static bool fdstore_child_fds(struct fdstore *store)
+{
+        int *high = NULL;
+        int start = FDSTORE_LISTEN_FDS_START;
+        size_t i = 0;
+
+        high = calloc(store->count, sizeof(int));
+        if (high == NULL) {
+                return false;
+        }
+
+        /* out of the way first: a stored fd may sit where another goes */
+        for (i = 0; i < store->count; i++) {
+                high[i] = fcntl(store->fds[i].fd, F_DUPFD_CLOEXEC,
+                                start + (int) store->count);
+                if (high[i] == -1) {
+                        return false;
+                }
+        }
+        for (i = 0; i < store->count; i++) {
+                if (dup2(high[i], start + (int) i) == -1) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+/**
+ * @fn char **fdstore_child(struct process *proc, char **envp)
+ * @brief Hands the store of proc to the freshly forked child about to be it
+ * @param envp the environment the child is going to exec with
+ * @return the environment with NOTIFY_SOCKET and the LISTEN_* variables
+ * @details Called in the child, after process_setup_child(). Services
+ *          without a store get envp back untouched.
+ */
+char **fdstore_child(struct process *proc, char **envp)
+{
+        struct fdstore *store = &proc->fdstore;
+        char **env = NULL;
+        char *names = NULL;
+        size_t length = 0;
+        size_t count = 0;
+        size_t i = 0;
+        size_t j = 0;
+
+        if (store->max == 0) {
+                return envp;
+        }
+
+        if (store->count > 0 && !fdstore_child_fds(store)) {
+                fprintf(stderr, "cyrenit[%d]: failed to hand over the "
+                        "stored descriptors\n", getpid());
+                store->count = 0;
+        }
+
+        for (count = 0; envp != NULL && envp[count] != NULL; count++);
+        env = calloc(count + 5, sizeof(char *));
+        for (i = 0; i < store->count; i++) {
+                length += strlen(store->fds[i].name) + 1;
+        }
+        names = malloc(length + sizeof("LISTEN_FDNAMES="));
+        if (env == NULL || names == NULL) {
+                return envp;
+        }
+
+        for (i = 0; i < count; i++) {
+                if (!fdstore_env_skip(envp[i])) {
+                        env[j++] = envp[i];
+                }
+        }
+        if (asprintf(&env[j], "NOTIFY_SOCKET=%s", FDSTORE_SOCKET_PATH) != -1) {
+                j++;
+        }
+        if (store->count == 0) {
+                return env;
+        }
+
+        if (asprintf(&env[j], "LISTEN_FDS=%zu", store->count) != -1) {
+                j++;
+        }
+        if (asprintf(&env[j], "LISTEN_PID=%d", getpid()) != -1) {
+                j++;
+        }
+        strcpy(names, "LISTEN_FDNAMES=");
+        for (i = 0; i < store->count; i++) {
+                strcat(names, store->fds[i].name);
+                if (i + 1 < store->count) {
+                        strcat(names, ":");
+                }
+        }
+        env[j++] = names;
+
+        return env;
+}
+
+/**
+ * @fn static struct process *fdstore_sender(pid_t pid)
+ * @brief Finds the service a message came from
+ * @details Services are session leaders, so their helpers are found
+ *          through their session.
+ */
+static struct process *fdstore_sender(pid_t pid)
+{
+        struct process *proc = process_find_by_pid(pid);
+        pid_t sid = 0;
+
+        if (proc != NULL) {
+                return proc;
+        }
+
+        sid = getsid(pid);
+        return sid > 1 ? process_find_by_pid(sid) : NULL;
+}
+
+/* Stores what a FDSTORE=1 message carried, closes what does not fit */
+static void fdstore_take(struct process *proc, int *fds, size_t count,
+                         const char *name)
+{
+        size_t stored = 0;
+        size_t i = 0;
+
+        for (i = 0; i < count; i++) {
+                if (fdstore_add(proc, fds[i], name)) {
+                        fds[i] = -1;
+                        stored++;
+                }
+        }
+
+        if (stored < count) {
+                fprintf(stderr, "cyrenit: %s stores at most %u descriptors, "
+                        "dropped %zu\n", fdstore_service(proc),
+                        proc->fdstore.max, count - stored);
+        }
+        if (stored > 0) {
+                fprintf(stdout, "cyrenit: %s stored %zu descriptors as %s\n",
+                        fdstore_service(proc), stored, name);
+        }
+}
+
+/* Acts on one notify message, whose fds are closed unless stored */
+static void fdstore_message(struct ucred *cred, char *text, int *fds,
+                            size_t count)
+{
+        struct process *proc = NULL;
+        const char *name = FDSTORE_DEFAULT_NAME;
+        char *line = NULL;
+        char *saveptr = NULL;
+        bool store = false;
+        bool remove = false;
+
+        for (line = strtok_r(text, "\n", &saveptr); line != NULL;
+             line = strtok_r(NULL, "\n", &saveptr)) {
+                if (strcmp(line, "FDSTORE=1") == STRCMP_EQUAL) {
+                        store = true;
+                }
+                else if (strcmp(line, "FDSTOREREMOVE=1") == STRCMP_EQUAL) {
+                        remove = true;
+                }
+                else if (strncmp(line, "FDNAME=", 7) == STRCMP_EQUAL) {
+                        name = line + 7;
+                }
+        }
+
+        proc = cred != NULL ? fdstore_sender(cred->pid) : NULL;
+        if ((store || remove) && proc == NULL) {
+                fprintf(stderr, "cyrenit: ignoring a notify message from "
+                        "pid %d, which is no service\n",
+                        cred != NULL ? cred->pid : -1);
+        }
+        else if ((store || remove) && !fdstore_valid_name(name)) {
+                fprintf(stderr, "cyrenit: %s sent an invalid FDNAME\n",
+                        fdstore_service(proc));
+        }
+        else if (remove) {
+                fprintf(stdout, "cyrenit: %s removed %zu descriptors named "
+                        "%s\n", fdstore_service(proc),
+                        fdstore_remove(proc, name), name);
+        }
+        else if (store && count > 0) {
+                fdstore_take(proc, fds, count, name);
+        }
+}
+
+static void fdstore_handle(int fd, uint32_t events, void *data)
+{
+        char text[FDSTORE_MSG_MAX + 1];
+        char control[CMSG_SPACE(sizeof(int) * FDSTORE_MSG_FDS) +
+                     CMSG_SPACE(sizeof(struct ucred))];
+        int fds[FDSTORE_MSG_FDS];
+        struct iovec iov = { text, FDSTORE_MSG_MAX };
+        struct msghdr msg;
+        struct cmsghdr *cmsg = NULL;
+        struct ucred *cred = NULL;
+        size_t count = 0;
+        size_t received = 0;
+        size_t i = 0;
+        ssize_t length = 0;
+
+        (void) events;
+        (void) data;
+        for (;;) {
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = &iov;
+                msg.msg_iovlen = 1;
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+                length = recvmsg(fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+                if (length == -1) {
+                        return;
+                }
+                text[length] = '\0';
+
+                cred = NULL;
+                count = 0;
+                for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+                     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                        if (cmsg->cmsg_level != SOL_SOCKET) {
+                                continue;
+                        }
+                        if (cmsg->cmsg_type == SCM_CREDENTIALS) {
+                                cred = (struct ucred *) CMSG_DATA(cmsg);
+                        }
+                        else if (cmsg->cmsg_type == SCM_RIGHTS) {
+                                received = (cmsg->cmsg_len - CMSG_LEN(0)) /
+                                           sizeof(int);
+                                if (received > FDSTORE_MSG_FDS - count) {
+                                        received = FDSTORE_MSG_FDS - count;
+                                }
+                                memcpy(fds + count, CMSG_DATA(cmsg),
+                                       received * sizeof(int));
+                                count += received;
+                        }
+                }
+                if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+                        fprintf(stderr, "cyrenit: dropping a truncated "
+                                "notify message\n");
+                }
+                else {
+                        fdstore_message(cred, text, fds, count);
+                }
+
+                for (i = 0; i < count; i++) {
+                        if (fds[i] != -1) {
+                                close(fds[i]);
+                        }
+                }
+        }
+}
+
+/**
+ * @fn bool fdstore_init()
+ * @brief Starts receiving on FDSTORE_SOCKET_PATH from the event loop
+ * @return true on success or false on failure
+ */
+bool fdstore_init()
+{
+        struct sockaddr_un addr;
+        int one = 1;
+
+        if (mkdir(CONTROL_RUN_DIR, 0755) != 0 && errno != EEXIST) {
+                perror("cyrenit: failed to create " CONTROL_RUN_DIR);
+                return false;
+        }
+
+        fdstore_socket = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK |
+                                SOCK_CLOEXEC, 0);
+        if (fdstore_socket == -1) {
+                perror("cyrenit: failed to create the notify socket");
+                return false;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, FDSTORE_SOCKET_PATH,
+                sizeof(addr.sun_path) - 1);
+        unlink(FDSTORE_SOCKET_PATH);
+
+        /* services may run as any user */
+        if (bind(fdstore_socket, (struct sockaddr *) &addr,
+                 sizeof(addr)) != 0 ||
+            chmod(FDSTORE_SOCKET_PATH, 0666) != 0 ||
+            setsockopt(fdstore_socket, SOL_SOCKET, SO_PASSCRED, &one,
+                       sizeof(one)) != 0) {
+                perror("cyrenit: failed to bind " FDSTORE_SOCKET_PATH);
+                close(fdstore_socket);
+                fdstore_socket = -1;
+                return false;
+        }
+
+        return fdstore_adopt(fdstore_socket);
+}
+
+/**
+ * @fn bool fdstore_adopt(int fd)
+ * @brief Receives on an already bound notify socket
+ * @param fd the socket, e.g. inherited over a re-exec of PID 1
+ * @return true on success or false on failure
+ */
+bool fdstore_adopt(int fd)
+{
+        if (fd < 0) {
+                return false;
+        }
+
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fdstore_socket = fd;
+        control_register("fdstore", "[clear <service>] list or close the "
+                         "descriptors services stored", fdstore_command);
+
+        return evloop_add(fdstore_socket, EVLOOP_IN, fdstore_handle, NULL);
+}
+
+static void fdstore_command(int argc, char **argv,
+                            struct control_reply *reply)
+{
+        struct process *proc = NULL;
+        size_t i = 0;
+        size_t j = 0;
+
+        if (argc == 3 && strcmp(argv[1], "clear") == STRCMP_EQUAL) {
+                proc = process_find_by_name(argv[2]);
+                if (proc == NULL) {
+                        control_reply_error(reply, "no service named %s",
+                                            argv[2]);
+                        return;
+                }
+                fdstore_clear(proc);
+                return;
+        }
+        if (argc != 1) {
+                control_reply_error(reply, "usage: %s [clear <service>]",
+                                    argv[0]);
+                return;
+        }
+
+        for (i = 0; i < registered_process_count; i++) {
+                proc = registered_processes[i];
+                if (proc->fdstore.max == 0) {
+                        continue;
+                }
+                control_reply_printf(reply, "%s fds=%zu max=%u",
+                                     fdstore_service(proc),
+                                     proc->fdstore.count, proc->fdstore.max);
+                for (j = 0; j < proc->fdstore.count; j++) {
+                        control_reply_printf(reply, " %s=%d",
+                                             proc->fdstore.fds[j].name,
+                                             proc->fdstore.fds[j].fd);
+                }
+                control_reply_printf(reply, "\n");
+        }
+}
+
+#endif//__FDSTORE_C
@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * fdstore.h - File descriptors kept by PID 1 across service restarts
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __FDSTORE_H
+#define __FDSTORE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "control.h"
+
+#define FDSTORE_SOCKET_PATH CONTROL_RUN_DIR "/notify"
+#define FDSTORE_MSG_MAX 4096
+/* descriptors taken from a single message */
+#define FDSTORE_MSG_FDS 64
+#define FDSTORE_NAME_MAX 255
+#define FDSTORE_DEFAULT_NAME "stored"
+/* where the descriptors handed back start, as sd_listen_fds() expects */
+#define FDSTORE_LISTEN_FDS_START 3
+
+struct process;
+
+/*
+ * A service with `fdstore = N` gets NOTIFY_SOCKET and may send PID 1 up to
+ * N descriptors (SCM_RIGHTS) with a "FDSTORE=1" datagram, optionally named
+ * with "FDNAME=name"; "FDSTOREREMOVE=1" with FDNAME closes them again. They
+ * are held while the service crashes, restarts or PID 1 re-executes, and
+ * every new instance gets them from fd 3 on, with LISTEN_FDS, LISTEN_PID
+ * and LISTEN_FDNAMES set. Stopping the service on purpose closes them.
+ * Senders are told apart by their credentials: the main process of the
+ * service, or anything in its session.
+ */
+struct fdstore_fd
+{
+        int fd;
+        char *name;
+};
+
+struct fdstore
+{
+        unsigned max;
+        struct fdstore_fd *fds;
+        size_t count;
+        size_t allocated;
+};
+
+extern int fdstore_socket;
+
+bool fdstore_add(struct process *proc, int fd, const char *name);
+void fdstore_clear(struct process *proc);
+char **fdstore_child(struct process *proc, char **envp);
+bool fdstore_init();
+bool fdstore_adopt(int fd);
+
+#endif//__FDSTORE_H
@@ -0,0 +1,683 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * job.c - Transactional start, stop and restart of services
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __JOB_C
+#define __JOB_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "bootopt.h"
+#include "cyrenit.h"
+#include "fdstore.h"
+#include "job.h"
+#include "memstat.h"
+#include "timer.h"
+#include "uevent.h"
+
+#define JOB_ALLOC_STEP 16
+/* a started service holds its cyrenit.parallel slot this long */
+#define JOB_START_SETTLE_MS 200
+
+enum job_progress
+{
+        JOB_PROGRESS_DONE = 0,
+        JOB_PROGRESS_FAILED,
+        JOB_PROGRESS_WAITING,
+        JOB_PROGRESS_BLOCKED
+};
+
+/* Jobs being built by job_submit(), or the queue they are merged into */
+struct job_list
+{
+        struct job *jobs;
+        size_t count;
+        size_t allocated;
+};
+
+static struct job_list queue = { NULL, 0, 0 };
+static bool dispatching = false;
+/* dispatches the queue from the loop, after a process went away */
+static struct timer job_timer;
+
+static void job_dispatch();
+static void jobs_command(int argc, char **argv, struct control_reply *reply);
+static void job_command(int argc, char **argv, struct control_reply *reply);
+
+/**
+ * @fn const char *job_type_name(enum job_type type)
+ * @brief Returns a printable name for a job type
+ */
+const char *job_type_name(enum job_type type)
+{
+        switch (type) {
+        case JOB_START:
+                return "start";
+        case JOB_STOP:
+                return "stop";
+        default:
+                return "restart";
+        }
+}
+
+static struct job *job_list_find(struct job_list *list,
+                                 const struct process *proc)
+{
+        size_t i = 0;
+
+        for (i = 0; i < list->count; i++) {
+                if (list->jobs[i].proc == proc) {
+                        return &list->jobs[i];
+                }
+        }
+
+        return NULL;
+}
+
+/*
+ * A stop wins over anything, two starts stay a start, anything else (a
+ * start meeting a stop or a restart) is a restart.
+ */
+static enum job_type job_merge_type(enum job_type current, enum job_type type)
+{
+        if (type == JOB_STOP) {
+                return JOB_STOP;
+        }
+        if (current == JOB_START && type == JOB_START) {
+                return JOB_START;
+        }
+
+        return JOB_RESTART;
+}
+
+/**
+ * @fn static bool job_list_add(struct job_list *list, struct process *proc,
+ *                              enum job_type type, bool *merged)
+ * @brief Adds a job for proc to list, merging it with an existing one
+ * @return true if proc had no job in list yet
+ */
+static bool job_list_add(struct job_list *list, struct process *proc,
+                         enum job_type type, bool *merged)
+{
+        struct job *new_jobs = NULL;
+        struct job *job = job_list_find(list, proc);
+
+        if (merged != NULL) {
+                *merged = job != NULL;
+        }
+
+        if (job != NULL) {
+                type = job_merge_type(job->type, type);
+                /* a merged restart stops again unless it is stopping */
+                if (type != job->type && type != JOB_START && !job->stopping) {
+                        job->stopped = false;
+                }
+                job->type = type;
+                return false;
+        }
+
+        if (list->count >= list->allocated) {
+                new_jobs = mem_reallocarray(MEM_PROC, list->jobs,
+                                            list->allocated + JOB_ALLOC_STEP,
+                                            sizeof(struct job));
+                if (new_jobs == NULL) {
+                        return false;
+                }
+                list->jobs = new_jobs;
+                list->allocated += JOB_ALLOC_STEP;
+        }
+
+        job = &list->jobs[list->count++];
+        memset(job, 0, sizeof(struct job));
+        job->proc = proc;
+        job->type = type;
+
+        return true;
+}
+
+static void job_list_remove(struct job_list *list, size_t index)
+{
+        memmove(&list->jobs[index], &list->jobs[index + 1],
+                (list->count - index - 1) * sizeof(struct job));
+        list->count--;
+}
+
+static bool job_names_contain(char **names, size_t count, const char *name)
+{
+        size_t i = 0;
+
+        for (i = 0; name != NULL && i < count; i++) {
+                if (strcmp(names[i], name) == STRCMP_EQUAL) {
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+static bool job_requires(const struct process *proc, const struct process *dep)
+{
+        return job_names_contain(proc->requires, proc->require_count,
+                                 dep->name);
+}
+
+/* Whether proc starts after dep, and so stops before it */
+static bool job_ordered_after(const struct process *proc,
+                              const struct process *dep)
+{
+        return job_requires(proc, dep) ||
+               job_names_contain(proc->after, proc->after_count, dep->name);
+}
+
+/* Running and not on its way out */
+static bool job_is_up(const struct process *proc)
+{
+        struct job *job = job_list_find(&queue, proc);
+
+        return proc->status == CYRENIT_PROC_STATUS_RUNNING &&
+               !proc->stopping && (job == NULL || job->type == JOB_START);
+}
+
+static void job_expand_start(struct job_list *tx, struct process *proc)
+{
+        struct process *dep = NULL;
+        size_t i = 0;
+
+        if (job_is_up(proc) || !job_list_add(tx, proc, JOB_START, NULL)) {
+                return;
+        }
+
+        for (i = 0; i < proc->require_count; i++) {
+                dep = process_find_by_name(proc->requires[i]);
+                if (dep != NULL) {
+                        job_expand_start(tx, dep);
+                }
+        }
+}
+
+static void job_expand_stop(struct job_list *tx, struct process *proc)
+{
+        struct process *other = NULL;
+        size_t i = 0;
+
+        if (!job_list_add(tx, proc, JOB_STOP, NULL)) {
+                return;
+        }
+
+        for (i = 0; i < registered_process_count; i++) {
+                other = registered_processes[i];
+                if (!other->retired && job_requires(other, proc) &&
+                    (other->status == CYRENIT_PROC_STATUS_RUNNING ||
+                     timer_is_armed(&other->restart_timer) ||
+                     job_list_find(&queue, other) != NULL)) {
+                        job_expand_stop(tx, other);
+                }
+        }
+}
+
+static void job_expand_restart(struct job_list *tx, struct process *proc)
+{
+        struct process *other = NULL;
+        size_t i = 0;
+
+        if (!job_list_add(tx, proc, JOB_RESTART, NULL)) {
+                return;
+        }
+
+        for (i = 0; i < registered_process_count; i++) {
+                other = registered_processes[i];
+                if (!other->retired && job_requires(other, proc) &&
+                    other->status == CYRENIT_PROC_STATUS_RUNNING) {
+                        job_expand_restart(tx, other);
+                }
+        }
+
+        for (i = 0; i < proc->require_count; i++) {
+                other = process_find_by_name(proc->requires[i]);
+                if (other != NULL) {
+                        job_expand_start(tx, other);
+                }
+        }
+}
+
+/**
+ * @fn size_t job_submit(struct process **procs, size_t count,
+ *                       enum job_type type, struct control_reply *reply)
+ * @brief Queues one transaction of type for procs and runs what it can
+ * @param reply where to describe the transaction, may be NULL
+ * @return the number of jobs in the transaction
+ * @details Starts happen before this returns unless they are ordered
+ *          after a stop still in progress.
+ */
+size_t job_submit(struct process **procs, size_t count, enum job_type type,
+                  struct control_reply *reply)
+{
+        struct job_list tx = { NULL, 0, 0 };
+        struct job *job = NULL;
+        bool merged = false;
+        size_t i = 0;
+
+        for (i = 0; i < count; i++) {
+                switch (type) {
+                case JOB_START:
+                        job_expand_start(&tx, procs[i]);
+                        break;
+                case JOB_STOP:
+                        job_expand_stop(&tx, procs[i]);
+                        break;
+                case JOB_RESTART:
+                        job_expand_restart(&tx, procs[i]);
+                        break;
+                }
+        }
+
+        for (i = 0; i < tx.count; i++) {
+                job_list_add(&queue, tx.jobs[i].proc, tx.jobs[i].type, &merged);
+                job = job_list_find(&queue, tx.jobs[i].proc);
+                if (reply == NULL || job == NULL) {
+                        continue;
+                }
+                if (merged) {
+                        control_reply_printf(reply, "%s %s (merged into a "
+                                             "%s)\n",
+                                             job_type_name(tx.jobs[i].type),
+                                             job->proc->name,
+                                             job_type_name(job->type));
+                }
+                else {
+                        control_reply_printf(reply, "%s %s\n",
+                                             job_type_name(job->type),
+                                             job->proc->name);
+                }
+        }
+        mem_free(MEM_PROC, tx.jobs);
+
+        job_dispatch();
+        return tx.count;
+}
+
+/*
+ * A job waits for another one when it is ordered after it: in its stop
+ * half, for the stop half of whatever is ordered after its process; in its
+ * start half, for any job of what its process is ordered after.
+ */
+static bool job_waits_for(const struct job *job, const struct job *other)
+{
+        if (job->type != JOB_START && !job->stopped) {
+                return other->type != JOB_START && !other->stopped &&
+                       job_ordered_after(other->proc, job->proc);
+        }
+
+        return job_ordered_after(job->proc, other->proc);
+}
+
+static bool job_blocked(const struct job *job)
+{
+        size_t i = 0;
+
+        for (i = 0; i < queue.count; i++) {
+                if (&queue.jobs[i] != job && queue.jobs[i].proc != NULL &&
+                    job_waits_for(job, &queue.jobs[i])) {
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+static const char *job_missing_requirement(const struct process *proc)
+{
+        struct process *dep = NULL;
+        size_t i = 0;
+
+        for (i = 0; i < proc->require_count; i++) {
+                dep = process_find_by_name(proc->requires[i]);
+                if (dep == NULL || dep->status != CYRENIT_PROC_STATUS_RUNNING ||
+                    dep->stopping) {
+                        return proc->requires[i];
+                }
+        }
+
+        return NULL;
+}
+
+static const char *job_missing_device(const struct process *proc)
+{
+        size_t i = 0;
+
+        for (i = 0; i < proc->device_count; i++) {
+                if (!uevent_device_present(proc->devices[i])) {
+                        return proc->devices[i];
+                }
+        }
+
+        return NULL;
+}
+
+static void job_device_ready(const char *device, bool present, void *data)
+{
+        struct job *job = job_list_find(&queue, data);
+
+        (void) device;
+
+        if (job == NULL) {
+                return;
+        }
+
+        job->device_wait = false;
+        job->device_timed_out = !present;
+        timer_add(&supervisor_timers, &job_timer, 0, TIMER_FINE);
+}
+
+/* One device at a time: the next one is looked at once this one is there */
+static enum job_progress job_wait_device(struct job *job, const char *device)
+{
+        if (job->device_timed_out) {
+                fprintf(stderr, "cyrenit: not starting %s, %s did not "
+                        "appear in %u s\n", job->proc->name, device,
+                        UEVENT_WAIT_TIMEOUT_MS / 1000);
+                return JOB_PROGRESS_FAILED;
+        }
+        if (job->device_wait) {
+                return JOB_PROGRESS_WAITING;
+        }
+
+        job->device_wait = true;
+        if (!uevent_wait(device, UEVENT_WAIT_TIMEOUT_MS, job_device_ready,
+                         job->proc)) {
+                return JOB_PROGRESS_FAILED;
+        }
+        fprintf(stdout, "cyrenit: %s waits for %s\n", job->proc->name,
+                device);
+        boot_trace("job: %s waits for %s", job->proc->name, device);
+
+        return JOB_PROGRESS_WAITING;
+}
+
+/**
+ * @fn static bool job_slot_free()
+ * @brief Whether one more service may start under cyrenit.parallel
+ * @details Services count as starting for their first JOB_START_SETTLE_MS,
+ *          whatever started them, unless they exit before.
+ */
+static bool job_slot_free()
+{
+        struct process *proc = NULL;
+        size_t starting = 0;
+        uint64_t now = 0;
+        size_t i = 0;
+
+        if (boot_options.parallel == 0) {
+                return true;
+        }
+
+        now = timer_wheel_now(&supervisor_timers);
+        for (i = 0; i < registered_process_count; i++) {
+                proc = registered_processes[i];
+                if (proc->status == CYRENIT_PROC_STATUS_RUNNING &&
+                    now - proc->started_at < JOB_START_SETTLE_MS) {
+                        starting++;
+                }
+        }
+
+        return starting < boot_options.parallel;
+}
+
+static enum job_progress job_step(struct job *job)
+{
+        struct process *proc = job->proc;
+        const char *missing = NULL;
+
+        if (job->stopping) {
+                return JOB_PROGRESS_WAITING;
+        }
+
+        if (job->type != JOB_START && !job->stopped) {
+                if (job_blocked(job)) {
+                        return JOB_PROGRESS_BLOCKED;
+                }
+                if (process_stop(proc)) {
+                        boot_trace("job: stopping %s", proc->name);
+                        job->stopping = true;
+                        return JOB_PROGRESS_WAITING;
+                }
+                job->stopped = true; //was not running
+        }
+
+        if (job->type == JOB_STOP) {
+                /* stopped for good, unlike a restart or a crash */
+                fdstore_clear(proc);
+                return JOB_PROGRESS_DONE;
+        }
+        if (job_blocked(job)) {
+                return JOB_PROGRESS_BLOCKED;
+        }
+        if (proc->status == CYRENIT_PROC_STATUS_RUNNING) {
+                return JOB_PROGRESS_DONE;
+        }
+
+        missing = job_missing_requirement(proc);
+        if (missing != NULL) {
+                fprintf(stderr, "cyrenit: not starting %s, it requires %s "
+                        "which is not running\n", proc->name, missing);
+                return JOB_PROGRESS_FAILED;
+        }
+
+        missing = job_missing_device(proc);
+        if (missing != NULL) {
+                return job_wait_device(job, missing);
+        }
+
+        if (!job_slot_free()) {
+                if (!timer_is_armed(&job_timer)) {
+                        timer_add(&supervisor_timers, &job_timer,
+                                  JOB_START_SETTLE_MS / 4, TIMER_FINE);
+                }
+                return JOB_PROGRESS_WAITING;
+        }
+
+        timer_cancel(&proc->restart_timer);
+        fprintf(stdout, "cyrenit: starting service %s\n", proc->name);
+        boot_trace("job: starting %s", proc->name);
+        if (!process_forkexec(proc)) {
+                fprintf(stderr, "cyrenit: failed to forkexec service %s\n",
+                        proc->name);
+                return JOB_PROGRESS_FAILED;
+        }
+        if (proc->pid > 0) {
+                boot_trace("job: %s is pid %d", proc->name, proc->pid);
+        }
+
+        return JOB_PROGRESS_DONE;
+}
+
+/**
+ * @fn static void job_dispatch()
+ * @brief Runs every queued job that is not ordered after another one,
+ *        until nothing else can move
+ * @details If nothing moved and no job is waiting for a process to exit,
+ *          the remaining jobs are ordered after each other in a cycle and
+ *          are dropped.
+ */
+static void job_dispatch()
+{
+        bool progress = true;
+        bool waiting = false;
+        size_t i = 0;
+
+        if (dispatching) {
+                return;
+        }
+        dispatching = true;
+
+        while (progress) {
+                progress = false;
+                waiting = false;
+                i = 0;
+                while (i < queue.count) {
+                        if (queue.jobs[i].proc == NULL) {
+                                job_list_remove(&queue, i);
+                                progress = true;
+                                continue;
+                        }
+
+                        switch (job_step(&queue.jobs[i])) {
+                        case JOB_PROGRESS_DONE:
+                        case JOB_PROGRESS_FAILED:
+                                uevent_cancel(queue.jobs[i].proc);
+                                job_list_remove(&queue, i);
+                                progress = true;
+                                continue;
+                        case JOB_PROGRESS_WAITING:
+                                waiting = true;
+                                break;
+                        case JOB_PROGRESS_BLOCKED:
+                                break;
+                        }
+                        i++;
+                }
+        }
+
+        if (queue.count > 0 && !waiting) {
+                for (i = 0; i < queue.count; i++) {
+                        fprintf(stderr, "cyrenit: dropping the %s job of %s, "
+                                "its ordering is a cycle\n",
+                                job_type_name(queue.jobs[i].type),
+                                queue.jobs[i].proc->name);
+                }
+                queue.count = 0;
+        }
+
+        dispatching = false;
+}
+
+static void job_timeout(struct timer *t, void *data)
+{
+        (void) t;
+        (void) data;
+        job_dispatch();
+}
+
+/**
+ * @fn void job_process_stopped(struct process *proc)
+ * @brief Completes the stop half of the job of proc, which just exited
+ */
+void job_process_stopped(struct process *proc)
+{
+        struct job *job = job_list_find(&queue, proc);
+
+        if (job == NULL || !job->stopping) {
+                return;
+        }
+
+        job->stopping = false;
+        job->stopped = true;
+        job_dispatch();
+}
+
+/**
+ * @fn void job_forget(struct process *proc)
+ * @brief Drops the job of a process that is going away
+ * @details The jobs ordered after it are dispatched from the loop.
+ */
+void job_forget(struct process *proc)
+{
+        struct job *job = job_list_find(&queue, proc);
+
+        uevent_cancel(proc);
+        if (job == NULL) {
+                return;
+        }
+
+        job->proc = NULL;
+        timer_add(&supervisor_timers, &job_timer, 0, TIMER_FINE);
+}
+
+/**
+ * @fn size_t job_pending()
+ * @brief Returns the number of queued jobs
+ */
+size_t job_pending()
+{
+        return queue.count;
+}
+
+/**
+ * @fn void jobs_init()
+ * @brief Registers the job control commands
+ */
+void jobs_init()
+{
+        timer_init(&job_timer, job_timeout, NULL);
+        control_register("start", "<service>... start services and what "
+                         "they require", job_command);
+        control_register("stop", "<service>... stop services and what "
+                         "requires them", job_command);
+        control_register("restart", "<service>... restart services and "
+                         "what requires them", job_command);
+        control_register("jobs", "list the queued jobs", jobs_command);
+}
+
+static void job_command(int argc, char **argv, struct control_reply *reply)
+{
+        struct process *procs[CONTROL_MAX_ARGS];
+        enum job_type type = JOB_START;
+        int i = 0;
+
+        if (strcmp(argv[0], "stop") == STRCMP_EQUAL) {
+                type = JOB_STOP;
+        }
+        else if (strcmp(argv[0], "restart") == STRCMP_EQUAL) {
+                type = JOB_RESTART;
+        }
+
+        if (argc < 2) {
+                control_reply_error(reply, "usage: %s <service>...",
+                                    argv[0]);
+                return;
+        }
+
+        for (i = 1; i < argc; i++) {
+                procs[i - 1] = process_find_by_name(argv[i]);
+                if (procs[i - 1] == NULL) {
+                        control_reply_error(reply, "no service named %s",
+                                            argv[i]);
+                        return;
+                }
+        }
+
+        if (job_submit(procs, (size_t) argc - 1, type, reply) == 0) {
+                control_reply_printf(reply, "nothing to do\n");
+        }
+}
+
+static void jobs_command(int argc, char **argv, struct control_reply *reply)
+{
+        struct job *job = NULL;
+        size_t i = 0;
+
+        (void) argc;
+        (void) argv;
+        for (i = 0; i < queue.count; i++) {
+                job = &queue.jobs[i];
+                if (job->proc == NULL) {
+                        continue;
+                }
+                control_reply_printf(reply, "%s %s %s\n",
+                                     job_type_name(job->type), job->proc->name,
+                                     job->stopping ? "stopping" :
+                                     job->stopped ? "starting" : "waiting");
+        }
+}
+
+#endif//__JOB_C
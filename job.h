@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * job.h - Transactional start, stop and restart of services
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __JOB_H
+#define __JOB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "control.h"
+#include "proc.h"
+
+enum job_type
+{
+        JOB_START = 0,
+        JOB_STOP,
+        JOB_RESTART
+};
+
+/*
+ * A request on some services becomes a transaction: the smallest set of
+ * jobs over the `requires` graph that satisfies it.
+ *
+ *   start X     starts X and whatever it requires that is not running
+ *   stop X      stops X and whatever requires it, transitively
+ *   restart X   restarts X and whatever running requires it, and starts
+ *               what X requires that is not running
+ *
+ * Jobs are queued with at most one per process; a job for a process that
+ * already has one merges with it (a stop cancels a pending start, a start
+ * after a pending stop makes a restart). Jobs run as soon as they are not
+ * ordered after another queued job, so independent ones run in parallel:
+ * a start waits for the jobs of what it requires or is `after`, a stop
+ * waits for the stops of what requires or is `after` it. With
+ * cyrenit.parallel (see bootopt.h), starts also wait for a free slot. A
+ * start also waits for the devices of the service, one at a time, and
+ * fails if one does not appear within UEVENT_WAIT_TIMEOUT_MS.
+ */
+struct job
+{
+        struct process *proc;
+        enum job_type type;
+        /* the stop half of a stop or restart is done */
+        bool stopped;
+        /* waiting for the process to exit */
+        bool stopping;
+        /* waiting for a device, or gave up on it */
+        bool device_wait;
+        bool device_timed_out;
+};
+
+size_t job_submit(struct process **procs, size_t count, enum job_type type,
+                  struct control_reply *reply);
+void job_process_stopped(struct process *proc);
+void job_forget(struct process *proc);
+size_t job_pending();
+const char *job_type_name(enum job_type type);
+void jobs_init();
+
+#endif//__JOB_H
@@ -0,0 +1,1125 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * journal.c - Indexed binary journal of the services' output
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __JOURNAL_C
+#define __JOURNAL_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <sched.h>
+
+#include <linux/limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cyrenit.h"
+#include "journal.h"
+#include "pool.h"
+#include "lz.h"
+#include "memstat.h"
+
+#define JOURNAL_ALLOC_STEP 64
+/* Open addressing, kept at most half full */
+#define JOURNAL_HASH_SIZE (JOURNAL_SERVICES_MAX * 2)
+
+#define JOURNAL_NS 1000000000ULL
+
+#define JOURNAL_ALIGNED(x) (((x) + JOURNAL_ALIGN - 1) & ~((uint64_t) JOURNAL_ALIGN - 1))
+
+struct journal_service
+{
+        char name[JOURNAL_NAME_MAX];
+        uint32_t *offsets;
+        size_t count;
+        size_t allocated;
+};
+
+/*
+ * The segment being written. Its indexes are built in memory as records
+ * are appended and written out as the footer when it is sealed.
+ */
+struct journal_writer
+{
+        int fd;
+        uint8_t *map;
+        struct journal_header *header;
+        uint64_t sequence;
+        uint64_t next_index;
+        uint64_t retry_at;
+        struct journal_service *services;
+        size_t service_count;
+        size_t service_allocated;
+        struct journal_time_entry *times;
+        size_t time_count;
+        size_t time_allocated;
+        uint32_t hash[JOURNAL_HASH_SIZE];
+};
+
+static struct journal_writer journal = { .fd = -1 };
+
+/*
+ * Packing requests not served yet; the packer job, which owns everything
+ * but the open segment, is queued by the one that raises it from zero
+ */
+static unsigned pack_requests = 0;
+/* Set when a segment could not be created, the packer then frees space */
+static bool packer_pressure = false;
+
+/**
+ * @fn uint64_t journal_now()
+ * @brief Returns the current CLOCK_MONOTONIC time in nanoseconds
+ */
+uint64_t journal_now()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * JOURNAL_NS + (uint64_t) ts.tv_nsec;
+}
+
+static bool journal_has_suffix(const char *name, const char *suffix)
+{
+        size_t length = strlen(name);
+        size_t suffix_length = strlen(suffix);
+
+        return length > suffix_length &&
+               strcmp(name + length - suffix_length, suffix) == STRCMP_EQUAL;
+}
+
+/* Segments, either raw or packed; temporary files start with a dot */
+static int journal_filter(const struct dirent *entry)
+{
+        return entry->d_name[0] != '.' &&
+               (journal_has_suffix(entry->d_name, JOURNAL_SUFFIX) ||
+                journal_has_suffix(entry->d_name, JOURNAL_PACKED_SUFFIX));
+}
+
+static void journal_packer(void *data);
+
+/* Queues the packer on the worker pool unless it is already queued */
+static void journal_wake_packer()
+{
+        if (__atomic_fetch_add(&pack_requests, 1, __ATOMIC_ACQ_REL) == 0 &&
+            !pool_submit(journal_packer, NULL, NULL, POOL_IDLE)) {
+                __atomic_store_n(&pack_requests, 0, __ATOMIC_RELEASE);
+        }
+}
+
+/**
+ * @fn static uint64_t journal_last_sequence()
+ * @brief Returns the highest sequence number found in JOURNAL_DIR
+ * @details Segment names are their sequence in fixed width hexadecimal,
+ *          so sorting them by name sorts them in time.
+ */
+static uint64_t journal_last_sequence()
+{
+        struct dirent **entries = NULL;
+        uint64_t last = 0;
+        uint64_t seq = 0;
+        int count = 0;
+        int i = 0;
+
+        count = scandir(JOURNAL_DIR, &entries, journal_filter, alphasort);
+        if (count < 0) {
+                return 0;
+        }
+
+        for (i = 0; i < count; i++) {
+                seq = strtoull(entries[i]->d_name, NULL, 16);
+                if (seq > last) {
+                        last = seq;
+                }
+                free(entries[i]);
+        }
+        free(entries);
+
+        return last;
+}
+
+static bool journal_open_segment()
+{
+        char path[PATH_MAX];
+
+        if (journal.sequence == 0) {
+                mkdir(CONTROL_RUN_DIR, 0755);
+                if (mkdir(JOURNAL_DIR, 0750) != 0 && errno != EEXIST) {
+                        return false;
+                }
+                journal.sequence = journal_last_sequence();
+                journal_wake_packer();
+        }
+        journal.sequence++;
+
+        snprintf(path, sizeof(path), "%s/%016llx%s", JOURNAL_DIR,
+                 (unsigned long long) journal.sequence, JOURNAL_SUFFIX);
+        journal.fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0640);
+        if (journal.fd == -1) {
+                return false;
+        }
+
+        /*
+         * Reserved up front: a full tmpfs would otherwise fault the writes
+         * to the mapping with SIGBUS
+         */
+        if (fallocate(journal.fd, 0, 0, JOURNAL_SEGMENT_SIZE) != 0 &&
+            (errno != EOPNOTSUPP ||
+             ftruncate(journal.fd, JOURNAL_SEGMENT_SIZE) != 0)) {
+                goto open_fail;
+        }
+
+        journal.map = mmap(NULL, JOURNAL_SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, journal.fd, 0);
+        if (journal.map == MAP_FAILED) {
+                journal.map = NULL;
+                goto open_fail;
+        }
+
+        journal.header = (struct journal_header *) journal.map;
+        memcpy(journal.header->magic, JOURNAL_MAGIC, 4);
+        journal.header->version = JOURNAL_VERSION;
+        journal.header->sequence = journal.sequence;
+        journal.header->data_end = sizeof(struct journal_header);
+        journal.next_index = journal.header->data_end;
+        memset(journal.hash, 0, sizeof(journal.hash));
+
+        return true;
+
+open_fail:
+        close(journal.fd);
+        unlink(path);
+        journal.fd = -1;
+        return false;
+}
+
+static bool journal_grow(void **array, size_t *allocated, size_t count,
+                         size_t size)
+{
+        void *new_array = NULL;
+
+        if (count < *allocated) {
+                return true;
+        }
+
+        new_array = mem_reallocarray(MEM_LOGS, *array,
+                                     *allocated + JOURNAL_ALLOC_STEP, size);
+        if (new_array == NULL) {
+                return false;
+        }
+
+        *array = new_array;
+        *allocated += JOURNAL_ALLOC_STEP;
+        return true;
+}
+
+/**
+ * @fn static bool journal_write_footer()
+ * @brief Writes the indexes of the current segment after its records
+ */
+static bool journal_write_footer()
+{
+        struct journal_service_entry *entries = NULL;
+        struct journal_footer footer;
+        uint64_t offset = 0;
+        uint64_t offsets_at = 0;
+        bool ok = true;
+        size_t i = 0;
+
+        offset = JOURNAL_ALIGNED(journal.header->data_end);
+        memset(&footer, 0, sizeof(footer));
+        footer.time_count = (uint32_t) journal.time_count;
+        footer.service_count = (uint32_t) journal.service_count;
+        footer.times_offset = offset + sizeof(footer);
+        footer.services_offset = footer.times_offset +
+                journal.time_count * sizeof(struct journal_time_entry);
+
+        entries = mem_calloc(MEM_LOGS, journal.service_count + 1,
+                             sizeof(struct journal_service_entry));
+        if (entries == NULL) {
+                return false;
+        }
+
+        offsets_at = footer.services_offset +
+                journal.service_count * sizeof(struct journal_service_entry);
+        for (i = 0; i < journal.service_count; i++) {
+                memcpy(entries[i].name, journal.services[i].name,
+                       JOURNAL_NAME_MAX);
+                entries[i].id = (uint32_t) i;
+                entries[i].record_count = (uint32_t) journal.services[i].count;
+                entries[i].offsets_offset = offsets_at;
+                offsets_at += journal.services[i].count * sizeof(uint32_t);
+        }
+
+        ok = pwrite(journal.fd, &footer, sizeof(footer), (off_t) offset) ==
+             sizeof(footer);
+        ok = ok && pwrite(journal.fd, journal.times,
+                          journal.time_count * sizeof(struct journal_time_entry),
+                          (off_t) footer.times_offset) >= 0;
+        ok = ok && pwrite(journal.fd, entries,
+                          journal.service_count *
+                          sizeof(struct journal_service_entry),
+                          (off_t) footer.services_offset) >= 0;
+        for (i = 0; ok && i < journal.service_count; i++) {
+                ok = pwrite(journal.fd, journal.services[i].offsets,
+                            journal.services[i].count * sizeof(uint32_t),
+                            (off_t) entries[i].offsets_offset) >= 0;
+        }
+        mem_free(MEM_LOGS, entries);
+
+        if (!ok || ftruncate(journal.fd, (off_t) offsets_at) != 0) {
+                return false;
+        }
+
+        journal.header->footer_offset = offset;
+        __atomic_store_n(&journal.header->flags, JOURNAL_SEALED,
+                         __ATOMIC_RELEASE);
+        return true;
+}
+
+/**
+ * @fn void journal_close()
+ * @brief Seals the segment being written, if any
+ * @details The next append starts a new segment, or retries opening one
+ *          if the journal had failed. The sealed segment is left to the
+ *          packer.
+ */
+void journal_close()
+{
+        size_t i = 0;
+
+        journal.retry_at = 0;
+        if (journal.fd == -1) {
+                return;
+        }
+
+        if (!journal_write_footer()) {
+                fprintf(stderr, "cyrenit: failed to seal journal segment "
+                        "%016llx, it will be scanned\n",
+                        (unsigned long long) journal.sequence);
+        }
+
+        munmap(journal.map, JOURNAL_SEGMENT_SIZE);
+        close(journal.fd);
+        journal.fd = -1;
+        journal.map = NULL;
+        journal.header = NULL;
+
+        for (i = 0; i < journal.service_count; i++) {
+                mem_free(MEM_LOGS, journal.services[i].offsets);
+        }
+        mem_free(MEM_LOGS, journal.services);
+        mem_free(MEM_LOGS, journal.times);
+        journal.services = NULL;
+        journal.service_count = 0;
+        journal.service_allocated = 0;
+        journal.times = NULL;
+        journal.time_count = 0;
+        journal.time_allocated = 0;
+
+        journal_wake_packer();
+}
+
+static uint32_t journal_hash(const char *name)
+{
+        uint32_t hash = 2166136261U;
+
+        while (*name != '\0') {
+                hash = (hash ^ (uint8_t) *name++) * 16777619U;
+        }
+
+        return hash;
+}
+
+static bool journal_put(uint64_t now, uint32_t service, int priority,
+                        uint8_t flags, const char *message, size_t length)
+{
+        struct journal_record *record = NULL;
+        struct journal_header *header = journal.header;
+        uint64_t offset = header->data_end;
+
+        record = (struct journal_record *) (journal.map + offset);
+        record->time = now;
+        record->service = service;
+        record->length = (uint16_t) length;
+        record->priority = (uint8_t) priority;
+        record->flags = flags;
+        memcpy(record->message, message, length);
+
+        if (offset >= journal.next_index) {
+                if (!journal_grow((void **) &journal.times,
+                                  &journal.time_allocated, journal.time_count,
+                                  sizeof(struct journal_time_entry))) {
+                        return false;
+                }
+                journal.times[journal.time_count].time = now;
+                journal.times[journal.time_count].offset = offset;
+                journal.time_count++;
+                journal.next_index = offset + JOURNAL_TIME_INDEX_STEP;
+        }
+
+        if (header->record_count == 0) {
+                header->first_time = now;
+        }
+        header->last_time = now;
+        header->record_count++;
+        __atomic_store_n(&header->data_end,
+                         JOURNAL_ALIGNED(offset + sizeof(struct journal_record) +
+                                         length), __ATOMIC_RELEASE);
+
+        return true;
+}
+
+/**
+ * @fn static int journal_service_id(const char *name, uint64_t now)
+ * @brief Returns the id of name in the current segment, declaring it
+ *        with a JOURNAL_RECORD_SERVICE record the first time
+ * @return the id or -1 on failure
+ */
+static int journal_service_id(const char *name, uint64_t now)
+{
+        struct journal_service *svc = NULL;
+        uint32_t slot = journal_hash(name) % JOURNAL_HASH_SIZE;
+        uint32_t id = 0;
+
+        while (journal.hash[slot] != 0) {
+                id = journal.hash[slot] - 1;
+                if (strncmp(journal.services[id].name, name,
+                            JOURNAL_NAME_MAX - 1) == STRCMP_EQUAL) {
+                        return (int) id;
+                }
+                slot = (slot + 1) % JOURNAL_HASH_SIZE;
+        }
+
+        if (journal.service_count >= JOURNAL_SERVICES_MAX ||
+            !journal_grow((void **) &journal.services,
+                          &journal.service_allocated, journal.service_count,
+                          sizeof(struct journal_service))) {
+                return -1;
+        }
+
+        id = (uint32_t) journal.service_count;
+        svc = &journal.services[id];
+        memset(svc, 0, sizeof(struct journal_service));
+        snprintf(svc->name, sizeof(svc->name), "%s", name);
+        if (!journal_put(now, id, JOURNAL_PRIORITY_DEFAULT,
+                         JOURNAL_RECORD_SERVICE, svc->name,
+                         strlen(svc->name))) {
+                return -1;
+        }
+
+        journal.service_count++;
+        journal.hash[slot] = id + 1;
+        return (int) id;
+}
+
+/**
+ * @fn bool journal_append(const char *service, int priority,
+ *                         const char *message, size_t length)
+ * @brief Appends a line of output of service to the journal
+ * @param service the service name
+ * @param priority the syslog(3) level of the line
+ * @param message the line, without its newline
+ * @param length the length of message
+ * @return true on success or false if the line was not journaled
+ * @details Nothing but memory writes unless a segment fills up or gets
+ *          JOURNAL_SEGMENT_AGE_S old; compression and deletion of the old
+ *          ones happen on the packer, a pool job. After failing to create a
+ *          segment (e.g. /run is full) the journal stays off for
+ *          JOURNAL_RETRY_S, while the packer makes room.
+ */
+MEM_HOT
+bool journal_append(const char *service, int priority, const char *message,
+                    size_t length)
+{
+        uint64_t now = journal_now();
+        uint64_t needed = 0;
+        struct journal_service *svc = NULL;
+        int id = -1;
+
+        if (journal.retry_at > now) {
+                return false;
+        }
+
+        if (length > UINT16_MAX) {
+                length = UINT16_MAX;
+        }
+        /* room for the record and for a declaration of its service */
+        needed = JOURNAL_ALIGNED(sizeof(struct journal_record) + length) +
+                 JOURNAL_ALIGNED(sizeof(struct journal_record) +
+                                 JOURNAL_NAME_MAX);
+
+        if (journal.fd != -1 &&
+            (journal.header->data_end + needed > JOURNAL_SEGMENT_SIZE ||
+             now - journal.header->first_time >
+             JOURNAL_SEGMENT_AGE_S * JOURNAL_NS)) {
+                journal_close();
+        }
+        if (journal.fd == -1 && !journal_open_segment()) {
+                journal.retry_at = now + JOURNAL_RETRY_S * JOURNAL_NS;
+                __atomic_store_n(&packer_pressure, true, __ATOMIC_RELAXED);
+                journal_wake_packer();
+                return false;
+        }
+
+        id = journal_service_id(service, now);
+        if (id < 0) {
+                return false;
+        }
+
+        svc = &journal.services[id];
+        if (!journal_grow((void **) &svc->offsets, &svc->allocated,
+                          svc->count, sizeof(uint32_t))) {
+                return false;
+        }
+        svc->offsets[svc->count++] = (uint32_t) journal.header->data_end;
+
+        return journal_put(now, (uint32_t) id, priority, 0, message, length);
+}
+
+/*
+ * Packer, a job on the worker pool: compresses the sealed segments and enforces
+ * JOURNAL_MAX_USE and JOURNAL_MAX_AGE_S. It only ever touches sealed
+ * segments, so it shares no state with the writer but packer_pressure.
+ */
+
+static bool journal_write_all(int fd, const void *buffer, size_t size)
+{
+        const char *p = buffer;
+        ssize_t ret = 0;
+
+        while (size > 0) {
+                ret = write(fd, p, size);
+                if (ret == -1) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        return false;
+                }
+                p += ret;
+                size -= (size_t) ret;
+        }
+
+        return true;
+}
+
+/**
+ * @fn static bool journal_pack(const char *name)
+ * @brief Compresses the segment name, if sealed, into name.lz
+ * @details Written to a dot file and renamed, so readers see either the
+ *          raw segment or the complete packed one.
+ */
+static bool journal_pack(const char *name)
+{
+        const struct journal_header *header = NULL;
+        struct journal_packed *packed = NULL;
+        char path[PATH_MAX];
+        char packed_path[PATH_MAX];
+        char temp_path[PATH_MAX];
+        struct stat st;
+        size_t size = 0;
+        void *map = MAP_FAILED;
+        bool ok = false;
+        int fd = -1;
+
+        snprintf(path, sizeof(path), "%s/%s", JOURNAL_DIR, name);
+        snprintf(packed_path, sizeof(packed_path), "%s/%s.lz", JOURNAL_DIR,
+                 name);
+        snprintf(temp_path, sizeof(temp_path), "%s/.%s.lz", JOURNAL_DIR, name);
+
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+                return false;
+        }
+        if (fstat(fd, &st) == 0 &&
+            (size_t) st.st_size >= sizeof(struct journal_header)) {
+                size = (size_t) st.st_size;
+                map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (map == MAP_FAILED) {
+                return false;
+        }
+
+        header = map;
+        if (!(__atomic_load_n(&header->flags, __ATOMIC_ACQUIRE) &
+              JOURNAL_SEALED)) {
+                goto pack_done; //still being written
+        }
+
+        packed = mem_malloc(MEM_LOGS,
+                            sizeof(struct journal_packed) + lz_bound(size));
+        if (packed == NULL) {
+                goto pack_done;
+        }
+        memset(packed, 0, sizeof(struct journal_packed));
+        memcpy(packed->magic, JOURNAL_PACKED_MAGIC, 4);
+        packed->version = JOURNAL_VERSION;
+        packed->sequence = header->sequence;
+        packed->first_time = header->first_time;
+        packed->last_time = header->last_time;
+        packed->size = size;
+        packed->packed_size = lz_compress(map, size, packed + 1,
+                                          lz_bound(size));
+        if (packed->packed_size == 0) {
+                goto pack_done;
+        }
+
+        fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+        if (fd == -1) {
+                goto pack_done;
+        }
+        ok = journal_write_all(fd, packed, sizeof(struct journal_packed) +
+                               packed->packed_size);
+        ok = close(fd) == 0 && ok;
+        ok = ok && rename(temp_path, packed_path) == 0;
+        if (!ok) {
+                unlink(temp_path);
+                goto pack_done;
+        }
+        unlink(path);
+
+pack_done:
+        mem_free(MEM_LOGS, packed);
+        munmap(map, size);
+        return ok;
+}
+
+/**
+ * @fn static bool journal_segment_info(const char *path, uint64_t *last_time,
+ *                                      bool *sealed)
+ * @brief Reads the end time of a raw or packed segment from its header
+ */
+static bool journal_segment_info(const char *path, uint64_t *last_time,
+                                 bool *sealed)
+{
+        struct journal_header header;
+        struct journal_packed packed;
+        bool ok = false;
+        int fd = -1;
+
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+                return false;
+        }
+
+        if (journal_has_suffix(path, JOURNAL_PACKED_SUFFIX)) {
+                ok = pread(fd, &packed, sizeof(packed), 0) == sizeof(packed);
+                *last_time = packed.last_time;
+                *sealed = true;
+        }
+        else {
+                ok = pread(fd, &header, sizeof(header), 0) == sizeof(header);
+                *last_time = header.last_time;
+                *sealed = header.flags & JOURNAL_SEALED;
+        }
+        close(fd);
+
+        return ok;
+}
+
+/**
+ * @fn static void journal_retain()
+ * @brief Deletes the oldest segments past JOURNAL_MAX_USE or
+ *        JOURNAL_MAX_AGE_S, and one more if the writer ran out of room
+ * @details The segment being written is never deleted.
+ */
+static void journal_retain()
+{
+        struct dirent **entries = NULL;
+        char path[PATH_MAX];
+        uint64_t total = 0;
+        uint64_t now = journal_now();
+        uint64_t last_time = 0;
+        bool pressure = false;
+        bool sealed = false;
+        struct stat st;
+        int count = 0;
+        int i = 0;
+
+        pressure = __atomic_exchange_n(&packer_pressure, false,
+                                       __ATOMIC_RELAXED);
+        count = scandir(JOURNAL_DIR, &entries, journal_filter, alphasort);
+        if (count < 0) {
+                return;
+        }
+
+        for (i = 0; i < count; i++) {
+                snprintf(path, sizeof(path), "%s/%s", JOURNAL_DIR,
+                         entries[i]->d_name);
+                if (stat(path, &st) == 0) {
+                        total += (uint64_t) st.st_size;
+                }
+        }
+
+        for (i = 0; i < count; i++) {
+                snprintf(path, sizeof(path), "%s/%s", JOURNAL_DIR,
+                         entries[i]->d_name);
+                free(entries[i]);
+                if (!journal_segment_info(path, &last_time, &sealed) ||
+                    !sealed || stat(path, &st) != 0) {
+                        continue;
+                }
+                if (!pressure && total <= JOURNAL_MAX_USE &&
+                    last_time + JOURNAL_MAX_AGE_S * JOURNAL_NS >= now) {
+                        continue;
+                }
+                if (unlink(path) == 0) {
+                        total -= (uint64_t) st.st_size;
+                        pressure = false;
+                }
+        }
+        free(entries);
+}
+
+static void journal_pack_sealed()
+{
+        struct dirent **entries = NULL;
+        int count = 0;
+        int i = 0;
+
+        count = scandir(JOURNAL_DIR, &entries, journal_filter, alphasort);
+        if (count < 0) {
+                return;
+        }
+
+        for (i = 0; i < count; i++) {
+                if (journal_has_suffix(entries[i]->d_name, JOURNAL_SUFFIX)) {
+                        journal_pack(entries[i]->d_name);
+                }
+                free(entries[i]);
+        }
+        free(entries);
+}
+
+/* Leftovers of a packing interrupted by a re-exec */
+static void journal_remove_temporary()
+{
+        char path[PATH_MAX];
+        struct dirent *entry = NULL;
+        DIR *dir = NULL;
+
+        dir = opendir(JOURNAL_DIR);
+        if (dir == NULL) {
+                return;
+        }
+
+        while ((entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] == '.' &&
+                    journal_has_suffix(entry->d_name, JOURNAL_PACKED_SUFFIX)) {
+                        snprintf(path, sizeof(path), "%s/%s", JOURNAL_DIR,
+                                 entry->d_name);
+                        unlink(path);
+                }
+        }
+        closedir(dir);
+}
+
+/**
+ * @fn static void journal_packer(void *data)
+ * @brief Packs and trims the journal until no request is left, on a worker
+ *        running on the idle CPU and I/O classes
+ * @details Without workers segments are still sealed, just never compressed
+ *          nor deleted.
+ */
+static void journal_packer(void *data)
+{
+        static bool cleaned = false;
+        unsigned requests = __atomic_load_n(&pack_requests, __ATOMIC_ACQUIRE);
+
+        (void) data;
+        if (!cleaned) {
+                journal_remove_temporary();
+                cleaned = true;
+        }
+
+        do {
+                journal_pack_sealed();
+                journal_retain();
+                requests = __atomic_sub_fetch(&pack_requests, requests,
+                                              __ATOMIC_ACQ_REL);
+        } while (requests > 0);
+}
+
+/*
+ * Reading side, used by the CLI. Segments are mapped read-only and every
+ * offset taken from them is checked against the mapping.
+ */
+
+struct journal_segment
+{
+        const uint8_t *map;
+        size_t size;
+        uint64_t data_end;
+        const char *names[JOURNAL_SERVICES_MAX];
+};
+
+static const struct journal_record *journal_record_at(
+                const struct journal_segment *seg, uint64_t offset)
+{
+        const struct journal_record *record = NULL;
+
+        if (offset < sizeof(struct journal_header) ||
+            offset + sizeof(struct journal_record) > seg->data_end) {
+                return NULL;
+        }
+
+        record = (const struct journal_record *) (seg->map + offset);
+        if (offset + sizeof(struct journal_record) + record->length >
+            seg->data_end) {
+                return NULL;
+        }
+
+        return record;
+}
+
+static uint64_t journal_record_next(const struct journal_record *record,
+                                    uint64_t offset)
+{
+        return JOURNAL_ALIGNED(offset + sizeof(struct journal_record) +
+                               record->length);
+}
+
+static void journal_print_record(const struct journal_segment *seg,
+                                 const struct journal_record *record,
+                                 FILE *out)
+{
+        const char *name = NULL;
+
+        if (record->service < JOURNAL_SERVICES_MAX) {
+                name = seg->names[record->service];
+        }
+
+        fprintf(out, "[%5llu.%06llu] <%u> %s: %.*s\n",
+                (unsigned long long) (record->time / 1000000000ULL),
+                (unsigned long long) (record->time % 1000000000ULL / 1000),
+                record->priority, name != NULL ? name : "?",
+                (int) record->length, record->message);
+}
+
+/**
+ * @fn static size_t journal_scan(struct journal_segment *seg,
+ *                                uint64_t offset, const char *service,
+ *                                uint64_t since, FILE *out)
+ * @brief Prints the records from offset on, learning the service names
+ *        from their declarations
+ */
+static size_t journal_scan(struct journal_segment *seg, uint64_t offset,
+                           const char *service, uint64_t since, FILE *out)
+{
+        const struct journal_record *record = NULL;
+        const char *name = NULL;
+        size_t printed = 0;
+
+        while ((record = journal_record_at(seg, offset)) != NULL) {
+                if (record->flags & JOURNAL_RECORD_SERVICE) {
+                        if (record->service < JOURNAL_SERVICES_MAX &&
+                            record->length < JOURNAL_NAME_MAX) {
+                                seg->names[record->service] =
+                                        record->message;
+                        }
+                }
+                else if (record->time >= since) {
+                        name = record->service < JOURNAL_SERVICES_MAX ?
+                               seg->names[record->service] : NULL;
+                        if (service == NULL ||
+                            (name != NULL &&
+                             strncmp(name, service, record->length) ==
+                             STRCMP_EQUAL)) {
+                                journal_print_record(seg, record, out);
+                                printed++;
+                        }
+                }
+                offset = journal_record_next(record, offset);
+        }
+
+        return printed;
+}
+
+/**
+ * @fn static size_t journal_print_sealed(struct journal_segment *seg,
+ *                                        const char *service,
+ *                                        uint64_t since, FILE *out)
+ * @brief Prints the matching records of a sealed segment through its
+ *        indexes, binary searching for since
+ */
+static size_t journal_print_sealed(struct journal_segment *seg,
+                                   const char *service, uint64_t since,
+                                   FILE *out)
+{
+        const struct journal_header *header = (const void *) seg->map;
+        const struct journal_footer *footer = NULL;
+        const struct journal_time_entry *times = NULL;
+        const struct journal_service_entry *services = NULL;
+        const struct journal_service_entry *svc = NULL;
+        const struct journal_record *record = NULL;
+        const uint32_t *offsets = NULL;
+        uint64_t start = sizeof(struct journal_header);
+        size_t printed = 0;
+        size_t low = 0;
+        size_t high = 0;
+        size_t mid = 0;
+        size_t i = 0;
+
+        if (header->footer_offset + sizeof(struct journal_footer) > seg->size) {
+                return journal_scan(seg, start, service, since, out);
+        }
+        footer = (const void *) (seg->map + header->footer_offset);
+        if (footer->service_count > JOURNAL_SERVICES_MAX ||
+            footer->times_offset + footer->time_count *
+            sizeof(struct journal_time_entry) > seg->size ||
+            footer->services_offset + footer->service_count *
+            sizeof(struct journal_service_entry) > seg->size) {
+                return journal_scan(seg, start, service, since, out);
+        }
+        times = (const void *) (seg->map + footer->times_offset);
+        services = (const void *) (seg->map + footer->services_offset);
+
+        for (i = 0; i < footer->service_count; i++) {
+                if (services[i].id < JOURNAL_SERVICES_MAX &&
+                    memchr(services[i].name, '\0', JOURNAL_NAME_MAX) != NULL) {
+                        seg->names[services[i].id] = services[i].name;
+                }
+                if (service != NULL &&
+                    strcmp(services[i].name, service) == STRCMP_EQUAL) {
+                        svc = &services[i];
+                }
+        }
+
+        if (service == NULL) {
+                /* the last index entry before since, then scan */
+                low = 0;
+                high = footer->time_count;
+                while (low < high) {
+                        mid = low + (high - low) / 2;
+                        if (times[mid].time < since) {
+                                low = mid + 1;
+                        }
+                        else {
+                                high = mid;
+                        }
+                }
+                if (low > 0) {
+                        start = times[low - 1].offset;
+                }
+                return journal_scan(seg, start, NULL, since, out);
+        }
+
+        if (svc == NULL || svc->offsets_offset + svc->record_count *
+            sizeof(uint32_t) > seg->size) {
+                return 0;
+        }
+        offsets = (const void *) (seg->map + svc->offsets_offset);
+
+        low = 0;
+        high = svc->record_count;
+        while (low < high) {
+                mid = low + (high - low) / 2;
+                record = journal_record_at(seg, offsets[mid]);
+                if (record != NULL && record->time < since) {
+                        low = mid + 1;
+                }
+                else {
+                        high = mid;
+                }
+        }
+
+        for (i = low; i < svc->record_count; i++) {
+                record = journal_record_at(seg, offsets[i]);
+                if (record != NULL) {
+                        journal_print_record(seg, record, out);
+                        printed++;
+                }
+        }
+
+        return printed;
+}
+
+static size_t journal_print_map(const void *map, size_t size,
+                                const char *service, uint64_t since,
+                                FILE *out)
+{
+        const struct journal_header *header = map;
+        struct journal_segment *seg = NULL;
+        size_t printed = 0;
+
+        if (size < sizeof(struct journal_header) ||
+            memcmp(header->magic, JOURNAL_MAGIC, 4) != 0 ||
+            header->version != JOURNAL_VERSION ||
+            header->last_time < since) {
+                return 0;
+        }
+
+        seg = mem_calloc(MEM_LOGS, 1, sizeof(struct journal_segment));
+        if (seg == NULL) {
+                return 0;
+        }
+
+        seg->map = map;
+        seg->size = size;
+        seg->data_end = __atomic_load_n(&header->data_end, __ATOMIC_ACQUIRE);
+        if (seg->data_end > seg->size) {
+                seg->data_end = seg->size;
+        }
+
+        if (__atomic_load_n(&header->flags, __ATOMIC_ACQUIRE) &
+            JOURNAL_SEALED) {
+                printed = journal_print_sealed(seg, service, since, out);
+        }
+        else {
+                printed = journal_scan(seg, sizeof(struct journal_header),
+                                       service, since, out);
+        }
+
+        mem_free(MEM_LOGS, seg);
+        return printed;
+}
+
+/**
+ * @fn static size_t journal_print_packed(const char *path,
+ *                                        const char *service,
+ *                                        uint64_t since, FILE *out)
+ * @brief Decompresses a packed segment and prints it like a raw one
+ * @details Skipped without decompressing when it ended before since.
+ */
+static size_t journal_print_packed(const char *path, const char *service,
+                                   uint64_t since, FILE *out)
+{
+        const struct journal_packed *packed = NULL;
+        struct stat st;
+        size_t printed = 0;
+        void *buffer = NULL;
+        void *map = MAP_FAILED;
+        int fd = -1;
+
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+                return 0;
+        }
+        if (fstat(fd, &st) == 0 &&
+            (size_t) st.st_size >= sizeof(struct journal_packed)) {
+                map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED,
+                           fd, 0);
+        }
+        close(fd);
+        if (map == MAP_FAILED) {
+                return 0;
+        }
+
+        packed = map;
+        if (memcmp(packed->magic, JOURNAL_PACKED_MAGIC, 4) != 0 ||
+            packed->version != JOURNAL_VERSION ||
+            packed->last_time < since ||
+            packed->packed_size > (size_t) st.st_size -
+            sizeof(struct journal_packed) ||
+            packed->size > JOURNAL_SEGMENT_SIZE * 2ULL) {
+                goto packed_done;
+        }
+
+        buffer = mem_malloc(MEM_LOGS, packed->size);
+        if (buffer != NULL &&
+            lz_decompress(packed + 1, packed->packed_size, buffer,
+                          packed->size) == (ssize_t) packed->size) {
+                printed = journal_print_map(buffer, packed->size, service,
+                                            since, out);
+        }
+        else {
+                fprintf(stderr, "cyrenit: %s is corrupt\n", path);
+        }
+        mem_free(MEM_LOGS, buffer);
+
+packed_done:
+        munmap(map, (size_t) st.st_size);
+        return printed;
+}
+
+static size_t journal_print_segment(const char *path, const char *service,
+                                    uint64_t since, FILE *out)
+{
+        char packed_path[PATH_MAX];
+        struct stat st;
+        size_t printed = 0;
+        void *map = MAP_FAILED;
+        int fd = -1;
+
+        if (journal_has_suffix(path, JOURNAL_PACKED_SUFFIX)) {
+                return journal_print_packed(path, service, since, out);
+        }
+
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+                /* packed since it was listed */
+                snprintf(packed_path, sizeof(packed_path), "%s.lz", path);
+                return errno == ENOENT ?
+                       journal_print_packed(packed_path, service, since, out) :
+                       0;
+        }
+        if (fstat(fd, &st) == 0 &&
+            (size_t) st.st_size >= sizeof(struct journal_header)) {
+                map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED,
+                           fd, 0);
+        }
+        close(fd);
+        if (map == MAP_FAILED) {
+                return 0;
+        }
+
+        printed = journal_print_map(map, (size_t) st.st_size, service, since,
+                                    out);
+        munmap(map, (size_t) st.st_size);
+        return printed;
+}
+
+/**
+ * @fn int journal_print(const char *service, uint64_t since, FILE *out)
+ * @brief Prints the journaled output of service, or of every service if
+ *        NULL, from the monotonic time since on
+ * @return the number of lines printed or -1 if there is no journal
+ * @details Segments that ended before since are skipped by their header
+ *          alone. Packed segments are decompressed in memory.
+ */
+int journal_print(const char *service, uint64_t since, FILE *out)
+{
+        struct dirent **entries = NULL;
+        char path[PATH_MAX];
+        size_t printed = 0;
+        int count = 0;
+        int i = 0;
+
+        count = scandir(JOURNAL_DIR, &entries, journal_filter, alphasort);
+        if (count < 0) {
+                return -1;
+        }
+
+        for (i = 0; i < count; i++) {
+                snprintf(path, sizeof(path), "%s/%s", JOURNAL_DIR,
+                         entries[i]->d_name);
+                /* caught between the rename and the unlink of the packer */
+                if (i + 1 < count &&
+                    strncmp(entries[i]->d_name, entries[i + 1]->d_name,
+                            strlen(entries[i]->d_name)) == STRCMP_EQUAL) {
+                        free(entries[i]);
+                        continue;
+                }
+                free(entries[i]);
+                printed += journal_print_segment(path, service, since, out);
+        }
+        free(entries);
+
+        return (int) printed;
+}
+
+#endif//__JOURNAL_C
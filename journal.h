@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * journal.h - Indexed binary journal of the services' output
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __JOURNAL_H
+#define __JOURNAL_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "control.h"
+
+#define JOURNAL_DIR CONTROL_RUN_DIR "/journal"
+#define JOURNAL_SUFFIX ".journal"
+#define JOURNAL_PACKED_SUFFIX ".journal.lz"
+#define JOURNAL_MAGIC "CYJL"
+#define JOURNAL_PACKED_MAGIC "CYJZ"
+#define JOURNAL_VERSION 1
+/* Segments are preallocated and mapped, records are appended with memcpy */
+#define JOURNAL_SEGMENT_SIZE (4U << 20)
+/* A segment is sealed when full or this old, whichever comes first */
+#define JOURNAL_SEGMENT_AGE_S 3600
+/* Oldest sealed segments are deleted past either limit */
+#define JOURNAL_MAX_USE (64U << 20)
+#define JOURNAL_MAX_AGE_S (7 * 24 * 3600)
+/* How long appends stay off after a segment could not be created */
+#define JOURNAL_RETRY_S 1
+/* One time index entry every this many bytes of records */
+#define JOURNAL_TIME_INDEX_STEP 16384
+#define JOURNAL_NAME_MAX 64
+#define JOURNAL_SERVICES_MAX 4096
+#define JOURNAL_ALIGN 8
+
+/* syslog(3) levels; a "<N>" prefix on a line sets it */
+#define JOURNAL_PRIORITY_DEFAULT 6
+
+#define JOURNAL_SEALED 0x1
+
+/* Declares the name of a service id for the rest of the segment */
+#define JOURNAL_RECORD_SERVICE 0x1
+
+/*
+ * A segment is a header, records in time order and, once sealed, a footer
+ * with the indexes:
+ *
+ *   header | records... | footer | time index | services | offsets
+ *
+ * Times are CLOCK_MONOTONIC nanoseconds. The segment being written has no
+ * footer yet; readers scan it up to data_end, which is only advanced
+ * after a record is complete.
+ */
+struct journal_header
+{
+        char magic[4];
+        uint32_t version;
+        uint64_t sequence;
+        uint64_t first_time;
+        uint64_t last_time;
+        uint64_t record_count;
+        uint64_t data_end;
+        uint64_t footer_offset;
+        uint32_t flags;
+        uint32_t reserved;
+};
+
+struct journal_record
+{
+        uint64_t time;
+        uint32_t service;
+        uint16_t length;
+        uint8_t priority;
+        uint8_t flags;
+        char message[];
+};
+
+struct journal_footer
+{
+        uint32_t time_count;
+        uint32_t service_count;
+        uint64_t times_offset;
+        uint64_t services_offset;
+};
+
+/* Sparse: the first record at or after every JOURNAL_TIME_INDEX_STEP */
+struct journal_time_entry
+{
+        uint64_t time;
+        uint64_t offset;
+};
+
+/* Every record of the service, through offsets_offset, in time order */
+struct journal_service_entry
+{
+        char name[JOURNAL_NAME_MAX];
+        uint32_t id;
+        uint32_t record_count;
+        uint64_t offsets_offset;
+};
+
+/*
+ * Sealed segments are compressed with lz.c in the background into
+ * <sequence>.journal.lz: this header followed by one block.
+ */
+struct journal_packed
+{
+        char magic[4];
+        uint32_t version;
+        uint64_t sequence;
+        uint64_t first_time;
+        uint64_t last_time;
+        uint64_t size;
+        uint64_t packed_size;
+};
+
+bool journal_append(const char *service, int priority, const char *message,
+                    size_t length);
+void journal_close();
+uint64_t journal_now();
+int journal_print(const char *service, uint64_t since, FILE *out);
+
+#endif//__JOURNAL_H
@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * kcmdline.c - Kernel command line parsing
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __KCMDLINE_C
+#define __KCMDLINE_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "cyrenit.h"
+#include "kcmdline.h"
+
+/**
+ * @fn static const char *kcmdline_next(const char *ptr, const char **key,
+ *                                      size_t *key_len, const char **val,
+ *                                      size_t *val_len)
+ * @brief Splits the next `key[=value]` word off the command line
+ * @return the position after the word or NULL at the end of the line
+ * @details Double quotes group spaces like the kernel does, they are not
+ *          part of the returned value.
+ */
+static const char *kcmdline_next(const char *ptr, const char **key,
+                                 size_t *key_len, const char **val,
+                                 size_t *val_len)
+{
+        bool quoted = false;
+
+        while (*ptr == ' ' || *ptr == '\t' || *ptr == '\n') {
+                ptr++;
+        }
+        if (*ptr == '\0') {
+                return NULL;
+        }
+
+        *key = ptr;
+        *val = NULL;
+        *val_len = 0;
+        while (*ptr != '\0' && *ptr != '=' && *ptr != ' ' && *ptr != '\n') {
+                ptr++;
+        }
+        *key_len = (size_t) (ptr - *key);
+
+        if (*ptr != '=') {
+                return ptr;
+        }
+
+        ptr++;
+        if (*ptr == '"') {
+                quoted = true;
+                ptr++;
+        }
+        *val = ptr;
+        while (*ptr != '\0' && *ptr != '\n' &&
+               (quoted ? *ptr != '"' : *ptr != ' ')) {
+                ptr++;
+        }
+        *val_len = (size_t) (ptr - *val);
+        if (quoted && *ptr == '"') {
+                ptr++;
+        }
+
+        return ptr;
+}
+
+static bool kcmdline_read(char *buffer, size_t size)
+{
+        ssize_t ret = 0;
+        int fd = -1;
+
+        fd = open(KCMDLINE_PATH, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+                return false;
+        }
+
+        ret = read(fd, buffer, size - 1);
+        close(fd);
+        if (ret < 0) {
+                return false;
+        }
+
+        buffer[ret] = '\0';
+        return true;
+}
+
+/**
+ * @fn bool kcmdline_get(const char *key, char *value, size_t size)
+ * @brief Looks up the value of key=value on the kernel command line
+ * @param key the parameter name
+ * @param value where to copy the value to
+ * @param size the size of value
+ * @return true if the key is present with a value
+ * @details The last occurrence wins, as it does for the kernel. Requires
+ *          /proc to be mounted.
+ */
+bool kcmdline_get(const char *key, char *value, size_t size)
+{
+        char buffer[KCMDLINE_MAX];
+        const char *ptr = buffer;
+        const char *k = NULL;
+        const char *v = NULL;
+        size_t k_len = 0;
+        size_t v_len = 0;
+        bool found = false;
+
+        if (key == NULL || value == NULL || size == 0 ||
+            !kcmdline_read(buffer, sizeof(buffer))) {
+                return false;
+        }
+
+        while ((ptr = kcmdline_next(ptr, &k, &k_len, &v, &v_len)) != NULL) {
+                if (v == NULL || k_len != strlen(key) ||
+                    strncmp(k, key, k_len) != STRCMP_EQUAL) {
+                        continue;
+                }
+                if (v_len >= size) {
+                        v_len = size - 1;
+                }
+                memcpy(value, v, v_len);
+                value[v_len] = '\0';
+                found = true;
+        }
+
+        return found;
+}
+
+/**
+ * @fn bool kcmdline_has(const char *key)
+ * @brief Checks whether a flag (a word without a value) is present
+ * @param key the flag, e.g. "ro"
+ */
+bool kcmdline_has(const char *key)
+{
+        char buffer[KCMDLINE_MAX];
+        const char *ptr = buffer;
+        const char *k = NULL;
+        const char *v = NULL;
+        size_t k_len = 0;
+        size_t v_len = 0;
+
+        if (key == NULL || !kcmdline_read(buffer, sizeof(buffer))) {
+                return false;
+        }
+
+        while ((ptr = kcmdline_next(ptr, &k, &k_len, &v, &v_len)) != NULL) {
+                if (v == NULL && k_len == strlen(key) &&
+                    strncmp(k, key, k_len) == STRCMP_EQUAL) {
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+#endif//__KCMDLINE_C
@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * kcmdline.h - Kernel command line parsing
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __KCMDLINE_H
+#define __KCMDLINE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define KCMDLINE_PATH "/proc/cmdline"
+#define KCMDLINE_MAX 4096
+
+bool kcmdline_get(const char *key, char *value, size_t size);
+bool kcmdline_has(const char *key);
+
+#endif//__KCMDLINE_H
@@ -0,0 +1,254 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * lz.c - Fast LZ77 block compressor for the journal
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __LZ_C
+#define __LZ_C
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "lz.h"
+
+static uint32_t lz_read32(const uint8_t *p)
+{
+        uint32_t value = 0;
+
+        memcpy(&value, p, sizeof(value));
+        return value;
+}
+
+static uint32_t lz_hash(uint32_t value)
+{
+        return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/* Copies 8 bytes at a time, so up to 7 bytes past length are written */
+static void lz_wildcopy(uint8_t *op, const uint8_t *ip, size_t length)
+{
+        uint8_t *end = op + length;
+
+        do {
+                memcpy(op, ip, 8);
+                op += 8;
+                ip += 8;
+        } while (op < end);
+}
+
+static uint8_t *lz_put_length(uint8_t *op, size_t length)
+{
+        while (length >= 255) {
+                *op++ = 255;
+                length -= 255;
+        }
+        *op++ = (uint8_t) length;
+
+        return op;
+}
+
+static uint8_t *lz_put_literals(uint8_t *op, uint8_t *token,
+                                const uint8_t *literals, size_t length)
+{
+        *token = (uint8_t) ((length >= 15 ? 15 : length) << 4);
+        if (length >= 15) {
+                op = lz_put_length(op, length - 15);
+        }
+        memcpy(op, literals, length);
+
+        return op + length;
+}
+
+/**
+ * @fn size_t lz_bound(size_t size)
+ * @brief Worst case compressed size of size bytes
+ */
+size_t lz_bound(size_t size)
+{
+        return size + size / 255 + 16;
+}
+
+/**
+ * @fn size_t lz_compress(const void *src, size_t size, void *dst,
+ *                        size_t capacity)
+ * @brief Compresses src into dst
+ * @param capacity the size of dst, at least lz_bound(size)
+ * @return the compressed size or 0 on failure
+ * @details Greedy, single probe hash table: fast rather than tight, which
+ *          is plenty for log lines.
+ */
+size_t lz_compress(const void *src, size_t size, void *dst, size_t capacity)
+{
+        const uint8_t *in = src;
+        const uint8_t *end = in + size;
+        const uint8_t *limit = in;
+        const uint8_t *ip = in;
+        const uint8_t *anchor = in;
+        const uint8_t *ref = NULL;
+        uint8_t *op = dst;
+        uint8_t *token = NULL;
+        uint32_t *table = NULL;
+        uint32_t hash = 0;
+        size_t length = 0;
+        size_t offset = 0;
+
+        if (capacity < lz_bound(size)) {
+                return 0;
+        }
+
+        table = calloc(1U << LZ_HASH_BITS, sizeof(uint32_t));
+        if (table == NULL) {
+                return 0;
+        }
+
+        if (size > LZ_MATCH_LIMIT) {
+                limit = end - LZ_MATCH_LIMIT;
+        }
+
+        while (ip < limit) {
+                hash = lz_hash(lz_read32(ip));
+                ref = in + table[hash];
+                table[hash] = (uint32_t) (ip - in);
+                if (ref >= ip || ip - ref > LZ_MAX_OFFSET ||
+                    lz_read32(ref) != lz_read32(ip)) {
+                        /* skip faster the longer nothing matched */
+                        ip += 1 + ((size_t) (ip - anchor) >> 6);
+                        continue;
+                }
+
+                length = LZ_MIN_MATCH;
+                while (ip + length < end - LZ_LAST_LITERALS &&
+                       ref[length] == ip[length]) {
+                        length++;
+                }
+
+                token = op++;
+                op = lz_put_literals(op, token, anchor, (size_t) (ip - anchor));
+                offset = (size_t) (ip - ref);
+                *op++ = (uint8_t) (offset & 0xff);
+                *op++ = (uint8_t) (offset >> 8);
+
+                length -= LZ_MIN_MATCH;
+                *token |= (uint8_t) (length >= 15 ? 15 : length);
+                if (length >= 15) {
+                        op = lz_put_length(op, length - 15);
+                }
+
+                ip += length + LZ_MIN_MATCH;
+                anchor = ip;
+        }
+
+        token = op++;
+        op = lz_put_literals(op, token, anchor, (size_t) (end - anchor));
+        free(table);
+
+        return (size_t) (op - (uint8_t *) dst);
+}
+
+static bool lz_get_length(const uint8_t **ip, const uint8_t *end,
+                          size_t *length)
+{
+        uint8_t byte = 255;
+
+        while (byte == 255) {
+                if (*ip >= end) {
+                        return false;
+                }
+                byte = *(*ip)++;
+                *length += byte;
+        }
+
+        return true;
+}
+
+/**
+ * @fn ssize_t lz_decompress(const void *src, size_t size, void *dst,
+ *                           size_t capacity)
+ * @brief Decompresses src into dst
+ * @return the decompressed size or -1 if src is corrupt or does not fit
+ * @details Every length and offset is checked, src may be untrusted.
+ */
+ssize_t lz_decompress(const void *src, size_t size, void *dst,
+                      size_t capacity)
+{
+        const uint8_t *ip = src;
+        const uint8_t *end = ip + size;
+        uint8_t *out = dst;
+        uint8_t *op = out;
+        uint8_t *oend = out + capacity;
+        const uint8_t *ref = NULL;
+        size_t length = 0;
+        size_t offset = 0;
+        size_t chunk = 0;
+        uint8_t token = 0;
+
+        while (ip < end) {
+                token = *ip++;
+
+                length = token >> 4;
+                if (length == 15 && !lz_get_length(&ip, end, &length)) {
+                        return -1;
+                }
+                if (length > (size_t) (end - ip) ||
+                    length > (size_t) (oend - op)) {
+                        return -1;
+                }
+                if ((size_t) (end - ip) >= length + 8 &&
+                    (size_t) (oend - op) >= length + 8) {
+                        lz_wildcopy(op, ip, length);
+                }
+                else {
+                        memcpy(op, ip, length);
+                }
+                ip += length;
+                op += length;
+
+                if (ip == end) {
+                        break;
+                }
+
+                if (end - ip < 2) {
+                        return -1;
+                }
+                offset = (size_t) ip[0] | (size_t) ip[1] << 8;
+                ip += 2;
+                if (offset == 0 || offset > (size_t) (op - out)) {
+                        return -1;
+                }
+
+                length = token & 15;
+                if (length == 15 && !lz_get_length(&ip, end, &length)) {
+                        return -1;
+                }
+                length += LZ_MIN_MATCH;
+                if (length > (size_t) (oend - op)) {
+                        return -1;
+                }
+
+                ref = op - offset;
+                if (offset >= 8 && (size_t) (oend - op) >= length + 8) {
+                        lz_wildcopy(op, ref, length);
+                        op += length;
+                        continue;
+                }
+                /* overlapping matches repeat, copy what is there so far */
+                while (length > 0) {
+                        chunk = (size_t) (op - ref) < length ?
+                                (size_t) (op - ref) : length;
+                        memcpy(op, ref, chunk);
+                        op += chunk;
+                        length -= chunk;
+                }
+        }
+
+        return (ssize_t) (op - out);
+}
+
+#endif//__LZ_C
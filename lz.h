@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * lz.h - Fast LZ77 block compressor for the journal
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __LZ_H
+#define __LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * The block format is the one of LZ4: sequences of a token (literal length
+ * in the high nibble, match length - 4 in the low one, 15 meaning more
+ * length bytes follow), the literals, and a little endian 16 bit offset of
+ * the match. The last sequence has literals only.
+ */
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 16
+/* The last match starts this far from the end, the last bytes are literals */
+#define LZ_MATCH_LIMIT 12
+#define LZ_LAST_LITERALS 5
+
+size_t lz_bound(size_t size);
+size_t lz_compress(const void *src, size_t size, void *dst, size_t capacity);
+ssize_t lz_decompress(const void *src, size_t size, void *dst,
+                      size_t capacity);
+
+#endif//__LZ_H
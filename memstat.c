@@ -0,0 +1,345 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * memstat.c - Heap accounting and footprint reduction of PID 1
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __MEMSTAT_C
+#define __MEMSTAT_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <malloc.h>
+
+#include <sys/mman.h>
+
+#include "control.h"
+#include "cyrenit.h"
+#include "kcmdline.h"
+#include "memstat.h"
+
+/*
+ * The journal compresses on its own thread, so the counters are updated
+ * atomically. The peak is only a best effort under contention.
+ */
+static struct mem_counter mem_counters[MEM_CLASSES];
+
+static const char *mem_class_names[MEM_CLASSES] = {
+        [MEM_PROC] = "proc",
+        [MEM_MOUNTS] = "mounts",
+        [MEM_ENV] = "env",
+        [MEM_LOGS] = "logs",
+        [MEM_EVENTS] = "events",
+        [MEM_CONTROL] = "control",
+};
+
+/* Bounds of the MEM_HOT code, provided by the linker */
+extern const char __start_cyrenit_hot[] __attribute__((weak));
+extern const char __stop_cyrenit_hot[] __attribute__((weak));
+
+static bool mem_lean = false;
+static size_t mem_locked = 0;
+
+static void mem_count(enum mem_class cls, void *ptr)
+{
+        struct mem_counter *counter = &mem_counters[cls];
+        size_t size = malloc_usable_size(ptr);
+        size_t bytes = 0;
+
+        bytes = __atomic_add_fetch(&counter->bytes, size, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&counter->blocks, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&counter->allocs, 1, __ATOMIC_RELAXED);
+        if (bytes > __atomic_load_n(&counter->peak, __ATOMIC_RELAXED)) {
+                __atomic_store_n(&counter->peak, bytes, __ATOMIC_RELAXED);
+        }
+}
+
+static void mem_uncount(enum mem_class cls, void *ptr)
+{
+        struct mem_counter *counter = &mem_counters[cls];
+
+        __atomic_sub_fetch(&counter->bytes, malloc_usable_size(ptr),
+                           __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&counter->blocks, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @fn void *mem_malloc(enum mem_class cls, size_t size)
+ * @brief malloc() counted as cls
+ */
+void *mem_malloc(enum mem_class cls, size_t size)
+{
+        void *ptr = malloc(size);
+
+        if (ptr != NULL) {
+                mem_count(cls, ptr);
+        }
+
+        return ptr;
+}
+
+/**
+ * @fn void *mem_calloc(enum mem_class cls, size_t count, size_t size)
+ * @brief calloc() counted as cls
+ */
+void *mem_calloc(enum mem_class cls, size_t count, size_t size)
+{
+        void *ptr = calloc(count, size);
+
+        if (ptr != NULL) {
+                mem_count(cls, ptr);
+        }
+
+        return ptr;
+}
+
+/**
+ * @fn void *mem_realloc(enum mem_class cls, void *ptr, size_t size)
+ * @brief realloc() counted as cls
+ * @details As realloc(), ptr is left alone if it fails.
+ */
+void *mem_realloc(enum mem_class cls, void *ptr, size_t size)
+{
+        size_t old_size = ptr != NULL ? malloc_usable_size(ptr) : 0;
+        void *new_ptr = NULL;
+
+        if (size == 0) {
+                mem_free(cls, ptr);
+                return NULL;
+        }
+
+        new_ptr = realloc(ptr, size);
+        if (new_ptr == NULL) {
+                return NULL;
+        }
+
+        if (ptr != NULL) {
+                __atomic_sub_fetch(&mem_counters[cls].bytes, old_size,
+                                   __ATOMIC_RELAXED);
+                __atomic_sub_fetch(&mem_counters[cls].blocks, 1,
+                                   __ATOMIC_RELAXED);
+        }
+        mem_count(cls, new_ptr);
+
+        return new_ptr;
+}
+
+/**
+ * @fn void *mem_reallocarray(enum mem_class cls, void *ptr, size_t count,
+ *                            size_t size)
+ * @brief reallocarray() counted as cls
+ */
+void *mem_reallocarray(enum mem_class cls, void *ptr, size_t count,
+                       size_t size)
+{
+        size_t total = 0;
+
+        if (__builtin_mul_overflow(count, size, &total)) {
+                return NULL;
+        }
+
+        return mem_realloc(cls, ptr, total);
+}
+
+/**
+ * @fn char *mem_strdup(enum mem_class cls, const char *str)
+ * @brief strdup() counted as cls
+ */
+char *mem_strdup(enum mem_class cls, const char *str)
+{
+        char *copy = strdup(str);
+
+        if (copy != NULL) {
+                mem_count(cls, copy);
+        }
+
+        return copy;
+}
+
+/**
+ * @fn void mem_free(enum mem_class cls, void *ptr)
+ * @brief free() of a block allocated as cls
+ */
+void mem_free(enum mem_class cls, void *ptr)
+{
+        if (ptr == NULL) {
+                return;
+        }
+
+        mem_uncount(cls, ptr);
+        free(ptr);
+}
+
+const char *mem_class_name(enum mem_class cls)
+{
+        return cls < MEM_CLASSES ? mem_class_names[cls] : "unknown";
+}
+
+/**
+ * @fn void memstat_get(enum mem_class cls, struct mem_counter *counter)
+ * @brief Copies the counters of cls into counter
+ */
+void memstat_get(enum mem_class cls, struct mem_counter *counter)
+{
+        struct mem_counter *src = &mem_counters[cls];
+
+        counter->bytes = __atomic_load_n(&src->bytes, __ATOMIC_RELAXED);
+        counter->peak = __atomic_load_n(&src->peak, __ATOMIC_RELAXED);
+        counter->blocks = __atomic_load_n(&src->blocks, __ATOMIC_RELAXED);
+        counter->allocs = __atomic_load_n(&src->allocs, __ATOMIC_RELAXED);
+}
+
+/**
+ * @fn uint64_t memstat_allocs()
+ * @brief Allocations made so far, in every class
+ */
+uint64_t memstat_allocs()
+{
+        uint64_t total = 0;
+        int i = 0;
+
+        for (i = 0; i < MEM_CLASSES; i++) {
+                total += __atomic_load_n(&mem_counters[i].allocs,
+                                         __ATOMIC_RELAXED);
+        }
+
+        return total;
+}
+
+/* Locks the pages holding the MEM_HOT code */
+static size_t memstat_lock_hot()
+{
+        uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+        uintptr_t start = 0;
+        uintptr_t end = 0;
+
+        if (__start_cyrenit_hot == NULL || __stop_cyrenit_hot == NULL) {
+                return 0;
+        }
+
+        start = (uintptr_t) __start_cyrenit_hot & ~(page - 1);
+        end = ((uintptr_t) __stop_cyrenit_hot + page - 1) & ~(page - 1);
+        if (mlock((void *) start, end - start) != 0) {
+                perror("cyrenit: failed to lock the hot code in memory");
+                return 0;
+        }
+
+        return end - start;
+}
+
+/**
+ * @fn bool memstat_lean_init()
+ * @brief Enters lean mode if cyrenit.lean is on the kernel command line
+ * @return true if in lean mode
+ * @details To be called before any thread is started: malloc is kept to a
+ *          single arena that is trimmed eagerly, stdio does not buffer, and
+ *          the MEM_HOT code is locked in memory. Nothing else is locked,
+ *          the rest of PID 1 may be paged out.
+ */
+bool memstat_lean_init()
+{
+        if (!kcmdline_has("cyrenit.lean")) {
+                return false;
+        }
+
+        mem_lean = true;
+        mallopt(M_ARENA_MAX, 1);
+        mallopt(M_TRIM_THRESHOLD, MEM_TRIM_THRESHOLD);
+
+        /* the console queue already assembles whole lines */
+        fflush(stdout);
+        fflush(stderr);
+        setvbuf(stdin, NULL, _IONBF, 0);
+        setvbuf(stdout, NULL, _IONBF, 0);
+        setvbuf(stderr, NULL, _IONBF, 0);
+
+        mem_locked = memstat_lock_hot();
+        fprintf(stdout, "cyrenit: lean mode, %zu KiB of hot code locked\n",
+                mem_locked / 1024);
+
+        return true;
+}
+
+/**
+ * @fn void memstat_settle()
+ * @brief Gives back to the kernel what booting left free on the heap
+ * @details Does nothing out of lean mode.
+ */
+void memstat_settle()
+{
+        if (mem_lean) {
+                malloc_trim(0);
+        }
+}
+
+/* Reads a "Key:   N kB" line of /proc/self/status */
+static unsigned long long memstat_status_kb(const char *key)
+{
+        char line[128];
+        unsigned long long value = 0;
+        size_t length = strlen(key);
+        FILE *status = fopen("/proc/self/status", "re");
+
+        if (status == NULL) {
+                return 0;
+        }
+
+        while (fgets(line, sizeof(line), status) != NULL) {
+                if (strncmp(line, key, length) == STRCMP_EQUAL &&
+                    line[length] == ':') {
+                        sscanf(line + length + 1, "%llu", &value);
+                        break;
+                }
+        }
+        fclose(status);
+
+        return value;
+}
+
+static void memstat_command(int argc, char **argv,
+                            struct control_reply *reply)
+{
+        struct mem_counter counter;
+        struct mallinfo2 info = mallinfo2();
+        int i = 0;
+
+        (void) argc;
+        (void) argv;
+        control_reply_printf(reply, "# rss_kb=%llu locked_kb=%llu "
+                             "heap_kb=%zu heap_free_kb=%zu mmap_kb=%zu "
+                             "lean=%s hot_kb=%zu\n",
+                             memstat_status_kb("VmRSS"),
+                             memstat_status_kb("VmLck"),
+                             info.arena / 1024, info.fordblks / 1024,
+                             info.hblkhd / 1024, mem_lean ? "yes" : "no",
+                             mem_locked / 1024);
+
+        for (i = 0; i < MEM_CLASSES; i++) {
+                memstat_get(i, &counter);
+                control_reply_printf(reply, "class=%s bytes=%zu peak=%zu "
+                                     "blocks=%zu allocs=%llu\n",
+                                     mem_class_name(i), counter.bytes,
+                                     counter.peak, counter.blocks,
+                                     (unsigned long long) counter.allocs);
+        }
+}
+
+/**
+ * @fn void memstat_init()
+ * @brief Serves `cyrenit memstat`
+ */
+void memstat_init()
+{
+        control_register("memstat", "dump PID 1's heap use by subsystem",
+                         memstat_command);
+}
+
+#endif//__MEMSTAT_C
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * memstat.h - Heap accounting and footprint reduction of PID 1
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __MEMSTAT_H
+#define __MEMSTAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * What PID 1 keeps on the heap is allocated through the mem_* wrappers,
+ * which count it by subsystem. Sizes are the usable ones malloc reports,
+ * so a block must be freed with the class it was allocated with. Timers
+ * live inside their owners, the event loop's tables count as "events".
+ */
+enum mem_class
+{
+        MEM_PROC = 0,
+        MEM_MOUNTS,
+        MEM_ENV,
+        MEM_LOGS,
+        MEM_EVENTS,
+        MEM_CONTROL,
+        MEM_CLASSES
+};
+
+struct mem_counter
+{
+        size_t bytes;
+        size_t peak;
+        size_t blocks;
+        uint64_t allocs;
+};
+
+/*
+ * Code run on every round of the event loop. In lean mode (cyrenit.lean on
+ * the kernel command line) it is locked in memory, so PID 1 does not page
+ * fault its way back in after it was swapped or reclaimed.
+ */
+#define MEM_HOT __attribute__((section("cyrenit_hot")))
+#define MEM_TRIM_THRESHOLD (64 * 1024)
+
+void *mem_malloc(enum mem_class cls, size_t size);
+void *mem_calloc(enum mem_class cls, size_t count, size_t size);
+void *mem_realloc(enum mem_class cls, void *ptr, size_t size);
+void *mem_reallocarray(enum mem_class cls, void *ptr, size_t count,
+                       size_t size);
+char *mem_strdup(enum mem_class cls, const char *str);
+void mem_free(enum mem_class cls, void *ptr);
+
+const char *mem_class_name(enum mem_class cls);
+void memstat_get(enum mem_class cls, struct mem_counter *counter);
+uint64_t memstat_allocs();
+bool memstat_lean_init();
+void memstat_settle();
+void memstat_init();
+
+#endif//__MEMSTAT_H
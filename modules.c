@@ -0,0 +1,622 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * modules.c - Kernel modules loaded in parallel during bootstrap
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __MODULES_C
+#define __MODULES_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <linux/limits.h>
+#include <linux/module.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+#include "cyrenit.h"
+#include "kcmdline.h"
+#include "modules.h"
+#include "par.h"
+
+#define MODULES_ALLOC_STEP 16
+
+/* A line of modules.dep, split in place */
+struct modules_dep
+{
+        char *name;
+        char *path;
+        char *deps;
+};
+
+struct modules_index
+{
+        char *text;
+        struct modules_dep *entries;
+        size_t count;
+};
+
+static const char *modules_suffixes[] = { ".ko", ".ko.gz", ".ko.xz",
+                                          ".ko.zst" };
+
+#define MODULES_SUFFIXES \
+        (sizeof(modules_suffixes) / sizeof(modules_suffixes[0]))
+
+/**
+ * @fn static char *modules_name(const char *path)
+ * @brief Module name of a file or a name as the user wrote it
+ * @return "snd_hda_intel" for ".../snd-hda-intel.ko.zst", or NULL
+ */
+static char *modules_name(const char *path)
+{
+        const char *base = strrchr(path, '/');
+        size_t length = 0;
+        size_t suffix = 0;
+        char *name = NULL;
+        size_t i = 0;
+
+        base = base == NULL ? path : base + 1;
+        length = strlen(base);
+        for (i = 0; i < MODULES_SUFFIXES; i++) {
+                suffix = strlen(modules_suffixes[i]);
+                if (length > suffix &&
+                    strcmp(base + length - suffix, modules_suffixes[i]) ==
+                    STRCMP_EQUAL) {
+                        length -= suffix;
+                        break;
+                }
+        }
+
+        name = strndup(base, length);
+        for (i = 0; name != NULL && i < length; i++) {
+                if (name[i] == '-') {
+                        name[i] = '_';
+                }
+        }
+
+        return name;
+}
+
+/* Loaded already, or built in with parameters */
+static bool modules_present(const char *name)
+{
+        char path[PATH_MAX];
+
+        snprintf(path, sizeof(path), MODULES_SYSFS "/%s", name);
+        return access(path, F_OK) == 0;
+}
+
+static bool modules_builtin(const char *dir, const char *name)
+{
+        char path[PATH_MAX];
+        char line[MODULES_LINE_MAX];
+        bool found = false;
+        char *other = NULL;
+        FILE *f = NULL;
+
+        snprintf(path, sizeof(path), "%s/modules.builtin", dir);
+        f = fopen(path, "re");
+        if (f == NULL) {
+                return false;
+        }
+
+        while (!found && fgets(line, sizeof(line), f) != NULL) {
+                line[strcspn(line, "\n")] = '\0';
+                other = modules_name(line);
+                found = other != NULL &&
+                        strcmp(other, name) == STRCMP_EQUAL;
+                free(other);
+        }
+        fclose(f);
+
+        return found;
+}
+
+static int modules_dep_compare(const void *a, const void *b)
+{
+        const struct modules_dep *x = a;
+        const struct modules_dep *y = b;
+
+        return strcmp(x->name, y->name);
+}
+
+static void modules_index_free(struct modules_index *index)
+{
+        size_t i = 0;
+
+        for (i = 0; i < index->count; i++) {
+                free(index->entries[i].name);
+        }
+        free(index->entries);
+        free(index->text);
+}
+
+/**
+ * @fn static bool modules_index_load(struct modules_index *index,
+ *                                    const char *dir)
+ * @brief Reads modules.dep and sorts it by module name
+ * @details Lines are "path: dependency paths...", the dependencies being
+ *          every module the first one needs, directly or not.
+ */
+static bool modules_index_load(struct modules_index *index, const char *dir)
+{
+        char path[PATH_MAX];
+        struct stat st;
+        char *line = NULL;
+        char *next = NULL;
+        char *colon = NULL;
+        size_t lines = 0;
+        size_t done = 0;
+        ssize_t ret = 0;
+        int fd = -1;
+
+        memset(index, 0, sizeof(*index));
+        snprintf(path, sizeof(path), "%s/modules.dep", dir);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1 || fstat(fd, &st) != 0) {
+                fprintf(stderr, "cyrenit: cannot read %s: %s\n", path,
+                        strerror(errno));
+                if (fd != -1) {
+                        close(fd);
+                }
+                return false;
+        }
+
+        index->text = malloc((size_t) st.st_size + 1);
+        while (index->text != NULL && done < (size_t) st.st_size) {
+                ret = read(fd, index->text + done, (size_t) st.st_size - done);
+                if (ret <= 0) {
+                        break;
+                }
+                done += (size_t) ret;
+        }
+        close(fd);
+        if (index->text == NULL) {
+                return false;
+        }
+        index->text[done] = '\0';
+
+        for (line = index->text; *line != '\0'; line++) {
+                lines += *line == '\n';
+        }
+        index->entries = calloc(lines + 1, sizeof(struct modules_dep));
+        if (index->entries == NULL) {
+                modules_index_free(index);
+                return false;
+        }
+
+        for (line = index->text; line != NULL && *line != '\0'; line = next) {
+                next = strchr(line, '\n');
+                if (next != NULL) {
+                        *next++ = '\0';
+                }
+                colon = strchr(line, ':');
+                if (colon == NULL) {
+                        continue;
+                }
+                *colon = '\0';
+                index->entries[index->count].path = line;
+                index->entries[index->count].deps = colon + 1;
+                index->entries[index->count].name = modules_name(line);
+                if (index->entries[index->count].name != NULL) {
+                        index->count++;
+                }
+        }
+
+        qsort(index->entries, index->count, sizeof(struct modules_dep),
+              modules_dep_compare);
+        return true;
+}
+
+static struct modules_dep *modules_index_find(struct modules_index *index,
+                                              char *name)
+{
+        struct modules_dep key = { name, NULL, NULL };
+
+        return bsearch(&key, index->entries, index->count,
+                       sizeof(struct modules_dep), modules_dep_compare);
+}
+
+static void modules_set_free(struct module_set *set)
+{
+        size_t i = 0;
+
+        for (i = 0; i < set->count; i++) {
+                free(set->modules[i].name);
+                free(set->modules[i].path);
+                free(set->modules[i].options);
+                free(set->modules[i].users);
+        }
+        free(set->modules);
+}
+
+/**
+ * @fn static ssize_t modules_set_add(struct module_set *set,
+ *                                    struct modules_dep *dep)
+ * @brief Adds the module of a modules.dep entry to the set, once
+ * @return its index in the set, or -1 on allocation failure
+ */
+static ssize_t modules_set_add(struct module_set *set,
+                               struct modules_dep *dep)
+{
+        struct module *new_modules = NULL;
+        struct module *mod = NULL;
+        size_t i = 0;
+
+        for (i = 0; i < set->count; i++) {
+                if (strcmp(set->modules[i].name, dep->name) == STRCMP_EQUAL) {
+                        return (ssize_t) i;
+                }
+        }
+
+        if (set->count >= set->allocated) {
+                new_modules = reallocarray(set->modules,
+                                           set->allocated + MODULES_ALLOC_STEP,
+                                           sizeof(struct module));
+                if (new_modules == NULL) {
+                        return -1;
+                }
+                set->modules = new_modules;
+                set->allocated += MODULES_ALLOC_STEP;
+        }
+
+        mod = &set->modules[set->count];
+        memset(mod, 0, sizeof(struct module));
+        mod->name = strdup(dep->name);
+        mod->path = strdup(dep->path);
+        if (mod->name == NULL || mod->path == NULL) {
+                free(mod->name);
+                free(mod->path);
+                return -1;
+        }
+        atomic_init(&mod->waiting, 0);
+        atomic_init(&mod->failed, false);
+
+        return (ssize_t) set->count++;
+}
+
+/* Records that the module at user needs the one at index */
+static bool modules_set_need(struct module_set *set, size_t user, size_t index)
+{
+        struct module *mod = &set->modules[index];
+        size_t *new_users = reallocarray(mod->users, mod->user_count + 1,
+                                         sizeof(size_t));
+
+        if (new_users == NULL) {
+                return false;
+        }
+        mod->users = new_users;
+        mod->users[mod->user_count++] = user;
+        atomic_fetch_add(&set->modules[user].waiting, 1);
+
+        return true;
+}
+
+/**
+ * @fn static bool modules_set_resolve(struct module_set *set,
+ *                                     struct modules_index *index)
+ * @brief Adds what every module of the set needs, until nothing is missing
+ * @details Dependencies are looked up for each module, not only for the
+ *          requested ones, so that two of them are never loaded at once
+ *          when one needs the other.
+ */
+static bool modules_set_resolve(struct module_set *set,
+                                struct modules_index *index)
+{
+        struct modules_dep *dep = NULL;
+        char *saveptr = NULL;
+        char *token = NULL;
+        char *name = NULL;
+        ssize_t needed = 0;
+        size_t i = 0;
+        bool ok = true;
+
+        for (i = 0; ok && i < set->count; i++) {
+                if (set->modules[i].resolved) {
+                        continue;
+                }
+                set->modules[i].resolved = true;
+                dep = modules_index_find(index, set->modules[i].name);
+                if (dep == NULL || dep->deps == NULL) {
+                        continue;
+                }
+
+                for (token = strtok_r(dep->deps, " \t", &saveptr);
+                     ok && token != NULL;
+                     token = strtok_r(NULL, " \t", &saveptr)) {
+                        name = modules_name(token);
+                        dep = name == NULL ? NULL :
+                              modules_index_find(index, name);
+                        if (dep != NULL && !modules_present(name)) {
+                                needed = modules_set_add(set, dep);
+                                ok = needed != -1 &&
+                                     modules_set_need(set, i,
+                                                      (size_t) needed);
+                        }
+                        free(name);
+                }
+                /* tokenized for good, it must not be split again */
+                modules_index_find(index, set->modules[i].name)->deps = NULL;
+        }
+
+        return ok;
+}
+
+/* A request of the config file or the command line */
+static bool modules_request(struct module_set *set,
+                            struct modules_index *index, const char *request,
+                            const char *options)
+{
+        struct modules_dep *dep = NULL;
+        char *name = modules_name(request);
+        ssize_t added = 0;
+
+        if (name == NULL) {
+                return false;
+        }
+        if (modules_present(name)) {
+                free(name);
+                return true;
+        }
+
+        dep = modules_index_find(index, name);
+        if (dep == NULL) {
+                if (!modules_builtin(set->dir, name)) {
+                        fprintf(stderr, "cyrenit: unknown kernel module "
+                                "%s\n", name);
+                }
+                free(name);
+                return true;
+        }
+        free(name);
+
+        added = modules_set_add(set, dep);
+        if (added == -1) {
+                return false;
+        }
+        if (options != NULL && *options != '\0' &&
+            set->modules[added].options == NULL) {
+                set->modules[added].options = strdup(options);
+        }
+
+        return true;
+}
+
+static void modules_read_conf(struct module_set *set,
+                              struct modules_index *index, const char *path)
+{
+        char line[MODULES_LINE_MAX];
+        char *name = NULL;
+        char *options = NULL;
+        FILE *f = fopen(path, "re");
+
+        if (f == NULL) {
+                return;
+        }
+
+        while (fgets(line, sizeof(line), f) != NULL) {
+                line[strcspn(line, "#\n")] = '\0';
+                name = line + strspn(line, " \t");
+                if (*name == '\0') {
+                        continue;
+                }
+                options = name + strcspn(name, " \t");
+                if (*options != '\0') {
+                        *options++ = '\0';
+                        options += strspn(options, " \t");
+                }
+                modules_request(set, index, name, options);
+        }
+        fclose(f);
+}
+
+static void modules_read_cmdline(struct module_set *set,
+                                 struct modules_index *index)
+{
+        char value[KCMDLINE_MAX];
+        char *saveptr = NULL;
+        char *name = NULL;
+
+        if (!kcmdline_get("cyrenit.modules", value, sizeof(value))) {
+                return;
+        }
+
+        for (name = strtok_r(value, ",", &saveptr); name != NULL;
+             name = strtok_r(NULL, ",", &saveptr)) {
+                modules_request(set, index, name, NULL);
+        }
+}
+
+static bool modules_compressed(const char *path)
+{
+        size_t length = strlen(path);
+
+        return length > 3 && strcmp(path + length - 3, ".ko") != STRCMP_EQUAL;
+}
+
+static void modules_path(struct module_set *set, struct module *mod,
+                         char *path, size_t size)
+{
+        // older depmod wrote absolute paths
+        snprintf(path, size, "%s/%s", *mod->path == '/' ? "" : set->dir,
+                 mod->path);
+}
+
+/* Runs on a worker: failures are only recorded, stderr belongs to the loop */
+static bool modules_insert(struct module_set *set, struct module *mod)
+{
+        char path[PATH_MAX];
+        long ret = 0;
+        int fd = -1;
+
+        modules_path(set, mod, path, sizeof(path));
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+                mod->error = errno;
+                return false;
+        }
+        mod->opened = true;
+
+        // the kernel decompresses what it was built to
+        ret = syscall(SYS_finit_module, fd,
+                      mod->options != NULL ? mod->options : "",
+                      modules_compressed(mod->path) ?
+                      MODULE_INIT_COMPRESSED_FILE : 0);
+        if (ret != 0 && errno != EEXIST) {
+                mod->error = errno;
+                close(fd);
+                return false;
+        }
+        close(fd);
+
+        return true;
+}
+
+/**
+ * @fn static void modules_report(struct module_set *set, struct module *mod)
+ * @brief Prints why mod was not loaded, if it was not
+ */
+static void modules_report(struct module_set *set, struct module *mod)
+{
+        char path[PATH_MAX];
+
+        if (mod->skipped) {
+                fprintf(stderr, "cyrenit: not loading module %s, a module "
+                        "it needs failed\n", mod->name);
+        }
+        else if (mod->error != 0 && !mod->opened) {
+                modules_path(set, mod, path, sizeof(path));
+                fprintf(stderr, "cyrenit: cannot open module %s: %s\n", path,
+                        strerror(mod->error));
+        }
+        else if (mod->error != 0) {
+                fprintf(stderr, "cyrenit: failed to load module %s: %s\n",
+                        mod->name, strerror(mod->error));
+        }
+}
+
+/**
+ * @fn static void modules_load_one(struct par_queue *q, void *item,
+ *                                  void *ctx)
+ * @brief Loads a module whose dependencies are in, then queues the
+ *        modules that were only waiting for it
+ */
+static void modules_load_one(struct par_queue *q, void *item, void *ctx)
+{
+        struct module_set *set = ctx;
+        struct module *mod = item;
+        struct module *user = NULL;
+        bool ok = false;
+        size_t i = 0;
+
+        if (atomic_load(&mod->failed)) {
+                mod->skipped = true;
+        }
+        else {
+                ok = modules_insert(set, mod);
+        }
+        atomic_fetch_add(ok ? &set->loaded : &set->failed, 1);
+
+        for (i = 0; i < mod->user_count; i++) {
+                user = &set->modules[mod->users[i]];
+                if (!ok) {
+                        atomic_store(&user->failed, true);
+                }
+                if (atomic_fetch_sub(&user->waiting, 1) == 1) {
+                        par_push(q, user);
+                }
+        }
+}
+
+static size_t modules_workers()
+{
+        size_t workers = par_workers();
+
+        return workers < MODULES_MIN_WORKERS ? MODULES_MIN_WORKERS : workers;
+}
+
+/**
+ * @fn size_t modules_load(const char *path)
+ * @brief Loads the kernel modules listed in path and on the kernel
+ *        command line, with what they need
+ * @param path the list, NULL for MODULES_CONF
+ * @return the number of modules loaded
+ * @details Blocks until every module is loaded or failed. Nothing is read
+ *          from /lib/modules when no module is asked for.
+ */
+size_t modules_load(const char *path)
+{
+        struct module_set set;
+        struct modules_index index;
+        struct utsname uts;
+        struct timespec start;
+        struct timespec end;
+        void **items = NULL;
+        size_t ready = 0;
+        size_t i = 0;
+
+        if (path == NULL) {
+                path = MODULES_CONF;
+        }
+        if (access(path, R_OK) != 0 && !kcmdline_has("cyrenit.modules")) {
+                return 0;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        memset(&set, 0, sizeof(set));
+        atomic_init(&set.loaded, 0);
+        atomic_init(&set.failed, 0);
+        uname(&uts);
+        snprintf(set.dir, sizeof(set.dir), MODULES_DIR "/%s", uts.release);
+        if (!modules_index_load(&index, set.dir)) {
+                return 0;
+        }
+
+        modules_read_conf(&set, &index, path);
+        modules_read_cmdline(&set, &index);
+        if (!modules_set_resolve(&set, &index)) {
+                fprintf(stderr, "cyrenit: out of memory resolving kernel "
+                        "modules\n");
+        }
+        modules_index_free(&index);
+
+        items = calloc(set.count + 1, sizeof(void *));
+        for (i = 0; items != NULL && i < set.count; i++) {
+                if (atomic_load(&set.modules[i].waiting) == 0) {
+                        items[ready++] = &set.modules[i];
+                }
+        }
+        if (ready > 0) {
+                par_run(modules_load_one, &set, items, ready,
+                        modules_workers());
+        }
+        free(items);
+        for (i = 0; i < set.count; i++) {
+                modules_report(&set, &set.modules[i]);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        fprintf(stdout, "cyrenit: loaded %zu kernel modules (%zu failed) in "
+                "%ld us\n", atomic_load(&set.loaded),
+                atomic_load(&set.failed),
+                (long) ((end.tv_sec - start.tv_sec) * 1000000 +
+                        (end.tv_nsec - start.tv_nsec) / 1000));
+        modules_set_free(&set);
+
+        return atomic_load(&set.loaded);
+}
+
+#endif//__MODULES_C
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * modules.h - Kernel modules loaded in parallel during bootstrap
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __MODULES_H
+#define __MODULES_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define MODULES_CONF "/etc/cyrenit/modules"
+#define MODULES_DIR "/lib/modules"
+#define MODULES_SYSFS "/sys/module"
+#define MODULES_LINE_MAX 1024
+/* module init functions mostly wait on hardware, not on a CPU */
+#define MODULES_MIN_WORKERS 4
+
+/*
+ * MODULES_CONF lists a module per line, optionally followed by its
+ * parameters ("snd_hda_intel power_save=1"); '#' starts a comment.
+ * cyrenit.modules=a,b on the kernel command line adds more. Names are
+ * looked up in modules.dep of the running kernel, which lists every module
+ * a module needs; modules already loaded or built in are skipped.
+ *
+ * Each module is loaded with finit_module() as soon as everything it
+ * needs is, so independent ones load concurrently on par_run() workers.
+ * A module whose dependency failed is not tried.
+ */
+struct module
+{
+        char *name;
+        /* relative to the modules directory of the running kernel */
+        char *path;
+        char *options;
+        /* modules of the set that need this one */
+        size_t *users;
+        size_t user_count;
+        /* its own dependencies were looked up */
+        bool resolved;
+        /* dependencies of the set not loaded yet */
+        atomic_size_t waiting;
+        atomic_bool failed;
+        /* why it was not loaded, reported once the workers are done */
+        int error;
+        bool opened;
+        bool skipped;
+};
+
+struct module_set
+{
+        char dir[MODULES_LINE_MAX];
+        struct module *modules;
+        size_t count;
+        size_t allocated;
+        atomic_size_t loaded;
+        atomic_size_t failed;
+};
+
+size_t modules_load(const char *path);
+
+#endif//__MODULES_H
@@ -13,17 +13,32 @@
 #ifndef __MOUNTS_C
 #define __MOUNTS_C
 
+#include "memstat.h"
 #include "mounts.h"
+#include "pool.h"
+#include "uevent.h"
 
+#ifndef _DEFAULT_SOURCE
 #define _DEFAULT_SOURCE
+#endif
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
 
 #include <sys/mount.h>
+#include <sys/stat.h>
 
-struct mount_task_list mounts = { .mount_tasks = NULL, .count = 0 };
+#define FSTAB_LINE_MAX 1024
+
+struct mount_task_list mounts = {
+        .mount_tasks = NULL,
+        .count = 0,
+        .allocated = 0
+};
 
 /**
  * @fn bool add_mount_task(struct mount_task *task)
@@ -35,6 +50,8 @@ struct mount_task_list mounts = { .mount_tasks = NULL, .count = 0 };
 bool add_mount_task(struct mount_task *task)
 {
         struct mount_task *add = NULL;
+        struct mount_task **new_tasks = NULL;
+        size_t new_size = 0;
 
         if (task == NULL) {
                 return false;
@@ -45,28 +62,27 @@ bool add_mount_task(struct mount_task *task)
                 return false;
         }
 
-        if (mounts.mount_tasks == NULL) {
-                mounts.count = MT_EMPTY;
-                mounts.mount_tasks = calloc(mounts.count, MT_SIZE);
-                if (mounts.mount_tasks == NULL) {
-                        goto add_mtask_free_and_return;
-                }
-        }
-        else {
-                mounts.mount_tasks = reallocarray(mounts.mount_tasks,
-                                                mounts.count+1, MT_SIZE);
-                if (mounts.mount_tasks == NULL) {
+        /* one spare slot keeps the array NULL terminated */
+        if (mounts.count + 1 >= mounts.allocated) {
+                new_size = mounts.allocated > 0 ? mounts.allocated * 2 :
+                           MT_ALLOC_STEP;
+                new_tasks = mem_reallocarray(MEM_MOUNTS, mounts.mount_tasks,
+                                             new_size, MT_PTR_SIZE);
+                if (new_tasks == NULL) {
                         goto add_mtask_free_and_return;
                 }
+                mounts.mount_tasks = new_tasks;
+                mounts.allocated = new_size;
         }
 
         mounts.mount_tasks[mounts.count] = add;
         mounts.count++;
+        mounts.mount_tasks[mounts.count] = NULL;
 
         return true;
 
 add_mtask_free_and_return:
-        free(add);
+        mount_task_destroy(add);
         return false;
 }
 
@@ -86,9 +102,69 @@ void free_mount_task_list()
                 mount_task_destroy(mounts.mount_tasks[i]);
         }
 
-        free(mounts.mount_tasks);
+        mem_free(MEM_MOUNTS, mounts.mount_tasks);
+        mounts.mount_tasks = NULL;
         mounts.count = MT_EMPTY;
-        
+        mounts.allocated = 0;
+}
+
+/* Whether path lies beneath dir, or is dir itself if self */
+static bool mounts_beneath(const char *path, const char *dir, bool self)
+{
+        size_t length = strlen(dir);
+
+        while (length > 1 && dir[length - 1] == '/') {
+                length--;
+        }
+        if (strncmp(path, dir, length) != 0) {
+                return false;
+        }
+
+        return path[length] == '/' || length == 1 ||
+               (self && path[length] == '\0');
+}
+
+/**
+ * @fn size_t mounts_retain(const char **targets)
+ * @brief Drops every task but the mounted critical ones at or beneath one of
+ *        targets
+ * @param targets NULL terminated
+ * @return the number of tasks dropped
+ * @details Used after switching root with the mounts moved into it: the
+ *          rest of the initramfs' list would be mounted into the real root.
+ */
+size_t mounts_retain(const char **targets)
+{
+        struct mount_task *task = NULL;
+        const char **target = NULL;
+        size_t dropped = 0;
+        size_t kept = 0;
+        size_t i = 0;
+        bool keep = false;
+
+        for (i = 0; i < mounts.count; i++) {
+                task = mounts.mount_tasks[i];
+                keep = false;
+                for (target = targets; !keep && *target != NULL; target++) {
+                        keep = task->tier == MOUNT_TIER_CRITICAL &&
+                               task->mounted &&
+                               mounts_beneath(task->target, *target, true);
+                }
+
+                if (keep) {
+                        mounts.mount_tasks[kept++] = task;
+                        continue;
+                }
+                mount_task_destroy(task);
+                dropped++;
+        }
+
+        mounts.count = kept;
+        if (mounts.mount_tasks != NULL) {
+                mounts.mount_tasks[kept] = NULL;
+        }
+
+        return dropped;
 }
 
 /**
@@ -100,7 +176,10 @@ struct mount_task *mount_task_create()
 {
         struct mount_task *ret = NULL;
 
-        ret = malloc(MT_SIZE);
+        ret = mem_malloc(MEM_MOUNTS, MT_SIZE);
+        if (ret == NULL) {
+                return NULL;
+        }
         bzero(ret, MT_SIZE);
 
         return ret;
@@ -135,6 +214,7 @@ struct mount_task *mount_task_duplicate(struct mount_task *task)
         set_fs = mount_task_set_fstype(ret, task->fs_type);
         set_data = mount_task_set_data(ret, task->data_size, task->data);
         set_flags = mount_task_set_flags(ret, task->flags);
+        ret->tier = task->tier;
 
         if (!set_src || !set_target || !set_fs || !set_flags || !set_data) {
                 mount_task_destroy(ret);
@@ -159,10 +239,10 @@ bool mount_task_set_source(struct mount_task *task, const char *source)
         }
 
         if (task->source != NULL) {
-                free(task->source);
+                mem_free(MEM_MOUNTS, task->source);
         }
 
-        task->source = strdup(source);
+        task->source = mem_strdup(MEM_MOUNTS, source);
         return task->source != NULL;
 }
 
@@ -180,10 +260,10 @@ bool mount_task_set_target(struct mount_task *task, const char *target)
         }
 
         if (task->target != NULL) {
-                free(task->target);
+                mem_free(MEM_MOUNTS, task->target);
         }
 
-        task->target = strdup(target);
+        task->target = mem_strdup(MEM_MOUNTS, target);
         return task->target != NULL;
 }
 
@@ -202,10 +282,10 @@ bool mount_task_set_fstype(struct mount_task *task, const char *type)
         }
 
         if (task->fs_type != NULL) {
-                free(task->fs_type);
+                mem_free(MEM_MOUNTS, task->fs_type);
         }
 
-        task->fs_type = strdup(type);
+        task->fs_type = mem_strdup(MEM_MOUNTS, type);
         return task->fs_type != NULL;
 }
 
@@ -224,7 +304,7 @@ bool mount_task_set_data(struct mount_task *task, size_t size, const void *data)
         }
 
         if (task->data != NULL) {
-                free(task->data);
+                mem_free(MEM_MOUNTS, task->data);
                 task->data_size = 0;
         }
 
@@ -233,7 +313,7 @@ bool mount_task_set_data(struct mount_task *task, size_t size, const void *data)
         }
 
         task->data_size = size;
-        task->data = malloc(size);
+        task->data = mem_malloc(MEM_MOUNTS, size);
         if (task->data == NULL) {
                 return false;
         }
@@ -259,6 +339,23 @@ bool mount_task_set_flags(struct mount_task *task, unsigned long flags)
         return true;
 }
 
+/**
+ * @fn bool mount_task_set_tier(struct mount_task *task, enum mount_tier tier)
+ * @brief Sets when a mount_task is mounted
+ * @param task the mount_task to be modified
+ * @param tier critical, deferred or on-demand
+ * @return true on success or false on failure
+ */
+bool mount_task_set_tier(struct mount_task *task, enum mount_tier tier)
+{
+        if (task == NULL || tier > MOUNT_TIER_ON_DEMAND) {
+                return false;
+        }
+
+        task->tier = tier;
+        return true;
+}
+
 /**
  * @fn void mount_task_destroy(struct mount_task *task)
  * @brief Destroys a mount_task structure and frees its memory
@@ -272,19 +369,22 @@ void mount_task_destroy(struct mount_task *task)
                 return;
         }
 
+        if (task->waiting) {
+                uevent_cancel(task);
+        }
         if (task->source != NULL) {
-                free(task->source);
+                mem_free(MEM_MOUNTS, task->source);
         }
         if (task->target != NULL) {
-                free(task->target);
+                mem_free(MEM_MOUNTS, task->target);
         }
         if (task->fs_type != NULL) {
-                free(task->fs_type);
+                mem_free(MEM_MOUNTS, task->fs_type);
         }
         if (task->data != NULL) {
-                free((void *) task->data);
+                mem_free(MEM_MOUNTS, (void *) task->data);
         }
-        free(task);
+        mem_free(MEM_MOUNTS, task);
 }
 
 
@@ -338,46 +438,431 @@ struct mount_task *mount_task_create_ready(const char *source,
 }
 
 /**
- * @fn bool do_mounts(struct mount_task_list *m)
- * @brief mount the taks in the mount_task_list m or the global one if NULL
+ * @fn const char *mount_tier_name(enum mount_tier tier)
+ * @brief Returns a printable name for a mount tier
+ */
+const char *mount_tier_name(enum mount_tier tier)
+{
+        switch (tier) {
+        case MOUNT_TIER_CRITICAL:
+                return "critical";
+        case MOUNT_TIER_DEFERRED:
+                return "deferred";
+        case MOUNT_TIER_ON_DEMAND:
+                return "on-demand";
+        default:
+                return "unknown";
+        }
+}
+
+/*
+ * Mounts and times a task without printing anything, so that it may run on
+ * a worker: stdout and stderr belong to the loop (see console.h)
+ */
+static bool mount_task_attempt(struct mount_task *task)
+{
+        struct timespec start;
+        struct timespec end;
+        int mt_ret = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        mt_ret = mount(task->source, task->target, task->fs_type,
+                       task->flags, task->data);
+        task->error = mt_ret == 0 ? 0 : errno;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        task->duration_us = (uint64_t) (end.tv_sec - start.tv_sec) * 1000000 +
+                            (uint64_t) ((end.tv_nsec - start.tv_nsec) / 1000);
+        task->mounted = mt_ret == 0;
+
+        return task->mounted;
+}
+
+/* Reports the outcome of mount_task_attempt(), from the loop */
+static void mount_task_report(const struct mount_task *task)
+{
+        if (!task->mounted) {
+                fprintf(stderr, "cyrenit: [%s] failed to mount %s on %s "
+                        "with type %s after %llu us: %s\n",
+                        mount_tier_name(task->tier), task->source,
+                        task->target, task->fs_type,
+                        (unsigned long long) task->duration_us,
+                        strerror(task->error));
+                return;
+        }
+
+        fprintf(stdout, "cyrenit: [%s] mounted %s on %s with type %s "
+                "in %llu us\n", mount_tier_name(task->tier), task->source,
+                task->target, task->fs_type,
+                (unsigned long long) task->duration_us);
+}
+
+/**
+ * @fn bool mount_task_mount(struct mount_task *task)
+ * @brief Mounts a single task, timing and reporting it
+ * @param task the mount_task to be mounted
+ * @return true on success or false on failure
+ */
+bool mount_task_mount(struct mount_task *task)
+{
+        if (task == NULL) {
+                return false;
+        }
+
+        mount_task_attempt(task);
+        mount_task_report(task);
+        return task->mounted;
+}
+
+/**
+ * @fn bool do_mounts(struct mount_task_list *m, enum mount_tier tier)
+ * @brief mount the tasks of a tier in the mount_task_list m or the global
+ *        one if NULL
  * @param m the mount task list pointer
- * @return true on success, false if it fails
+ * @param tier only tasks of this tier are mounted
+ * @return true if anything was mounted, false otherwise
+ * @details On-demand tasks are not mounted here, see automount.c.
  */
-bool do_mounts(struct mount_task_list *m)
+bool do_mounts(struct mount_task_list *m, enum mount_tier tier)
 {
         struct mount_task_list *mtl_ptr = m;
-        struct mount_task **array_ptr = NULL;
         struct mount_task *ptr = NULL;
-        int mt_ret = 0;
         bool ret = false;
+        size_t i = 0;
 
         if (mtl_ptr == NULL) {
                 mtl_ptr = &mounts;
         }
 
-        array_ptr = mtl_ptr->mount_tasks;
-
-        while (array_ptr != NULL && *array_ptr != NULL) {
-                ptr = *(array_ptr);
-                fprintf(stdout, "cyrenit: mounting %s on %s with type %s\n",
-                        ptr->source, ptr->target, ptr->fs_type);
-                mt_ret = mount(ptr->source, ptr->target, ptr->fs_type,
-                                ptr->flags, ptr->data);
-                if (mt_ret != 0) {
-                        perror("Error: ");
+        for (i = 0; i < mtl_ptr->count; i++) {
+                ptr = mtl_ptr->mount_tasks[i];
+                if (ptr == NULL || ptr->tier != tier || ptr->mounted ||
+                    ptr->waiting) {
+                        continue;
                 }
-                else {
+                if (mount_task_mount(ptr)) {
                         ret = true;
                 }
+        }
+
+        return ret;
+}
+
+/* A deferred task and the copy of it a worker mounts */
+struct mounts_job
+{
+        struct mount_task *task;
+        struct mount_task *copy;
+};
 
-                if (array_ptr - mtl_ptr->mount_tasks == (ptrdiff_t) mtl_ptr->count) {
-                        break;
+static size_t mounts_dispatch_deferred();
+
+static bool mounts_is_listed(const struct mount_task *task)
+{
+        size_t i = 0;
+
+        for (i = 0; i < mounts.count; i++) {
+                if (mounts.mount_tasks[i] == task) {
+                        return true;
                 }
+        }
 
-                array_ptr++;
+        return false;
+}
+
+/*
+ * Whether parent is a deferred task still to be mounted beneath which
+ * task's target lies: task has to wait for it.
+ */
+static bool mounts_blocks(const struct mount_task *parent,
+                          const struct mount_task *task)
+{
+        if (parent == task || parent->tier != MOUNT_TIER_DEFERRED ||
+            parent->mounted || parent->failed) {
+                return false;
         }
 
-        return ret;
+        return mounts_beneath(task->target, parent->target, false);
+}
+
+static void mounts_job_run(void *data)
+{
+        struct mounts_job *job = data;
+
+        mount_task_attempt(job->copy);
+}
+
+static void mounts_job_done(void *data)
+{
+        struct mounts_job *job = data;
+
+        // the list may have been reloaded meanwhile
+        if (mounts_is_listed(job->task)) {
+                job->task->queued = false;
+                job->task->mounted = job->copy->mounted;
+                job->task->failed = !job->copy->mounted;
+                job->task->duration_us = job->copy->duration_us;
+                job->task->error = job->copy->error;
+        }
+        mount_task_report(job->copy);
+        mount_task_destroy(job->copy);
+        mem_free(MEM_MOUNTS, job);
+
+        mounts_dispatch_deferred();
+}
+
+/**
+ * @fn static bool mounts_submit(struct mount_task *task)
+ * @brief Hands a copy of task to a worker, the result is applied to task
+ *        from the loop
+ * @details Without workers it is mounted right away.
+ */
+static bool mounts_submit(struct mount_task *task)
+{
+        struct mounts_job *job = mem_malloc(MEM_MOUNTS,
+                                            sizeof(struct mounts_job));
+
+        if (job != NULL) {
+                job->task = task;
+                job->copy = mount_task_duplicate(task);
+                if (job->copy != NULL &&
+                    pool_submit(mounts_job_run, mounts_job_done, job, 0)) {
+                        task->queued = true;
+                        return true;
+                }
+                mount_task_destroy(job->copy);
+                mem_free(MEM_MOUNTS, job);
+        }
+
+        task->failed = !mount_task_mount(task);
+        return false;
+}
+
+/**
+ * @fn static size_t mounts_dispatch_deferred()
+ * @brief Submits every deferred task that is ready to be mounted
+ * @return the number of tasks handed to workers
+ * @details A task is ready when its device is there and no deferred task
+ *          it is mounted beneath is still pending, so that nested mounts
+ *          keep their order while independent ones run at once.
+ */
+static size_t mounts_dispatch_deferred()
+{
+        struct mount_task *task = NULL;
+        bool blocked = false;
+        size_t submitted = 0;
+        size_t i = 0;
+        size_t j = 0;
+
+        for (i = 0; i < mounts.count; i++) {
+                task = mounts.mount_tasks[i];
+                if (task == NULL || task->tier != MOUNT_TIER_DEFERRED ||
+                    task->mounted || task->failed || task->waiting ||
+                    task->queued || !uevent_device_present(task->source)) {
+                        continue;
+                }
+
+                blocked = false;
+                for (j = 0; !blocked && j < mounts.count; j++) {
+                        blocked = mounts.mount_tasks[j] != NULL &&
+                                  mounts_blocks(mounts.mount_tasks[j], task);
+                }
+                if (!blocked && mounts_submit(task)) {
+                        submitted++;
+                }
+        }
+
+        return submitted;
+}
+
+static void mounts_device_ready(const char *device, bool present, void *data)
+{
+        struct mount_task *task = data;
+
+        task->waiting = false;
+        if (!present) {
+                fprintf(stderr, "cyrenit: %s did not appear, not mounting "
+                        "%s\n", device, task->target);
+                task->failed = true;
+        }
+        else {
+                fprintf(stdout, "cyrenit[%d]: %s appeared, mounting %s\n",
+                        getpid(), device, task->target);
+        }
+
+        mounts_dispatch_deferred();
+}
+
+/**
+ * @fn size_t mounts_deferred_pending()
+ * @brief Counts the deferred tasks waiting for their device or a worker
+ */
+size_t mounts_deferred_pending()
+{
+        size_t count = 0;
+        size_t i = 0;
+
+        for (i = 0; i < mounts.count; i++) {
+                if (mounts.mount_tasks[i]->waiting ||
+                    mounts.mount_tasks[i]->queued) {
+                        count++;
+                }
+        }
+
+        return count;
+}
+
+/**
+ * @fn size_t do_mounts_deferred()
+ * @brief Mounts the deferred tier from the worker pool
+ * @return the number of tasks handed to workers right away
+ * @details Workers share PID 1's mount namespace, so their mounts are
+ *          visible to everyone while PID 1 keeps serving its event loop.
+ *          Tasks whose device is missing wait for it and are mounted once
+ *          it shows up; tasks beneath another one wait for it.
+ */
+size_t do_mounts_deferred()
+{
+        struct mount_task *task = NULL;
+        size_t i = 0;
+
+        for (i = 0; i < mounts.count; i++) {
+                task = mounts.mount_tasks[i];
+                if (task->tier != MOUNT_TIER_DEFERRED || task->mounted ||
+                    task->waiting || task->queued ||
+                    uevent_device_present(task->source)) {
+                        continue;
+                }
+
+                task->waiting = true;
+                if (!uevent_wait(task->source, UEVENT_WAIT_TIMEOUT_MS,
+                                 mounts_device_ready, task)) {
+                        task->waiting = false;
+                        task->failed = true;
+                        continue;
+                }
+                fprintf(stdout, "cyrenit: %s waits for %s\n", task->target,
+                        task->source);
+        }
+
+        return mounts_dispatch_deferred();
+}
+
+static unsigned long mounts_parse_options(char *options, char *data,
+                                          size_t data_size)
+{
+        static const struct {
+                const char *name;
+                unsigned long flag;
+        } known[] = {
+                { "ro", MS_RDONLY },
+                { "nosuid", MS_NOSUID },
+                { "nodev", MS_NODEV },
+                { "noexec", MS_NOEXEC },
+                { "noatime", MS_NOATIME },
+                { "relatime", MS_RELATIME },
+                { NULL, 0 }
+        };
+        unsigned long flags = 0;
+        char *saveptr = NULL;
+        char *opt = NULL;
+        size_t length = 0;
+        size_t i = 0;
+        bool found = false;
+
+        data[0] = '\0';
+        for (opt = strtok_r(options, ",", &saveptr); opt != NULL;
+             opt = strtok_r(NULL, ",", &saveptr)) {
+                found = false;
+                for (i = 0; known[i].name != NULL; i++) {
+                        if (strcmp(opt, known[i].name) == 0) {
+                                flags |= known[i].flag;
+                                found = true;
+                                break;
+                        }
+                }
+                if (found || strcmp(opt, "defaults") == 0 ||
+                    strcmp(opt, "rw") == 0) {
+                        continue;
+                }
+
+                length = strlen(data);
+                snprintf(data + length, data_size - length, "%s%s",
+                         length ? "," : "", opt);
+        }
+
+        return flags;
+}
+
+/**
+ * @fn size_t mounts_load_fstab(const char *path)
+ * @brief Adds the mount tasks listed in an fstab-like file
+ * @param path the file, MOUNTS_FSTAB if NULL
+ * @return the number of tasks added
+ * @details Each line holds `source target type options tier`, where tier
+ *          is one of critical, deferred or on-demand (critical if absent).
+ *          Options not known as mount flags are passed as filesystem data.
+ */
+size_t mounts_load_fstab(const char *path)
+{
+        char line[FSTAB_LINE_MAX];
+        char data[FSTAB_LINE_MAX];
+        char source[FSTAB_LINE_MAX];
+        char target[FSTAB_LINE_MAX];
+        char fs_type[FSTAB_LINE_MAX];
+        char options[FSTAB_LINE_MAX];
+        char tier[FSTAB_LINE_MAX];
+        struct mount_task *task = NULL;
+        unsigned long flags = 0;
+        size_t added = 0;
+        FILE *f = NULL;
+        int fields = 0;
+
+        f = fopen(path == NULL ? MOUNTS_FSTAB : path, "re");
+        if (f == NULL) {
+                return 0;
+        }
+
+        while (fgets(line, sizeof(line), f) != NULL) {
+                if (line[strspn(line, " \t")] == '#') {
+                        continue;
+                }
+
+                strcpy(options, "defaults");
+                strcpy(tier, "critical");
+                fields = sscanf(line, "%1023s %1023s %1023s %1023s %1023s",
+                                source, target, fs_type, options, tier);
+                if (fields < 3) {
+                        continue;
+                }
+
+                flags = mounts_parse_options(options, data, sizeof(data));
+                task = mount_task_create_ready(source, target, fs_type, flags,
+                                               *data ? strlen(data) + 1 : 0,
+                                               data);
+                if (task == NULL) {
+                        continue;
+                }
+
+                if (strcmp(tier, "deferred") == 0) {
+                        mount_task_set_tier(task, MOUNT_TIER_DEFERRED);
+                }
+                else if (strcmp(tier, "on-demand") == 0) {
+                        mount_task_set_tier(task, MOUNT_TIER_ON_DEMAND);
+                }
+                else if (strcmp(tier, "critical") != 0) {
+                        fprintf(stderr, "cyrenit: unknown mount tier %s for "
+                                "%s, mounting it as critical\n", tier, target);
+                }
+
+                if (add_mount_task(task)) {
+                        added++;
+                }
+                mount_task_destroy(task);
+        }
+
+        fclose(f);
+        return added;
 }
 
 #endif//__MOUNTS_C
\ No newline at end of file
@@ -14,7 +14,27 @@
 #define __MOUNTS_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <sys/types.h>
+
+#define MOUNTS_FSTAB "/etc/cyrenit/fstab"
+
+/*
+ * Critical tasks are mounted by bootstrap() before any service starts,
+ * deferred ones in the background after the services are started and
+ * on-demand ones through autofs the first time their target is accessed.
+ * A deferred task whose source is a device node that is not there yet
+ * waits for it (see uevent.h) and is mounted when it appears. Deferred
+ * tasks are mounted on the worker pool (see pool.h), each one after the
+ * deferred tasks it lies beneath.
+ */
+enum mount_tier
+{
+        MOUNT_TIER_CRITICAL = 0,
+        MOUNT_TIER_DEFERRED,
+        MOUNT_TIER_ON_DEMAND
+};
 
 struct mount_task
 {
@@ -24,21 +44,36 @@ struct mount_task
         void *data;
         unsigned long flags;
         size_t data_size;
+        enum mount_tier tier;
+        bool mounted;
+        /* deferred, held back until its source device appears */
+        bool waiting;
+        /* deferred, being mounted by a worker */
+        bool queued;
+        /* deferred, its device never came or mounting it failed */
+        bool failed;
+        /* errno of the last failed mount */
+        int error;
+        uint64_t duration_us;
 };
 
 struct mount_task_list
 {
         struct mount_task **mount_tasks;
         size_t count;
+        size_t allocated;
 };
 
 #define MT_SIZE sizeof(struct mount_task)
+#define MT_PTR_SIZE sizeof(struct mount_task *)
 #define MT_EMPTY 0
+#define MT_ALLOC_STEP 8
 
 extern struct mount_task_list mounts;
 
 bool add_mount_task(struct mount_task *task);
 void free_mount_task_list();
+size_t mounts_retain(const char **targets);
 
 struct mount_task *mount_task_create();
 struct mount_task *mount_task_duplicate(struct mount_task *task);
@@ -47,6 +82,7 @@ bool mount_task_set_target(struct mount_task *task, const char *target);
 bool mount_task_set_fstype(struct mount_task *task, const char *type);
 bool mount_task_set_data(struct mount_task *task, size_t size, const void *data);
 bool mount_task_set_flags(struct mount_task *task, unsigned long flags);
+bool mount_task_set_tier(struct mount_task *task, enum mount_tier tier);
 void mount_task_destroy(struct mount_task *task);
 
 struct mount_task *mount_task_create_ready(const char *source,
@@ -56,6 +92,11 @@ struct mount_task *mount_task_create_ready(const char *source,
                                         size_t data_size,
                                         const void *data);
 
-bool do_mounts(struct mount_task_list *m);
+bool mount_task_mount(struct mount_task *task);
+bool do_mounts(struct mount_task_list *m, enum mount_tier tier);
+size_t do_mounts_deferred();
+size_t mounts_deferred_pending();
+size_t mounts_load_fstab(const char *path);
+const char *mount_tier_name(enum mount_tier tier);
 
 #endif//__MOUNTS_H
\ No newline at end of file
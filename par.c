@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * par.c - Fork-join worker threads for parallel boot stages
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __PAR_C
+#define __PAR_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "par.h"
+
+#define PAR_ALLOC_STEP 64
+
+/**
+ * @fn size_t par_workers()
+ * @brief Number of workers for a parallel stage: online CPUs, capped
+ */
+size_t par_workers()
+{
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (cpus < 1) {
+                return 1;
+        }
+
+        return cpus > PAR_MAX_WORKERS ? PAR_MAX_WORKERS : (size_t) cpus;
+}
+
+/**
+ * @fn bool par_push(struct par_queue *q, void *item)
+ * @brief Queues an item, callable from any worker
+ * @return true on success or false on allocation failure
+ */
+bool par_push(struct par_queue *q, void *item)
+{
+        void **new_items = NULL;
+        size_t new_size = 0;
+
+        pthread_mutex_lock(&q->lock);
+        if (q->count >= q->allocated) {
+                new_size = q->allocated + PAR_ALLOC_STEP;
+                new_items = reallocarray(q->items, new_size, sizeof(void *));
+                if (new_items == NULL) {
+                        pthread_mutex_unlock(&q->lock);
+                        return false;
+                }
+                q->items = new_items;
+                q->allocated = new_size;
+        }
+        q->items[q->count++] = item;
+        pthread_cond_signal(&q->cond);
+        pthread_mutex_unlock(&q->lock);
+
+        return true;
+}
+
+/**
+ * @fn static void *par_worker(void *arg)
+ * @brief Runs queued items until the queue is empty and nobody is busy
+ * @details Items are taken LIFO, which keeps tree walks depth first and
+ *          their working set small.
+ */
+static void *par_worker(void *arg)
+{
+        struct par_queue *q = arg;
+        void *item = NULL;
+
+        pthread_mutex_lock(&q->lock);
+        while (true) {
+                while (q->count == 0 && q->active > 0) {
+                        pthread_cond_wait(&q->cond, &q->lock);
+                }
+                if (q->count == 0) {
+                        break; //drained, wake up the other idle workers
+                }
+
+                item = q->items[--q->count];
+                q->active++;
+                pthread_mutex_unlock(&q->lock);
+
+                q->fn(q, item, q->ctx);
+
+                pthread_mutex_lock(&q->lock);
+                q->active--;
+        }
+        pthread_cond_broadcast(&q->cond);
+        pthread_mutex_unlock(&q->lock);
+
+        return NULL;
+}
+
+/**
+ * @fn bool par_run(par_fn fn, void *ctx, void **items, size_t count,
+ *                  size_t workers)
+ * @brief Runs fn over items (and whatever fn pushes) on worker threads
+ * @param fn the function run for every item
+ * @param ctx opaque pointer handed to fn
+ * @param items the initial items
+ * @param count the number of initial items
+ * @param workers the number of threads, the caller being one of them
+ * @return true when every item ran, false if the queue could not be set up
+ * @details Blocks until all the work is done. If no thread can be created
+ *          the caller runs everything alone.
+ */
+bool par_run(par_fn fn, void *ctx, void **items, size_t count,
+             size_t workers)
+{
+        struct par_queue q;
+        pthread_t threads[PAR_MAX_WORKERS];
+        size_t started = 0;
+        size_t i = 0;
+
+        if (fn == NULL) {
+                return false;
+        }
+
+        memset(&q, 0, sizeof(q));
+        pthread_mutex_init(&q.lock, NULL);
+        pthread_cond_init(&q.cond, NULL);
+        q.fn = fn;
+        q.ctx = ctx;
+
+        for (i = 0; i < count; i++) {
+                if (!par_push(&q, items[i])) {
+                        free(q.items);
+                        return false;
+                }
+        }
+
+        if (workers > PAR_MAX_WORKERS) {
+                workers = PAR_MAX_WORKERS;
+        }
+        for (i = 1; i < workers; i++) {
+                if (pthread_create(&threads[started], NULL, par_worker,
+                                   &q) != 0) {
+                        break;
+                }
+                started++;
+        }
+
+        par_worker(&q);
+        for (i = 0; i < started; i++) {
+                pthread_join(threads[i], NULL);
+        }
+
+        pthread_cond_destroy(&q.cond);
+        pthread_mutex_destroy(&q.lock);
+        free(q.items);
+
+        return true;
+}
+
+#endif//__PAR_C
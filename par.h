@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * par.h - Fork-join worker threads for parallel boot stages
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __PAR_H
+#define __PAR_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define PAR_MAX_WORKERS 8
+
+struct par_queue;
+
+/*
+ * Called from the worker threads for every item. It may push more items
+ * to the queue (e.g. subdirectories of a tree walk) and owns item.
+ */
+typedef void (*par_fn)(struct par_queue *q, void *item, void *ctx);
+
+struct par_queue
+{
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        void **items;
+        size_t count;
+        size_t allocated;
+        size_t active;
+        par_fn fn;
+        void *ctx;
+};
+
+size_t par_workers();
+bool par_push(struct par_queue *q, void *item);
+bool par_run(par_fn fn, void *ctx, void **items, size_t count,
+             size_t workers);
+
+#endif//__PAR_H
@@ -0,0 +1,271 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * pool.c - Worker threads for blocking work of PID 1
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __POOL_C
+#define __POOL_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include <linux/ioprio.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+#include "evloop.h"
+#include "memstat.h"
+#include "pool.h"
+
+/* Jobs waiting for a worker, FIFO */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct pool_job *queue_head = NULL;
+static struct pool_job *queue_tail = NULL;
+
+/*
+ * Finished jobs. Workers push at done_head with a single exchange, the
+ * loop pops from done_tail; done_stub keeps the queue from ever being
+ * empty, so that pushing never has to touch done_tail.
+ */
+static struct pool_job done_stub;
+static struct pool_job *_Atomic done_head = &done_stub;
+static struct pool_job *done_tail = &done_stub;
+
+static int done_fd = -1;
+static size_t started = 0;
+/* submitted and not done yet, counted on the loop */
+static size_t pending = 0;
+
+static void pool_done_push(struct pool_job *job)
+{
+        struct pool_job *prev = NULL;
+
+        atomic_store_explicit(&job->done_next, NULL, memory_order_relaxed);
+        prev = atomic_exchange_explicit(&done_head, job,
+                                        memory_order_acq_rel);
+        atomic_store_explicit(&prev->done_next, job, memory_order_release);
+}
+
+/**
+ * @fn static struct pool_job *pool_done_pop()
+ * @brief Takes the oldest finished job, from the loop only
+ * @return the job, or NULL if there is none or a worker is halfway through
+ *         pushing one, in which case its eventfd write is still to come
+ */
+static struct pool_job *pool_done_pop()
+{
+        struct pool_job *tail = done_tail;
+        struct pool_job *next = atomic_load_explicit(&tail->done_next,
+                                                     memory_order_acquire);
+
+        if (tail == &done_stub) {
+                if (next == NULL) {
+                        return NULL;
+                }
+                done_tail = next;
+                tail = next;
+                next = atomic_load_explicit(&next->done_next,
+                                            memory_order_acquire);
+        }
+
+        if (next != NULL) {
+                done_tail = next;
+                return tail;
+        }
+
+        if (tail != atomic_load_explicit(&done_head, memory_order_acquire)) {
+                return NULL;
+        }
+
+        // tail is the last one: put the stub back behind it to take it
+        pool_done_push(&done_stub);
+        next = atomic_load_explicit(&tail->done_next, memory_order_acquire);
+        if (next != NULL) {
+                done_tail = next;
+                return tail;
+        }
+
+        return NULL;
+}
+
+static void pool_set_idle(bool idle)
+{
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        pthread_setschedparam(pthread_self(), idle ? SCHED_IDLE : SCHED_OTHER,
+                              &param);
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                idle ? IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0) :
+                       IOPRIO_PRIO_VALUE(IOPRIO_CLASS_NONE, 0));
+}
+
+static void *pool_worker(void *arg)
+{
+        struct pool_job *job = NULL;
+        uint64_t one = 1;
+
+        (void) arg;
+        while (true) {
+                pthread_mutex_lock(&queue_lock);
+                while (queue_head == NULL) {
+                        pthread_cond_wait(&queue_cond, &queue_lock);
+                }
+                job = queue_head;
+                queue_head = job->queued_next;
+                if (queue_head == NULL) {
+                        queue_tail = NULL;
+                }
+                pthread_mutex_unlock(&queue_lock);
+
+                if (job->flags & POOL_IDLE) {
+                        pool_set_idle(true);
+                }
+                job->run(job->data);
+                if (job->flags & POOL_IDLE) {
+                        pool_set_idle(false);
+                }
+
+                pool_done_push(job);
+                if (write(done_fd, &one, sizeof(one)) == -1) {
+                        continue; //the counter is pending anyway
+                }
+        }
+
+        return NULL;
+}
+
+/* Runs the done functions of the finished jobs, on the loop */
+static void pool_handle(int fd, uint32_t events, void *data)
+{
+        struct pool_job *job = NULL;
+        uint64_t count = 0;
+
+        (void) events;
+        (void) data;
+        while (read(fd, &count, sizeof(count)) == -1 && errno == EINTR);
+
+        while ((job = pool_done_pop()) != NULL) {
+                pending--;
+                if (job->done != NULL) {
+                        job->done(job->data);
+                }
+                mem_free(MEM_EVENTS, job);
+        }
+}
+
+/**
+ * @fn bool pool_init()
+ * @brief Starts the workers and hands their completions to the event loop
+ * @return true when at least one worker runs
+ * @details The loop must be set up. The workers live as long as PID 1 and
+ *          do not survive a re-exec, which waits for pool_pending() to
+ *          drop to zero.
+ */
+bool pool_init()
+{
+        pthread_attr_t attr;
+        pthread_t thread;
+        size_t i = 0;
+
+        if (started > 0) {
+                return true;
+        }
+
+        done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (done_fd == -1) {
+                return false;
+        }
+        if (!evloop_add(done_fd, EVLOOP_IN, pool_handle, NULL)) {
+                close(done_fd);
+                done_fd = -1;
+                return false;
+        }
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        for (i = 0; i < POOL_WORKERS; i++) {
+                if (pthread_create(&thread, &attr, pool_worker, NULL) != 0) {
+                        break;
+                }
+                started++;
+        }
+        pthread_attr_destroy(&attr);
+
+        return started > 0;
+}
+
+/**
+ * @fn bool pool_running()
+ * @brief Tells whether jobs can be submitted
+ */
+bool pool_running()
+{
+        return started > 0;
+}
+
+/**
+ * @fn size_t pool_pending()
+ * @brief Counts the jobs whose done function has not run yet
+ */
+size_t pool_pending()
+{
+        return pending;
+}
+
+/**
+ * @fn bool pool_submit(pool_fn run, pool_fn done, void *data,
+ *                      unsigned flags)
+ * @brief Queues run(data) for a worker, then done(data) on the loop
+ * @param done called once run returned, may be NULL
+ * @param flags POOL_IDLE or 0
+ * @return true if queued, false without workers or memory, the caller
+ *         then does the work itself or goes without
+ */
+bool pool_submit(pool_fn run, pool_fn done, void *data, unsigned flags)
+{
+        struct pool_job *job = NULL;
+
+        if (started == 0 || run == NULL) {
+                return false;
+        }
+
+        job = mem_calloc(MEM_EVENTS, 1, sizeof(struct pool_job));
+        if (job == NULL) {
+                return false;
+        }
+        job->run = run;
+        job->done = done;
+        job->data = data;
+        job->flags = flags;
+
+        pthread_mutex_lock(&queue_lock);
+        if (queue_tail != NULL) {
+                queue_tail->queued_next = job;
+        }
+        else {
+                queue_head = job;
+        }
+        queue_tail = job;
+        pthread_cond_signal(&queue_cond);
+        pthread_mutex_unlock(&queue_lock);
+        pending++;
+
+        return true;
+}
+
+#endif//__POOL_C
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * pool.h - Worker threads for blocking work of PID 1
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __POOL_H
+#define __POOL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define POOL_WORKERS 4
+
+/*
+ * A job's run function is called on one of POOL_WORKERS threads, its done
+ * function (if any) back on the event loop once run returned. Whatever
+ * belongs to the main thread, registered_processes, mount tasks, timers,
+ * is only touched from done: run gets its own copy of what it needs.
+ *
+ * Finished jobs reach the loop through a lock-free multi-producer single-
+ * consumer queue, and an eventfd wakes the loop up. Jobs are not ordered
+ * with respect to each other. Jobs are submitted from the main thread.
+ */
+typedef void (*pool_fn)(void *data);
+
+enum pool_flags
+{
+        /* run on the idle CPU and I/O scheduling classes */
+        POOL_IDLE = 1 << 0
+};
+
+struct pool_job
+{
+        pool_fn run;
+        pool_fn done;
+        void *data;
+        unsigned flags;
+        /* waiting for a worker */
+        struct pool_job *queued_next;
+        /* in the queue of finished jobs */
+        struct pool_job *_Atomic done_next;
+};
+
+bool pool_init();
+bool pool_running();
+size_t pool_pending();
+bool pool_submit(pool_fn run, pool_fn done, void *data, unsigned flags);
+
+#endif//__POOL_H
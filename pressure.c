@@ -0,0 +1,785 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * pressure.c - Shedding of low priority services under memory pressure
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __PRESSURE_C
+#define __PRESSURE_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <inttypes.h>
+
+#include "console.h"
+#include "control.h"
+#include "cyrenit.h"
+#include "evloop.h"
+#include "job.h"
+#include "memstat.h"
+#include "pressure.h"
+#include "timer.h"
+
+#define PRESSURE_ALLOC_STEP 8
+#define PRESSURE_REASON_MAX 128
+#define PRESSURE_EVENTS_SIZE 256
+#define PRESSURE_REQUESTED "requested with `cyrenit pressure`"
+/* How far requires are followed looking for a more important service */
+#define PRESSURE_NEED_DEPTH 16
+
+struct pressure_trigger
+{
+        const char *kind;
+        unsigned stall_us;
+        /* every task stalled: freezing would not be enough */
+        bool full;
+        int fd;
+        uint64_t fired;
+};
+
+static struct pressure_trigger pressure_triggers[] = {
+        { "some", PRESSURE_SOME_US, false, -1, 0 },
+        { "full", PRESSURE_FULL_US, true, -1, 0 },
+};
+
+#define PRESSURE_TRIGGERS \
+        (sizeof(pressure_triggers) / sizeof(pressure_triggers[0]))
+
+static const char *pressure_tier_names[CYRENIT_PROC_TIERS] = {
+        [CYRENIT_PROC_TIER_CRITICAL] = "critical",
+        [CYRENIT_PROC_TIER_NORMAL] = "normal",
+        [CYRENIT_PROC_TIER_LOW] = "low",
+        [CYRENIT_PROC_TIER_IDLE] = "idle",
+};
+
+/* the cgroups watched, one entry per cgroup however many services share it */
+static struct pressure_events *pressure_watches = NULL;
+static size_t pressure_watch_count = 0;
+static size_t pressure_watch_allocated = 0;
+
+static bool pressure_ready = false;
+static bool pressure_exhausted = false;
+static uint64_t pressure_last_step = 0;
+static struct timer pressure_settle_timer;
+
+/* Processes of a tier, by what pressure did to them */
+struct pressure_tally
+{
+        size_t running;
+        size_t frozen;
+        size_t shed;
+};
+
+const char *pressure_tier_name(enum proc_tier tier)
+{
+        return tier < CYRENIT_PROC_TIERS ? pressure_tier_names[tier] :
+                                           "unknown";
+}
+
+/**
+ * @fn bool pressure_parse_tier(const char *name, enum proc_tier *tier)
+ * @brief Parses the tier setting of a service
+ * @return true if name is a tier
+ */
+bool pressure_parse_tier(const char *name, enum proc_tier *tier)
+{
+        int i = 0;
+
+        for (i = 0; i < CYRENIT_PROC_TIERS; i++) {
+                if (strcmp(name, pressure_tier_names[i]) == STRCMP_EQUAL) {
+                        *tier = (enum proc_tier) i;
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+static const char *pressure_name(struct process *proc)
+{
+        return proc->name != NULL ? proc->name : proc->exec_image;
+}
+
+/**
+ * @fn bool pressure_freeze(struct process *proc, bool freeze)
+ * @brief Freezes or thaws proc
+ * @return true on success
+ * @details Through cgroup.freeze when proc has a cgroup v2 directory, or
+ *          by stopping and continuing its process group otherwise. Does
+ *          not change proc->frozen.
+ */
+bool pressure_freeze(struct process *proc, bool freeze)
+{
+        char path[PATH_MAX];
+        bool ok = false;
+        int fd = -1;
+
+        if (proc->cgroup != NULL) {
+                snprintf(path, sizeof(path), "%s/%s", proc->cgroup,
+                         PRESSURE_FREEZE_FILE);
+                fd = open(path, O_WRONLY | O_CLOEXEC);
+                if (fd != -1) {
+                        ok = write(fd, freeze ? "1\n" : "0\n", 2) == 2;
+                        close(fd);
+                        if (ok) {
+                                return true;
+                        }
+                }
+        }
+
+        /* services are session (and so process group) leaders */
+        if (proc->pid <= 0) {
+                return false;
+        }
+
+        return kill(-proc->pid, freeze ? SIGSTOP : SIGCONT) == 0 ||
+               kill(proc->pid, freeze ? SIGSTOP : SIGCONT) == 0;
+}
+
+static bool pressure_requires(const struct process *proc,
+                              const struct process *dep)
+{
+        size_t i = 0;
+
+        if (dep->name == NULL) {
+                return false;
+        }
+        for (i = 0; i < proc->require_count; i++) {
+                if (strcmp(proc->requires[i], dep->name) == STRCMP_EQUAL) {
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+static bool pressure_up(const struct process *proc)
+{
+        return !proc->retired && !proc->stopping &&
+               proc->status == CYRENIT_PROC_STATUS_RUNNING;
+}
+
+/**
+ * @fn static bool pressure_needed(const struct process *proc, int depth)
+ * @brief Whether a running service of a more important tier requires proc,
+ *        directly or through services of proc's own tier or lower
+ * @details Such a service is neither frozen nor shed: stopping proc would
+ *          stop what requires it as well (see job.c), tier or not.
+ */
+static bool pressure_needed(const struct process *proc, int depth)
+{
+        const struct process *other = NULL;
+        size_t i = 0;
+
+        if (depth > PRESSURE_NEED_DEPTH) {
+                return false;
+        }
+
+        for (i = 0; i < registered_process_count; i++) {
+                other = registered_processes[i];
+                if (other == proc || !pressure_up(other) ||
+                    !pressure_requires(other, proc)) {
+                        continue;
+                }
+                if (other->tier < proc->tier ||
+                    pressure_needed(other, depth + 1)) {
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+static void pressure_tally(enum proc_tier tier, struct pressure_tally *tally)
+{
+        struct process *proc = NULL;
+        size_t i = 0;
+
+        memset(tally, 0, sizeof(*tally));
+        for (i = 0; i < registered_process_count; i++) {
+                proc = registered_processes[i];
+                if (proc->tier != tier) {
+                        continue;
+                }
+                if (proc->frozen) {
+                        tally->frozen++;
+                }
+                else if (proc->status == CYRENIT_PROC_STATUS_RUNNING &&
+                         !proc->stopping && !pressure_needed(proc, 0)) {
+                        tally->running++;
+                }
+                if (proc->shed) {
+                        tally->shed++;
+                }
+        }
+}
+
+static void pressure_freeze_tier(enum proc_tier tier, const char *reason)
+{
+        struct process *proc = NULL;
+        size_t i = 0;
+
+        for (i = 0; i < registered_process_count; i++) {
+                proc = registered_processes[i];
+                if (proc->tier != tier || proc->frozen || proc->stopping ||
+                    proc->status != CYRENIT_PROC_STATUS_RUNNING ||
+                    pressure_needed(proc, 0)) {
+                        continue;
+                }
+                if (!pressure_freeze(proc, true)) {
+                        console_printf(CONSOLE_ERR, "cyrenit: failed to "
+                                       "freeze %s\n", pressure_name(proc));
+                        continue;
+                }
+                proc->frozen = true;
+                console_printf(CONSOLE_WARNING, "cyrenit: froze %s (%s "
+                               "tier): %s\n", pressure_name(proc),
+                               pressure_tier_name(tier), reason);
+        }
+}
+
+/*
+ * Thaws what is frozen in tier, and stops everything in it but what a more
+ * important service needs. What requires the services stopped is stopped
+ * along (see job.c), it is marked as shed too so that it comes back.
+ */
+static void pressure_shed_tier(enum proc_tier tier, const char *reason)
+{
+        struct process **procs = NULL;
+        struct process *proc = NULL;
+        size_t count = 0;
+        size_t i = 0;
+        size_t j = 0;
+
+        procs = mem_calloc(MEM_PROC, registered_process_count + 1,
+                           sizeof(struct process *));
+        if (procs == NULL) {
+                return;
+        }
+
+        for (i = 0; i < registered_process_count; i++) {
+                proc = registered_processes[i];
+                if (proc->tier != tier || proc->stopping ||
+                    (!proc->frozen &&
+                     proc->status != CYRENIT_PROC_STATUS_RUNNING)) {
+                        continue;
+                }
+                /* SIGTERM is not handled while frozen */
+                if (proc->frozen && pressure_freeze(proc, false)) {
+                        proc->frozen = false;
+                }
+                if (pressure_needed(proc, 0)) {
+                        continue;
+                }
+                proc->shed = true;
+                procs[count++] = proc;
+                console_printf(CONSOLE_WARNING, "cyrenit: shedding %s (%s "
+                               "tier): %s\n", pressure_name(proc),
+                               pressure_tier_name(tier), reason);
+        }
+
+        /* procs grows as dependents are found, j walks it */
+        for (j = 0; j < count; j++) {
+                for (i = 0; i < registered_process_count; i++) {
+                        proc = registered_processes[i];
+                        if (proc->shed || !pressure_up(proc) ||
+                            !pressure_requires(proc, procs[j])) {
+                                continue;
+                        }
+                        proc->shed = true;
+                        procs[count++] = proc;
+                        console_printf(CONSOLE_WARNING, "cyrenit: shedding "
+                                       "%s (%s tier), it requires %s\n",
+                                       pressure_name(proc),
+                                       pressure_tier_name(proc->tier),
+                                       pressure_name(procs[j]));
+                }
+        }
+
+        if (count > 0) {
+                job_submit(procs, count, JOB_STOP, NULL);
+        }
+        mem_free(MEM_PROC, procs);
+}
+
+/**
+ * @fn static bool pressure_escalate(const char *reason, bool full)
+ * @brief Takes the next step down: freezes or stops the lowest tier left
+ * @return false if there is nothing left to shed
+ */
+static bool pressure_escalate(const char *reason, bool full)
+{
+        struct pressure_tally tally;
+        int tier = 0;
+
+        for (tier = CYRENIT_PROC_TIER_IDLE; tier >= CYRENIT_PROC_TIER_LOW;
+             tier--) {
+                pressure_tally(tier, &tally);
+                if (tally.frozen > 0) {
+                        pressure_shed_tier(tier, reason);
+                        return true;
+                }
+                if (tally.running > 0) {
+                        pressure_freeze_tier(tier, reason);
+                        if (full) {
+                                pressure_shed_tier(tier, reason);
+                        }
+                        return true;
+                }
+        }
+
+        if (!pressure_exhausted) {
+                console_printf(CONSOLE_CRIT, "cyrenit: %s, and no low or idle "
+                               "service is left to shed\n", reason);
+                pressure_exhausted = true;
+        }
+
+        return false;
+}
+
+/**
+ * @fn static bool pressure_recover(const char *reason)
+ * @brief Undoes the last step: thaws or starts again the highest tier shed
+ * @return false if nothing was left to undo
+ */
+static bool pressure_recover(const char *reason)
+{
+        struct process **procs = NULL;
+        struct process *proc = NULL;
+        struct pressure_tally tally;
+        size_t count = 0;
+        size_t i = 0;
+        int tier = 0;
+
+        for (tier = CYRENIT_PROC_TIER_LOW; tier <= CYRENIT_PROC_TIER_IDLE;
+             tier++) {
+                pressure_tally(tier, &tally);
+                if (tally.frozen > 0 || tally.shed > 0) {
+                        break;
+                }
+        }
+        if (tier > CYRENIT_PROC_TIER_IDLE) {
+                return false;
+        }
+
+        procs = mem_calloc(MEM_PROC, registered_process_count + 1,
+                           sizeof(struct process *));
+        if (procs == NULL) {
+                return false;
+        }
+
+        for (i = 0; i < registered_process_count; i++) {
+                proc = registered_processes[i];
+                if ((int) proc->tier != tier) {
+                        continue;
+                }
+                if (proc->frozen) {
+                        if (!pressure_freeze(proc, false)) {
+                                console_printf(CONSOLE_ERR, "cyrenit: failed "
+                                               "to thaw %s\n",
+                                               pressure_name(proc));
+                                continue;
+                        }
+                        proc->frozen = false;
+                        console_printf(CONSOLE_NOTICE, "cyrenit: thawed %s "
+                                       "(%s tier): %s\n", pressure_name(proc),
+                                       pressure_tier_name(tier), reason);
+                }
+                /* a frozen tier is thawed before what was shed restarts */
+                else if (proc->shed && tally.frozen == 0) {
+                        proc->shed = false;
+                        procs[count++] = proc;
+                        console_printf(CONSOLE_NOTICE, "cyrenit: starting %s "
+                                       "again (%s tier): %s\n",
+                                       pressure_name(proc),
+                                       pressure_tier_name(tier), reason);
+                }
+        }
+
+        if (count > 0) {
+                job_submit(procs, count, JOB_START, NULL);
+        }
+        mem_free(MEM_PROC, procs);
+        pressure_exhausted = false;
+
+        return true;
+}
+
+/* Reads the avg10 of the "some" or "full" line, -1 if unknown */
+static double pressure_avg10(const char *kind)
+{
+        char line[128];
+        char format[32];
+        double avg10 = -1;
+        FILE *psi = fopen(PRESSURE_PATH, "re");
+
+        if (psi == NULL) {
+                return -1;
+        }
+
+        snprintf(format, sizeof(format), "%s avg10=%%lf", kind);
+        while (fgets(line, sizeof(line), psi) != NULL) {
+                if (sscanf(line, format, &avg10) == 1) {
+                        break;
+                }
+        }
+        fclose(psi);
+
+        return avg10;
+}
+
+static bool pressure_pending()
+{
+        size_t i = 0;
+
+        for (i = 0; i < registered_process_count; i++) {
+                if (registered_processes[i]->frozen ||
+                    registered_processes[i]->shed) {
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+static void pressure_settle_timeout(struct timer *t, void *data)
+{
+        char reason[PRESSURE_REASON_MAX];
+        double avg10 = pressure_avg10("some");
+
+        (void) data;
+        if (avg10 < PRESSURE_CLEAR_AVG10) {
+                snprintf(reason, sizeof(reason), "memory pressure cleared "
+                         "(some avg10=%.2f)", avg10 < 0 ? 0 : avg10);
+                pressure_recover(reason);
+        }
+
+        if (pressure_pending()) {
+                timer_add(&supervisor_timers, t, PRESSURE_SETTLE_MS,
+                          TIMER_COARSE);
+        }
+}
+
+static void pressure_handle(int fd, uint32_t events, void *data)
+{
+        struct pressure_trigger *trigger = data;
+        char reason[PRESSURE_REASON_MAX];
+        uint64_t now = timer_wheel_now(&supervisor_timers);
+
+        if (events & EVLOOP_ERR) {
+                console_printf(CONSOLE_ERR, "cyrenit: the %s memory pressure "
+                               "trigger went away\n", trigger->kind);
+                evloop_del(fd);
+                close(fd);
+                trigger->fd = -1;
+                return;
+        }
+        if (!(events & EVLOOP_PRI)) {
+                return;
+        }
+
+        trigger->fired++;
+        timer_cancel(&pressure_settle_timer);
+        timer_add(&supervisor_timers, &pressure_settle_timer,
+                  PRESSURE_SETTLE_MS, TIMER_COARSE);
+
+        /* the last step has not had the time to help yet */
+        if (pressure_last_step != 0 &&
+            now - pressure_last_step < PRESSURE_HOLD_MS) {
+                return;
+        }
+
+        snprintf(reason, sizeof(reason), "memory pressure (%s avg10=%.2f)",
+                 trigger->kind, pressure_avg10(trigger->kind));
+        if (pressure_escalate(reason, trigger->full)) {
+                pressure_last_step = now;
+        }
+}
+
+static bool pressure_events_read(int fd, struct pressure_events *ev)
+{
+        char buffer[PRESSURE_EVENTS_SIZE];
+        char *line = NULL;
+        char *saveptr = NULL;
+        char key[32];
+        unsigned long long value = 0;
+        ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+
+        if (length <= 0) {
+                return false;
+        }
+        buffer[length] = '\0';
+
+        for (line = strtok_r(buffer, "\n", &saveptr); line != NULL;
+             line = strtok_r(NULL, "\n", &saveptr)) {
+                if (sscanf(line, "%31s %llu", key, &value) != 2) {
+                        continue;
+                }
+                if (strcmp(key, "high") == STRCMP_EQUAL) {
+                        ev->high = value;
+                }
+                else if (strcmp(key, "max") == STRCMP_EQUAL) {
+                        ev->max = value;
+                }
+                else if (strcmp(key, "oom") == STRCMP_EQUAL) {
+                        ev->oom = value;
+                }
+                else if (strcmp(key, "oom_kill") == STRCMP_EQUAL) {
+                        ev->oom_kill = value;
+                }
+        }
+
+        return true;
+}
+
+/* memory.events changed: says which counters went up, and by how much */
+static void pressure_events_handle(int fd, uint32_t events, void *data)
+{
+        struct pressure_events *ev = NULL;
+        struct pressure_events now;
+        size_t index = (size_t) (uintptr_t) data;
+
+        if (index >= pressure_watch_count) {
+                return;
+        }
+        ev = &pressure_watches[index];
+        now = *ev;
+        /* kernfs flags every change with EPOLLERR as well */
+        (void) events;
+        if (!pressure_events_read(fd, &now)) {
+                /* the cgroup was removed */
+                evloop_del(fd);
+                close(fd);
+                ev->fd = -1;
+                return;
+        }
+
+        if (now.oom_kill > ev->oom_kill) {
+                console_printf(CONSOLE_ERR, "cyrenit: the OOM killer killed "
+                               "%" PRIu64 " processes in %s\n",
+                               now.oom_kill - ev->oom_kill, ev->cgroup);
+        }
+        else if (now.oom > ev->oom) {
+                console_printf(CONSOLE_ERR, "cyrenit: %s ran out of memory "
+                               "%" PRIu64 " times\n", ev->cgroup,
+                               now.oom - ev->oom);
+        }
+        if (now.max > ev->max) {
+                console_printf(CONSOLE_WARNING, "cyrenit: %s reached its "
+                               "memory.max %" PRIu64 " times\n", ev->cgroup,
+                               now.max - ev->max);
+        }
+        else if (now.high > ev->high) {
+                console_printf(CONSOLE_NOTICE, "cyrenit: %s was throttled "
+                               "over its memory.high %" PRIu64 " times\n",
+                               ev->cgroup, now.high - ev->high);
+        }
+        *ev = now;
+}
+
+/**
+ * @fn void pressure_watch(struct process *proc)
+ * @brief Watches the memory.events of proc's cgroup, if not yet watched
+ * @details Called whenever a process starts. Cgroups without memory.events
+ *          (no memory controller, or cgroup v1) are remembered as such.
+ */
+void pressure_watch(struct process *proc)
+{
+        struct pressure_events *ev = NULL;
+        char path[PATH_MAX];
+        size_t i = 0;
+
+        if (!pressure_ready || proc->cgroup == NULL) {
+                return;
+        }
+        for (i = 0; i < pressure_watch_count; i++) {
+                if (strcmp(pressure_watches[i].cgroup, proc->cgroup) ==
+                    STRCMP_EQUAL) {
+                        return;
+                }
+        }
+
+        if (pressure_watch_count >= pressure_watch_allocated) {
+                size_t new_size = pressure_watch_allocated > 0 ?
+                                  pressure_watch_allocated * 2 :
+                                  PRESSURE_ALLOC_STEP;
+                ev = mem_reallocarray(MEM_EVENTS, pressure_watches, new_size,
+                                      sizeof(struct pressure_events));
+                if (ev == NULL) {
+                        return;
+                }
+                pressure_watches = ev;
+                pressure_watch_allocated = new_size;
+        }
+
+        ev = &pressure_watches[pressure_watch_count];
+        memset(ev, 0, sizeof(*ev));
+        ev->cgroup = mem_strdup(MEM_EVENTS, proc->cgroup);
+        if (ev->cgroup == NULL) {
+                return;
+        }
+        snprintf(path, sizeof(path), "%s/%s", proc->cgroup,
+                 PRESSURE_EVENTS_FILE);
+        ev->fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (ev->fd != -1 && (!pressure_events_read(ev->fd, ev) ||
+                             !evloop_add(ev->fd, EVLOOP_PRI,
+                                         pressure_events_handle,
+                                         (void *) (uintptr_t)
+                                         pressure_watch_count))) {
+                close(ev->fd);
+                ev->fd = -1;
+        }
+        pressure_watch_count++;
+}
+
+/**
+ * @fn void pressure_process_exited(struct process *proc)
+ * @brief Thaws what is left of a frozen process that went away
+ * @details Otherwise its restart would start frozen in the same cgroup.
+ */
+void pressure_process_exited(struct process *proc)
+{
+        if (!proc->frozen) {
+                return;
+        }
+
+        if (proc->cgroup != NULL) {
+                pressure_freeze(proc, false);
+        }
+        proc->frozen = false;
+}
+
+static bool pressure_trigger_open(struct pressure_trigger *trigger)
+{
+        char spec[64];
+        int length = 0;
+
+        trigger->fd = open(PRESSURE_PATH, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (trigger->fd == -1) {
+                return false;
+        }
+
+        length = snprintf(spec, sizeof(spec), "%s %u %u", trigger->kind,
+                          trigger->stall_us, PRESSURE_WINDOW_US);
+        /* the kernel wants the terminating NUL as well */
+        if (write(trigger->fd, spec, (size_t) length + 1) != length + 1 ||
+            !evloop_add(trigger->fd, EVLOOP_PRI, pressure_handle, trigger)) {
+                close(trigger->fd);
+                trigger->fd = -1;
+                return false;
+        }
+
+        return true;
+}
+
+static void pressure_command(int argc, char **argv,
+                             struct control_reply *reply)
+{
+        struct process *proc = NULL;
+        size_t i = 0;
+
+        if (argc == 2 && strcmp(argv[1], "shed") == STRCMP_EQUAL) {
+                if (!pressure_escalate(PRESSURE_REQUESTED, false)) {
+                        control_reply_printf(reply, "nothing left to shed\n");
+                }
+                timer_cancel(&pressure_settle_timer);
+                timer_add(&supervisor_timers, &pressure_settle_timer,
+                          PRESSURE_SETTLE_MS, TIMER_COARSE);
+                return;
+        }
+        if (argc == 2 && strcmp(argv[1], "recover") == STRCMP_EQUAL) {
+                if (!pressure_recover(PRESSURE_REQUESTED)) {
+                        control_reply_printf(reply, "nothing to recover\n");
+                }
+                return;
+        }
+        if (argc != 1) {
+                control_reply_error(reply, "usage: %s [shed | recover]",
+                                    argv[0]);
+                return;
+        }
+
+        control_reply_printf(reply, "# some_avg10=%.2f full_avg10=%.2f",
+                             pressure_avg10("some"), pressure_avg10("full"));
+        for (i = 0; i < PRESSURE_TRIGGERS; i++) {
+                control_reply_printf(reply, " %s_fired=%" PRIu64 "%s",
+                                     pressure_triggers[i].kind,
+                                     pressure_triggers[i].fired,
+                                     pressure_triggers[i].fd == -1 ?
+                                     "(off)" : "");
+        }
+        control_reply_printf(reply, "\n");
+
+        for (i = 0; i < registered_process_count; i++) {
+                proc = registered_processes[i];
+                control_reply_printf(reply, "%s tier=%s %s\n",
+                                     pressure_name(proc),
+                                     pressure_tier_name(proc->tier),
+                                     proc->frozen ? "frozen" :
+                                     proc->shed ? "shed" :
+                                     process_status_name(proc->status));
+        }
+        for (i = 0; i < pressure_watch_count; i++) {
+                if (pressure_watches[i].fd == -1) {
+                        continue;
+                }
+                control_reply_printf(reply, "cgroup=%s high=%" PRIu64
+                                     " max=%" PRIu64 " oom=%" PRIu64
+                                     " oom_kill=%" PRIu64 "\n",
+                                     pressure_watches[i].cgroup,
+                                     pressure_watches[i].high,
+                                     pressure_watches[i].max,
+                                     pressure_watches[i].oom,
+                                     pressure_watches[i].oom_kill);
+        }
+}
+
+/**
+ * @fn void pressure_init()
+ * @brief Registers the PSI triggers and watches the services' cgroups
+ * @details To be called once the event loop is up. Without PSI (a kernel
+ *          without CONFIG_PSI, or psi=0) services are only shed on request,
+ *          with `cyrenit pressure shed`. After a reexec, what the previous
+ *          PID 1 froze or shed is recovered as usual.
+ */
+void pressure_init()
+{
+        size_t armed = 0;
+        size_t i = 0;
+
+        timer_init(&pressure_settle_timer, pressure_settle_timeout, NULL);
+        pressure_ready = true;
+        for (i = 0; i < PRESSURE_TRIGGERS; i++) {
+                if (pressure_trigger_open(&pressure_triggers[i])) {
+                        armed++;
+                }
+        }
+        if (armed == 0) {
+                fprintf(stderr, "cyrenit: no memory pressure triggers, "
+                        "services will not be shed\n");
+        }
+
+        for (i = 0; i < registered_process_count; i++) {
+                pressure_watch(registered_processes[i]);
+        }
+        if (pressure_pending()) {
+                timer_add(&supervisor_timers, &pressure_settle_timer,
+                          PRESSURE_SETTLE_MS, TIMER_COARSE);
+        }
+
+        control_register("pressure", "[shed | recover] show or act on "
+                         "memory pressure", pressure_command);
+}
+
+#endif//__PRESSURE_C
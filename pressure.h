@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * pressure.h - Shedding of low priority services under memory pressure
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __PRESSURE_H
+#define __PRESSURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "proc.h"
+
+#define PRESSURE_PATH "/proc/pressure/memory"
+#define PRESSURE_EVENTS_FILE "memory.events"
+#define PRESSURE_FREEZE_FILE "cgroup.freeze"
+
+/*
+ * PSI triggers: some task stalled on memory for 10% of a 2 s window, or
+ * every task for 5% of it. Unprivileged triggers need a multiple of 2 s.
+ */
+#define PRESSURE_WINDOW_US 2000000
+#define PRESSURE_SOME_US 200000
+#define PRESSURE_FULL_US 100000
+/* a step is given this long to help before the next trigger sheds more */
+#define PRESSURE_HOLD_MS 5000
+/*
+ * Pressure has cleared once "some" avg10 stayed below this percentage
+ * for PRESSURE_SETTLE_MS. One step is undone per settle period.
+ */
+#define PRESSURE_CLEAR_AVG10 1.0
+#define PRESSURE_SETTLE_MS 10000
+
+/*
+ * Services declare a tier (see service.h). As memory pressure rises, the
+ * lowest tier still running is frozen (cgroup.freeze, or SIGSTOP without a
+ * cgroup), then stopped, then the next one up; "full" pressure stops a tier
+ * right away. Only the low and idle tiers are ever shed. Once pressure
+ * clears, the last tier shed is thawed or started again, and so on down.
+ * Each tier also sets the services' oom_score_adj, so that when the kernel
+ * runs out anyway its OOM killer goes for the idle tier first and keeps
+ * away from the critical one.
+ */
+struct pressure_events
+{
+        char *cgroup;
+        int fd;
+        uint64_t high;
+        uint64_t max;
+        uint64_t oom;
+        uint64_t oom_kill;
+};
+
+bool pressure_freeze(struct process *proc, bool freeze);
+void pressure_watch(struct process *proc);
+void pressure_process_exited(struct process *proc);
+const char *pressure_tier_name(enum proc_tier tier);
+bool pressure_parse_tier(const char *name, enum proc_tier *tier);
+void pressure_init();
+
+#endif//__PRESSURE_H
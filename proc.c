@@ -17,13 +17,28 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <limits.h>
+#include <signal.h>
+#include <fcntl.h>
 
 #include <linux/limits.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #include "cyrenit.h"
+#include "job.h"
+#include "memstat.h"
+#include "pressure.h"
 #include "proc.h"
+#include "sandbox.h"
 
 #define PROCESS_ALLOC_STEP 8
+/* Unknown exits kept for zygote answers that come after them */
+#define PROCESS_EARLY_EXITS 16
+
+static void process_restart_timeout(struct timer *t, void *data);
+static void process_stop_timeout(struct timer *t, void *data);
 
 /**
  * @var struct process **registered_processes
@@ -40,11 +55,23 @@ size_t registered_process_count = 0;
 /**
  * @var size_t registered_process_allocated
  * @brief Allocated size of the registered processes array
- * @details The registered_processes array is resized in steps of
- *         PROCESS_ALLOC_STEP entries.
+ * @details The registered_processes array starts with PROCESS_ALLOC_STEP
+ *         entries and doubles when full.
  */
 size_t registered_process_allocated = 0;
 
+/* The vector and its strings are one block, see process_set_env() */
+static void process_free_env(struct process *proc)
+{
+        if (proc->environment != NULL && !proc->env_shared) {
+                mem_free(MEM_ENV, proc->environment);
+        }
+        proc->environment = NULL;
+        proc->env_shared = false;
+        proc->env_counter = 0;
+        proc->env_allocated = 0;
+}
+
 /**
  * @fn struct process *process_create()
  * @brief Creates a process structure and returns it
@@ -54,15 +81,24 @@ struct process *process_create()
 {
         struct process *ret = NULL;
 
-        ret = malloc(sizeof(struct process));
+        ret = mem_calloc(MEM_PROC, 1, sizeof(struct process));
         if (ret == NULL) {
                 return NULL;
         }
 
-        bzero(ret, sizeof(struct process));
-
         ret->status = CYRENIT_PROC_STATUS_UNSTARTED;
         ret->pid = -1;
+        ret->pidfd = -1;
+        ret->restart = CYRENIT_PROC_RESTART_ON_FAILURE;
+        ret->restart_delay_ms = RESTART_DELAY_DEFAULT_MS;
+        ret->stop_timeout_ms = STOP_TIMEOUT_DEFAULT_MS;
+        ret->tier = CYRENIT_PROC_TIER_NORMAL;
+        ret->target = BOOT_TARGET_FULL;
+        timer_init(&ret->restart_timer, process_restart_timeout, ret);
+        timer_init(&ret->stop_timer, process_stop_timeout, ret);
+        svclog_init(&ret->log);
+        exec_attrs_init(&ret->attrs);
+        zygote_init(&ret->zygote);
 
         return ret;
 }
@@ -78,27 +114,50 @@ void process_destroy(struct process *proc)
                 return;
         }
 
+        timer_cancel(&proc->restart_timer);
+        timer_cancel(&proc->stop_timer);
+        job_forget(proc);
+        zygote_stop(proc);
+        svclog_close(proc);
+        fdstore_clear(proc);
+        if (proc->pidfd != -1) {
+                close(proc->pidfd);
+        }
+
+        if (proc->name != NULL) {
+                mem_free(MEM_PROC, proc->name);
+        }
+
         if (proc->exec_image != NULL) {
-                free(proc->exec_image);
+                mem_free(MEM_PROC, proc->exec_image);
+        }
+
+        if (proc->cgroup != NULL) {
+                mem_free(MEM_PROC, proc->cgroup);
         }
 
         if (proc->argv != NULL) {
                 for (size_t i = 0; i < proc->arg_counter; i++) {
                         if (proc->argv[i] != NULL) {
-                                free(proc->argv[i]);
+                                mem_free(MEM_PROC, proc->argv[i]);
                         }
                 }
-                free(proc->argv);
+                mem_free(MEM_PROC, proc->argv);
         }
-        if (proc->environment != NULL) {
-                for (size_t i = 0; i < proc->env_counter; i++) {
-                        if (proc->environment[i] != NULL) {
-                                free(proc->environment[i]);
-                        }
-                }
-                free(proc->environment);
+        process_free_env(proc);
+        for (size_t i = 0; i < proc->require_count; i++) {
+                mem_free(MEM_PROC, proc->requires[i]);
         }
-        free(proc);       
+        mem_free(MEM_PROC, proc->requires);
+        for (size_t i = 0; i < proc->after_count; i++) {
+                mem_free(MEM_PROC, proc->after[i]);
+        }
+        mem_free(MEM_PROC, proc->after);
+        for (size_t i = 0; i < proc->device_count; i++) {
+                mem_free(MEM_PROC, proc->devices[i]);
+        }
+        mem_free(MEM_PROC, proc->devices);
+        mem_free(MEM_PROC, proc);       
 }
 
 /**
@@ -116,16 +175,19 @@ bool process_set_image(struct process *proc, const char *path)
                 return false;
         }
 
-        new_path = strdup(path);
+        new_path = mem_strdup(MEM_PROC, path);
         if (new_path == NULL) {
                 return false;
         }
 
         if (proc->exec_image != NULL) {
-                free(proc->exec_image);
+                mem_free(MEM_PROC, proc->exec_image);
         }
 
         proc->exec_image = new_path;
+        if (proc->name == NULL) {
+                process_set_name(proc, basename(new_path));
+        }
         if (proc->argv != NULL && proc->arg_counter > 0) {
                 proc->argv[0] = new_path;
         }
@@ -138,6 +200,62 @@ bool process_set_image(struct process *proc, const char *path)
         return true;
 }
 
+/**
+ * @fn bool process_set_name(struct process *proc, const char *name)
+ * @brief Sets the service name of a process
+ * @param proc the process to be modified
+ * @param name the name shown by the CLI, defaults to the image basename
+ * @return true on success or false on failure
+ */
+bool process_set_name(struct process *proc, const char *name)
+{
+        char *new_name = NULL;
+
+        if (proc == NULL || name == NULL) {
+                return false;
+        }
+
+        new_name = mem_strdup(MEM_PROC, name);
+        if (new_name == NULL) {
+                return false;
+        }
+
+        if (proc->name != NULL) {
+                mem_free(MEM_PROC, proc->name);
+        }
+
+        proc->name = new_name;
+        return true;
+}
+
+/**
+ * @fn bool process_set_cgroup(struct process *proc, const char *cgroup)
+ * @brief Sets the cgroup v2 directory accounting for a process
+ * @param proc the process to be modified
+ * @param cgroup absolute path of the cgroup directory
+ * @return true on success or false on failure
+ */
+bool process_set_cgroup(struct process *proc, const char *cgroup)
+{
+        char *new_cgroup = NULL;
+
+        if (proc == NULL || cgroup == NULL) {
+                return false;
+        }
+
+        new_cgroup = mem_strdup(MEM_PROC, cgroup);
+        if (new_cgroup == NULL) {
+                return false;
+        }
+
+        if (proc->cgroup != NULL) {
+                mem_free(MEM_PROC, proc->cgroup);
+        }
+
+        proc->cgroup = new_cgroup;
+        return true;
+}
+
 /**
  * @fn bool process_set_args(struct process *proc, const char **args)
  * @brief Sets the argument vector of a process
@@ -164,7 +282,7 @@ bool process_set_args(struct process *proc, const char **args)
                         arg_ptr++;
                 }
                 while (arg_ptr > proc->argv) {
-                        free(*(--arg_ptr));
+                        mem_free(MEM_PROC, *(--arg_ptr));
                         proc->arg_counter--;
                 }
 
@@ -202,11 +320,16 @@ bool process_set_args(struct process *proc, const char **args)
  * @param proc the process to be modified
  * @param envp the environment vector
  * @return true on success or false on failure
+ * @details The vector and its strings are copied into a single block.
  */
 bool process_set_env(struct process *proc, const char **envp)
 {
         char **env_ptr = NULL;
+        char **environment = NULL;
+        char *strings = NULL;
         size_t envp_size = 0;
+        size_t size = 0;
+        size_t i = 0;
 
         if (proc == NULL || envp == NULL) {
                 return false;
@@ -214,6 +337,7 @@ bool process_set_env(struct process *proc, const char **envp)
 
         env_ptr = (char **) envp;
         while (env_ptr != NULL && *env_ptr != NULL) {
+                size += strlen(*env_ptr) + 1;
                 env_ptr++;
         }
 
@@ -223,23 +347,23 @@ bool process_set_env(struct process *proc, const char **envp)
                 return false; //empty list
         }
 
-        proc->environment = malloc(sizeof(char *) * (envp_size + 1));
-        if (proc->environment == NULL) {
+        size += sizeof(char *) * (envp_size + 1);
+        environment = mem_malloc(MEM_ENV, size);
+        if (environment == NULL) {
                 return false;
         }
 
-        env_ptr = (char **) envp;
-        proc->env_counter = 0;
-        while (env_ptr != NULL && *env_ptr != NULL) {
-                proc->environment[proc->env_counter] = strdup(*env_ptr);
-                if (proc->environment[proc->env_counter] == NULL) {
-                        return false;
-                }
-
-                proc->env_counter++;
-                env_ptr++;
+        strings = (char *) (environment + envp_size + 1);
+        for (i = 0; i < envp_size; i++) {
+                environment[i] = strings;
+                strings = stpcpy(strings, envp[i]) + 1;
         }
-        proc->environment[proc->env_counter] = NULL;
+        environment[envp_size] = NULL;
+
+        process_free_env(proc);
+        proc->environment = environment;
+        proc->env_counter = envp_size;
+
         return true;
 }
 
@@ -262,7 +386,8 @@ bool process_add_arg(struct process *proc, const char *arg)
 
         if (proc->arg_counter + 1 >= proc->arg_allocated) {
                 new_size = proc->arg_allocated + 8;
-                new_argv = realloc(proc->argv, sizeof(char *) * new_size);
+                new_argv = mem_realloc(MEM_PROC, proc->argv,
+                                       sizeof(char *) * new_size);
                 if (new_argv == NULL) {
                         return false;
                 }
@@ -270,7 +395,7 @@ bool process_add_arg(struct process *proc, const char *arg)
                 proc->arg_allocated = new_size;
         }
 
-        new_arg = strdup(arg);
+        new_arg = mem_strdup(MEM_PROC, arg);
         if (new_arg == NULL) {
                 return false;
         }
@@ -282,6 +407,75 @@ bool process_add_arg(struct process *proc, const char *arg)
         return true;
 }
 
+static bool process_add_name(char ***names, size_t *count, const char *name)
+{
+        char **new_names = NULL;
+        size_t i = 0;
+
+        for (i = 0; i < *count; i++) {
+                if (strcmp((*names)[i], name) == STRCMP_EQUAL) {
+                        return true;
+                }
+        }
+
+        new_names = mem_reallocarray(MEM_PROC, *names, *count + 1,
+                                     sizeof(char *));
+        if (new_names == NULL) {
+                return false;
+        }
+        *names = new_names;
+
+        new_names[*count] = mem_strdup(MEM_PROC, name);
+        if (new_names[*count] == NULL) {
+                return false;
+        }
+        (*count)++;
+
+        return true;
+}
+
+/**
+ * @fn bool process_add_require(struct process *proc, const char *name)
+ * @brief Makes proc need the service name running, started before it
+ * @return true on success or false on failure
+ */
+bool process_add_require(struct process *proc, const char *name)
+{
+        if (proc == NULL || name == NULL) {
+                return false;
+        }
+
+        return process_add_name(&proc->requires, &proc->require_count, name);
+}
+
+/**
+ * @fn bool process_add_after(struct process *proc, const char *name)
+ * @brief Orders the start of proc after the service name, if both start
+ * @return true on success or false on failure
+ */
+bool process_add_after(struct process *proc, const char *name)
+{
+        if (proc == NULL || name == NULL) {
+                return false;
+        }
+
+        return process_add_name(&proc->after, &proc->after_count, name);
+}
+
+/**
+ * @fn bool process_add_device(struct process *proc, const char *device)
+ * @brief Makes the start of proc wait for device to appear
+ * @return true on success or false on failure
+ */
+bool process_add_device(struct process *proc, const char *device)
+{
+        if (proc == NULL || device == NULL) {
+                return false;
+        }
+
+        return process_add_name(&proc->devices, &proc->device_count, device);
+}
+
 /**
  * @fn bool process_set_envdynamic(struct process *proc)
  * @brief Sets the environment of a process to be dynamic
@@ -295,18 +489,7 @@ bool process_set_envdynamic(struct process *proc)
                 return false;
         }
 
-        if (proc->environment != NULL) {
-                for (size_t i = 0; i < proc->env_counter; i++) {
-                        if (proc->environment[i] != NULL) {
-                                free(proc->environment[i]);
-                        }
-                }
-                free(proc->environment);
-                proc->environment = NULL;
-                proc->env_counter = 0;
-                proc->env_allocated = 0;
-        }
-
+        process_free_env(proc);
         proc->env_dynamic = true;
         return true;
 }
@@ -359,12 +542,147 @@ bool process_set_retid(struct process *proc, int retid)
 }
 
 /**
- * @fn bool process_forkexec(struct process *proc)
- * @brief Forks and execs the process described by proc
- * @param proc the process to be forked and execed
- * @return true on success or false on failure
+ * @fn bool process_enter_cgroup(struct process *proc)
+ * @brief Moves the calling process into the cgroup of proc, if it has one
+ * @return true on success or if proc has no cgroup
  */
-bool process_forkexec(struct process *proc)
+bool process_enter_cgroup(struct process *proc)
+{
+        char path[PATH_MAX];
+        bool ok = false;
+        int fd = -1;
+
+        if (proc->cgroup == NULL) {
+                return true;
+        }
+
+        snprintf(path, sizeof(path), "%s/cgroup.procs", proc->cgroup);
+        fd = open(path, O_WRONLY | O_CLOEXEC);
+        if (fd == -1) {
+                return false;
+        }
+
+        ok = write(fd, "0\n", 2) == 2;
+        close(fd);
+
+        return ok;
+}
+
+/*
+ * oom_score_adj of each tier: the OOM killer goes for idle services first
+ * and leaves critical ones to the very last
+ */
+static const char *process_oom_scores[CYRENIT_PROC_TIERS] = {
+        [CYRENIT_PROC_TIER_CRITICAL] = "-900\n",
+        [CYRENIT_PROC_TIER_NORMAL] = "0\n",
+        [CYRENIT_PROC_TIER_LOW] = "500\n",
+        [CYRENIT_PROC_TIER_IDLE] = "1000\n",
+};
+
+/**
+ * @fn static bool process_set_oom_score(struct process *proc)
+ * @brief Sets the calling process' oom_score_adj after the tier of proc
+ */
+static bool process_set_oom_score(struct process *proc)
+{
+        const char *score = process_oom_scores[proc->tier];
+        bool ok = false;
+        int fd = open("/proc/self/oom_score_adj", O_WRONLY | O_CLOEXEC);
+
+        if (fd == -1) {
+                return false;
+        }
+        ok = write(fd, score, strlen(score)) == (ssize_t) strlen(score);
+        close(fd);
+
+        return ok;
+}
+
+/**
+ * @fn bool process_setup_child(struct process *proc)
+ * @brief Prepares a freshly forked child to become proc
+ * @param proc the process the child is going to execute
+ * @return true on success or false if the child must not exec
+ * @details Shared by process_forkexec() and the zygotes.
+ */
+bool process_setup_child(struct process *proc)
+{
+        sigset_t empty_mask;
+
+        // PID 1 blocks the signals it handles through signalfd
+        sigemptyset(&empty_mask);
+        sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+        // and ignores SIGTTOU for the console, which exec would keep
+        signal(SIGTTOU, SIG_DFL);
+
+        /*
+         * A session of its own also keeps the service out of PID 1's
+         * process group, which autofs treats as the mount daemon.
+         */
+        setsid();
+        if (proc->console) {
+                ioctl(console_fd, TIOCSCTTY, 0);
+                dup2(console_fd, STDIN_FILENO);
+                dup2(console_fd, STDOUT_FILENO);
+                dup2(console_fd, STDERR_FILENO);
+        }
+        else {
+                svclog_child(proc);
+        }
+
+        if (!process_enter_cgroup(proc)) {
+                fprintf(stderr, "cyrenit[%d]: failed to enter cgroup %s\n",
+                        getpid(), proc->cgroup);
+        }
+
+        // before exec_attrs_apply() may drop the privilege to lower it
+        if (!process_set_oom_score(proc)) {
+                fprintf(stderr, "cyrenit[%d]: failed to set the OOM score "
+                        "of %s\n", getpid(), proc->exec_image);
+        }
+
+        // its mounts go read-only here, the cgroup had to be entered first
+        if (!sandbox_setup(proc->sandbox)) {
+                return false;
+        }
+
+        if (!exec_attrs_apply(&proc->attrs)) {
+                fprintf(stderr, "cyrenit[%d]: failed to apply the "
+                        "execution attributes of %s\n", getpid(),
+                        proc->exec_image);
+                return false;
+        }
+
+        return true;
+}
+
+/**
+ * @fn static bool process_started(struct process *proc, pid_t pid)
+ * @brief Records that proc now runs as pid
+ * @details pid is -1 while a zygote is yet to tell it, see
+ *          process_spawned().
+ */
+static bool process_started(struct process *proc, pid_t pid)
+{
+        proc->pid = pid;
+        proc->pidfd = pid > 0 ? (int) syscall(SYS_pidfd_open, pid, 0) : -1;
+        proc->status = CYRENIT_PROC_STATUS_RUNNING;
+        proc->started_at = timer_wheel_now(&supervisor_timers);
+        pressure_watch(proc);
+        if (!proc->registered) {
+                if (!register_process(proc)) {
+                        fprintf(stderr, "cyrenit: failed to register "
+                                "process %s\n", proc->exec_image);
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+static bool process_signal(struct process *proc, int sig);
+
+static bool process_fork(struct process *proc)
 {
         pid_t pid = 0;
         int exec_ret = 0;
@@ -372,32 +690,22 @@ bool process_forkexec(struct process *proc)
         char **argv = NULL;
         char *empty_arr[] = {NULL, NULL};
 
-        if (proc == NULL || proc->exec_image == NULL) {
-                return -1;
-        }
-
-        if (proc->status == CYRENIT_PROC_STATUS_RUNNING) {
-                return false; //already running
-        }
-
         fprintf(stdout, "cyrenit[%d]: forking process for %s\n",
                 getpid(), proc->exec_image);
-        pid = fork();
-        
+        fflush(stdout);
+        pid = proc->sandbox != 0 ? sandbox_fork(proc->sandbox) : fork();
+
         if (pid == -1) {
                 fprintf(stderr, "cyrenit[%d]: ", getpid());
                 perror("error forking process!");
-                return -1; //fork error
+                return false; //fork error
         }
 
-        sleep(1);
-        fprintf(stdout, "cyrenit[%d]: forked process %d for %s\n",
-                getpid(), pid, proc->exec_image);
-        sleep(1);
-        
         if (pid == FORK_ISCHILD) {
-                fprintf(stdout, "cyrenit[%d]: entering the children\n",
-                        getpid());
+                if (!process_setup_child(proc)) {
+                        _exit(EXIT_FAILURE);
+                }
+
                 argv = proc->argv;
                 if (argv == NULL) {
                         argv = empty_arr;
@@ -410,41 +718,196 @@ bool process_forkexec(struct process *proc)
                 else {
                         envp = proc->environment;
                 }
-
-                fprintf(stdout, "cyrenit[%d]: ready for execve of %s"
-                        "with %zu args and %zu env vars\n",
-                        getpid(), proc->exec_image,
-                        proc->arg_counter, proc->env_counter);
+                envp = fdstore_child(proc, envp);
 
                 exec_ret = execve(proc->exec_image, argv, envp);
                 if (exec_ret == -1) {
                         fprintf(stderr, "cyrenit[%d]: error executing %s:",
                                 getpid(), proc->exec_image);
                         perror(" ");
-                        exit(EXIT_FAILURE);
-                        return false;
+                        _exit(EXIT_FAILURE);
                 }
         }
-        else {
-                fprintf(stdout, "cyrenit[%d]: parent process, child is %d\n",
-                        getpid(), pid);
-                proc->pid = pid;
-                proc->status = CYRENIT_PROC_STATUS_RUNNING;
-                if (!proc->registered) {
-                        if (!register_process(proc)) {
-                                fprintf(stderr, "cyrenit: failed to register "
-                                        "process %s\n", proc->exec_image);
-                                return false;
-                        }
-                        proc->registered = true;
+
+        fprintf(stdout, "cyrenit[%d]: forked process %d for %s\n",
+                getpid(), pid, proc->exec_image);
+        return process_started(proc, pid);
+}
+
+/**
+ * @fn bool process_forkexec(struct process *proc)
+ * @brief Forks and execs the process described by proc
+ * @param proc the process to be forked and execed
+ * @return true on success or false on failure
+ * @details Processes using a zygote are cloned by it instead: they count
+ *          as running from the request on, with a pid of -1 until the
+ *          answer reaches process_spawned(). Sandboxed ones are forked
+ *          into their namespaces by sandbox_fork().
+ */
+bool process_forkexec(struct process *proc)
+{
+        if (proc == NULL || proc->exec_image == NULL) {
+                return false;
+        }
+
+        if (proc->status == CYRENIT_PROC_STATUS_RUNNING) {
+                return false; //already running
+        }
+
+        if (!proc->console && !svclog_open(proc)) {
+                fprintf(stderr, "cyrenit: not capturing the output of %s\n",
+                        proc->exec_image);
+        }
+
+        /*
+         * the zygote does not hold what the service stored, nor lives in
+         * its namespaces
+         */
+        if (proc->use_zygote && proc->fdstore.max == 0 &&
+            proc->sandbox == 0) {
+                if (zygote_spawn(proc)) {
+                        return process_started(proc, -1);
+                }
+                fprintf(stderr, "cyrenit: zygote of %s failed, forking it "
+                        "directly\n", proc->exec_image);
+        }
+
+        return process_fork(proc);
+}
+
+/* Exits reaped before a zygote told whose they were, newest last */
+static struct
+{
+        pid_t pid;
+        int status;
+        struct rusage ru;
+} early_exits[PROCESS_EARLY_EXITS];
+static size_t early_exit_next = 0;
+
+static bool process_claim_exit(pid_t pid, int *status, struct rusage *ru)
+{
+        size_t i = 0;
+
+        for (i = 0; i < PROCESS_EARLY_EXITS; i++) {
+                if (early_exits[i].pid == pid) {
+                        early_exits[i].pid = 0;
+                        *status = early_exits[i].status;
+                        *ru = early_exits[i].ru;
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+/**
+ * @fn void process_spawned(struct process *proc, pid_t pid)
+ * @brief Takes the answer of proc's zygote: the pid of the new instance,
+ *        or -1 if it failed, which forks it directly instead
+ * @details The instance is PID 1's child and may have been reaped already,
+ *          its exit is then applied right away. A stop requested meanwhile
+ *          is carried out now.
+ */
+void process_spawned(struct process *proc, pid_t pid)
+{
+        struct rusage ru;
+        int status = 0;
+
+        if (pid <= 0) {
+                fprintf(stderr, "cyrenit: zygote of %s failed, forking it "
+                        "directly\n", proc->exec_image);
+                if (proc->stopping || !process_fork(proc)) {
+                        process_exited(proc, W_EXITCODE(EXIT_FAILURE, 0));
+                }
+                return;
+        }
+
+        fprintf(stdout, "cyrenit[%d]: zygote %d spawned process %d for %s\n",
+                getpid(), proc->zygote.pid, pid, proc->exec_image);
+        proc->pid = pid;
+        proc->pidfd = (int) syscall(SYS_pidfd_open, pid, 0);
+
+        if (process_claim_exit(pid, &status, &ru)) {
+                stats_account_exit(proc, &ru);
+                process_exited(proc, status);
+                return;
+        }
+        if (proc->stopping) {
+                process_signal(proc, SIGTERM);
+        }
+}
+
+/**
+ * @fn size_t process_spawning()
+ * @brief Counts the processes waiting for their zygote's answer
+ */
+size_t process_spawning()
+{
+        size_t count = 0;
+        size_t i = 0;
+
+        for (i = 0; i < registered_process_count; i++) {
+                if (registered_processes[i]->zygote.pending) {
+                        count++;
                 }
         }
 
-        fprintf(stdout, "cyrenit[%d]: process_forkexec for %s "
-                "completed\n", getpid(), proc->exec_image);
+        return count;
+}
 
-        return proc->pid == pid;
+static bool process_signal(struct process *proc, int sig)
+{
+        if (proc->pidfd != -1 &&
+            syscall(SYS_pidfd_send_signal, proc->pidfd, sig, NULL, 0) == 0) {
+                return true;
+        }
 
+        return proc->pid > 0 && kill(proc->pid, sig) == 0;
+}
+
+static void process_stop_timeout(struct timer *t, void *data)
+{
+        struct process *proc = data;
+
+        (void) t;
+        fprintf(stderr, "cyrenit: %s did not stop in %u ms, killing it\n",
+                proc->exec_image, proc->stop_timeout_ms);
+        process_signal(proc, SIGKILL);
+}
+
+/**
+ * @fn bool process_stop(struct process *proc)
+ * @brief Stops proc for good: SIGTERM, then SIGKILL after stop_timeout_ms
+ * @param proc the process to be stopped
+ * @return true if it was signaled or false if it was not running
+ * @details A pending restart is cancelled and the exit does not schedule
+ *          another one, see process_exited().
+ */
+bool process_stop(struct process *proc)
+{
+        if (proc == NULL) {
+                return false;
+        }
+
+        timer_cancel(&proc->restart_timer);
+        if (proc->status != CYRENIT_PROC_STATUS_RUNNING) {
+                return false;
+        }
+        if (proc->stopping) {
+                return true;
+        }
+
+        fprintf(stdout, "cyrenit: stopping %s\n", proc->name != NULL ?
+                proc->name : proc->exec_image);
+        // a spawn waiting for its pid is signaled by process_spawned()
+        if (!process_signal(proc, SIGTERM) && !proc->zygote.pending) {
+                return false;
+        }
+        proc->stopping = true;
+        timer_add(&supervisor_timers, &proc->stop_timer,
+                  proc->stop_timeout_ms, TIMER_FINE);
+
+        return true;
 }
 
 /**
@@ -460,20 +923,14 @@ bool register_process(struct process *proc)
                 return false;
         }
 
-        if (registered_processes == NULL) {
-                registered_processes = malloc(sizeof(struct process *) *
-                                             PROCESS_ALLOC_STEP);
-                if (registered_processes == NULL) {
-                        return false;
-                }
-                registered_process_allocated = PROCESS_ALLOC_STEP;
-                registered_process_count = 0;
-        }
-
         if (registered_process_count >= registered_process_allocated) {
-                size_t new_size = registered_process_allocated + PROCESS_ALLOC_STEP;
-                struct process **new_array = realloc(registered_processes,
-                                                     new_size * sizeof(struct process *));
+                size_t new_size = registered_process_allocated > 0 ?
+                                  registered_process_allocated * 2 :
+                                  PROCESS_ALLOC_STEP;
+                struct process **new_array = mem_reallocarray(MEM_PROC,
+                                                registered_processes,
+                                                new_size,
+                                                sizeof(struct process *));
                 if (new_array == NULL) {
                         return false;
                 }
@@ -482,7 +939,246 @@ bool register_process(struct process *proc)
         }
 
         registered_processes[registered_process_count++] = proc;
+        proc->registered = true;
+        return true;
+}
+
+/**
+ * @fn bool unregister_process(struct process *proc)
+ * @brief Removes a process from the global registered_processes array
+ * @param proc the process to be unregistered
+ * @return true on success or false if it was not registered
+ * @details The order of the remaining processes is kept.
+ */
+bool unregister_process(struct process *proc)
+{
+        size_t i = 0;
+
+        if (proc == NULL || !proc->registered) {
+                return false;
+        }
+
+        for (i = 0; i < registered_process_count; i++) {
+                if (registered_processes[i] == proc) {
+                        break;
+                }
+        }
+        if (i == registered_process_count) {
+                return false;
+        }
+
+        memmove(&registered_processes[i], &registered_processes[i + 1],
+                (registered_process_count - i - 1) *
+                sizeof(struct process *));
+        registered_process_count--;
+        proc->registered = false;
         return true;
 }
 
+/**
+ * @fn struct process *process_find_by_name(const char *name)
+ * @brief Looks up a registered process by its service name
+ * @return the process or NULL if none has that name
+ * @details Retired processes are never found.
+ */
+struct process *process_find_by_name(const char *name)
+{
+        size_t i = 0;
+
+        if (name == NULL) {
+                return NULL;
+        }
+
+        for (i = 0; i < registered_process_count; i++) {
+                if (!registered_processes[i]->retired &&
+                    registered_processes[i]->name != NULL &&
+                    strcmp(registered_processes[i]->name, name) ==
+                    STRCMP_EQUAL) {
+                        return registered_processes[i];
+                }
+        }
+
+        return NULL;
+}
+
+/**
+ * @fn struct process *process_find_by_pid(pid_t pid)
+ * @brief Looks up a registered process by its current PID
+ * @param pid the PID to look for
+ * @return the process or NULL if no registered process has that PID
+ */
+struct process *process_find_by_pid(pid_t pid)
+{
+        size_t i = 0;
+
+        if (pid <= 0) {
+                return NULL;
+        }
+
+        for (i = 0; i < registered_process_count; i++) {
+                if (registered_processes[i]->pid == pid) {
+                        return registered_processes[i];
+                }
+        }
+
+        return NULL;
+}
+
+static void process_restart_timeout(struct timer *t, void *data)
+{
+        struct process *proc = data;
+
+        (void) t;
+        fprintf(stdout, "cyrenit: restarting %s (restart #%u)\n",
+                proc->exec_image, proc->restart_count);
+        if (!process_forkexec(proc)) {
+                fprintf(stderr, "cyrenit: failed to restart %s\n",
+                        proc->exec_image);
+                process_exited(proc, W_EXITCODE(EXIT_FAILURE, 0));
+        }
+}
+
+/**
+ * @fn void process_exited(struct process *proc, int status)
+ * @brief Records the exit of proc and schedules a restart if due
+ * @param proc the process that exited
+ * @param status the wait status of the process
+ * @details Restarts back off exponentially from restart_delay_ms up to
+ *          RESTART_DELAY_MAX_MS. A process that stayed up for at least
+ *          RESTART_STABLE_MS starts over from the initial delay. Retired
+ *          processes are destroyed instead, proc is gone on return.
+ *          Processes stopped with process_stop() are not restarted, their
+ *          stop job (if any) carries on instead.
+ */
+MEM_HOT
+void process_exited(struct process *proc, int status)
+{
+        uint64_t now = 0;
+        uint64_t delay = 0;
+        bool failed = false;
+        bool stopped = false;
+
+        if (proc == NULL) {
+                return;
+        }
+
+        now = timer_wheel_now(&supervisor_timers);
+        failed = !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS;
+
+        proc->pid = -1;
+        if (proc->pidfd != -1) {
+                close(proc->pidfd);
+                proc->pidfd = -1;
+        }
+        proc->status = CYRENIT_PROC_STATUS_STOPPED;
+        proc->ret_value = WIFEXITED(status) ? WEXITSTATUS(status) :
+                                              128 + WTERMSIG(status);
+        pressure_process_exited(proc);
+
+        if (WIFSIGNALED(status)) {
+                fprintf(stderr, "cyrenit: %s was killed by signal %d\n",
+                        proc->exec_image, WTERMSIG(status));
+        }
+        else {
+                fprintf(stdout, "cyrenit: %s exited with status %d\n",
+                        proc->exec_image, proc->ret_value);
+        }
+
+        stopped = proc->stopping;
+        if (stopped) {
+                timer_cancel(&proc->stop_timer);
+                proc->stopping = false;
+        }
+
+        if (proc->retired) {
+                fprintf(stdout, "cyrenit: %s retired\n", proc->name);
+                unregister_process(proc);
+                process_destroy(proc);
+                return;
+        }
+
+        if (stopped) {
+                job_process_stopped(proc);
+                return;
+        }
+
+        if (proc->restart == CYRENIT_PROC_RESTART_NEVER ||
+            (proc->restart == CYRENIT_PROC_RESTART_ON_FAILURE && !failed)) {
+                return;
+        }
+
+        if (now - proc->started_at >= RESTART_STABLE_MS) {
+                proc->restart_backoff = 0;
+        }
+
+        delay = proc->restart_delay_ms;
+        delay <<= proc->restart_backoff < 16 ? proc->restart_backoff : 16;
+        if (delay > RESTART_DELAY_MAX_MS) {
+                delay = RESTART_DELAY_MAX_MS;
+        }
+        else {
+                proc->restart_backoff++;
+        }
+        proc->restart_count++;
+
+        fprintf(stdout, "cyrenit: restarting %s in %llu ms\n",
+                proc->exec_image, (unsigned long long) delay);
+        timer_add(&supervisor_timers, &proc->restart_timer, delay,
+                  delay >= TIMER_COARSE_TICKS * 4 ? TIMER_COARSE : TIMER_FINE);
+}
+
+/**
+ * @fn void process_reap_children()
+ * @brief Reaps every exited child, updating the registered processes
+ * @details Children that are not registered (e.g. reparented orphans) are
+ *          just reaped, the last PROCESS_EARLY_EXITS of them are kept for
+ *          process_spawned(). The rusage of registered ones is accounted.
+ */
+MEM_HOT
+void process_reap_children()
+{
+        struct process *proc = NULL;
+        struct rusage ru;
+        int status = 0;
+        pid_t pid = 0;
+
+        while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+                if (!WIFEXITED(status) && !WIFSIGNALED(status)) {
+                        continue;
+                }
+
+                proc = process_find_by_pid(pid);
+                if (proc == NULL) {
+                        // maybe a zygote's child whose pid is on its way
+                        early_exits[early_exit_next].pid = pid;
+                        early_exits[early_exit_next].status = status;
+                        early_exits[early_exit_next].ru = ru;
+                        early_exit_next = (early_exit_next + 1) %
+                                          PROCESS_EARLY_EXITS;
+                        continue;
+                }
+
+                stats_account_exit(proc, &ru);
+                process_exited(proc, status);
+        }
+}
+
+/**
+ * @fn const char *process_status_name(enum proc_status status)
+ * @brief Returns a printable name for a process status
+ */
+const char *process_status_name(enum proc_status status)
+{
+        switch (status) {
+        case CYRENIT_PROC_STATUS_UNSTARTED:
+                return "unstarted";
+        case CYRENIT_PROC_STATUS_RUNNING:
+                return "running";
+        case CYRENIT_PROC_STATUS_STOPPED:
+                return "stopped";
+        default:
+                return "unknown";
+        }
+}
+
 #endif//__PROC_C
\ No newline at end of file
@@ -13,10 +13,27 @@
 #define __PROC_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
+#include "bootopt.h"
+#include "execattr.h"
+#include "fdstore.h"
+#include "stats.h"
+#include "svclog.h"
+#include "timer.h"
+#include "zygote.h"
+
 #define FORK_ISCHILD 0
 
+/* Restart backoff: doubles from restart_delay_ms up to the maximum */
+#define RESTART_DELAY_DEFAULT_MS 1000
+#define RESTART_DELAY_MAX_MS 60000
+/* A process that ran this long is considered stable, resetting backoff */
+#define RESTART_STABLE_MS 10000
+/* Stopping sends SIGTERM, then SIGKILL if still running after this */
+#define STOP_TIMEOUT_DEFAULT_MS 5000
+
 enum proc_status
 {
         CYRENIT_PROC_STATUS_UNKNOWN = 0,
@@ -25,11 +42,31 @@ enum proc_status
         CYRENIT_PROC_STATUS_STOPPED
 };
 
+enum proc_restart
+{
+        CYRENIT_PROC_RESTART_NEVER = 0,
+        CYRENIT_PROC_RESTART_ON_FAILURE,
+        CYRENIT_PROC_RESTART_ALWAYS
+};
+
+/* Ordered by importance, see pressure.h */
+enum proc_tier
+{
+        CYRENIT_PROC_TIER_CRITICAL = 0,
+        CYRENIT_PROC_TIER_NORMAL,
+        CYRENIT_PROC_TIER_LOW,
+        CYRENIT_PROC_TIER_IDLE,
+        CYRENIT_PROC_TIERS
+};
+
 struct process
 {
         pid_t pid;
+        int pidfd;
         int ret_value;
+        char *name;
         char *exec_image;
+        char *cgroup;
         char **argv;
         char **environment;
         size_t arg_counter;
@@ -37,8 +74,45 @@ struct process
         size_t env_counter;
         size_t env_allocated;
         bool env_dynamic;
+        /* environment borrowed from a service template, not freed */
+        bool env_shared;
         bool registered;
+        /* dropped by scaling down: unregistered and destroyed on exit */
+        bool retired;
+        bool console;
         enum proc_status status;
+        enum proc_restart restart;
+        unsigned restart_count;
+        unsigned restart_backoff;
+        unsigned restart_delay_ms;
+        uint64_t started_at;
+        struct timer restart_timer;
+        /* stopped on purpose, not restarted when it exits */
+        bool stopping;
+        unsigned stop_timeout_ms;
+        struct timer stop_timer;
+        /* what memory pressure may do to it: frozen, or stopped (shed) */
+        enum proc_tier tier;
+        bool frozen;
+        bool shed;
+        /* the smallest boot target it is started in */
+        enum boot_target target;
+        /* services this one needs running, and the ones it starts after */
+        char **requires;
+        size_t require_count;
+        char **after;
+        size_t after_count;
+        /* devices its start waits for, see uevent.h */
+        char **devices;
+        size_t device_count;
+        struct process_stats stats;
+        struct svclog log;
+        struct exec_attrs attrs;
+        bool use_zygote;
+        struct zygote zygote;
+        struct fdstore fdstore;
+        /* namespaces and private mounts, see sandbox.h */
+        unsigned sandbox;
 };
 
 extern struct process **registered_processes;
@@ -48,16 +122,32 @@ extern size_t registered_process_allocated;
 struct process *process_create();
 void process_destroy(struct process *proc);
 bool process_set_image(struct process *proc, const char *path);
+bool process_set_name(struct process *proc, const char *name);
+bool process_set_cgroup(struct process *proc, const char *cgroup);
 bool process_set_args(struct process *proc, const char **args);
 bool process_set_env(struct process *proc, const char **envp);
 bool process_add_arg(struct process *proc, const char *arg);
 bool process_set_envdynamic(struct process *proc);
+bool process_add_require(struct process *proc, const char *name);
+bool process_add_after(struct process *proc, const char *name);
+bool process_add_device(struct process *proc, const char *device);
 
 bool process_set_pid(struct process *proc, pid_t pid);
 bool process_set_retid(struct process *proc, int retid);
 bool process_forkexec(struct process *proc);
+void process_spawned(struct process *proc, pid_t pid);
+size_t process_spawning();
+bool process_enter_cgroup(struct process *proc);
+bool process_setup_child(struct process *proc);
+bool process_stop(struct process *proc);
 
 bool register_process(struct process *proc);
+bool unregister_process(struct process *proc);
+struct process *process_find_by_pid(pid_t pid);
+struct process *process_find_by_name(const char *name);
+void process_exited(struct process *proc, int status);
+void process_reap_children();
+const char *process_status_name(enum proc_status status);
 
 static inline bool process_is_registered(struct process *proc)
 {
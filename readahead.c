@@ -0,0 +1,614 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * readahead.c - Boot readahead, recording and replaying file accesses
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __READAHEAD_C
+#define __READAHEAD_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <linux/limits.h>
+#include <sys/fanotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cyrenit.h"
+#include "evloop.h"
+#include "kcmdline.h"
+#include "par.h"
+#include "proc.h"
+#include "readahead.h"
+#include "timer.h"
+
+#define READAHEAD_ALLOC_STEP 256
+#define READAHEAD_EVENT_BUFFER 8192
+#define READAHEAD_OPTION_SIZE 16
+
+struct readahead_record
+{
+        char *path;
+        dev_t dev;
+        ino_t ino;
+        uint32_t length;
+        uint16_t service;
+        uint16_t flags;
+};
+
+static enum readahead_mode mode = READAHEAD_OFF;
+
+/* replay */
+static pthread_t replay_thread;
+static bool replaying = false;
+static void *trace_map = NULL;
+static size_t trace_size = 0;
+/* what the replay issued, reported once it is joined */
+static uint64_t replay_bytes = 0;
+static uint64_t replay_ms = 0;
+
+/* record */
+static int fan_fd = -1;
+static bool fan_attached = false;
+static struct timer record_timer;
+/* a recording waiting for the root to be remounted read-write */
+static struct timer save_timer;
+static uint64_t save_waited_ms = 0;
+static struct readahead_record *records = NULL;
+static size_t record_count = 0;
+static size_t record_allocated = 0;
+static char **services = NULL;
+static size_t service_count = 0;
+
+static uint64_t readahead_now_ms()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+/**
+ * @fn static bool readahead_map(const char *path)
+ * @brief Maps the trace at path and checks it is consistent
+ */
+static bool readahead_map(const char *path)
+{
+        const struct readahead_header *hdr = NULL;
+        struct stat st;
+        size_t needed = 0;
+        int fd = -1;
+
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+                return false;
+        }
+
+        if (fstat(fd, &st) != 0 ||
+            (size_t) st.st_size < sizeof(struct readahead_header)) {
+                close(fd);
+                return false;
+        }
+
+        trace_size = (size_t) st.st_size;
+        trace_map = mmap(NULL, trace_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (trace_map == MAP_FAILED) {
+                trace_map = NULL;
+                return false;
+        }
+
+        hdr = trace_map;
+        needed = sizeof(struct readahead_header) +
+                 (size_t) hdr->entry_count * sizeof(struct readahead_entry) +
+                 (size_t) hdr->service_count * sizeof(uint32_t) +
+                 hdr->strings_size;
+        if (hdr->magic != READAHEAD_MAGIC ||
+            hdr->version != READAHEAD_VERSION || needed != trace_size ||
+            hdr->strings_size == 0 ||
+            ((const char *) trace_map)[trace_size - 1] != '\0') {
+                fprintf(stderr, "cyrenit: ignoring invalid readahead trace "
+                        "%s\n", path);
+                munmap(trace_map, trace_size);
+                trace_map = NULL;
+                return false;
+        }
+
+        return true;
+}
+
+/**
+ * @fn static void readahead_one(struct par_queue *q, void *item, void *ctx)
+ * @brief Prefetches a single traced file
+ * @details Opening the file already pulls in its inode and directory
+ *          entries, POSIX_FADV_WILLNEED then starts reading the data
+ *          without waiting for it.
+ */
+static void readahead_one(struct par_queue *q, void *item, void *ctx)
+{
+        const struct readahead_header *hdr = ctx;
+        const struct readahead_entry *entry = item;
+        const char *strings = NULL;
+        int fd = -1;
+
+        (void) q;
+        strings = (const char *) ctx + trace_size - hdr->strings_size;
+        if (entry->path >= hdr->strings_size) {
+                return;
+        }
+
+        fd = open(strings + entry->path, O_RDONLY | O_NOATIME | O_CLOEXEC);
+        if (fd == -1 && errno == EPERM) {
+                fd = open(strings + entry->path, O_RDONLY | O_CLOEXEC);
+        }
+        if (fd == -1) {
+                return;
+        }
+
+        posix_fadvise(fd, 0, entry->length, POSIX_FADV_WILLNEED);
+        close(fd);
+}
+
+static void *readahead_replay(void *arg)
+{
+        const struct readahead_header *hdr = trace_map;
+        const struct readahead_entry *entries = NULL;
+        uint64_t start = 0;
+        uint64_t bytes = 0;
+        void **items = NULL;
+        size_t i = 0;
+
+        (void) arg;
+        start = readahead_now_ms();
+        entries = (const struct readahead_entry *) (hdr + 1);
+        items = calloc(hdr->entry_count, sizeof(void *));
+        if (items == NULL) {
+                return NULL;
+        }
+
+        /* the queue is LIFO, push the first accessed files last */
+        for (i = 0; i < hdr->entry_count; i++) {
+                items[hdr->entry_count - 1 - i] = (void *) &entries[i];
+                bytes += entries[i].length;
+        }
+
+        par_run(readahead_one, trace_map, items, hdr->entry_count,
+                PAR_MAX_WORKERS);
+        free(items);
+
+        // printing is the loop's business, readahead_wait() reports it
+        replay_bytes = bytes;
+        replay_ms = readahead_now_ms() - start;
+        return NULL;
+}
+
+static uint16_t readahead_service(pid_t pid)
+{
+        struct process *proc = NULL;
+        char **new_services = NULL;
+        size_t i = 0;
+
+        proc = process_find_by_pid(pid);
+        if (proc == NULL || proc->name == NULL) {
+                return 0;
+        }
+
+        for (i = 0; i < service_count; i++) {
+                if (strcmp(services[i], proc->name) == STRCMP_EQUAL) {
+                        return (uint16_t) (i + 1);
+                }
+        }
+
+        if (service_count >= UINT16_MAX - 1) {
+                return 0;
+        }
+        new_services = reallocarray(services, service_count + 1,
+                                    sizeof(char *));
+        if (new_services == NULL) {
+                return 0;
+        }
+        services = new_services;
+        services[service_count] = strdup(proc->name);
+        if (services[service_count] == NULL) {
+                return 0;
+        }
+
+        return (uint16_t) ++service_count;
+}
+
+/**
+ * @fn static void readahead_note(int fd, pid_t pid, uint64_t mask)
+ * @brief Records the first open of the regular file behind fd
+ */
+static void readahead_note(int fd, pid_t pid, uint64_t mask)
+{
+        struct readahead_record *new_records = NULL;
+        struct readahead_record *rec = NULL;
+        char link[PATH_MAX];
+        char path[PATH_MAX];
+        struct stat st;
+        ssize_t length = 0;
+        size_t new_size = 0;
+        size_t i = 0;
+
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+                return;
+        }
+
+        /* boot opens a few hundred files, a linear scan is fine */
+        for (i = 0; i < record_count; i++) {
+                if (records[i].ino == st.st_ino && records[i].dev == st.st_dev) {
+                        if (mask & FAN_OPEN_EXEC) {
+                                records[i].flags |= READAHEAD_EXEC;
+                        }
+                        return;
+                }
+        }
+
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+        length = readlink(link, path, sizeof(path) - 1);
+        if (length <= 0 || path[0] != '/') {
+                return;
+        }
+        path[length] = '\0';
+
+        if (record_count >= record_allocated) {
+                new_size = record_allocated + READAHEAD_ALLOC_STEP;
+                new_records = reallocarray(records, new_size,
+                                           sizeof(struct readahead_record));
+                if (new_records == NULL) {
+                        return;
+                }
+                records = new_records;
+                record_allocated = new_size;
+        }
+
+        rec = &records[record_count];
+        rec->path = strdup(path);
+        if (rec->path == NULL) {
+                return;
+        }
+        rec->dev = st.st_dev;
+        rec->ino = st.st_ino;
+        rec->length = (uint64_t) st.st_size > READAHEAD_MAX_BYTES ?
+                      READAHEAD_MAX_BYTES : (uint32_t) st.st_size;
+        rec->service = readahead_service(pid);
+        rec->flags = (mask & FAN_OPEN_EXEC) ? READAHEAD_EXEC : 0;
+        record_count++;
+}
+
+static void readahead_handle(int fd, uint32_t events, void *data)
+{
+        char buffer[READAHEAD_EVENT_BUFFER]
+                __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+        struct fanotify_event_metadata *md = NULL;
+        ssize_t length = 0;
+
+        (void) events;
+        (void) data;
+        while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+                for (md = (struct fanotify_event_metadata *) buffer;
+                     FAN_EVENT_OK(md, length); md = FAN_EVENT_NEXT(md, length)) {
+                        if (md->vers != FANOTIFY_METADATA_VERSION) {
+                                continue;
+                        }
+                        if (md->fd >= 0) {
+                                readahead_note(md->fd, md->pid, md->mask);
+                                close(md->fd);
+                        }
+                }
+        }
+}
+
+static void readahead_free_record()
+{
+        size_t i = 0;
+
+        for (i = 0; i < record_count; i++) {
+                free(records[i].path);
+        }
+        for (i = 0; i < service_count; i++) {
+                free(services[i]);
+        }
+        free(records);
+        free(services);
+        records = NULL;
+        services = NULL;
+        record_count = 0;
+        record_allocated = 0;
+        service_count = 0;
+}
+
+static void readahead_close_record()
+{
+        if (fan_fd == -1) {
+                return;
+        }
+
+        timer_cancel(&record_timer);
+        if (fan_attached) {
+                evloop_del(fan_fd);
+                fan_attached = false;
+        }
+        close(fan_fd);
+        fan_fd = -1;
+}
+
+static bool readahead_mkdir(const char *path)
+{
+        char dir[PATH_MAX];
+        char *ptr = NULL;
+
+        snprintf(dir, sizeof(dir), "%s", path);
+        for (ptr = dir + 1; *ptr != '\0'; ptr++) {
+                if (*ptr != '/') {
+                        continue;
+                }
+                *ptr = '\0';
+                if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+                        return false;
+                }
+                *ptr = '/';
+        }
+
+        return mkdir(dir, 0755) == 0 || errno == EEXIST;
+}
+
+/**
+ * @fn static bool readahead_save(const char *path)
+ * @brief Writes the recorded accesses as a trace, atomically replacing path
+ */
+static bool readahead_save(const char *path)
+{
+        struct readahead_header hdr;
+        struct readahead_entry entry;
+        char tmp[PATH_MAX];
+        uint32_t offset = 0;
+        uint32_t name = 0;
+        size_t i = 0;
+        bool ok = true;
+        int err = 0;
+        FILE *f = NULL;
+
+        if (!readahead_mkdir(READAHEAD_DIR)) {
+                return false;
+        }
+
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+        f = fopen(tmp, "we");
+        if (f == NULL) {
+                return false;
+        }
+
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = READAHEAD_MAGIC;
+        hdr.version = READAHEAD_VERSION;
+        hdr.service_count = (uint16_t) service_count;
+        hdr.entry_count = (uint32_t) record_count;
+        for (i = 0; i < record_count; i++) {
+                hdr.strings_size += (uint32_t) strlen(records[i].path) + 1;
+        }
+        for (i = 0; i < service_count; i++) {
+                hdr.strings_size += (uint32_t) strlen(services[i]) + 1;
+        }
+        ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+
+        for (i = 0; ok && i < record_count; i++) {
+                entry.path = offset;
+                entry.length = records[i].length;
+                entry.service = records[i].service;
+                entry.flags = records[i].flags;
+                offset += (uint32_t) strlen(records[i].path) + 1;
+                ok = fwrite(&entry, sizeof(entry), 1, f) == 1;
+        }
+        for (i = 0; ok && i < service_count; i++) {
+                name = offset;
+                offset += (uint32_t) strlen(services[i]) + 1;
+                ok = fwrite(&name, sizeof(name), 1, f) == 1;
+        }
+        for (i = 0; ok && i < record_count; i++) {
+                ok = fwrite(records[i].path, strlen(records[i].path) + 1, 1,
+                            f) == 1;
+        }
+        for (i = 0; ok && i < service_count; i++) {
+                ok = fwrite(services[i], strlen(services[i]) + 1, 1, f) == 1;
+        }
+
+        if (fclose(f) != 0 || !ok || rename(tmp, path) != 0) {
+                ok = false;
+        }
+        if (!ok) {
+                err = errno;
+                unlink(tmp);
+                errno = err;
+                return false;
+        }
+
+        return true;
+}
+
+/*
+ * Saves the recording once it is over. The root is mounted read-only
+ * unless booted with rw, so the recording is kept while something may
+ * still remount it read-write, rather than lost and taken again on every
+ * boot.
+ */
+static void readahead_record_done(struct timer *t, void *data)
+{
+        (void) t;
+        (void) data;
+
+        readahead_close_record();
+        if (record_count > 0 && readahead_save(READAHEAD_TRACE)) {
+                fprintf(stdout, "cyrenit: recorded %zu files of %zu services "
+                        "into %s\n", record_count, service_count,
+                        READAHEAD_TRACE);
+        }
+        else if (record_count > 0 && errno == EROFS &&
+                 save_waited_ms < READAHEAD_SAVE_WAIT_MS) {
+                if (save_waited_ms == 0) {
+                        fprintf(stderr, "cyrenit: %s is read-only, keeping "
+                                "the readahead trace until it is writable\n",
+                                READAHEAD_DIR);
+                }
+                save_waited_ms += READAHEAD_SAVE_RETRY_MS;
+                timer_add(&supervisor_timers, &save_timer,
+                          READAHEAD_SAVE_RETRY_MS, TIMER_COARSE);
+                return;
+        }
+        else if (record_count > 0) {
+                fprintf(stderr, "cyrenit: failed to save the readahead trace "
+                        "%s: %s, the next boot records again\n",
+                        READAHEAD_TRACE, strerror(errno));
+        }
+        readahead_free_record();
+        mode = READAHEAD_OFF;
+}
+
+/**
+ * @fn static bool readahead_record()
+ * @brief Starts watching every open of the root filesystem
+ */
+static bool readahead_record()
+{
+        unsigned int flags = FAN_MARK_ADD | FAN_MARK_FILESYSTEM;
+        uint64_t mask = FAN_OPEN | FAN_OPEN_EXEC;
+
+        fan_fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK,
+                               O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+        if (fan_fd == -1) {
+                return false;
+        }
+
+        /* older kernels lack filesystem marks, the root mount will do */
+        if (fanotify_mark(fan_fd, flags, mask, AT_FDCWD, "/") != 0 &&
+            fanotify_mark(fan_fd, FAN_MARK_ADD | FAN_MARK_MOUNT, mask,
+                          AT_FDCWD, "/") != 0) {
+                close(fan_fd);
+                fan_fd = -1;
+                return false;
+        }
+
+        timer_init(&record_timer, readahead_record_done, NULL);
+        timer_init(&save_timer, readahead_record_done, NULL);
+        save_waited_ms = 0;
+        return true;
+}
+
+/**
+ * @fn enum readahead_mode readahead_start()
+ * @brief Replays the readahead trace of the root filesystem, or starts
+ *        recording one if there is none
+ * @return the mode readahead is running in
+ * @details The replay runs on its own threads while bootstrap goes on.
+ *          The kernel command line option cyrenit.readahead=off disables
+ *          it and cyrenit.readahead=record records a new trace.
+ */
+enum readahead_mode readahead_start()
+{
+        char option[READAHEAD_OPTION_SIZE];
+        bool force_record = false;
+
+        if (kcmdline_get("cyrenit.readahead", option, sizeof(option))) {
+                if (strcmp(option, "off") == STRCMP_EQUAL) {
+                        return READAHEAD_OFF;
+                }
+                force_record = strcmp(option, "record") == STRCMP_EQUAL;
+        }
+
+        if (!force_record && readahead_map(READAHEAD_TRACE)) {
+                if (pthread_create(&replay_thread, NULL, readahead_replay,
+                                   NULL) == 0) {
+                        replaying = true;
+                        mode = READAHEAD_REPLAY;
+                        return mode;
+                }
+                munmap(trace_map, trace_size);
+                trace_map = NULL;
+        }
+
+        if (readahead_record()) {
+                mode = READAHEAD_RECORD;
+        }
+        else {
+                perror("cyrenit: cannot record file accesses");
+        }
+
+        return mode;
+}
+
+/**
+ * @fn void readahead_attach()
+ * @brief Hands the recording over to the event loop
+ * @details The kernel queues the events until then. Recording stops and
+ *          the trace is saved READAHEAD_RECORD_MS later.
+ */
+void readahead_attach()
+{
+        if (fan_fd == -1 || fan_attached) {
+                return;
+        }
+
+        fan_attached = evloop_add(fan_fd, EVLOOP_IN, readahead_handle, NULL);
+        if (!fan_attached) {
+                readahead_close_record();
+                readahead_free_record();
+                mode = READAHEAD_OFF;
+                return;
+        }
+
+        timer_add(&supervisor_timers, &record_timer, READAHEAD_RECORD_MS,
+                  TIMER_COARSE);
+}
+
+/**
+ * @fn void readahead_wait()
+ * @brief Waits until every readahead of the replay has been issued
+ */
+void readahead_wait()
+{
+        if (!replaying) {
+                return;
+        }
+
+        pthread_join(replay_thread, NULL);
+        replaying = false;
+        fprintf(stdout, "cyrenit: readahead of %u files (%llu KiB) issued "
+                "in %llu ms\n",
+                ((const struct readahead_header *) trace_map)->entry_count,
+                (unsigned long long) replay_bytes / 1024,
+                (unsigned long long) replay_ms);
+        munmap(trace_map, trace_size);
+        trace_map = NULL;
+        mode = READAHEAD_OFF;
+}
+
+/**
+ * @fn void readahead_stop()
+ * @brief Finishes the replay and drops an ongoing recording
+ * @details Used before switching root, the trace of the initramfs is of
+ *          no use for the real root.
+ */
+void readahead_stop()
+{
+        readahead_wait();
+        readahead_close_record();
+        timer_cancel(&save_timer);
+        readahead_free_record();
+        mode = READAHEAD_OFF;
+}
+
+#endif//__READAHEAD_C
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * readahead.h - Boot readahead, recording and replaying file accesses
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __READAHEAD_H
+#define __READAHEAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define READAHEAD_DIR "/var/lib/cyrenit"
+#define READAHEAD_TRACE READAHEAD_DIR "/readahead.trace"
+/* How long the first boot is recorded for */
+#define READAHEAD_RECORD_MS 30000
+/* How often, and how long, a trace waits for a read-only root to be rw */
+#define READAHEAD_SAVE_RETRY_MS 30000
+#define READAHEAD_SAVE_WAIT_MS 600000
+/* Nothing past this is prefetched from a single file */
+#define READAHEAD_MAX_BYTES (64U << 20)
+#define READAHEAD_MAGIC 0x41524943 /* "CIRA" */
+#define READAHEAD_VERSION 1
+
+/*
+ * The trace is a header, entry_count entries in first access order,
+ * service_count offsets of service names and a table of NUL terminated
+ * strings the offsets point into. Entries with service 0 were opened by
+ * something that is not a supervised service (e.g. PID 1 itself).
+ */
+struct readahead_header
+{
+        uint32_t magic;
+        uint16_t version;
+        uint16_t service_count;
+        uint32_t entry_count;
+        uint32_t strings_size;
+};
+
+struct readahead_entry
+{
+        uint32_t path;
+        uint32_t length;
+        uint16_t service;
+        uint16_t flags;
+};
+
+#define READAHEAD_EXEC 0x1
+
+enum readahead_mode
+{
+        READAHEAD_OFF = 0,
+        READAHEAD_RECORD,
+        READAHEAD_REPLAY
+};
+
+enum readahead_mode readahead_start();
+void readahead_attach();
+void readahead_wait();
+void readahead_stop();
+
+#endif//__READAHEAD_H
@@ -0,0 +1,817 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * reexec.c - Stateful re-execution of PID 1
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __REEXEC_C
+#define __REEXEC_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include <linux/limits.h>
+#include <sys/mman.h>
+
+#include "automount.h"
+#include "console.h"
+#include "control.h"
+#include "cyrenit.h"
+#include "fdstore.h"
+#include "job.h"
+#include "journal.h"
+#include "mounts.h"
+#include "pool.h"
+#include "proc.h"
+#include "reexec.h"
+#include "service.h"
+#include "svclog.h"
+#include "timer.h"
+#include "topology.h"
+
+#define REEXEC_ALLOC_STEP 16
+
+/*
+ * Everything a process block is rebuilt from that cannot be applied to the
+ * process as soon as its line is read.
+ */
+struct reexec_process
+{
+        struct process *proc;
+        char **env;
+        size_t env_count;
+        size_t env_allocated;
+        uint64_t uptime_ms;
+        uint64_t restart_in_ms;
+        bool restart_pending;
+        uint64_t stop_in_ms;
+        bool stop_pending;
+        int log_fds[2];
+};
+
+static int *kept_fds = NULL;
+static size_t kept_count = 0;
+static size_t kept_allocated = 0;
+static char reexec_path[PATH_MAX];
+static struct timer reexec_timer;
+
+static void reexec_command(int argc, char **argv, struct control_reply *reply);
+
+/**
+ * @fn static bool reexec_keep(int fd)
+ * @brief Lets fd survive the execve() of the new binary
+ */
+static bool reexec_keep(int fd)
+{
+        int *new_fds = NULL;
+        size_t new_size = 0;
+
+        if (fd < 0) {
+                return true;
+        }
+
+        if (kept_count >= kept_allocated) {
+                new_size = kept_allocated + REEXEC_ALLOC_STEP;
+                new_fds = reallocarray(kept_fds, new_size, sizeof(int));
+                if (new_fds == NULL) {
+                        return false;
+                }
+                kept_fds = new_fds;
+                kept_allocated = new_size;
+        }
+
+        if (fcntl(fd, F_SETFD, 0) != 0) {
+                return false;
+        }
+        kept_fds[kept_count++] = fd;
+
+        return true;
+}
+
+/**
+ * @fn static void reexec_unkeep()
+ * @brief Marks the kept descriptors close-on-exec again
+ * @details Used when the execve() failed, so services never inherit them.
+ */
+static void reexec_unkeep()
+{
+        size_t i = 0;
+
+        for (i = 0; i < kept_count; i++) {
+                fcntl(kept_fds[i], F_SETFD, FD_CLOEXEC);
+        }
+        kept_count = 0;
+}
+
+static void reexec_put_escaped(FILE *f, const char *value)
+{
+        const unsigned char *ptr = (const unsigned char *) value;
+
+        fputc(' ', f);
+        if (*ptr == '\0') {
+                fputs("%00", f);
+                return;
+        }
+
+        for (; *ptr != '\0'; ptr++) {
+                if (*ptr <= ' ' || *ptr == '%' || *ptr == 0x7f) {
+                        fprintf(f, "%%%02x", *ptr);
+                }
+                else {
+                        fputc(*ptr, f);
+                }
+        }
+}
+
+static void reexec_put(FILE *f, const char *key, const char *value)
+{
+        if (value == NULL) {
+                return;
+        }
+
+        fputs(key, f);
+        reexec_put_escaped(f, value);
+        fputc('\n', f);
+}
+
+static void reexec_unescape(char *value)
+{
+        char *out = value;
+        unsigned byte = 0;
+
+        while (*value != '\0') {
+                if (value[0] == '%' && isxdigit((unsigned char) value[1]) &&
+                    isxdigit((unsigned char) value[2]) &&
+                    sscanf(value + 1, "%2x", &byte) == 1) {
+                        *out++ = (char) byte;
+                        value += 3;
+                        if (byte == 0) {
+                                break;
+                        }
+                        continue;
+                }
+                *out++ = *value++;
+        }
+        *out = '\0';
+}
+
+static int reexec_split(char *line, char **fields)
+{
+        char *saveptr = NULL;
+        char *token = NULL;
+        int count = 0;
+
+        token = strtok_r(line, " \n", &saveptr);
+        while (token != NULL && count < REEXEC_MAX_FIELDS) {
+                reexec_unescape(token);
+                fields[count++] = token;
+                token = strtok_r(NULL, " \n", &saveptr);
+        }
+
+        return count;
+}
+
+static void reexec_put_attrs(FILE *f, struct exec_attrs *attrs)
+{
+        char cpus[SERVICE_LINE_MAX];
+
+        fprintf(f, "attrs %d %llu %d %d %d %d %d %d %u %d %u\n", attrs->numa,
+                (unsigned long long) attrs->numa_nodes, attrs->sched_policy,
+                attrs->sched_priority, attrs->has_nice, attrs->nice,
+                attrs->ioprio, attrs->has_uid, (unsigned) attrs->uid,
+                attrs->has_gid, (unsigned) attrs->gid);
+        if (attrs->has_affinity) {
+                topology_format_cpulist(&attrs->affinity, cpus, sizeof(cpus));
+                fprintf(f, "cpus %s\n", cpus);
+        }
+}
+
+static bool reexec_put_process(FILE *f, struct process *proc, uint64_t now)
+{
+        struct process_stats *st = &proc->stats;
+        uint64_t expires = 0;
+        size_t i = 0;
+
+        fputs("process\n", f);
+        reexec_put(f, "name", proc->name);
+        reexec_put(f, "image", proc->exec_image);
+        reexec_put(f, "cgroup", proc->cgroup);
+        /* argv[0] is the image, set back by process_set_image() */
+        for (i = 1; proc->argv != NULL && i < proc->arg_counter; i++) {
+                reexec_put(f, "arg", proc->argv[i]);
+        }
+        if (proc->env_dynamic) {
+                fputs("env_dynamic\n", f);
+        }
+        for (i = 0; proc->environment != NULL && i < proc->env_counter; i++) {
+                reexec_put(f, "env", proc->environment[i]);
+        }
+        for (i = 0; i < proc->require_count; i++) {
+                reexec_put(f, "requires", proc->requires[i]);
+        }
+        for (i = 0; i < proc->after_count; i++) {
+                reexec_put(f, "after", proc->after[i]);
+        }
+        for (i = 0; i < proc->device_count; i++) {
+                reexec_put(f, "device", proc->devices[i]);
+        }
+
+        fprintf(f, "console %d\n", proc->console);
+        fprintf(f, "zygote %d\n", proc->use_zygote);
+        fprintf(f, "retired %d\n", proc->retired);
+        fprintf(f, "tier %d %d %d\n", proc->tier, proc->frozen, proc->shed);
+        fprintf(f, "sandbox %u\n", proc->sandbox);
+        fprintf(f, "fdstore %u\n", proc->fdstore.max);
+        for (i = 0; i < proc->fdstore.count; i++) {
+                fprintf(f, "fd %d", proc->fdstore.fds[i].fd);
+                reexec_put_escaped(f, proc->fdstore.fds[i].name);
+                fputc('\n', f);
+        }
+        reexec_put_attrs(f, &proc->attrs);
+        fprintf(f, "state %d %d %d %d\n", proc->pid, proc->pidfd,
+                proc->status, proc->ret_value);
+        fprintf(f, "restart %d %u %u %u\n", proc->restart,
+                proc->restart_count, proc->restart_backoff,
+                proc->restart_delay_ms);
+        fprintf(f, "uptime %llu\n", (unsigned long long)
+                (now > proc->started_at ? now - proc->started_at : 0));
+        if (timer_is_armed(&proc->restart_timer)) {
+                expires = proc->restart_timer.expires;
+                fprintf(f, "restart_in %llu\n", (unsigned long long)
+                        (expires > now ? expires - now : 0));
+        }
+        fprintf(f, "stop %u %d\n", proc->stop_timeout_ms, proc->stopping);
+        if (timer_is_armed(&proc->stop_timer)) {
+                expires = proc->stop_timer.expires;
+                fprintf(f, "stop_in %llu\n", (unsigned long long)
+                        (expires > now ? expires - now : 0));
+        }
+        if (proc->log.read_fd != -1) {
+                fprintf(f, "log %d %d\n", proc->log.read_fd,
+                        proc->log.write_fd);
+        }
+        fprintf(f, "stats %llu %llu %llu %llu %llu %llu\n",
+                (unsigned long long) st->exits,
+                (unsigned long long) st->utime_us,
+                (unsigned long long) st->stime_us,
+                (unsigned long long) st->minflt,
+                (unsigned long long) st->majflt,
+                (unsigned long long) st->maxrss_kb);
+        fputs("end\n", f);
+
+        for (i = 0; i < proc->fdstore.count; i++) {
+                if (!reexec_keep(proc->fdstore.fds[i].fd)) {
+                        return false;
+                }
+        }
+
+        return reexec_keep(proc->pidfd) && reexec_keep(proc->log.read_fd) &&
+               reexec_keep(proc->log.write_fd);
+}
+
+static bool reexec_put_automount(FILE *f, struct automount *am)
+{
+        struct mount_task *task = am->task;
+
+        if (am->pipe_fd == -1) {
+                return true; //the kernel side is gone
+        }
+
+        fprintf(f, "automount %d %d %d %lu %d", am->pipe_fd, am->ioctl_fd,
+                task->tier, task->flags, task->mounted);
+        reexec_put_escaped(f, task->source);
+        reexec_put_escaped(f, task->target);
+        reexec_put_escaped(f, task->fs_type);
+        if (task->data != NULL && task->data_size > 0) {
+                reexec_put_escaped(f, task->data);
+        }
+        fputc('\n', f);
+
+        return reexec_keep(am->pipe_fd) && reexec_keep(am->ioctl_fd);
+}
+
+/**
+ * @fn bool reexec_serialize(int fd)
+ * @brief Writes the supervisor state to fd
+ * @param fd the state file, rewound afterwards
+ * @return true on success or false on failure
+ * @details Every descriptor named in the state is made inheritable.
+ */
+bool reexec_serialize(int fd)
+{
+        uint64_t now = 0;
+        bool ok = true;
+        size_t i = 0;
+        FILE *f = NULL;
+        int dup_fd = -1;
+
+        dup_fd = dup(fd);
+        if (dup_fd == -1) {
+                return false;
+        }
+
+        f = fdopen(dup_fd, "w");
+        if (f == NULL) {
+                close(dup_fd);
+                return false;
+        }
+
+        now = timer_wheel_now(&supervisor_timers);
+        fprintf(f, "%s %d\n", REEXEC_STATE_MAGIC, REEXEC_STATE_VERSION);
+        if (control_fd != -1) {
+                fprintf(f, "control %d\n", control_fd);
+                ok = ok && reexec_keep(control_fd);
+        }
+        if (console_fd != -1) {
+                fprintf(f, "console %d\n", console_fd);
+                ok = ok && reexec_keep(console_fd);
+        }
+        if (fdstore_socket != -1) {
+                fprintf(f, "notify %d\n", fdstore_socket);
+                ok = ok && reexec_keep(fdstore_socket);
+        }
+        for (i = 0; i < automount_count; i++) {
+                ok = ok && reexec_put_automount(f, automounts[i]);
+        }
+        for (i = 0; i < registered_process_count; i++) {
+                ok = ok && reexec_put_process(f, registered_processes[i], now);
+        }
+
+        if (fclose(f) != 0) {
+                ok = false;
+        }
+
+        return ok && lseek(fd, 0, SEEK_SET) == 0;
+}
+
+/**
+ * @fn int reexec_state_fd(int argc, char **argv)
+ * @brief Looks for the state handed over by a previous PID 1
+ * @return the state file descriptor or -1 on a regular boot
+ */
+int reexec_state_fd(int argc, char **argv)
+{
+        size_t length = strlen(REEXEC_STATE_ARG);
+        int i = 0;
+
+        for (i = 1; i < argc; i++) {
+                if (strncmp(argv[i], REEXEC_STATE_ARG, length) ==
+                    STRCMP_EQUAL) {
+                        return atoi(argv[i] + length);
+                }
+        }
+
+        return -1;
+}
+
+static bool reexec_add_env(struct reexec_process *rp, const char *value)
+{
+        char **new_env = NULL;
+        size_t new_size = 0;
+
+        /* one extra slot for the NULL terminator */
+        if (rp->env_count + 1 >= rp->env_allocated) {
+                new_size = rp->env_allocated + REEXEC_ALLOC_STEP;
+                new_env = reallocarray(rp->env, new_size, sizeof(char *));
+                if (new_env == NULL) {
+                        return false;
+                }
+                rp->env = new_env;
+                rp->env_allocated = new_size;
+        }
+
+        rp->env[rp->env_count] = strdup(value);
+        if (rp->env[rp->env_count] == NULL) {
+                return false;
+        }
+        rp->env[++rp->env_count] = NULL;
+
+        return true;
+}
+
+static bool reexec_restore_field(struct reexec_process *rp, int argc,
+                                 char **argv)
+{
+        struct process *proc = rp->proc;
+        struct process_stats *st = &proc->stats;
+        unsigned long long values[6];
+        size_t i = 0;
+
+        if (strcmp(argv[0], "name") == STRCMP_EQUAL && argc == 2) {
+                return process_set_name(proc, argv[1]);
+        }
+        if (strcmp(argv[0], "image") == STRCMP_EQUAL && argc == 2) {
+                return process_set_image(proc, argv[1]);
+        }
+        if (strcmp(argv[0], "cgroup") == STRCMP_EQUAL && argc == 2) {
+                return process_set_cgroup(proc, argv[1]);
+        }
+        if (strcmp(argv[0], "arg") == STRCMP_EQUAL && argc == 2) {
+                return process_add_arg(proc, argv[1]);
+        }
+        if (strcmp(argv[0], "env_dynamic") == STRCMP_EQUAL) {
+                return process_set_envdynamic(proc);
+        }
+        if (strcmp(argv[0], "env") == STRCMP_EQUAL && argc == 2) {
+                return reexec_add_env(rp, argv[1]);
+        }
+        if (strcmp(argv[0], "requires") == STRCMP_EQUAL && argc == 2) {
+                return process_add_require(proc, argv[1]);
+        }
+        if (strcmp(argv[0], "after") == STRCMP_EQUAL && argc == 2) {
+                return process_add_after(proc, argv[1]);
+        }
+        if (strcmp(argv[0], "device") == STRCMP_EQUAL && argc == 2) {
+                return process_add_device(proc, argv[1]);
+        }
+        if (strcmp(argv[0], "console") == STRCMP_EQUAL && argc == 2) {
+                proc->console = atoi(argv[1]) != 0;
+                return true;
+        }
+        if (strcmp(argv[0], "zygote") == STRCMP_EQUAL && argc == 2) {
+                proc->use_zygote = atoi(argv[1]) != 0;
+                return true;
+        }
+        if (strcmp(argv[0], "retired") == STRCMP_EQUAL && argc == 2) {
+                proc->retired = atoi(argv[1]) != 0;
+                return true;
+        }
+        if (strcmp(argv[0], "tier") == STRCMP_EQUAL && argc == 4) {
+                proc->tier = (enum proc_tier) atoi(argv[1]);
+                proc->frozen = atoi(argv[2]) != 0;
+                proc->shed = atoi(argv[3]) != 0;
+                return proc->tier < CYRENIT_PROC_TIERS;
+        }
+        if (strcmp(argv[0], "sandbox") == STRCMP_EQUAL && argc == 2) {
+                proc->sandbox = (unsigned) strtoul(argv[1], NULL, 10);
+                return true;
+        }
+        if (strcmp(argv[0], "fdstore") == STRCMP_EQUAL && argc == 2) {
+                proc->fdstore.max = (unsigned) strtoul(argv[1], NULL, 10);
+                return true;
+        }
+        if (strcmp(argv[0], "fd") == STRCMP_EQUAL && argc == 3) {
+                if (!fdstore_add(proc, atoi(argv[1]), argv[2])) {
+                        close(atoi(argv[1]));
+                }
+                return true;
+        }
+        if (strcmp(argv[0], "attrs") == STRCMP_EQUAL && argc == 12) {
+                proc->attrs.numa = (enum exec_numa) atoi(argv[1]);
+                proc->attrs.numa_nodes = strtoull(argv[2], NULL, 10);
+                proc->attrs.sched_policy = atoi(argv[3]);
+                proc->attrs.sched_priority = atoi(argv[4]);
+                proc->attrs.has_nice = atoi(argv[5]) != 0;
+                proc->attrs.nice = atoi(argv[6]);
+                proc->attrs.ioprio = atoi(argv[7]);
+                proc->attrs.has_uid = atoi(argv[8]) != 0;
+                proc->attrs.uid = (uid_t) strtoul(argv[9], NULL, 10);
+                proc->attrs.has_gid = atoi(argv[10]) != 0;
+                proc->attrs.gid = (gid_t) strtoul(argv[11], NULL, 10);
+                return true;
+        }
+        if (strcmp(argv[0], "cpus") == STRCMP_EQUAL && argc == 2) {
+                return exec_attrs_set(&proc->attrs, "cpus", argv[1]);
+        }
+        if (strcmp(argv[0], "state") == STRCMP_EQUAL && argc == 5) {
+                proc->pid = atoi(argv[1]);
+                proc->pidfd = atoi(argv[2]);
+                proc->status = (enum proc_status) atoi(argv[3]);
+                proc->ret_value = atoi(argv[4]);
+                if (proc->pidfd != -1) {
+                        fcntl(proc->pidfd, F_SETFD, FD_CLOEXEC);
+                }
+                return true;
+        }
+        if (strcmp(argv[0], "restart") == STRCMP_EQUAL && argc == 5) {
+                proc->restart = (enum proc_restart) atoi(argv[1]);
+                proc->restart_count = (unsigned) strtoul(argv[2], NULL, 10);
+                proc->restart_backoff = (unsigned) strtoul(argv[3], NULL, 10);
+                proc->restart_delay_ms = (unsigned) strtoul(argv[4], NULL,
+                                                            10);
+                return true;
+        }
+        if (strcmp(argv[0], "uptime") == STRCMP_EQUAL && argc == 2) {
+                rp->uptime_ms = strtoull(argv[1], NULL, 10);
+                return true;
+        }
+        if (strcmp(argv[0], "restart_in") == STRCMP_EQUAL && argc == 2) {
+                rp->restart_in_ms = strtoull(argv[1], NULL, 10);
+                rp->restart_pending = true;
+                return true;
+        }
+        if (strcmp(argv[0], "stop") == STRCMP_EQUAL && argc == 3) {
+                proc->stop_timeout_ms = (unsigned) strtoul(argv[1], NULL, 10);
+                proc->stopping = atoi(argv[2]) != 0;
+                return true;
+        }
+        if (strcmp(argv[0], "stop_in") == STRCMP_EQUAL && argc == 2) {
+                rp->stop_in_ms = strtoull(argv[1], NULL, 10);
+                rp->stop_pending = true;
+                return true;
+        }
+        if (strcmp(argv[0], "log") == STRCMP_EQUAL && argc == 3) {
+                rp->log_fds[0] = atoi(argv[1]);
+                rp->log_fds[1] = atoi(argv[2]);
+                return true;
+        }
+        if (strcmp(argv[0], "stats") == STRCMP_EQUAL && argc == 7) {
+                for (i = 0; i < 6; i++) {
+                        values[i] = strtoull(argv[i + 1], NULL, 10);
+                }
+                st->exits = values[0];
+                st->utime_us = values[1];
+                st->stime_us = values[2];
+                st->minflt = values[3];
+                st->majflt = values[4];
+                st->maxrss_kb = values[5];
+                return true;
+        }
+
+        fprintf(stderr, "cyrenit: ignoring unknown state entry %s\n",
+                argv[0]);
+        return true;
+}
+
+/**
+ * @fn static void reexec_restore_process(struct reexec_process *rp)
+ * @brief Registers a process rebuilt from the state, without starting it
+ */
+static void reexec_restore_process(struct reexec_process *rp)
+{
+        struct process *proc = rp->proc;
+        uint64_t now = 0;
+        size_t i = 0;
+
+        now = timer_wheel_now(&supervisor_timers);
+        proc->started_at = now > rp->uptime_ms ? now - rp->uptime_ms : 0;
+
+        if (rp->env != NULL) {
+                process_set_env(proc, (const char **) rp->env);
+                for (i = 0; i < rp->env_count; i++) {
+                        free(rp->env[i]);
+                }
+                free(rp->env);
+        }
+
+        if (rp->log_fds[0] != -1 &&
+            !svclog_adopt(proc, rp->log_fds[0], rp->log_fds[1])) {
+                fprintf(stderr, "cyrenit: lost the output of %s\n",
+                        proc->exec_image);
+        }
+
+        if (!register_process(proc)) {
+                fprintf(stderr, "cyrenit: failed to restore %s\n",
+                        proc->exec_image);
+                process_destroy(proc);
+                return;
+        }
+
+        if (rp->restart_pending) {
+                timer_add(&supervisor_timers, &proc->restart_timer,
+                          rp->restart_in_ms, TIMER_FINE);
+        }
+        if (rp->stop_pending) {
+                timer_add(&supervisor_timers, &proc->stop_timer,
+                          rp->stop_in_ms, TIMER_FINE);
+        }
+
+        fprintf(stdout, "cyrenit: restored %s (pid %d, %s)\n",
+                proc->exec_image, proc->pid,
+                process_status_name(proc->status));
+}
+
+static void reexec_restore_automount(int argc, char **argv)
+{
+        struct mount_task *task = NULL;
+
+        if (argc < 9) {
+                return;
+        }
+
+        task = mount_task_create_ready(argv[6], argv[7], argv[8],
+                                       strtoul(argv[4], NULL, 10),
+                                       argc > 9 ? strlen(argv[9]) + 1 : 0,
+                                       argc > 9 ? argv[9] : NULL);
+        if (task == NULL) {
+                return;
+        }
+        mount_task_set_tier(task, (enum mount_tier) atoi(argv[3]));
+        task->mounted = atoi(argv[5]) != 0;
+
+        /* the list keeps a copy of the task, the trigger serves that one */
+        if (!add_mount_task(task) ||
+            !automount_adopt(mounts.mount_tasks[mounts.count - 1],
+                             atoi(argv[1]), atoi(argv[2]))) {
+                fprintf(stderr, "cyrenit: lost the autofs trigger on %s\n",
+                        task->target);
+        }
+        mount_task_destroy(task);
+}
+
+/**
+ * @fn bool reexec_restore(int fd)
+ * @brief Rebuilds the supervisor state written by reexec_serialize()
+ * @param fd the state file, closed when done
+ * @return true if the state was recognised
+ * @details Must run after the event loop is set up. Running processes are
+ *          adopted as they are and pending restarts are armed again.
+ */
+bool reexec_restore(int fd)
+{
+        struct reexec_process rp;
+        char *fields[REEXEC_MAX_FIELDS];
+        char *line = NULL;
+        size_t size = 0;
+        bool valid = false;
+        FILE *f = NULL;
+        int count = 0;
+
+        memset(&rp, 0, sizeof(rp));
+        if (lseek(fd, 0, SEEK_SET) != 0) {
+                close(fd);
+                return false;
+        }
+
+        f = fdopen(fd, "r");
+        if (f == NULL) {
+                close(fd);
+                return false;
+        }
+
+        while (getline(&line, &size, f) != -1) {
+                count = reexec_split(line, fields);
+                if (count == 0) {
+                        continue;
+                }
+
+                if (!valid) {
+                        if (count != 2 ||
+                            strcmp(fields[0], REEXEC_STATE_MAGIC) !=
+                            STRCMP_EQUAL ||
+                            atoi(fields[1]) != REEXEC_STATE_VERSION) {
+                                fprintf(stderr, "cyrenit: unknown state "
+                                        "format\n");
+                                break;
+                        }
+                        valid = true;
+                        continue;
+                }
+
+                if (rp.proc != NULL) {
+                        if (strcmp(fields[0], "end") == STRCMP_EQUAL) {
+                                reexec_restore_process(&rp);
+                                memset(&rp, 0, sizeof(rp));
+                        }
+                        else if (!reexec_restore_field(&rp, count, fields)) {
+                                fprintf(stderr, "cyrenit: failed to restore "
+                                        "%s of a process\n", fields[0]);
+                        }
+                        continue;
+                }
+
+                if (strcmp(fields[0], "process") == STRCMP_EQUAL) {
+                        rp.proc = process_create();
+                        rp.log_fds[0] = -1;
+                        rp.log_fds[1] = -1;
+                }
+                else if (strcmp(fields[0], "control") == STRCMP_EQUAL &&
+                         count == 2) {
+                        control_adopt(atoi(fields[1]));
+                }
+                else if (strcmp(fields[0], "console") == STRCMP_EQUAL &&
+                         count == 2) {
+                        console_fd = atoi(fields[1]);
+                }
+                else if (strcmp(fields[0], "notify") == STRCMP_EQUAL &&
+                         count == 2) {
+                        fdstore_adopt(atoi(fields[1]));
+                }
+                else if (strcmp(fields[0], "automount") == STRCMP_EQUAL) {
+                        reexec_restore_automount(count, fields);
+                }
+        }
+
+        if (rp.proc != NULL) {
+                reexec_restore_process(&rp); //truncated, keep what we have
+        }
+
+        free(line);
+        fclose(f);
+
+        return valid;
+}
+
+/**
+ * @fn bool reexec(const char *path)
+ * @brief Replaces PID 1 with the binary at path, keeping every service
+ * @param path the new binary, REEXEC_DEFAULT_BINARY if NULL
+ * @return false on failure; on success it does not return
+ * @details The state goes to a memfd whose number is passed to the new
+ *          binary as REEXEC_STATE_ARG. Children that exit meanwhile stay
+ *          zombies and are reaped once the new binary is up.
+ */
+bool reexec(const char *path)
+{
+        char state_arg[sizeof(REEXEC_STATE_ARG) + 16];
+        char *argv[] = { INIT_CMD, state_arg, NULL };
+        int fd = -1;
+
+        if (path == NULL) {
+                path = REEXEC_DEFAULT_BINARY;
+        }
+
+        fd = memfd_create("cyrenit-state", 0);
+        if (fd == -1) {
+                perror("cyrenit: failed to create the state memfd");
+                return false;
+        }
+
+        if (!reexec_serialize(fd)) {
+                fprintf(stderr, "cyrenit: failed to serialize the state\n");
+                goto reexec_fail;
+        }
+
+        snprintf(state_arg, sizeof(state_arg), "%s%d", REEXEC_STATE_ARG, fd);
+        fprintf(stdout, "cyrenit[%d]: re-executing %s\n", getpid(), path);
+        console_flush(CONSOLE_FLUSH_MS);
+        /* sealed so its indexes survive; appends open a new one on failure */
+        journal_close();
+
+        execve(path, argv, environ);
+        console_printf(CONSOLE_CRIT, "cyrenit: failed to execute %s: %s\n",
+                       path, strerror(errno));
+
+reexec_fail:
+        reexec_unkeep();
+        close(fd);
+        return false;
+}
+
+static void reexec_timeout(struct timer *t, void *data)
+{
+        (void) t;
+        (void) data;
+        reexec(reexec_path);
+}
+
+/**
+ * @fn void reexec_init()
+ * @brief Registers the `reexec` command
+ */
+void reexec_init()
+{
+        timer_init(&reexec_timer, reexec_timeout, NULL);
+        control_register("reexec", "[binary] re-execute PID 1 in place",
+                         reexec_command);
+}
+
+static void reexec_command(int argc, char **argv, struct control_reply *reply)
+{
+        const char *path = argc > 1 ? argv[1] : REEXEC_DEFAULT_BINARY;
+
+        if (access(path, X_OK) != 0) {
+                control_reply_error(reply, "%s: %s", path, strerror(errno));
+                return;
+        }
+        /* the queue is not part of the state */
+        if (job_pending() > 0) {
+                control_reply_error(reply, "%zu jobs pending, try again "
+                                    "once they are done", job_pending());
+                return;
+        }
+        /* nor is the work of the pool, nor what deferred mounts wait for */
+        if (pool_pending() > 0 || mounts_deferred_pending() > 0) {
+                control_reply_error(reply, "%zu worker jobs and %zu "
+                                    "deferred mounts pending, try again "
+                                    "once they are done", pool_pending(),
+                                    mounts_deferred_pending());
+                return;
+        }
+        if (process_spawning() > 0) {
+                control_reply_error(reply, "%zu zygote spawns pending, try "
+                                    "again once they are done",
+                                    process_spawning());
+                return;
+        }
+
+        strncpy(reexec_path, path, sizeof(reexec_path) - 1);
+        reexec_path[sizeof(reexec_path) - 1] = '\0';
+
+        /* after this reply went out, the connection does not survive */
+        control_reply_printf(reply, "re-executing %s\n", path);
+        timer_add(&supervisor_timers, &reexec_timer, 0, TIMER_FINE);
+}
+
+#endif//__REEXEC_C
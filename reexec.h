@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * reexec.h - Stateful re-execution of PID 1
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __REEXEC_H
+#define __REEXEC_H
+
+#include <stdbool.h>
+
+#define REEXEC_DEFAULT_BINARY "/sbin/init"
+#define REEXEC_STATE_ARG "--deserialize="
+#define REEXEC_STATE_MAGIC "cyrenit-state"
+#define REEXEC_STATE_VERSION 1
+#define REEXEC_MAX_FIELDS 16
+
+/*
+ * The state is a text file in a memfd, one `key value...` line per item.
+ * Values are separated by single spaces, so strings have their spaces,
+ * control characters and '%' escaped as %XX. A process is described by the
+ * lines between `process` and `end`. File descriptors named in the state
+ * are inherited by the new binary as they are.
+ */
+
+int reexec_state_fd(int argc, char **argv);
+bool reexec_serialize(int fd);
+bool reexec_restore(int fd);
+bool reexec(const char *path);
+void reexec_init();
+
+#endif//__REEXEC_H
@@ -0,0 +1,424 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * sandbox.c - Namespaces and private mounts of services
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __SANDBOX_C
+#define __SANDBOX_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+
+#include <net/if.h>
+#include <linux/mount.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "cyrenit.h"
+#include "sandbox.h"
+
+static const struct
+{
+        const char *name;
+        unsigned flag;
+} sandbox_names[] = {
+        {"mount", SANDBOX_MOUNT},
+        {"pid", SANDBOX_PID},
+        {"ipc", SANDBOX_IPC},
+        {"net", SANDBOX_NET},
+        {"readonly", SANDBOX_READONLY},
+        {"dev", SANDBOX_DEV},
+};
+
+#define SANDBOX_NAMES (sizeof(sandbox_names) / sizeof(sandbox_names[0]))
+
+/* the only devices in a private /dev, bind mounted from the real one */
+static const char *sandbox_dev_nodes[] = {
+        "null", "zero", "full", "random", "urandom", "tty"
+};
+
+#define SANDBOX_DEV_NODES \
+        (sizeof(sandbox_dev_nodes) / sizeof(sandbox_dev_nodes[0]))
+
+static const char *sandbox_dev_links[][2] = {
+        {"fd", "/proc/self/fd"},
+        {"stdin", "/proc/self/fd/0"},
+        {"stdout", "/proc/self/fd/1"},
+        {"stderr", "/proc/self/fd/2"},
+};
+
+#define SANDBOX_DEV_LINKS \
+        (sizeof(sandbox_dev_links) / sizeof(sandbox_dev_links[0]))
+
+/**
+ * @fn bool sandbox_parse(char *value, unsigned *flags)
+ * @brief Parses the sandbox setting of a service
+ * @param value space separated names, modified while parsing
+ * @return true if every name is known
+ */
+bool sandbox_parse(char *value, unsigned *flags)
+{
+        char *saveptr = NULL;
+        char *token = NULL;
+        size_t i = 0;
+
+        *flags = 0;
+        for (token = strtok_r(value, " \t", &saveptr); token != NULL;
+             token = strtok_r(NULL, " \t", &saveptr)) {
+                for (i = 0; i < SANDBOX_NAMES; i++) {
+                        if (strcmp(token, sandbox_names[i].name) ==
+                            STRCMP_EQUAL) {
+                                break;
+                        }
+                }
+                if (i == SANDBOX_NAMES) {
+                        return false;
+                }
+                *flags |= sandbox_names[i].flag;
+        }
+
+        // a new /proc, a read-only root or a new /dev all need their own
+        if (*flags & (SANDBOX_PID | SANDBOX_READONLY | SANDBOX_DEV)) {
+                *flags |= SANDBOX_MOUNT;
+        }
+
+        return true;
+}
+
+static unsigned long sandbox_namespaces(unsigned flags)
+{
+        unsigned long ns = 0;
+
+        ns |= flags & SANDBOX_MOUNT ? CLONE_NEWNS : 0;
+        ns |= flags & SANDBOX_PID ? CLONE_NEWPID : 0;
+        ns |= flags & SANDBOX_IPC ? CLONE_NEWIPC : 0;
+        ns |= flags & SANDBOX_NET ? CLONE_NEWNET : 0;
+
+        return ns;
+}
+
+/* PID 1's own PID namespace, to return to after spawning into a new one */
+static int sandbox_home_pidfd = -1;
+
+/**
+ * @fn static bool sandbox_pid_unshare()
+ * @brief Makes the next child of the calling thread the PID 1 of a new
+ *        PID namespace
+ * @details unshare(CLONE_NEWPID) only changes the namespace the calling
+ *          thread's children are born in, so it is fine in PID 1 next to
+ *          its worker threads. sandbox_pid_restore() undoes it.
+ */
+static bool sandbox_pid_unshare()
+{
+        if (sandbox_home_pidfd == -1) {
+                sandbox_home_pidfd = (int) syscall(SYS_pidfd_open, getpid(),
+                                                   0);
+                if (sandbox_home_pidfd == -1) {
+                        return false;
+                }
+        }
+
+        return unshare(CLONE_NEWPID) == 0;
+}
+
+static void sandbox_pid_restore()
+{
+        int saved_errno = errno;
+
+        if (setns(sandbox_home_pidfd, CLONE_NEWPID) == -1) {
+                fprintf(stderr, "cyrenit[%d]: sandbox: cannot return to the "
+                        "PID namespace of PID 1: %s\n", getpid(),
+                        strerror(errno));
+        }
+        errno = saved_errno;
+}
+
+/**
+ * @fn pid_t sandbox_fork(unsigned flags)
+ * @brief Forks a process living in the namespaces flags asks for
+ * @return as fork(): 0 in the new process, its PID or -1 in the caller
+ * @details Stands in for fork() when spawning sandboxed services. The
+ *          child unshares the namespaces it can move into itself. A
+ *          process cannot move itself into a new PID namespace: the caller
+ *          unshares that one around the fork(), so the child is born as
+ *          the namespace's PID 1, still a child of the caller.
+ */
+pid_t sandbox_fork(unsigned flags)
+{
+        unsigned long ns = sandbox_namespaces(flags) & ~CLONE_NEWPID;
+        pid_t pid = 0;
+
+        if ((flags & SANDBOX_PID) && !sandbox_pid_unshare()) {
+                return -1;
+        }
+
+        pid = fork();
+        if (pid == FORK_ISCHILD) {
+                if (unshare((int) ns) == -1) {
+                        fprintf(stderr, "cyrenit[%d]: cannot create the "
+                                "namespaces of the sandbox: %s\n", getpid(),
+                                strerror(errno));
+                        _exit(EXIT_FAILURE);
+                }
+                return 0;
+        }
+
+        if (flags & SANDBOX_PID) {
+                sandbox_pid_restore();
+        }
+
+        return pid;
+}
+
+/**
+ * @fn static int sandbox_fs(const char *type, const char *size,
+ *                           const char *mode, unsigned attrs)
+ * @brief Creates a detached mount of a new filesystem
+ * @param size,mode filesystem options, NULL to leave them out
+ * @return the mount fd, or -1 on failure
+ */
+static int sandbox_fs(const char *type, const char *size, const char *mode,
+                      unsigned attrs)
+{
+        int mnt = -1;
+        int fs = (int) syscall(SYS_fsopen, type, FSOPEN_CLOEXEC);
+
+        if (fs == -1) {
+                return -1;
+        }
+
+        if ((size == NULL || syscall(SYS_fsconfig, fs, FSCONFIG_SET_STRING,
+                                     "size", size, 0) == 0) &&
+            (mode == NULL || syscall(SYS_fsconfig, fs, FSCONFIG_SET_STRING,
+                                     "mode", mode, 0) == 0) &&
+            syscall(SYS_fsconfig, fs, FSCONFIG_CMD_CREATE, NULL, NULL,
+                    0) == 0) {
+                mnt = (int) syscall(SYS_fsmount, fs, FSMOUNT_CLOEXEC, attrs);
+        }
+        close(fs);
+
+        return mnt;
+}
+
+/* Attaches a detached mount on path, closing it */
+static bool sandbox_attach(int mnt, const char *path)
+{
+        bool ok = mnt != -1 &&
+                  syscall(SYS_move_mount, mnt, "", AT_FDCWD, path,
+                          MOVE_MOUNT_F_EMPTY_PATH) == 0;
+
+        if (!ok) {
+                fprintf(stderr, "cyrenit[%d]: sandbox: cannot mount %s: "
+                        "%s\n", getpid(), path, strerror(errno));
+        }
+        if (mnt != -1) {
+                close(mnt);
+        }
+
+        return ok;
+}
+
+/*
+ * The nodes are cloned before the new /dev hides them, and the clones
+ * bound on empty files of it.
+ */
+static bool sandbox_dev()
+{
+        char path[32];
+        int nodes[SANDBOX_DEV_NODES];
+        bool ok = true;
+        size_t i = 0;
+        int fd = -1;
+
+        for (i = 0; i < SANDBOX_DEV_NODES; i++) {
+                snprintf(path, sizeof(path), "/dev/%s", sandbox_dev_nodes[i]);
+                nodes[i] = (int) syscall(SYS_open_tree, AT_FDCWD, path,
+                                         OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC);
+        }
+
+        ok = sandbox_attach(sandbox_fs("tmpfs", SANDBOX_DEV_SIZE, "755",
+                                       MOUNT_ATTR_NOSUID |
+                                       MOUNT_ATTR_NOEXEC), "/dev");
+
+        for (i = 0; i < SANDBOX_DEV_NODES; i++) {
+                if (nodes[i] == -1) {
+                        continue; // not on this system
+                }
+                snprintf(path, sizeof(path), "/dev/%s", sandbox_dev_nodes[i]);
+                fd = ok ? open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0666) :
+                          -1;
+                if (fd == -1) {
+                        close(nodes[i]);
+                        ok = false;
+                        continue;
+                }
+                close(fd);
+                ok = sandbox_attach(nodes[i], path) && ok;
+        }
+
+        for (i = 0; ok && i < SANDBOX_DEV_LINKS; i++) {
+                snprintf(path, sizeof(path), "/dev/%s",
+                         sandbox_dev_links[i][0]);
+                ok = symlink(sandbox_dev_links[i][1], path) == 0;
+        }
+
+        return ok && mkdir("/dev/shm", 0755) == 0 &&
+               chmod("/dev/shm", 01777) == 0;
+}
+
+static bool sandbox_loopback()
+{
+        struct ifreq ifr;
+        bool ok = false;
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+        if (fd == -1) {
+                return false;
+        }
+
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, "lo", IFNAMSIZ - 1);
+        if (ioctl(fd, SIOCGIFFLAGS, &ifr) == 0) {
+                ifr.ifr_flags |= IFF_UP;
+                ok = ioctl(fd, SIOCSIFFLAGS, &ifr) == 0;
+        }
+        close(fd);
+
+        return ok;
+}
+
+/**
+ * @fn static void sandbox_init()
+ * @brief Forks the service off and stays as the PID 1 of its namespace
+ * @details Returns in the service only. The kernel drops the signals a
+ *          namespace's PID 1 has no handler for, SIGTERM from process_stop()
+ *          included, so this init takes them (blocked signals are not
+ *          dropped) and passes them on to the service, reaps whatever the
+ *          namespace leaves behind and exits as the service did, 128 plus
+ *          the signal if it was killed. Without it the service runs as the
+ *          namespace's PID 1 itself. The init never execs, so it closes
+ *          what it inherited from PID 1, control connections included.
+ */
+static void sandbox_init()
+{
+        siginfo_t info;
+        sigset_t all;
+        sigset_t none;
+        pid_t service = 0;
+        pid_t pid = 0;
+        int status = 0;
+        int sig = 0;
+
+        sigfillset(&all);
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &all, NULL);
+        service = fork();
+        if (service <= 0) {
+                if (service == -1) {
+                        fprintf(stderr, "cyrenit[%d]: sandbox: no init for "
+                                "the PID namespace: %s\n", getpid(),
+                                strerror(errno));
+                }
+                sigprocmask(SIG_SETMASK, &none, NULL);
+                return;
+        }
+
+        syscall(SYS_close_range, 0, ~0U, 0);
+        for (;;) {
+                sig = sigwaitinfo(&all, &info);
+                if (sig == -1) {
+                        continue;
+                }
+                if (sig != SIGCHLD) {
+                        kill(service, sig);
+                        continue;
+                }
+                while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                        if (pid != service) {
+                                continue;
+                        }
+                        _exit(WIFEXITED(status) ? WEXITSTATUS(status) :
+                                                  128 + WTERMSIG(status));
+                }
+        }
+}
+
+/**
+ * @fn bool sandbox_setup(unsigned flags)
+ * @brief Sets up the mounts and network of a child from sandbox_fork()
+ * @return true on success, or false if the service must not run
+ * @details Called by the child while it still has its privileges, after it
+ *          entered its cgroup (read-only once this returns). Needs Linux
+ *          5.12 for mount_setattr(): every mount is made a slave, and
+ *          read-only with SANDBOX_READONLY, in a single call. With
+ *          SANDBOX_PID the caller returns as the service, under an init
+ *          (see sandbox_init()).
+ */
+bool sandbox_setup(unsigned flags)
+{
+        struct mount_attr attr;
+
+        if (flags & SANDBOX_MOUNT) {
+                memset(&attr, 0, sizeof(attr));
+                attr.propagation = MS_SLAVE;
+                attr.attr_set = flags & SANDBOX_READONLY ?
+                                MOUNT_ATTR_RDONLY : 0;
+                if (syscall(SYS_mount_setattr, AT_FDCWD, "/", AT_RECURSIVE,
+                            &attr, sizeof(attr)) == -1) {
+                        fprintf(stderr, "cyrenit[%d]: sandbox: cannot set "
+                                "up the mounts: %s\n", getpid(),
+                                strerror(errno));
+                        return false;
+                }
+        }
+
+        if ((flags & SANDBOX_DEV) && !sandbox_dev()) {
+                fprintf(stderr, "cyrenit[%d]: sandbox: cannot populate "
+                        "/dev: %s\n", getpid(), strerror(errno));
+                return false;
+        }
+
+        if ((flags & SANDBOX_READONLY) &&
+            !sandbox_attach(sandbox_fs("tmpfs", SANDBOX_TMP_SIZE, "1777",
+                                       MOUNT_ATTR_NOSUID |
+                                       MOUNT_ATTR_NODEV), "/tmp")) {
+                return false;
+        }
+
+        if ((flags & SANDBOX_PID) &&
+            !sandbox_attach(sandbox_fs("proc", NULL, NULL,
+                                       MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV |
+                                       MOUNT_ATTR_NOEXEC), "/proc")) {
+                return false;
+        }
+
+        if ((flags & SANDBOX_NET) && !sandbox_loopback()) {
+                fprintf(stderr, "cyrenit[%d]: sandbox: cannot bring up "
+                        "loopback: %s\n", getpid(), strerror(errno));
+                return false;
+        }
+
+        if (flags & SANDBOX_PID) {
+                sandbox_init();
+        }
+
+        return true;
+}
+
+#endif//__SANDBOX_C
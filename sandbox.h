@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * sandbox.h - Namespaces and private mounts of services
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __SANDBOX_H
+#define __SANDBOX_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* size of the tmpfs on /tmp and on a private /dev */
+#define SANDBOX_TMP_SIZE "64m"
+#define SANDBOX_DEV_SIZE "1m"
+
+/*
+ * `sandbox = mount pid ipc net readonly dev` in a service file, any of:
+ *
+ *   mount     private mount namespace; host mounts still propagate in,
+ *             none of the service's propagate out
+ *   pid       private PID namespace with its own /proc. A small init is
+ *             its PID 1, passing signals on to the service and reaping
+ *             the namespace's orphans
+ *   ipc       private System V IPC and POSIX message queues
+ *   net       private network namespace with only loopback, up
+ *   readonly  every mount read-only, with a fresh tmpfs on /tmp
+ *   dev       a tmpfs on /dev holding null, zero, full, random, urandom
+ *             and tty only
+ *
+ * pid, readonly and dev imply mount. The namespaces are created at spawn
+ * time, the mounts set up by the child before it drops its privileges.
+ */
+enum sandbox_flags
+{
+        SANDBOX_MOUNT = 1 << 0,
+        SANDBOX_PID = 1 << 1,
+        SANDBOX_IPC = 1 << 2,
+        SANDBOX_NET = 1 << 3,
+        SANDBOX_READONLY = 1 << 4,
+        SANDBOX_DEV = 1 << 5,
+};
+
+bool sandbox_parse(char *value, unsigned *flags);
+pid_t sandbox_fork(unsigned flags);
+bool sandbox_setup(unsigned flags);
+
+#endif//__SANDBOX_H
@@ -0,0 +1,978 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * service.c - Service definition files
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __SERVICE_C
+#define __SERVICE_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include <linux/limits.h>
+
+#include "cyrenit.h"
+#include "bootopt.h"
+#include "control.h"
+#include "execattr.h"
+#include "job.h"
+#include "memstat.h"
+#include "pressure.h"
+#include "proc.h"
+#include "sandbox.h"
+#include "service.h"
+#include "topology.h"
+
+#define SERVICE_ENV_MAX 64
+#define SERVICE_ALLOC_STEP 8
+
+/**
+ * @var struct service_template **service_templates
+ * @brief Every template loaded from the service files
+ */
+struct service_template **service_templates = NULL;
+size_t service_template_count = 0;
+static size_t service_template_allocated = 0;
+
+static void service_scale_command(int argc, char **argv,
+                                  struct control_reply *reply);
+
+static char *service_trim(char *str)
+{
+        char *end = NULL;
+
+        while (isspace((unsigned char) *str)) {
+                str++;
+        }
+
+        end = str + strlen(str);
+        while (end > str && isspace((unsigned char) end[-1])) {
+                *(--end) = '\0';
+        }
+
+        return str;
+}
+
+static bool service_set_exec(struct process *proc, char *value)
+{
+        char *saveptr = NULL;
+        char *token = NULL;
+
+        token = strtok_r(value, " \t", &saveptr);
+        if (token == NULL || !process_set_image(proc, token)) {
+                return false;
+        }
+
+        while ((token = strtok_r(NULL, " \t", &saveptr)) != NULL) {
+                if (!process_add_arg(proc, token)) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+static bool service_set_names(struct process *proc,
+                              bool (*add)(struct process *, const char *),
+                              char *value)
+{
+        char *saveptr = NULL;
+        char *token = NULL;
+
+        for (token = strtok_r(value, " \t", &saveptr); token != NULL;
+             token = strtok_r(NULL, " \t", &saveptr)) {
+                if (!add(proc, token)) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+static bool service_set_restart(struct process *proc, const char *value)
+{
+        if (strcmp(value, "never") == STRCMP_EQUAL) {
+                proc->restart = CYRENIT_PROC_RESTART_NEVER;
+        }
+        else if (strcmp(value, "on-failure") == STRCMP_EQUAL) {
+                proc->restart = CYRENIT_PROC_RESTART_ON_FAILURE;
+        }
+        else if (strcmp(value, "always") == STRCMP_EQUAL) {
+                proc->restart = CYRENIT_PROC_RESTART_ALWAYS;
+        }
+        else {
+                return false;
+        }
+
+        return true;
+}
+
+static bool service_parse_scale(const char *value, enum service_scale *scale,
+                                unsigned *count)
+{
+        unsigned long n = 0;
+        char *end = NULL;
+
+        if (strcmp(value, "cpus") == STRCMP_EQUAL) {
+                *scale = SERVICE_SCALE_CPUS;
+                return true;
+        }
+        if (strcmp(value, "nodes") == STRCMP_EQUAL) {
+                *scale = SERVICE_SCALE_NODES;
+                return true;
+        }
+
+        n = strtoul(value, &end, 10);
+        if (end == value || *end != '\0' || n > SERVICE_INSTANCES_MAX) {
+                return false;
+        }
+
+        *scale = SERVICE_SCALE_COUNT;
+        *count = (unsigned) n;
+        return true;
+}
+
+/**
+ * @fn static bool service_set(struct process *proc,
+ *                             struct service_template *tmpl,
+ *                             const char *key, char *value, char **env,
+ *                             size_t *env_count)
+ * @brief Applies a single setting of a service file
+ * @details tmpl is NULL unless the file is a template.
+ */
+static bool service_set(struct process *proc, struct service_template *tmpl,
+                        const char *key, char *value, char **env,
+                        size_t *env_count)
+{
+        char *end = NULL;
+
+        if (strcmp(key, "name") == STRCMP_EQUAL) {
+                return process_set_name(proc, value);
+        }
+        if (strcmp(key, "exec") == STRCMP_EQUAL) {
+                return service_set_exec(proc, value);
+        }
+        if (strcmp(key, "restart") == STRCMP_EQUAL) {
+                return service_set_restart(proc, value);
+        }
+        if (strcmp(key, "restart_delay") == STRCMP_EQUAL) {
+                proc->restart_delay_ms = (unsigned) strtoul(value, &end, 10);
+                return end != value && *end == '\0';
+        }
+        if (strcmp(key, "stop_timeout") == STRCMP_EQUAL) {
+                proc->stop_timeout_ms = (unsigned) strtoul(value, &end, 10);
+                return end != value && *end == '\0';
+        }
+        if (strcmp(key, "requires") == STRCMP_EQUAL) {
+                return service_set_names(proc, process_add_require, value);
+        }
+        if (strcmp(key, "after") == STRCMP_EQUAL) {
+                return service_set_names(proc, process_add_after, value);
+        }
+        if (strcmp(key, "devices") == STRCMP_EQUAL) {
+                return service_set_names(proc, process_add_device, value);
+        }
+        if (strcmp(key, "cgroup") == STRCMP_EQUAL) {
+                return process_set_cgroup(proc, value);
+        }
+        if (strcmp(key, "fdstore") == STRCMP_EQUAL) {
+                proc->fdstore.max = (unsigned) strtoul(value, &end, 10);
+                return end != value && *end == '\0';
+        }
+        if (strcmp(key, "sandbox") == STRCMP_EQUAL) {
+                return sandbox_parse(value, &proc->sandbox);
+        }
+        if (strcmp(key, "target") == STRCMP_EQUAL) {
+                return boot_target_parse(value, &proc->target);
+        }
+        if (strcmp(key, "tier") == STRCMP_EQUAL) {
+                return pressure_parse_tier(value, &proc->tier);
+        }
+        if (strcmp(key, "zygote") == STRCMP_EQUAL) {
+                proc->use_zygote = strcmp(value, "yes") == STRCMP_EQUAL;
+                return proc->use_zygote ||
+                       strcmp(value, "no") == STRCMP_EQUAL;
+        }
+        if (strcmp(key, "instances") == STRCMP_EQUAL && tmpl != NULL) {
+                return service_parse_scale(value, &tmpl->scale, &tmpl->count);
+        }
+        if (strcmp(key, "env") == STRCMP_EQUAL) {
+                if (*env_count >= SERVICE_ENV_MAX || strchr(value, '=') == NULL) {
+                        return false;
+                }
+                env[*env_count] = strdup(value);
+                if (env[*env_count] == NULL) {
+                        return false;
+                }
+                (*env_count)++;
+                return true;
+        }
+
+        return exec_attrs_set(&proc->attrs, key, value);
+}
+
+/**
+ * @fn static struct process *service_parse(const char *path,
+ *                                          struct service_template *tmpl)
+ * @brief Builds an unregistered process out of a service file
+ * @param path the service file
+ * @param tmpl the template being loaded, NULL for regular services
+ * @return the process on success or NULL on failure
+ * @details Invalid settings are reported and ignored, a missing `exec`
+ *          makes the whole file invalid.
+ */
+static struct process *service_parse(const char *path,
+                                     struct service_template *tmpl)
+{
+        char line[SERVICE_LINE_MAX];
+        char name[NAME_MAX + 1];
+        char *env[SERVICE_ENV_MAX + 1];
+        struct process *proc = NULL;
+        const char *base = NULL;
+        size_t env_count = 0;
+        size_t lineno = 0;
+        size_t i = 0;
+        char *key = NULL;
+        char *value = NULL;
+        char *ptr = NULL;
+        FILE *f = NULL;
+
+        f = fopen(path, "re");
+        if (f == NULL) {
+                return NULL;
+        }
+
+        proc = process_create();
+        if (proc == NULL) {
+                fclose(f);
+                return NULL;
+        }
+
+        base = strrchr(path, '/');
+        base = base == NULL ? path : base + 1;
+        snprintf(name, sizeof(name), "%s", base);
+        ptr = strstr(name, SERVICE_SUFFIX);
+        if (ptr != NULL) {
+                *ptr = '\0';
+        }
+        process_set_name(proc, name);
+
+        while (fgets(line, sizeof(line), f) != NULL) {
+                lineno++;
+                ptr = strchr(line, '#');
+                if (ptr != NULL) {
+                        *ptr = '\0';
+                }
+
+                key = service_trim(line);
+                if (*key == '\0') {
+                        continue;
+                }
+
+                ptr = strchr(key, '=');
+                if (ptr == NULL) {
+                        fprintf(stderr, "cyrenit: %s:%zu: expected "
+                                "key = value\n", path, lineno);
+                        continue;
+                }
+                *ptr = '\0';
+                key = service_trim(key);
+                value = service_trim(ptr + 1);
+
+                if (!service_set(proc, tmpl, key, value, env, &env_count)) {
+                        fprintf(stderr, "cyrenit: %s:%zu: invalid setting "
+                                "%s = %s\n", path, lineno, key, value);
+                }
+        }
+        fclose(f);
+
+        env[env_count] = NULL;
+        if (env_count > 0) {
+                process_set_env(proc, (const char **) env);
+        }
+        else {
+                process_set_envdynamic(proc);
+        }
+        for (i = 0; i < env_count; i++) {
+                free(env[i]);
+        }
+
+        if (proc->exec_image == NULL) {
+                fprintf(stderr, "cyrenit: %s: no exec setting\n", path);
+                process_destroy(proc);
+                return NULL;
+        }
+
+        return proc;
+}
+
+/**
+ * @fn struct process *service_load(const char *path)
+ * @brief Builds an unregistered process out of a regular service file
+ * @param path the service file
+ * @return the process on success or NULL on failure
+ */
+struct process *service_load(const char *path)
+{
+        return service_parse(path, NULL);
+}
+
+static bool service_is_template(const char *file)
+{
+        const char *suffix = strstr(file, SERVICE_SUFFIX);
+
+        return suffix != NULL && suffix > file &&
+               suffix[-1] == SERVICE_TEMPLATE_MARK;
+}
+
+/**
+ * @fn static char *service_expand(const char *str, unsigned id)
+ * @brief Returns a copy of str with every SERVICE_INSTANCE_VAR replaced by id
+ */
+static char *service_expand(const char *str, unsigned id)
+{
+        size_t var_length = strlen(SERVICE_INSTANCE_VAR);
+        const char *ptr = str;
+        char id_str[16];
+        char *ret = NULL;
+        char *out = NULL;
+        size_t count = 0;
+
+        while ((ptr = strstr(ptr, SERVICE_INSTANCE_VAR)) != NULL) {
+                count++;
+                ptr += var_length;
+        }
+        if (count == 0) {
+                return strdup(str);
+        }
+
+        snprintf(id_str, sizeof(id_str), "%u", id);
+        ret = malloc(strlen(str) + count * strlen(id_str) + 1);
+        if (ret == NULL) {
+                return NULL;
+        }
+
+        out = ret;
+        while ((ptr = strstr(str, SERVICE_INSTANCE_VAR)) != NULL) {
+                memcpy(out, str, (size_t) (ptr - str));
+                out += ptr - str;
+                out = stpcpy(out, id_str);
+                str = ptr + var_length;
+        }
+        strcpy(out, str);
+
+        return ret;
+}
+
+static bool service_set_expanded(struct process *proc,
+                                 bool (*set)(struct process *, const char *),
+                                 const char *value, unsigned id)
+{
+        char *expanded = NULL;
+        bool ok = false;
+
+        expanded = service_expand(value, id);
+        if (expanded == NULL) {
+                return false;
+        }
+
+        ok = set(proc, expanded);
+        free(expanded);
+        return ok;
+}
+
+/**
+ * @fn static bool service_instance_env(struct process *proc,
+ *                                      const struct process *def,
+ *                                      unsigned id)
+ * @brief Gives an instance the environment of its template
+ * @details The definition's vector is borrowed as is unless one of its
+ *          entries uses SERVICE_INSTANCE_VAR.
+ */
+static bool service_instance_env(struct process *proc,
+                                 const struct process *def, unsigned id)
+{
+        char *env[SERVICE_ENV_MAX + 1];
+        bool expand = false;
+        bool ok = false;
+        size_t i = 0;
+
+        if (def->environment == NULL) {
+                return process_set_envdynamic(proc);
+        }
+
+        for (i = 0; i < def->env_counter; i++) {
+                if (strstr(def->environment[i], SERVICE_INSTANCE_VAR) != NULL) {
+                        expand = true;
+                }
+        }
+
+        if (!expand) {
+                proc->environment = def->environment;
+                proc->env_counter = def->env_counter;
+                proc->env_shared = true;
+                return true;
+        }
+
+        for (i = 0; i < def->env_counter && i < SERVICE_ENV_MAX; i++) {
+                env[i] = service_expand(def->environment[i], id);
+                if (env[i] == NULL) {
+                        break;
+                }
+        }
+        env[i] = NULL;
+
+        ok = i == def->env_counter &&
+             process_set_env(proc, (const char **) env);
+        while (i > 0) {
+                free(env[--i]);
+        }
+
+        return ok;
+}
+
+/**
+ * @fn static struct process *service_instantiate(
+ *                              struct service_template *tmpl, unsigned id)
+ * @brief Builds the unregistered instance id of tmpl
+ */
+static struct process *service_instantiate(struct service_template *tmpl,
+                                           unsigned id)
+{
+        const struct process *def = tmpl->definition;
+        struct process *proc = NULL;
+        char name[NAME_MAX + 1];
+        bool ok = false;
+        size_t i = 0;
+
+        proc = process_create();
+        if (proc == NULL) {
+                return NULL;
+        }
+
+        snprintf(name, sizeof(name), "%s%c%u", tmpl->name,
+                 SERVICE_TEMPLATE_MARK, id);
+        ok = process_set_name(proc, name) &&
+             service_set_expanded(proc, process_set_image, def->exec_image,
+                                  id);
+        for (i = 1; ok && i < def->arg_counter; i++) {
+                ok = service_set_expanded(proc, process_add_arg,
+                                          def->argv[i], id);
+        }
+        if (ok && def->cgroup != NULL) {
+                ok = service_set_expanded(proc, process_set_cgroup,
+                                          def->cgroup, id);
+        }
+        for (i = 0; ok && i < def->require_count; i++) {
+                ok = service_set_expanded(proc, process_add_require,
+                                          def->requires[i], id);
+        }
+        for (i = 0; ok && i < def->after_count; i++) {
+                ok = service_set_expanded(proc, process_add_after,
+                                          def->after[i], id);
+        }
+        for (i = 0; ok && i < def->device_count; i++) {
+                ok = service_set_expanded(proc, process_add_device,
+                                          def->devices[i], id);
+        }
+        if (ok) {
+                ok = service_instance_env(proc, def, id);
+        }
+        if (!ok) {
+                process_destroy(proc);
+                return NULL;
+        }
+
+        proc->restart = def->restart;
+        proc->restart_delay_ms = def->restart_delay_ms;
+        proc->stop_timeout_ms = def->stop_timeout_ms;
+        proc->tier = def->tier;
+        proc->target = def->target;
+        proc->fdstore.max = def->fdstore.max;
+        proc->sandbox = def->sandbox;
+        proc->use_zygote = def->use_zygote;
+        proc->attrs = def->attrs;
+
+        /* place the instance where it belongs, unless told otherwise */
+        if (tmpl->scale == SERVICE_SCALE_CPUS && topology.loaded &&
+            !proc->attrs.has_affinity) {
+                CPU_ZERO(&proc->attrs.affinity);
+                CPU_SET(id, &proc->attrs.affinity);
+                proc->attrs.has_affinity = true;
+        }
+        if (tmpl->scale == SERVICE_SCALE_NODES && topology.loaded) {
+                if (!proc->attrs.has_affinity) {
+                        proc->attrs.affinity = topology.node_cpus[id];
+                        proc->attrs.has_affinity = true;
+                }
+                if (proc->attrs.numa == EXEC_NUMA_DEFAULT) {
+                        proc->attrs.numa = EXEC_NUMA_BIND;
+                        proc->attrs.numa_nodes = 1ULL << id;
+                }
+        }
+
+        return proc;
+}
+
+static bool service_instance_id(const struct process *proc, unsigned *id)
+{
+        const char *mark = strrchr(proc->name, SERVICE_TEMPLATE_MARK);
+        char *end = NULL;
+
+        if (mark == NULL || mark[1] == '\0') {
+                return false;
+        }
+
+        *id = (unsigned) strtoul(mark + 1, &end, 10);
+        return *end == '\0';
+}
+
+/**
+ * @fn static size_t service_template_ids(struct service_template *tmpl,
+ *                                        unsigned *ids)
+ * @brief Lists the instance ids tmpl should be running with
+ * @param ids room for SERVICE_INSTANCES_MAX ids
+ * @return the number of ids
+ * @details Without a topology, per-CPU and per-node templates fall back to
+ *          a single instance 0.
+ */
+static size_t service_template_ids(struct service_template *tmpl,
+                                   unsigned *ids)
+{
+        size_t count = 0;
+        unsigned i = 0;
+
+        switch (tmpl->scale) {
+        case SERVICE_SCALE_CPUS:
+                for (i = 0; i < CPU_SETSIZE && count < SERVICE_INSTANCES_MAX;
+                     i++) {
+                        if (CPU_ISSET(i, &topology.online)) {
+                                ids[count++] = i;
+                        }
+                }
+                break;
+        case SERVICE_SCALE_NODES:
+                for (i = 0; i < TOPOLOGY_MAX_NODES; i++) {
+                        if (topology.node_mask & (1ULL << i)) {
+                                ids[count++] = i;
+                        }
+                }
+                break;
+        default:
+                for (i = 0; i < tmpl->count; i++) {
+                        ids[count++] = i;
+                }
+                return count;
+        }
+
+        if (count == 0) {
+                ids[count++] = 0;
+        }
+        return count;
+}
+
+static bool service_template_add(struct service_template *tmpl,
+                                 struct process *proc)
+{
+        struct process **new_array = NULL;
+        size_t new_size = 0;
+
+        if (tmpl->instance_count >= tmpl->instance_allocated) {
+                new_size = tmpl->instance_allocated + SERVICE_ALLOC_STEP;
+                new_array = mem_realloc(MEM_PROC, tmpl->instances,
+                                        new_size * sizeof(struct process *));
+                if (new_array == NULL) {
+                        return false;
+                }
+                tmpl->instances = new_array;
+                tmpl->instance_allocated = new_size;
+        }
+
+        tmpl->instances[tmpl->instance_count++] = proc;
+        return true;
+}
+
+/**
+ * @fn static void service_template_retire(struct service_template *tmpl,
+ *                                          size_t index)
+ * @brief Takes an instance out of tmpl and stops it
+ * @details A running instance is stopped and destroyed once reaped, see
+ *          process_exited().
+ */
+static void service_template_retire(struct service_template *tmpl,
+                                    size_t index)
+{
+        struct process *proc = tmpl->instances[index];
+
+        memmove(&tmpl->instances[index], &tmpl->instances[index + 1],
+                (tmpl->instance_count - index - 1) *
+                sizeof(struct process *));
+        tmpl->instance_count--;
+
+        timer_cancel(&proc->restart_timer);
+        if (proc->status != CYRENIT_PROC_STATUS_RUNNING) {
+                unregister_process(proc);
+                process_destroy(proc);
+                return;
+        }
+
+        proc->retired = true;
+        process_stop(proc);
+}
+
+/**
+ * @fn bool service_template_scale(struct service_template *tmpl, bool start)
+ * @brief Brings the instances of tmpl in line with its scale and count
+ * @param tmpl the template
+ * @param start whether new instances are started or left unstarted
+ * @return true on success or false if some instance could not be created
+ * @details New instances are started as a single job transaction, so they
+ *          wait for what their template requires like any other service.
+ */
+bool service_template_scale(struct service_template *tmpl, bool start)
+{
+        unsigned ids[SERVICE_INSTANCES_MAX];
+        struct process *created[SERVICE_INSTANCES_MAX];
+        struct process *proc = NULL;
+        size_t count = 0;
+        size_t wanted = 0;
+        size_t i = 0;
+        size_t j = 0;
+        unsigned id = 0;
+        bool ok = true;
+
+        wanted = service_template_ids(tmpl, ids);
+
+        for (i = tmpl->instance_count; i-- > 0;) {
+                service_instance_id(tmpl->instances[i], &id);
+                for (j = 0; j < wanted && ids[j] != id; j++);
+                if (j == wanted) {
+                        service_template_retire(tmpl, i);
+                }
+        }
+
+        for (i = 0; i < wanted; i++) {
+                for (j = 0; j < tmpl->instance_count; j++) {
+                        if (service_instance_id(tmpl->instances[j], &id) &&
+                            id == ids[i]) {
+                                break;
+                        }
+                }
+                if (j < tmpl->instance_count) {
+                        continue;
+                }
+
+                proc = service_instantiate(tmpl, ids[i]);
+                if (proc == NULL || !register_process(proc)) {
+                        process_destroy(proc);
+                        ok = false;
+                        continue;
+                }
+                if (!service_template_add(tmpl, proc)) {
+                        unregister_process(proc);
+                        process_destroy(proc);
+                        ok = false;
+                        continue;
+                }
+
+                created[count++] = proc;
+        }
+
+        if (start && count > 0) {
+                job_submit(created, count, JOB_START, NULL);
+        }
+
+        return ok;
+}
+
+/**
+ * @fn struct service_template *service_template_find(const char *name)
+ * @brief Looks up a loaded template by name, with or without the '@'
+ */
+struct service_template *service_template_find(const char *name)
+{
+        size_t length = strlen(name);
+        size_t i = 0;
+
+        if (length > 0 && name[length - 1] == SERVICE_TEMPLATE_MARK) {
+                length--;
+        }
+
+        for (i = 0; i < service_template_count; i++) {
+                if (strlen(service_templates[i]->name) == length &&
+                    strncmp(service_templates[i]->name, name, length) ==
+                    STRCMP_EQUAL) {
+                        return service_templates[i];
+                }
+        }
+
+        return NULL;
+}
+
+/**
+ * @fn static struct service_template *service_template_load(
+ *                                              const char *path)
+ * @brief Loads and registers a template file, without any instance
+ */
+static struct service_template *service_template_load(const char *path)
+{
+        struct service_template **new_array = NULL;
+        struct service_template *tmpl = NULL;
+        size_t new_size = 0;
+        char *mark = NULL;
+
+        tmpl = mem_calloc(MEM_PROC, 1, sizeof(struct service_template));
+        if (tmpl == NULL) {
+                return NULL;
+        }
+        tmpl->scale = SERVICE_SCALE_COUNT;
+        tmpl->count = 1;
+
+        tmpl->definition = service_parse(path, tmpl);
+        if (tmpl->definition == NULL) {
+                mem_free(MEM_PROC, tmpl);
+                return NULL;
+        }
+
+        tmpl->name = mem_strdup(MEM_PROC, tmpl->definition->name);
+        if (tmpl->name != NULL) {
+                mark = strrchr(tmpl->name, SERVICE_TEMPLATE_MARK);
+                if (mark != NULL && mark[1] == '\0') {
+                        *mark = '\0';
+                }
+        }
+
+        if (tmpl->name == NULL || service_template_find(tmpl->name) != NULL) {
+                goto fail;
+        }
+
+        if (service_template_count >= service_template_allocated) {
+                new_size = service_template_allocated + SERVICE_ALLOC_STEP;
+                new_array = mem_realloc(MEM_PROC, service_templates,
+                                        new_size *
+                                        sizeof(struct service_template *));
+                if (new_array == NULL) {
+                        goto fail;
+                }
+                service_templates = new_array;
+                service_template_allocated = new_size;
+        }
+
+        service_templates[service_template_count++] = tmpl;
+        return tmpl;
+
+fail:
+        process_destroy(tmpl->definition);
+        mem_free(MEM_PROC, tmpl->name);
+        mem_free(MEM_PROC, tmpl);
+        return NULL;
+}
+
+static int service_filter(const struct dirent *entry)
+{
+        size_t length = strlen(entry->d_name);
+        size_t suffix = strlen(SERVICE_SUFFIX);
+
+        return entry->d_name[0] != '.' && length > suffix &&
+               strcmp(entry->d_name + length - suffix, SERVICE_SUFFIX) ==
+               STRCMP_EQUAL;
+}
+
+/**
+ * @fn size_t services_load_dir(const char *dir)
+ * @brief Loads and registers every service file of dir, in name order
+ * @param dir the directory, SERVICES_DIR if NULL
+ * @return the number of services registered
+ * @details The services are left unstarted. Templates are registered with
+ *          all of their instances.
+ */
+size_t services_load_dir(const char *dir)
+{
+        struct service_template *tmpl = NULL;
+        struct dirent **entries = NULL;
+        struct process *proc = NULL;
+        char path[PATH_MAX];
+        size_t loaded = 0;
+        int count = 0;
+        int i = 0;
+
+        if (dir == NULL) {
+                dir = SERVICES_DIR;
+        }
+
+        count = scandir(dir, &entries, service_filter, alphasort);
+        if (count < 0) {
+                return 0;
+        }
+
+        for (i = 0; i < count; i++) {
+                snprintf(path, sizeof(path), "%s/%s", dir, entries[i]->d_name);
+
+                if (service_is_template(entries[i]->d_name)) {
+                        free(entries[i]);
+                        tmpl = service_template_load(path);
+                        if (tmpl == NULL) {
+                                continue;
+                        }
+                        if (!service_template_scale(tmpl, false)) {
+                                fprintf(stderr, "cyrenit: %s: failed to "
+                                        "create every instance\n", path);
+                        }
+                        loaded += tmpl->instance_count;
+                        continue;
+                }
+                free(entries[i]);
+
+                proc = service_load(path);
+                if (proc == NULL) {
+                        continue;
+                }
+                if (!register_process(proc)) {
+                        process_destroy(proc);
+                        continue;
+                }
+                loaded++;
+        }
+        free(entries);
+
+        return loaded;
+}
+
+/**
+ * @fn size_t service_templates_adopt(const char *dir)
+ * @brief Reloads the templates of dir around already registered instances
+ * @param dir the directory, SERVICES_DIR if NULL
+ * @return the number of instances adopted
+ * @details Used after a re-exec, when the instances come from the state
+ *          and only the templates are missing. Nothing is started or
+ *          stopped here.
+ */
+size_t service_templates_adopt(const char *dir)
+{
+        struct service_template *tmpl = NULL;
+        struct dirent **entries = NULL;
+        struct process *proc = NULL;
+        char path[PATH_MAX];
+        size_t prefix = 0;
+        size_t adopted = 0;
+        size_t j = 0;
+        int count = 0;
+        int i = 0;
+
+        if (dir == NULL) {
+                dir = SERVICES_DIR;
+        }
+
+        count = scandir(dir, &entries, service_filter, alphasort);
+        if (count < 0) {
+                return 0;
+        }
+
+        for (i = 0; i < count; i++) {
+                snprintf(path, sizeof(path), "%s/%s", dir, entries[i]->d_name);
+                tmpl = NULL;
+                if (service_is_template(entries[i]->d_name)) {
+                        tmpl = service_template_load(path);
+                }
+                free(entries[i]);
+                if (tmpl == NULL) {
+                        continue;
+                }
+
+                prefix = strlen(tmpl->name);
+                for (j = 0; j < registered_process_count; j++) {
+                        proc = registered_processes[j];
+                        if (!proc->retired &&
+                            strncmp(proc->name, tmpl->name, prefix) ==
+                            STRCMP_EQUAL &&
+                            proc->name[prefix] == SERVICE_TEMPLATE_MARK &&
+                            service_template_add(tmpl, proc)) {
+                                adopted++;
+                        }
+                }
+        }
+        free(entries);
+
+        return adopted;
+}
+
+/**
+ * @fn void services_init()
+ * @brief Registers the service control commands
+ */
+void services_init()
+{
+        control_register("scale", "[template count|cpus|nodes] list or "
+                         "scale templated services", service_scale_command);
+}
+
+static const char *service_scale_name(const struct service_template *tmpl)
+{
+        switch (tmpl->scale) {
+        case SERVICE_SCALE_CPUS:
+                return "cpus";
+        case SERVICE_SCALE_NODES:
+                return "nodes";
+        default:
+                return "count";
+        }
+}
+
+static void service_scale_command(int argc, char **argv,
+                                  struct control_reply *reply)
+{
+        struct service_template *tmpl = NULL;
+        size_t i = 0;
+
+        if (argc == 1) {
+                for (i = 0; i < service_template_count; i++) {
+                        tmpl = service_templates[i];
+                        control_reply_printf(reply, "%s%c: %s, %zu "
+                                             "instances\n", tmpl->name,
+                                             SERVICE_TEMPLATE_MARK,
+                                             service_scale_name(tmpl),
+                                             tmpl->instance_count);
+                }
+                return;
+        }
+
+        if (argc != 3) {
+                control_reply_error(reply, "usage: scale [template "
+                                    "count|cpus|nodes]");
+                return;
+        }
+
+        tmpl = service_template_find(argv[1]);
+        if (tmpl == NULL) {
+                control_reply_error(reply, "no template named %s", argv[1]);
+                return;
+        }
+        if (!service_parse_scale(argv[2], &tmpl->scale, &tmpl->count)) {
+                control_reply_error(reply, "invalid scale %s", argv[2]);
+                return;
+        }
+
+        if (!service_template_scale(tmpl, true)) {
+                control_reply_error(reply, "%s%c: only %zu instances could "
+                                    "be started", tmpl->name,
+                                    SERVICE_TEMPLATE_MARK,
+                                    tmpl->instance_count);
+                return;
+        }
+
+        control_reply_printf(reply, "%s%c: %zu instances\n", tmpl->name,
+                             SERVICE_TEMPLATE_MARK, tmpl->instance_count);
+}
+
+#endif//__SERVICE_C
@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * service.h - Service definition files
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __SERVICE_H
+#define __SERVICE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "proc.h"
+
+#define SERVICES_DIR "/etc/cyrenit/services"
+#define SERVICE_SUFFIX ".svc"
+#define SERVICE_LINE_MAX 1024
+/* worker@.svc is a template, its instances are named worker@<id> */
+#define SERVICE_TEMPLATE_MARK '@'
+#define SERVICE_INSTANCE_VAR "%i"
+#define SERVICE_INSTANCES_MAX 1024
+
+/*
+ * A service file holds one `key = value` setting per line, '#' starts a
+ * comment. The service is named after the file unless `name` is set.
+ *
+ *   exec = /path/to/binary arguments...    (required)
+ *   restart = never | on-failure | always
+ *   restart_delay = <ms>
+ *   stop_timeout = <ms>                    (SIGTERM to SIGKILL)
+ *   requires = <service> ...               (started first, see job.h)
+ *   after = <service> ...                  (ordering only)
+ *   devices = /dev/<node> | <subsystem>:<name> ...
+ *                                          (started once they appear, see
+ *                                           uevent.h)
+ *   env = KEY=value                        (repeatable, default: inherit)
+ *   cgroup = /sys/fs/cgroup/<path>
+ *   target = minimal | rescue | full      (started at boot from, see
+ *                                           bootopt.h; default: full)
+ *   tier = critical | normal | low | idle  (under memory pressure, see
+ *                                           pressure.h; default: normal)
+ *   cpus = 0-3,8 | node:<nodes>
+ *   numa = bind:<nodes> | preferred:<node> | interleave:<nodes|all>
+ *   sched = other | batch | idle | fifo | rr
+ *   priority = <1-99, for fifo and rr>
+ *   nice = <-20..19>
+ *   ioprio = idle | be[:0-7] | rt[:0-7]
+ *   user = <name|uid>
+ *   group = <name|gid>
+ *   zygote = yes | no                      (spawn through a zygote)
+ *   fdstore = <max>                        (descriptors it may store, see
+ *                                           fdstore.h; default: 0)
+ *   sandbox = mount pid ipc net readonly dev
+ *                                          (namespaces and mounts of its
+ *                                           own, see sandbox.h)
+ *
+ * Templates (name@.svc) also take:
+ *
+ *   instances = <count> | cpus | nodes     (default: 1)
+ *
+ * and substitute %i in exec, env, cgroup, requires, after and devices with
+ * the instance id: 0..N-1, or the CPU or NUMA node the instance is for.
+ * Per-CPU and per-node instances are also pinned there unless cpus or numa
+ * are set.
+ */
+
+enum service_scale
+{
+        SERVICE_SCALE_COUNT = 0,
+        SERVICE_SCALE_CPUS,
+        SERVICE_SCALE_NODES
+};
+
+/*
+ * The definition is parsed once and never started. Instances are copies of
+ * it and share its environment when no env setting uses %i.
+ */
+struct service_template
+{
+        char *name;
+        struct process *definition;
+        enum service_scale scale;
+        unsigned count;
+        struct process **instances;
+        size_t instance_count;
+        size_t instance_allocated;
+};
+
+extern struct service_template **service_templates;
+extern size_t service_template_count;
+
+struct process *service_load(const char *path);
+size_t services_load_dir(const char *dir);
+struct service_template *service_template_find(const char *name);
+bool service_template_scale(struct service_template *tmpl, bool start);
+size_t service_templates_adopt(const char *dir);
+void services_init();
+
+#endif//__SERVICE_H
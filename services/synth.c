@@ -0,0 +1,499 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * synth.c - Synthetic service for stressing the supervisor (testing service)
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __SYNTH_C
+#define __SYNTH_C
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/* how often flood and leak catch up with their rate */
+#define SYNTH_TICK_MS 10
+#define SYNTH_IDLE_TICK_MS 1000
+#define SYNTH_SLOW_START_MS 2000
+#define SYNTH_ORPHAN_MS 60000
+#define SYNTH_LINE_MAX 4096
+#define SYNTH_MB (1024 * 1024)
+
+/*
+ * What the service does is a comma separated list of modes, given as
+ * --mode=slow,flood or SYNTH_MODE=slow,flood; every --name=value option
+ * may be given as SYNTH_<NAME> in the environment too, the command line
+ * winning. Modes:
+ *
+ *   idle          do nothing until lifetime runs out (the default)
+ *   exit          exit with exit-code after delay ms
+ *   crash         kill itself with signal after delay ms
+ *   slow          take start ms (2000 by default) to become ready
+ *   flood         print line-byte lines at rate MB/s
+ *   leak          allocate and touch leak MB/s, up to leak-max MB (0: no
+ *                 limit)
+ *   orphans       fork orphans processes that outlive it by orphan ms
+ *   ignore-term   ignore SIGTERM, so only SIGKILL stops it
+ *
+ * Once started (after start ms), READY=1 is sent to $NOTIFY_SOCKET if set
+ * and "ready" is printed. With lifetime ms set, it exits with exit-code
+ * when that runs out. jitter (percent) spreads delay, start and lifetime
+ * around their values, from seed (default: the pid), so that thousands of
+ * instances of a template do not all act at once.
+ */
+enum synth_mode
+{
+        SYNTH_IDLE = 0,
+        SYNTH_EXIT = 1 << 0,
+        SYNTH_CRASH = 1 << 1,
+        SYNTH_SLOW = 1 << 2,
+        SYNTH_FLOOD = 1 << 3,
+        SYNTH_LEAK = 1 << 4,
+        SYNTH_ORPHANS = 1 << 5,
+        SYNTH_IGNORE_TERM = 1 << 6
+};
+
+static const struct
+{
+        const char *name;
+        unsigned mode;
+} synth_modes[] = {
+        {"idle", SYNTH_IDLE},
+        {"exit", SYNTH_EXIT},
+        {"crash", SYNTH_CRASH},
+        {"slow", SYNTH_SLOW},
+        {"flood", SYNTH_FLOOD},
+        {"leak", SYNTH_LEAK},
+        {"orphans", SYNTH_ORPHANS},
+        {"ignore-term", SYNTH_IGNORE_TERM},
+};
+
+#define SYNTH_MODES (sizeof(synth_modes) / sizeof(synth_modes[0]))
+
+static const struct
+{
+        const char *name;
+        int signal;
+} synth_signals[] = {
+        {"SEGV", SIGSEGV}, {"ABRT", SIGABRT}, {"KILL", SIGKILL},
+        {"BUS", SIGBUS}, {"FPE", SIGFPE}, {"ILL", SIGILL},
+        {"TERM", SIGTERM}, {"INT", SIGINT},
+};
+
+#define SYNTH_SIGNALS (sizeof(synth_signals) / sizeof(synth_signals[0]))
+
+struct synth_config
+{
+        unsigned modes;
+        int exit_code;
+        int signal;
+        long delay_ms;
+        long start_ms;
+        long lifetime_ms;
+        double rate_mb;
+        long line_bytes;
+        double leak_mb;
+        long leak_max_mb;
+        long orphans;
+        long orphan_ms;
+        long jitter;
+        unsigned seed;
+};
+
+static int synth_argc = 0;
+static char **synth_argv = NULL;
+
+/**
+ * @fn static const char *synth_option(const char *name)
+ * @brief Returns --name=value from the command line, or SYNTH_NAME from
+ *        the environment (upper case, '-' as '_'), or NULL
+ */
+static const char *synth_option(const char *name)
+{
+        char key[64];
+        size_t length = strlen(name);
+        size_t i = 0;
+        int arg = 0;
+
+        for (arg = 1; arg < synth_argc; arg++) {
+                if (strncmp(synth_argv[arg], "--", 2) == 0 &&
+                    strncmp(synth_argv[arg] + 2, name, length) == 0 &&
+                    synth_argv[arg][length + 2] == '=') {
+                        return synth_argv[arg] + length + 3;
+                }
+        }
+
+        snprintf(key, sizeof(key), "SYNTH_%s", name);
+        for (i = 6; key[i] != '\0'; i++) {
+                key[i] = key[i] == '-' ? '_' :
+                         (char) (key[i] >= 'a' && key[i] <= 'z' ?
+                                 key[i] - 'a' + 'A' : key[i]);
+        }
+
+        return getenv(key);
+}
+
+static long synth_long(const char *name, long fallback)
+{
+        const char *value = synth_option(name);
+        char *end = NULL;
+        long number = 0;
+
+        if (value == NULL) {
+                return fallback;
+        }
+
+        number = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || number < 0) {
+                fprintf(stderr, "synth: invalid %s %s, using %ld\n", name,
+                        value, fallback);
+                return fallback;
+        }
+
+        return number;
+}
+
+static double synth_double(const char *name, double fallback)
+{
+        const char *value = synth_option(name);
+        char *end = NULL;
+        double number = 0;
+
+        if (value == NULL) {
+                return fallback;
+        }
+
+        number = strtod(value, &end);
+        if (end == value || *end != '\0' || number < 0) {
+                fprintf(stderr, "synth: invalid %s %s, using %g\n", name,
+                        value, fallback);
+                return fallback;
+        }
+
+        return number;
+}
+
+static bool synth_parse_modes(const char *value, unsigned *modes)
+{
+        char buffer[256];
+        char *saveptr = NULL;
+        char *name = NULL;
+        size_t i = 0;
+
+        snprintf(buffer, sizeof(buffer), "%s", value);
+        *modes = SYNTH_IDLE;
+        for (name = strtok_r(buffer, ",", &saveptr); name != NULL;
+             name = strtok_r(NULL, ",", &saveptr)) {
+                for (i = 0; i < SYNTH_MODES; i++) {
+                        if (strcmp(name, synth_modes[i].name) == 0) {
+                                *modes |= synth_modes[i].mode;
+                                break;
+                        }
+                }
+                if (i == SYNTH_MODES) {
+                        fprintf(stderr, "synth: unknown mode %s\n", name);
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+static int synth_parse_signal(const char *value)
+{
+        char *end = NULL;
+        long number = 0;
+        size_t i = 0;
+
+        if (strncmp(value, "SIG", 3) == 0) {
+                value += 3;
+        }
+        for (i = 0; i < SYNTH_SIGNALS; i++) {
+                if (strcmp(value, synth_signals[i].name) == 0) {
+                        return synth_signals[i].signal;
+                }
+        }
+
+        number = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || number <= 0 || number >= NSIG) {
+                fprintf(stderr, "synth: unknown signal %s, using SEGV\n",
+                        value);
+                return SIGSEGV;
+        }
+
+        return (int) number;
+}
+
+/* Spreads value by up to jitter percent either way */
+static long synth_jitter(const struct synth_config *config, long value)
+{
+        long spread = value * config->jitter / 100;
+
+        if (spread <= 0) {
+                return value;
+        }
+
+        return value - spread + (long) (rand() % (2 * spread + 1));
+}
+
+static bool synth_load_config(struct synth_config *config)
+{
+        const char *value = NULL;
+
+        memset(config, 0, sizeof(*config));
+        value = synth_option("mode");
+        if (value != NULL && !synth_parse_modes(value, &config->modes)) {
+                return false;
+        }
+        value = synth_option("signal");
+        config->signal = value != NULL ? synth_parse_signal(value) : SIGSEGV;
+
+        config->exit_code = (int) synth_long("exit-code", 0);
+        config->delay_ms = synth_long("delay", 0);
+        config->start_ms = synth_long("start", config->modes & SYNTH_SLOW ?
+                                      SYNTH_SLOW_START_MS : 0);
+        config->lifetime_ms = synth_long("lifetime", 0);
+        config->rate_mb = synth_double("rate", 1);
+        config->line_bytes = synth_long("line-bytes", 128);
+        config->leak_mb = synth_double("leak", 1);
+        config->leak_max_mb = synth_long("leak-max", 0);
+        config->orphans = synth_long("orphans", 4);
+        config->orphan_ms = synth_long("orphan", SYNTH_ORPHAN_MS);
+        config->jitter = synth_long("jitter", 0);
+        config->seed = (unsigned) synth_long("seed", (long) getpid());
+
+        if (config->line_bytes < 2 || config->line_bytes > SYNTH_LINE_MAX) {
+                config->line_bytes = 128;
+        }
+        config->jitter = config->jitter > 100 ? 100 : config->jitter;
+        srand(config->seed);
+        config->delay_ms = synth_jitter(config, config->delay_ms);
+        config->start_ms = synth_jitter(config, config->start_ms);
+        config->lifetime_ms = synth_jitter(config, config->lifetime_ms);
+
+        return true;
+}
+
+static long long synth_now_ms()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void synth_sleep_ms(long ms)
+{
+        struct timespec ts;
+
+        ts.tv_sec = ms / 1000;
+        ts.tv_nsec = (ms % 1000) * 1000000L;
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+/* The sd_notify() protocol, abstract sockets included */
+static void synth_notify(const char *message)
+{
+        const char *path = getenv("NOTIFY_SOCKET");
+        struct sockaddr_un addr;
+        socklen_t length = 0;
+        int fd = -1;
+
+        if (path == NULL || (path[0] != '/' && path[0] != '@') ||
+            strlen(path) >= sizeof(addr.sun_path)) {
+                return;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+        if (path[0] == '@') {
+                addr.sun_path[0] = '\0';
+        }
+        length = (socklen_t) (offsetof(struct sockaddr_un, sun_path) +
+                              strlen(path));
+
+        fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+                return;
+        }
+        sendto(fd, message, strlen(message), MSG_NOSIGNAL,
+               (struct sockaddr *) &addr, length);
+        close(fd);
+}
+
+/**
+ * @fn static void synth_fork_orphans(const struct synth_config *config)
+ * @brief Leaves processes behind for the supervisor to deal with
+ * @details Each is forked from a child that exits right away, so that it
+ *          is reparented to PID 1 (or the closest subreaper) while still
+ *          in the service's session and cgroup.
+ */
+static void synth_fork_orphans(const struct synth_config *config)
+{
+        pid_t pid = 0;
+        long i = 0;
+
+        for (i = 0; i < config->orphans; i++) {
+                pid = fork();
+                if (pid == 0) {
+                        if (fork() == 0) {
+                                synth_sleep_ms(config->orphan_ms);
+                                _exit(EXIT_SUCCESS);
+                        }
+                        _exit(EXIT_SUCCESS);
+                }
+                if (pid == -1) {
+                        perror("synth: fork");
+                        return;
+                }
+                while (waitpid(pid, NULL, 0) == -1 && errno == EINTR);
+        }
+        printf("synth: left %ld orphans behind for %ld ms\n", config->orphans,
+               config->orphan_ms);
+}
+
+static void synth_crash(const struct synth_config *config)
+{
+        printf("synth: crashing with signal %d\n", config->signal);
+        fflush(stdout);
+        signal(config->signal, SIG_DFL);
+        raise(config->signal);
+        abort();
+}
+
+/**
+ * @fn static bool synth_flood(const struct synth_config *config,
+ *                             long long elapsed_ms, long long *written)
+ * @brief Writes whatever keeps the output at rate MB/s since the start
+ * @details A slow reader makes the writes block: the supervisor's pipes
+ *          throttle the flood as they would a real service.
+ */
+static bool synth_flood(const struct synth_config *config,
+                        long long elapsed_ms, long long *written)
+{
+        static char line[SYNTH_LINE_MAX];
+        static long long count = 0;
+        long long due = (long long) (config->rate_mb * SYNTH_MB *
+                                     elapsed_ms / 1000);
+        size_t length = (size_t) config->line_bytes;
+        ssize_t ret = 0;
+
+        while (*written + (long long) length <= due) {
+                memset(line, 'x', length - 1);
+                snprintf(line, length, "synth: flood line %lld ", count++);
+                line[strlen(line)] = 'x';
+                line[length - 1] = '\n';
+                ret = write(STDOUT_FILENO, line, length);
+                if (ret == -1 && errno == EINTR) {
+                        continue;
+                }
+                if (ret <= 0) {
+                        return false;
+                }
+                *written += ret;
+        }
+
+        return true;
+}
+
+/* Allocates what keeps the leak at leak MB/s, touching every page */
+static void synth_leak(const struct synth_config *config,
+                       long long elapsed_ms, long long *leaked)
+{
+        long long due = (long long) (config->leak_mb * SYNTH_MB *
+                                     elapsed_ms / 1000);
+        long long max = (long long) config->leak_max_mb * SYNTH_MB;
+        char *block = NULL;
+
+        if (max > 0 && due > max) {
+                due = max;
+        }
+        while (*leaked + SYNTH_MB <= due) {
+                block = malloc(SYNTH_MB);
+                if (block == NULL) {
+                        return;
+                }
+                memset(block, 0xa5, SYNTH_MB);
+                *leaked += SYNTH_MB;
+        }
+}
+
+int main(int argc, char **argv)
+{
+        struct synth_config config;
+        long long start = synth_now_ms();
+        long long elapsed = 0;
+        long long written = 0;
+        long long leaked = 0;
+        long tick = SYNTH_IDLE_TICK_MS;
+
+        synth_argc = argc;
+        synth_argv = argv;
+        if (!synth_load_config(&config)) {
+                return EXIT_FAILURE;
+        }
+        setvbuf(stdout, NULL, _IOLBF, 0);
+
+        if (config.modes & SYNTH_IGNORE_TERM) {
+                signal(SIGTERM, SIG_IGN);
+        }
+        if (config.modes & SYNTH_ORPHANS) {
+                synth_fork_orphans(&config);
+        }
+        if (config.modes & (SYNTH_EXIT | SYNTH_CRASH)) {
+                synth_sleep_ms(config.delay_ms);
+                if (config.modes & SYNTH_CRASH) {
+                        synth_crash(&config);
+                }
+                printf("synth: exiting with %d\n", config.exit_code);
+                return config.exit_code;
+        }
+
+        synth_sleep_ms(config.start_ms);
+        synth_notify("READY=1");
+        printf("synth: ready after %ld ms\n", config.start_ms);
+
+        if (config.modes & (SYNTH_FLOOD | SYNTH_LEAK)) {
+                tick = SYNTH_TICK_MS;
+        }
+        start = synth_now_ms();
+        while (config.lifetime_ms == 0 || elapsed < config.lifetime_ms) {
+                if ((config.modes & SYNTH_FLOOD) &&
+                    !synth_flood(&config, elapsed, &written)) {
+                        return EXIT_FAILURE;
+                }
+                if (config.modes & SYNTH_LEAK) {
+                        synth_leak(&config, elapsed, &leaked);
+                }
+                if (config.lifetime_ms > 0 &&
+                    config.lifetime_ms - elapsed < tick) {
+                        tick = (long) (config.lifetime_ms - elapsed);
+                }
+                synth_sleep_ms(tick);
+                elapsed = synth_now_ms() - start;
+        }
+
+        printf("synth: lifetime over, exiting with %d\n", config.exit_code);
+        return config.exit_code;
+}
+
+#endif//__SYNTH_C
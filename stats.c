@@ -0,0 +1,345 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * stats.c - Per-service resource accounting
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __STATS_C
+#define __STATS_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <linux/limits.h>
+
+#include "control.h"
+#include "proc.h"
+#include "stats.h"
+#include "timer.h"
+
+#define STATS_READ_SIZE 1024
+
+static struct timer sampler_timer;
+static uint64_t sampler_interval_ms = STATS_INTERVAL_MIN_MS;
+static uint64_t sampler_cost_ppm = 0;
+/* cost of the rounds since the interval was last adapted */
+static uint64_t sampler_window_ns = 0;
+static uint64_t sampler_window_ms = 0;
+static unsigned sampler_window_rounds = 0;
+static long clock_ticks = 0;
+static long page_kb = 0;
+
+static void stats_command(int argc, char **argv, struct control_reply *reply);
+
+static uint64_t stats_thread_cpu_ns()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static ssize_t stats_read_file(const char *path, char *buffer, size_t size)
+{
+        ssize_t ret = 0;
+        int fd = -1;
+
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+                return -1;
+        }
+
+        ret = read(fd, buffer, size - 1);
+        close(fd);
+        if (ret < 0) {
+                return -1;
+        }
+
+        buffer[ret] = '\0';
+        return ret;
+}
+
+/**
+ * @fn static bool stats_read_procfs(pid_t pid, uint64_t *cpu_us,
+ *                                   uint64_t *rss_kb)
+ * @brief Reads CPU time and RSS of a single process from /proc/<pid>/stat
+ */
+static bool stats_read_procfs(pid_t pid, uint64_t *cpu_us, uint64_t *rss_kb)
+{
+        char path[PATH_MAX];
+        char buffer[STATS_READ_SIZE];
+        unsigned long long utime = 0;
+        unsigned long long stime = 0;
+        long long rss = 0;
+        char *ptr = NULL;
+
+        snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+        if (stats_read_file(path, buffer, sizeof(buffer)) <= 0) {
+                return false;
+        }
+
+        /* comm may contain spaces and parentheses, skip past the last ')' */
+        ptr = strrchr(buffer, ')');
+        if (ptr == NULL) {
+                return false;
+        }
+
+        if (sscanf(ptr + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                   "%llu %llu %*d %*d %*d %*d %*d %*d %*u %*u %lld",
+                   &utime, &stime, &rss) != 3) {
+                return false;
+        }
+
+        *cpu_us = (utime + stime) * 1000000ULL / (unsigned long long) clock_ticks;
+        *rss_kb = rss > 0 ? (uint64_t) rss * (uint64_t) page_kb : 0;
+        return true;
+}
+
+/**
+ * @fn static bool stats_read_cgroup(const char *cgroup, uint64_t *cpu_us,
+ *                                   uint64_t *rss_kb)
+ * @brief Reads cpu.stat and memory.current of a cgroup v2 directory
+ * @details Covers every process of the service, not only the main one.
+ */
+static bool stats_read_cgroup(const char *cgroup, uint64_t *cpu_us,
+                              uint64_t *rss_kb)
+{
+        char path[PATH_MAX];
+        char buffer[STATS_READ_SIZE];
+        unsigned long long value = 0;
+        char *ptr = NULL;
+
+        snprintf(path, sizeof(path), "%s/cpu.stat", cgroup);
+        if (stats_read_file(path, buffer, sizeof(buffer)) <= 0) {
+                return false;
+        }
+        ptr = strstr(buffer, "usage_usec ");
+        if (ptr == NULL || sscanf(ptr, "usage_usec %llu", &value) != 1) {
+                return false;
+        }
+        *cpu_us = value;
+
+        snprintf(path, sizeof(path), "%s/memory.current", cgroup);
+        if (stats_read_file(path, buffer, sizeof(buffer)) <= 0 ||
+            sscanf(buffer, "%llu", &value) != 1) {
+                return false;
+        }
+        *rss_kb = value / 1024;
+
+        return true;
+}
+
+/**
+ * @fn void stats_account_exit(struct process *proc, const struct rusage *ru)
+ * @brief Adds the resource usage of an exited instance to the aggregates
+ * @param proc the process that exited
+ * @param ru the usage returned by wait4(), may be NULL
+ */
+void stats_account_exit(struct process *proc, const struct rusage *ru)
+{
+        struct process_stats *st = NULL;
+
+        if (proc == NULL) {
+                return;
+        }
+
+        st = &proc->stats;
+        st->exits++;
+        if (ru != NULL) {
+                st->utime_us += (uint64_t) ru->ru_utime.tv_sec * 1000000ULL +
+                                (uint64_t) ru->ru_utime.tv_usec;
+                st->stime_us += (uint64_t) ru->ru_stime.tv_sec * 1000000ULL +
+                                (uint64_t) ru->ru_stime.tv_usec;
+                st->minflt += (uint64_t) ru->ru_minflt;
+                st->majflt += (uint64_t) ru->ru_majflt;
+                if ((uint64_t) ru->ru_maxrss > st->maxrss_kb) {
+                        st->maxrss_kb = (uint64_t) ru->ru_maxrss;
+                }
+        }
+
+        st->cpu_us = 0;
+        st->rss_kb = 0;
+        st->cpu_permille = 0;
+        st->last_sample_ms = 0;
+        st->idle_rounds = 0;
+        st->skip = 0;
+}
+
+/**
+ * @fn bool stats_sample_process(struct process *proc, uint64_t now_ms)
+ * @brief Samples CPU and memory usage of a running process
+ * @param proc the process
+ * @param now_ms the current supervisor time
+ * @return true if a sample was taken
+ * @details Services with a cgroup are sampled through it, the others
+ *          through /proc/<pid>/stat. Services found idle are sampled less
+ *          and less often, up to every STATS_IDLE_SKIP_MAX rounds.
+ */
+bool stats_sample_process(struct process *proc, uint64_t now_ms)
+{
+        struct process_stats *st = NULL;
+        uint64_t cpu_us = 0;
+        uint64_t rss_kb = 0;
+        uint64_t elapsed = 0;
+        bool ok = false;
+
+        if (proc == NULL || proc->pid <= 0) {
+                return false;
+        }
+
+        if (proc->cgroup != NULL) {
+                ok = stats_read_cgroup(proc->cgroup, &cpu_us, &rss_kb);
+        }
+        if (!ok) {
+                ok = stats_read_procfs(proc->pid, &cpu_us, &rss_kb);
+        }
+        if (!ok) {
+                return false;
+        }
+
+        st = &proc->stats;
+        if (st->last_sample_ms != 0 && now_ms > st->last_sample_ms &&
+            cpu_us >= st->cpu_us) {
+                elapsed = now_ms - st->last_sample_ms;
+                st->cpu_permille = (uint32_t) ((cpu_us - st->cpu_us) /
+                                               elapsed);
+                if (cpu_us == st->cpu_us) {
+                        if (st->idle_rounds < STATS_IDLE_SKIP_MAX) {
+                                st->idle_rounds++;
+                        }
+                }
+                else {
+                        st->idle_rounds = 0;
+                }
+        }
+
+        st->skip = st->idle_rounds;
+        st->cpu_us = cpu_us;
+        st->rss_kb = rss_kb;
+        if (rss_kb > st->maxrss_kb) {
+                st->maxrss_kb = rss_kb;
+        }
+        st->last_sample_ms = now_ms;
+
+        return true;
+}
+
+/**
+ * @fn static void stats_sampler_round(struct timer *t, void *data)
+ * @brief Samples every due service and adapts the sampling interval
+ * @details The cost of each round is measured in thread CPU time. The
+ *          interval doubles whenever the sampler uses more than half of
+ *          STATS_BUDGET_PPM and halves again when it is well below it.
+ *          Idle services are only sampled every STATS_IDLE_SKIP_MAX + 1
+ *          rounds and tend to come due together, so the cost is averaged
+ *          over that many rounds before the interval is adapted.
+ */
+static void stats_sampler_round(struct timer *t, void *data)
+{
+        uint64_t start = 0;
+        uint64_t now = 0;
+        size_t i = 0;
+        struct process *proc = NULL;
+
+        (void) data;
+        start = stats_thread_cpu_ns();
+        now = timer_wheel_now(&supervisor_timers);
+
+        for (i = 0; i < registered_process_count; i++) {
+                proc = registered_processes[i];
+                if (proc->pid <= 0) {
+                        continue;
+                }
+                if (proc->stats.skip > 0) {
+                        proc->stats.skip--;
+                        continue;
+                }
+                stats_sample_process(proc, now);
+        }
+
+        sampler_window_ns += stats_thread_cpu_ns() - start;
+        sampler_window_ms += sampler_interval_ms;
+        if (++sampler_window_rounds >= STATS_IDLE_SKIP_MAX + 1) {
+                sampler_cost_ppm = sampler_window_ns / sampler_window_ms;
+                sampler_window_ns = 0;
+                sampler_window_ms = 0;
+                sampler_window_rounds = 0;
+                if (sampler_cost_ppm > STATS_BUDGET_PPM / 2 &&
+                    sampler_interval_ms < STATS_INTERVAL_MAX_MS) {
+                        sampler_interval_ms *= 2;
+                }
+                else if (sampler_cost_ppm < STATS_BUDGET_PPM / 8 &&
+                         sampler_interval_ms > STATS_INTERVAL_MIN_MS) {
+                        sampler_interval_ms /= 2;
+                }
+        }
+
+        timer_add(&supervisor_timers, t, sampler_interval_ms, TIMER_COARSE);
+}
+
+/**
+ * @fn bool stats_start_sampler()
+ * @brief Arms the periodic sampler and registers the `stats` command
+ * @return true on success or false on failure
+ */
+bool stats_start_sampler()
+{
+        clock_ticks = sysconf(_SC_CLK_TCK);
+        page_kb = sysconf(_SC_PAGESIZE) / 1024;
+        if (clock_ticks <= 0 || page_kb <= 0) {
+                return false;
+        }
+
+        control_register("stats", "dump per-service resource usage",
+                         stats_command);
+
+        timer_init(&sampler_timer, stats_sampler_round, NULL);
+        timer_add(&supervisor_timers, &sampler_timer, sampler_interval_ms,
+                  TIMER_COARSE);
+
+        return true;
+}
+
+static void stats_command(int argc, char **argv, struct control_reply *reply)
+{
+        struct process *proc = NULL;
+        struct process_stats *st = NULL;
+        size_t i = 0;
+
+        (void) argc;
+        (void) argv;
+        control_reply_printf(reply, "# interval_ms=%llu cost_ppm=%llu\n",
+                             (unsigned long long) sampler_interval_ms,
+                             (unsigned long long) sampler_cost_ppm);
+
+        for (i = 0; i < registered_process_count; i++) {
+                proc = registered_processes[i];
+                st = &proc->stats;
+                control_reply_printf(reply,
+                        "name=%s pid=%d status=%s cpu_permille=%u "
+                        "rss_kb=%llu maxrss_kb=%llu utime_us=%llu "
+                        "stime_us=%llu minflt=%llu majflt=%llu exits=%llu "
+                        "restarts=%u\n",
+                        proc->name, proc->pid,
+                        process_status_name(proc->status), st->cpu_permille,
+                        (unsigned long long) st->rss_kb,
+                        (unsigned long long) st->maxrss_kb,
+                        (unsigned long long) st->utime_us,
+                        (unsigned long long) st->stime_us,
+                        (unsigned long long) st->minflt,
+                        (unsigned long long) st->majflt,
+                        (unsigned long long) st->exits, proc->restart_count);
+        }
+}
+
+#endif//__STATS_C
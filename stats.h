@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * stats.h - Per-service resource accounting
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+/* Sampling period bounds; the sampler backs off inside them on its own */
+#define STATS_INTERVAL_MIN_MS 1000
+#define STATS_INTERVAL_MAX_MS 16000
+/* Idle services are only sampled every Nth round */
+#define STATS_IDLE_SKIP_MAX 8
+/* The sampler keeps its own CPU use below this share, in parts per million */
+#define STATS_BUDGET_PPM 1000
+
+struct process;
+
+struct process_stats
+{
+        /* accumulated from wait4() over every exit */
+        uint64_t exits;
+        uint64_t utime_us;
+        uint64_t stime_us;
+        uint64_t minflt;
+        uint64_t majflt;
+        uint64_t maxrss_kb;
+        /* live sampling of the current instance */
+        uint64_t cpu_us;
+        uint64_t rss_kb;
+        uint64_t last_sample_ms;
+        uint32_t cpu_permille;
+        uint32_t idle_rounds;
+        uint32_t skip;
+};
+
+void stats_account_exit(struct process *proc, const struct rusage *ru);
+bool stats_sample_process(struct process *proc, uint64_t now_ms);
+bool stats_start_sampler();
+
+#endif//__STATS_H
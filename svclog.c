@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * svclog.c - Capture of the output of services
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __SVCLOG_C
+#define __SVCLOG_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "console.h"
+#include "evloop.h"
+#include "journal.h"
+#include "memstat.h"
+#include "proc.h"
+#include "svclog.h"
+
+static const char *svclog_name(struct process *proc)
+{
+        return proc->name != NULL ? proc->name : proc->exec_image;
+}
+
+/**
+ * @fn static void svclog_emit(struct process *proc, const char *line,
+ *                             size_t length)
+ * @brief Journals a line of a service and echoes it to the console
+ * @details A "<N>" prefix, as in sd-daemon(3), sets the priority of the
+ *          line and is stripped.
+ */
+MEM_HOT
+static void svclog_emit(struct process *proc, const char *line, size_t length)
+{
+        int priority = JOURNAL_PRIORITY_DEFAULT;
+
+        if (length >= 3 && line[0] == '<' && line[1] >= '0' &&
+            line[1] <= '7' && line[2] == '>') {
+                priority = line[1] - '0';
+                line += 3;
+                length -= 3;
+        }
+
+        journal_append(svclog_name(proc), priority, line, length);
+        console_printf(priority, "%s: %.*s\n", svclog_name(proc), (int) length,
+                       line);
+}
+
+/**
+ * @fn static void svclog_feed(struct process *proc, const char *data,
+ *                             size_t size)
+ * @brief Forwards the complete lines written by a service, prefixed with
+ *        its name
+ * @details Lines longer than SVCLOG_LINE_MAX are split.
+ */
+MEM_HOT
+static void svclog_feed(struct process *proc, const char *data, size_t size)
+{
+        struct svclog *log = &proc->log;
+        char *start = NULL;
+        char *newline = NULL;
+        size_t chunk = 0;
+        size_t left = 0;
+
+        while (size > 0) {
+                chunk = SVCLOG_LINE_MAX - log->length;
+                if (chunk > size) {
+                        chunk = size;
+                }
+                memcpy(log->line + log->length, data, chunk);
+                log->length += chunk;
+                data += chunk;
+                size -= chunk;
+
+                start = log->line;
+                left = log->length;
+                while ((newline = memchr(start, '\n', left)) != NULL) {
+                        svclog_emit(proc, start, (size_t) (newline - start));
+                        left -= (size_t) (newline - start) + 1;
+                        start = newline + 1;
+                }
+                if (left == SVCLOG_LINE_MAX) {
+                        svclog_emit(proc, start, left);
+                        left = 0;
+                }
+                memmove(log->line, start, left);
+                log->length = left;
+        }
+}
+
+MEM_HOT
+static void svclog_handle(int fd, const char *buffer, ssize_t length,
+                          void *data)
+{
+        (void) fd;
+        if (length > 0) {
+                svclog_feed(data, buffer, (size_t) length);
+        }
+}
+
+/**
+ * @fn static void svclog_drain(struct process *proc)
+ * @brief Reads whatever is left in the log pipe of proc, outside the loop
+ */
+static void svclog_drain(struct process *proc)
+{
+        char buffer[SVCLOG_LINE_MAX];
+        ssize_t ret = 0;
+
+        while ((ret = read(proc->log.read_fd, buffer, sizeof(buffer))) > 0) {
+                svclog_feed(proc, buffer, (size_t) ret);
+        }
+}
+
+/**
+ * @fn void svclog_init(struct svclog *log)
+ * @brief Initialises a service log without opening it
+ */
+void svclog_init(struct svclog *log)
+{
+        log->read_fd = -1;
+        log->write_fd = -1;
+        log->line = NULL;
+        log->length = 0;
+}
+
+/**
+ * @fn bool svclog_adopt(struct process *proc, int read_fd, int write_fd)
+ * @brief Makes an already open pipe the log of proc
+ * @param proc the process
+ * @param read_fd the end PID 1 reads from
+ * @param write_fd the end handed to the service
+ * @return true on success or false on failure
+ * @details Used directly when the pipe survived a re-exec of PID 1.
+ */
+bool svclog_adopt(struct process *proc, int read_fd, int write_fd)
+{
+        struct svclog *log = NULL;
+
+        if (proc == NULL || read_fd < 0 || write_fd < 0) {
+                return false;
+        }
+
+        log = &proc->log;
+        log->line = mem_malloc(MEM_LOGS, SVCLOG_LINE_MAX);
+        if (log->line == NULL) {
+                return false;
+        }
+
+        fcntl(read_fd, F_SETFD, FD_CLOEXEC);
+        fcntl(write_fd, F_SETFD, FD_CLOEXEC);
+        fcntl(read_fd, F_SETFL, O_NONBLOCK);
+        log->read_fd = read_fd;
+        log->write_fd = write_fd;
+        log->length = 0;
+
+        if (!evloop_add_reader(read_fd, svclog_handle, proc)) {
+                mem_free(MEM_LOGS, log->line);
+                svclog_init(log);
+                return false;
+        }
+
+        return true;
+}
+
+/**
+ * @fn bool svclog_open(struct process *proc)
+ * @brief Creates the log pipe of proc, if it has none yet
+ * @return true if proc has a log pipe
+ * @details Fails without the event loop, the output of the service then
+ *          goes straight to PID 1's own stdout and stderr.
+ */
+bool svclog_open(struct process *proc)
+{
+        int fds[2] = { -1, -1 };
+
+        if (proc == NULL) {
+                return false;
+        }
+
+        if (proc->log.read_fd != -1) {
+                return true;
+        }
+
+        if (pipe2(fds, O_CLOEXEC) != 0) {
+                return false;
+        }
+
+        if (!svclog_adopt(proc, fds[0], fds[1])) {
+                close(fds[0]);
+                close(fds[1]);
+                return false;
+        }
+
+        return true;
+}
+
+/**
+ * @fn void svclog_child(struct process *proc)
+ * @brief Points stdout and stderr of a forked child to its log pipe
+ * @details To be called in the child between fork() and execve().
+ */
+void svclog_child(struct process *proc)
+{
+        if (proc->log.write_fd == -1) {
+                return;
+        }
+
+        dup2(proc->log.write_fd, STDOUT_FILENO);
+        dup2(proc->log.write_fd, STDERR_FILENO);
+}
+
+/**
+ * @fn void svclog_close(struct process *proc)
+ * @brief Forwards what is left in the log of proc and closes it
+ */
+void svclog_close(struct process *proc)
+{
+        struct svclog *log = NULL;
+
+        if (proc == NULL || proc->log.read_fd == -1) {
+                return;
+        }
+
+        log = &proc->log;
+        evloop_del(log->read_fd);
+        svclog_drain(proc);
+        if (log->length > 0) {
+                svclog_emit(proc, log->line, log->length);
+        }
+
+        close(log->read_fd);
+        close(log->write_fd);
+        mem_free(MEM_LOGS, log->line);
+        svclog_init(log);
+}
+
+#endif//__SVCLOG_C
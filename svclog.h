@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * svclog.h - Capture of the output of services
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __SVCLOG_H
+#define __SVCLOG_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SVCLOG_LINE_MAX 1024
+
+struct process;
+
+/*
+ * Every non-console service writes its stdout and stderr into a pipe owned
+ * by PID 1. The pipe outlives the instances of the service, so output
+ * written while PID 1 is busy (or re-executing) just waits in the pipe.
+ */
+struct svclog
+{
+        int read_fd;
+        int write_fd;
+        char *line;
+        size_t length;
+};
+
+void svclog_init(struct svclog *log);
+bool svclog_open(struct process *proc);
+bool svclog_adopt(struct process *proc, int read_fd, int write_fd);
+void svclog_child(struct process *proc);
+void svclog_close(struct process *proc);
+
+#endif//__SVCLOG_H
@@ -0,0 +1,324 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * switchroot.c - Switching from the initramfs to the real root
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __SWITCHROOT_C
+#define __SWITCHROOT_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+#include <linux/limits.h>
+#include <linux/magic.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include "cyrenit.h"
+#include "kcmdline.h"
+#include "par.h"
+#include "switchroot.h"
+
+static const char *moved_mounts[] = { "/proc", "/sys", "/dev", "/run", NULL };
+
+struct free_ctx
+{
+        int root_fd;
+        dev_t root_dev;
+        atomic_size_t unlinked;
+        pthread_mutex_t dirs_lock;
+        char **dirs;
+        size_t dir_count;
+        size_t dir_allocated;
+};
+
+/**
+ * @fn struct mount_task *switch_root_task_from_cmdline()
+ * @brief Builds the mount_task of the real root from root=, rootfstype=,
+ *        rootflags= and ro/rw on the kernel command line
+ * @return the task or NULL if no root= was given (stay in the initramfs)
+ */
+struct mount_task *switch_root_task_from_cmdline()
+{
+        char root[PATH_MAX];
+        char fs_type[NAME_MAX];
+        char flags[KCMDLINE_MAX];
+        unsigned long mount_flags = MS_RDONLY;
+        bool has_flags = false;
+
+        if (!kcmdline_get("root", root, sizeof(root)) || *root == '\0') {
+                return NULL;
+        }
+
+        if (!kcmdline_get("rootfstype", fs_type, sizeof(fs_type))) {
+                strcpy(fs_type, SWITCH_ROOT_DEFAULT_FSTYPE);
+        }
+        has_flags = kcmdline_get("rootflags", flags, sizeof(flags));
+        if (kcmdline_has("rw")) {
+                mount_flags = 0;
+        }
+
+        return mount_task_create_ready(root, SWITCH_ROOT_MOUNTPOINT, fs_type,
+                                       mount_flags,
+                                       has_flags ? strlen(flags) + 1 : 0,
+                                       flags);
+}
+
+static bool free_ctx_add_dir(struct free_ctx *ctx, char *path)
+{
+        char **new_dirs = NULL;
+        size_t new_size = 0;
+
+        pthread_mutex_lock(&ctx->dirs_lock);
+        if (ctx->dir_count >= ctx->dir_allocated) {
+                new_size = ctx->dir_allocated ? ctx->dir_allocated * 2 : 64;
+                new_dirs = reallocarray(ctx->dirs, new_size, sizeof(char *));
+                if (new_dirs == NULL) {
+                        pthread_mutex_unlock(&ctx->dirs_lock);
+                        return false;
+                }
+                ctx->dirs = new_dirs;
+                ctx->dir_allocated = new_size;
+        }
+        ctx->dirs[ctx->dir_count++] = path;
+        pthread_mutex_unlock(&ctx->dirs_lock);
+
+        return true;
+}
+
+/**
+ * @fn static void free_dir(struct par_queue *q, void *item, void *ctx)
+ * @brief Unlinks every non-directory entry of a directory
+ * @details Subdirectories on the same filesystem are queued for the other
+ *          workers and remembered to be removed once empty. Anything on
+ *          another device (i.e. a mount point) is left alone.
+ */
+static void free_dir(struct par_queue *q, void *item, void *ctx)
+{
+        struct free_ctx *fc = ctx;
+        char *path = item;
+        char *child = NULL;
+        struct dirent *ent = NULL;
+        struct stat st;
+        DIR *dir = NULL;
+        int fd = -1;
+
+        fd = openat(fc->root_fd, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW |
+                    O_CLOEXEC);
+        if (fd == -1 || fstat(fd, &st) != 0 || st.st_dev != fc->root_dev) {
+                if (fd != -1) {
+                        close(fd);
+                }
+                free(path);
+                return;
+        }
+
+        dir = fdopendir(fd);
+        if (dir == NULL) {
+                close(fd);
+                free(path);
+                return;
+        }
+
+        while ((ent = readdir(dir)) != NULL) {
+                if (strcmp(ent->d_name, ".") == 0 ||
+                    strcmp(ent->d_name, "..") == 0) {
+                        continue;
+                }
+
+                if (ent->d_type == DT_UNKNOWN || ent->d_type == DT_DIR) {
+                        if (fstatat(fd, ent->d_name, &st,
+                                    AT_SYMLINK_NOFOLLOW) != 0) {
+                                continue;
+                        }
+                        if (S_ISDIR(st.st_mode)) {
+                                if (st.st_dev != fc->root_dev) {
+                                        continue; //do not cross filesystems
+                                }
+                                if (asprintf(&child, "%s/%s", path,
+                                             ent->d_name) < 0) {
+                                        continue;
+                                }
+                                if (!free_ctx_add_dir(fc, child)) {
+                                        free(child);
+                                        continue;
+                                }
+                                child = strdup(child);
+                                if (child != NULL && !par_push(q, child)) {
+                                        free(child);
+                                }
+                                continue;
+                        }
+                }
+
+                if (unlinkat(fd, ent->d_name, 0) == 0) {
+                        atomic_fetch_add(&fc->unlinked, 1);
+                }
+        }
+
+        closedir(dir);
+        free(path);
+}
+
+static int compare_depth(const void *a, const void *b)
+{
+        const char *pa = *(const char * const *) a;
+        const char *pb = *(const char * const *) b;
+        size_t da = 0;
+        size_t db = 0;
+
+        for (; *pa; pa++) {
+                da += *pa == '/';
+        }
+        for (; *pb; pb++) {
+                db += *pb == '/';
+        }
+
+        return da < db ? 1 : (da > db ? -1 : 0);
+}
+
+/**
+ * @fn size_t switch_root_free_initramfs(int root_fd)
+ * @brief Deletes the contents of the initramfs to give its RAM back
+ * @param root_fd an open directory fd of the old (initramfs) root
+ * @return the number of entries removed
+ * @details Files are unlinked by par_workers() threads walking the tree in
+ *          parallel, directories are removed deepest first afterwards. The
+ *          walk refuses anything that is not a ramfs/tmpfs and never
+ *          crosses into other filesystems.
+ */
+size_t switch_root_free_initramfs(int root_fd)
+{
+        struct free_ctx ctx;
+        struct statfs sfs;
+        struct stat st;
+        void *start[1];
+        size_t removed = 0;
+        size_t i = 0;
+
+        if (fstatfs(root_fd, &sfs) != 0 || fstat(root_fd, &st) != 0) {
+                return 0;
+        }
+        if (sfs.f_type != RAMFS_MAGIC && sfs.f_type != TMPFS_MAGIC) {
+                fprintf(stderr, "cyrenit: old root is not an initramfs, "
+                        "not freeing it\n");
+                return 0;
+        }
+
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.root_fd = root_fd;
+        ctx.root_dev = st.st_dev;
+        atomic_init(&ctx.unlinked, 0);
+        pthread_mutex_init(&ctx.dirs_lock, NULL);
+
+        start[0] = strdup(".");
+        if (start[0] == NULL) {
+                return 0;
+        }
+        par_run(free_dir, &ctx, start, 1, par_workers());
+
+        qsort(ctx.dirs, ctx.dir_count, sizeof(char *), compare_depth);
+        for (i = 0; i < ctx.dir_count; i++) {
+                if (unlinkat(root_fd, ctx.dirs[i], AT_REMOVEDIR) == 0) {
+                        removed++;
+                }
+                free(ctx.dirs[i]);
+        }
+        free(ctx.dirs);
+        pthread_mutex_destroy(&ctx.dirs_lock);
+
+        return removed + atomic_load(&ctx.unlinked);
+}
+
+/**
+ * @fn bool switch_root(struct mount_task *root_task)
+ * @brief Mounts the real root, moves the API filesystems into it, makes
+ *        it the root and frees the initramfs
+ * @param root_task the mount_task of the real root, whose target is the
+ *        temporary mount point
+ * @return true when running on the new root, false if still on the
+ *         initramfs
+ * @details PID 1 keeps running (and supervising) from memory; nothing is
+ *          exec'd. The initramfs is emptied after the chroot through a
+ *          directory fd kept open on it, and only the mount tasks of what
+ *          was moved stay in the list, for the real root's fstab to join.
+ */
+bool switch_root(struct mount_task *root_task)
+{
+        char path[PATH_MAX];
+        const char **mnt = NULL;
+        const char *newroot = NULL;
+        size_t freed = 0;
+        int root_fd = -1;
+
+        if (root_task == NULL) {
+                return false;
+        }
+        newroot = root_task->target;
+
+        if (mkdir(newroot, 0755) != 0 && errno != EEXIST) {
+                perror("cyrenit: failed to create the new root mount point");
+                return false;
+        }
+        if (!mount_task_mount(root_task)) {
+                return false;
+        }
+
+        for (mnt = moved_mounts; *mnt != NULL; mnt++) {
+                snprintf(path, sizeof(path), "%s%s", newroot, *mnt);
+                mkdir(path, 0755);
+                if (mount(*mnt, path, NULL, MS_MOVE, NULL) != 0) {
+                        fprintf(stderr, "cyrenit: failed to move %s to %s: "
+                                "%s\n", *mnt, path, strerror(errno));
+                        umount2(path, MNT_DETACH);
+                }
+        }
+
+        root_fd = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (chdir(newroot) != 0 ||
+            mount(newroot, "/", NULL, MS_MOVE, NULL) != 0) {
+                perror("cyrenit: failed to switch to the new root");
+                chdir("/");
+                for (mnt = moved_mounts; *mnt != NULL; mnt++) {
+                        snprintf(path, sizeof(path), "%s%s", newroot, *mnt);
+                        mount(path, *mnt, NULL, MS_MOVE, NULL);
+                }
+                umount2(newroot, MNT_DETACH);
+                if (root_fd != -1) {
+                        close(root_fd);
+                }
+                return false;
+        }
+        if (chroot(".") != 0 || chdir("/") != 0) {
+                perror("cyrenit: failed to chroot into the new root");
+        }
+
+        fprintf(stdout, "cyrenit: switched root to %s\n", root_task->source);
+        fprintf(stdout, "cyrenit: dropped %zu mount tasks of the initramfs\n",
+                mounts_retain(moved_mounts));
+
+        if (root_fd != -1) {
+                freed = switch_root_free_initramfs(root_fd);
+                close(root_fd);
+                fprintf(stdout, "cyrenit: freed %zu initramfs entries\n",
+                        freed);
+        }
+
+        return true;
+}
+
+#endif//__SWITCHROOT_C
@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * switchroot.h - Switching from the initramfs to the real root
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __SWITCHROOT_H
+#define __SWITCHROOT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "mounts.h"
+
+#define SWITCH_ROOT_MOUNTPOINT "/new_root"
+#define SWITCH_ROOT_DEFAULT_FSTYPE "ext4"
+
+struct mount_task *switch_root_task_from_cmdline();
+bool switch_root(struct mount_task *root_task);
+size_t switch_root_free_initramfs(int root_fd);
+
+#endif//__SWITCHROOT_H
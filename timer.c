@@ -0,0 +1,496 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * timer.c - Hierarchical timer wheel for supervisor timeouts
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __TIMER_C
+#define __TIMER_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sys/timerfd.h>
+
+#include "memstat.h"
+#include "timer.h"
+
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_SEC 1000000000ULL
+#define TIMER_NEVER UINT64_MAX
+
+/**
+ * @var struct timer_wheel supervisor_timers
+ * @brief The timer wheel driving every supervisor timeout
+ */
+struct timer_wheel supervisor_timers = { .fd = -1 };
+
+static inline unsigned timer_shift(unsigned level)
+{
+        return level == 0 ? 0 : TIMER_L0_BITS + (level - 1) * TIMER_LN_BITS;
+}
+
+static uint64_t timer_monotonic_ns()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * NSEC_PER_SEC + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * @fn static int timer_l0_next_set(struct timer_wheel *w, unsigned from)
+ * @brief Finds the first occupied level 0 slot at or after from
+ * @return the slot index or -1 if none of [from, TIMER_L0_SIZE) is occupied
+ */
+static int timer_l0_next_set(struct timer_wheel *w, unsigned from)
+{
+        unsigned word = from / 64;
+        uint64_t bits = 0;
+
+        if (from >= TIMER_L0_SIZE) {
+                return -1;
+        }
+
+        bits = w->l0_map[word] & (~0ULL << (from % 64));
+        while (true) {
+                if (bits != 0) {
+                        return (int) (word * 64 + __builtin_ctzll(bits));
+                }
+                if (++word >= TIMER_L0_SIZE / 64) {
+                        return -1;
+                }
+                bits = w->l0_map[word];
+        }
+}
+
+static void timer_enqueue(struct timer_wheel *w, struct timer *t)
+{
+        struct timer_slot *slot = NULL;
+        uint64_t delta = 0;
+        unsigned level = 0;
+        unsigned index = 0;
+
+        if (t->expires < w->current) {
+                t->expires = w->current;
+        }
+        delta = t->expires - w->current;
+
+        if (delta < TIMER_L0_SIZE) {
+                index = t->expires & (TIMER_L0_SIZE - 1);
+                slot = &w->l0[index];
+                w->l0_map[index / 64] |= 1ULL << (index % 64);
+        }
+        else {
+                level = 1;
+                while (level < TIMER_LEVELS - 1 &&
+                       delta >= 1ULL << timer_shift(level + 1)) {
+                        level++;
+                }
+                index = (t->expires >> timer_shift(level)) &
+                        (TIMER_LN_SIZE - 1);
+                slot = &w->ln[level - 1][index];
+                w->ln_map[level - 1] |= 1ULL << index;
+        }
+
+        t->level = (uint8_t) level;
+        t->slot = (uint16_t) index;
+        t->next = slot->head;
+        if (slot->head != NULL) {
+                slot->head->pprev = &t->next;
+        }
+        slot->head = t;
+        t->pprev = &slot->head;
+        t->wheel = w;
+}
+
+static void timer_unlink(struct timer_wheel *w, struct timer *t)
+{
+        *t->pprev = t->next;
+        if (t->next != NULL) {
+                t->next->pprev = t->pprev;
+        }
+
+        if (t->level == 0 && w->l0[t->slot].head == NULL) {
+                w->l0_map[t->slot / 64] &= ~(1ULL << (t->slot % 64));
+        }
+        else if (t->level > 0 && w->ln[t->level - 1][t->slot].head == NULL) {
+                w->ln_map[t->level - 1] &= ~(1ULL << t->slot);
+        }
+
+        t->next = NULL;
+        t->pprev = NULL;
+        t->wheel = NULL;
+}
+
+/**
+ * @fn static bool timer_cascade(struct timer_wheel *w, unsigned level)
+ * @brief Moves the current slot of level down to the lower levels
+ * @return true if the level also wrapped and the next one must cascade
+ */
+static bool timer_cascade(struct timer_wheel *w, unsigned level)
+{
+        unsigned index = (w->current >> timer_shift(level)) &
+                         (TIMER_LN_SIZE - 1);
+        struct timer_slot *slot = &w->ln[level - 1][index];
+        struct timer *list = slot->head;
+        struct timer *t = NULL;
+
+        slot->head = NULL;
+        w->ln_map[level - 1] &= ~(1ULL << index);
+
+        while (list != NULL) {
+                t = list;
+                list = t->next;
+                timer_enqueue(w, t);
+        }
+
+        return index == 0;
+}
+
+static void timer_rearm(struct timer_wheel *w)
+{
+        struct itimerspec its;
+        uint64_t next = 0;
+        uint64_t when = 0;
+
+        if (w->fd < 0 || w->running) {
+                return;
+        }
+
+        memset(&its, 0, sizeof(its));
+        if (!timer_wheel_next(w, &next)) {
+                if (w->armed_tick != TIMER_NEVER) {
+                        timerfd_settime(w->fd, TFD_TIMER_ABSTIME, &its, NULL);
+                        w->armed_tick = TIMER_NEVER;
+                }
+                return;
+        }
+
+        if (next == w->armed_tick) {
+                return;
+        }
+
+        when = w->base_ns + next * NSEC_PER_MSEC;
+        its.it_value.tv_sec = (time_t) (when / NSEC_PER_SEC);
+        its.it_value.tv_nsec = (long) (when % NSEC_PER_SEC);
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+                its.it_value.tv_nsec = 1; //zero would disarm
+        }
+
+        if (timerfd_settime(w->fd, TFD_TIMER_ABSTIME, &its, NULL) != 0) {
+                perror("cyrenit: failed to arm timerfd");
+                return;
+        }
+        w->armed_tick = next;
+}
+
+/**
+ * @fn bool timer_wheel_init(struct timer_wheel *w, bool use_timerfd)
+ * @brief Initializes an empty timer wheel
+ * @param w the wheel to be initialized
+ * @param use_timerfd whether the wheel should own a timerfd to be polled
+ * @return true on success or false on failure
+ * @details Without a timerfd the owner must call timer_wheel_advance()
+ *          on its own, which is how the benchmarks drive the wheel.
+ */
+bool timer_wheel_init(struct timer_wheel *w, bool use_timerfd)
+{
+        if (w == NULL) {
+                return false;
+        }
+
+        memset(w, 0, sizeof(struct timer_wheel));
+        w->fd = -1;
+        w->armed_tick = TIMER_NEVER;
+        w->base_ns = timer_monotonic_ns();
+
+        if (use_timerfd) {
+                w->fd = timerfd_create(CLOCK_MONOTONIC,
+                                       TFD_NONBLOCK | TFD_CLOEXEC);
+                if (w->fd == -1) {
+                        perror("cyrenit: failed to create timerfd");
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+/**
+ * @fn void timer_wheel_release(struct timer_wheel *w)
+ * @brief Detaches every pending timer and closes the timerfd
+ * @param w the wheel to be released
+ */
+void timer_wheel_release(struct timer_wheel *w)
+{
+        struct timer *t = NULL;
+        size_t i = 0;
+        size_t j = 0;
+
+        if (w == NULL) {
+                return;
+        }
+
+        for (i = 0; i < TIMER_L0_SIZE; i++) {
+                while ((t = w->l0[i].head) != NULL) {
+                        timer_unlink(w, t);
+                }
+        }
+        for (i = 0; i < TIMER_LEVELS - 1; i++) {
+                for (j = 0; j < TIMER_LN_SIZE; j++) {
+                        while ((t = w->ln[i][j].head) != NULL) {
+                                timer_unlink(w, t);
+                        }
+                }
+        }
+
+        if (w->fd != -1) {
+                close(w->fd);
+                w->fd = -1;
+        }
+        w->pending = 0;
+}
+
+/**
+ * @fn uint64_t timer_wheel_now(struct timer_wheel *w)
+ * @brief Returns the current time in wheel ticks (milliseconds)
+ */
+uint64_t timer_wheel_now(struct timer_wheel *w)
+{
+        return (timer_monotonic_ns() - w->base_ns) / NSEC_PER_MSEC;
+}
+
+/**
+ * @fn void timer_wheel_advance(struct timer_wheel *w, uint64_t now)
+ * @brief Runs every timer that expired up to (and including) tick now
+ * @param w the timer wheel
+ * @param now the tick to advance to
+ * @details Callbacks run with the timer already detached, so they are free
+ *          to re-arm it. Runs of empty level 0 slots are skipped at once.
+ */
+MEM_HOT
+void timer_wheel_advance(struct timer_wheel *w, uint64_t now)
+{
+        struct timer *list = NULL;
+        struct timer *t = NULL;
+        unsigned index = 0;
+        unsigned level = 0;
+        int next_set = 0;
+        uint64_t jump = 0;
+
+        while (w->current <= now) {
+                index = w->current & (TIMER_L0_SIZE - 1);
+                if (index == 0) {
+                        for (level = 1; level < TIMER_LEVELS; level++) {
+                                if (!timer_cascade(w, level)) {
+                                        break;
+                                }
+                        }
+                }
+
+                list = w->l0[index].head;
+                w->l0[index].head = NULL;
+                w->l0_map[index / 64] &= ~(1ULL << (index % 64));
+                w->current++;
+
+                while (list != NULL) {
+                        t = list;
+                        list = t->next;
+                        t->next = NULL;
+                        t->pprev = NULL;
+                        t->wheel = NULL;
+                        w->pending--;
+                        if (t->callback != NULL) {
+                                t->callback(t, t->data);
+                        }
+                }
+
+                index = w->current & (TIMER_L0_SIZE - 1);
+                if (index == 0 || w->current > now) {
+                        continue;
+                }
+
+                next_set = timer_l0_next_set(w, index);
+                if (next_set < 0) {
+                        jump = (w->current | (TIMER_L0_SIZE - 1)) + 1;
+                }
+                else {
+                        jump = w->current - index + (unsigned) next_set;
+                }
+                w->current = jump < now + 1 ? jump : now + 1;
+        }
+}
+
+/**
+ * @fn bool timer_wheel_next(struct timer_wheel *w, uint64_t *next)
+ * @brief Finds the next tick at which the wheel has work to do
+ * @param w the timer wheel
+ * @param next where to store the tick
+ * @return false if no timer is pending
+ * @details Level 0 slots hold exact expiries. For the upper levels the
+ *          tick returned is when their next occupied slot cascades, which
+ *          is never later than the timers it holds.
+ */
+bool timer_wheel_next(struct timer_wheel *w, uint64_t *next)
+{
+        uint64_t best = TIMER_NEVER;
+        uint64_t candidate = 0;
+        uint64_t map = 0;
+        unsigned index = 0;
+        unsigned level = 0;
+        unsigned shift = 0;
+        unsigned dist = 0;
+        int set = 0;
+
+        if (w == NULL || w->pending == 0) {
+                return false;
+        }
+
+        index = w->current & (TIMER_L0_SIZE - 1);
+        set = timer_l0_next_set(w, index);
+        if (set >= 0) {
+                best = w->current + (unsigned) set - index;
+        }
+        else if ((set = timer_l0_next_set(w, 0)) >= 0) {
+                best = w->current + TIMER_L0_SIZE - index + (unsigned) set;
+        }
+
+        for (level = 1; level < TIMER_LEVELS; level++) {
+                map = w->ln_map[level - 1];
+                if (map == 0) {
+                        continue;
+                }
+                shift = timer_shift(level);
+                index = (w->current >> shift) & (TIMER_LN_SIZE - 1);
+                /* rotate so bit 0 is the slot right after the current one */
+                index = (index + 1) % TIMER_LN_SIZE;
+                map = (map >> index) | (index ? map << (64 - index) : 0);
+                dist = (unsigned) __builtin_ctzll(map) + 1;
+                candidate = ((w->current >> shift) + dist) << shift;
+                if (candidate < best) {
+                        best = candidate;
+                }
+        }
+
+        *next = best;
+        return best != TIMER_NEVER;
+}
+
+/**
+ * @fn void timer_wheel_handle(struct timer_wheel *w)
+ * @brief Handles a timerfd expiration: runs due timers and re-arms the fd
+ * @param w the timer wheel
+ */
+MEM_HOT
+void timer_wheel_handle(struct timer_wheel *w)
+{
+        uint64_t expirations = 0;
+
+        if (w->fd != -1) {
+                if (read(w->fd, &expirations, sizeof(expirations)) < 0) {
+                        expirations = 0; //spurious wakeup, EAGAIN
+                }
+        }
+
+        w->running = true;
+        w->armed_tick = TIMER_NEVER;
+        timer_wheel_advance(w, timer_wheel_now(w));
+        w->running = false;
+
+        timer_rearm(w);
+}
+
+/**
+ * @fn void timer_init(struct timer *t, timer_cb callback, void *data)
+ * @brief Initializes a disarmed timer
+ * @param t the timer
+ * @param callback called when the timer expires
+ * @param data opaque pointer handed to callback
+ */
+void timer_init(struct timer *t, timer_cb callback, void *data)
+{
+        if (t == NULL) {
+                return;
+        }
+
+        memset(t, 0, sizeof(struct timer));
+        t->callback = callback;
+        t->data = data;
+}
+
+/**
+ * @fn void timer_add(struct timer_wheel *w, struct timer *t, uint64_t ms,
+ *                    enum timer_resolution res)
+ * @brief Arms t to expire ms milliseconds from now
+ * @param w the timer wheel
+ * @param t the timer, re-armed if already pending
+ * @param ms the timeout in milliseconds
+ * @param res TIMER_FINE for millisecond precision or TIMER_COARSE to round
+ *            the expiry up so that coarse timers share wakeups
+ * @details O(1): the timer is linked into a single slot and the timerfd is
+ *          only touched when the new expiry is earlier than the armed one.
+ */
+void timer_add(struct timer_wheel *w, struct timer *t, uint64_t ms,
+               enum timer_resolution res)
+{
+        uint64_t now = 0;
+
+        if (w == NULL || t == NULL) {
+                return;
+        }
+
+        timer_cancel(t);
+
+        if (ms > TIMER_MAX_TICKS) {
+                ms = TIMER_MAX_TICKS;
+        }
+
+        now = w->fd != -1 ? timer_wheel_now(w) : w->current;
+        if (now < w->current) {
+                now = w->current;
+        }
+        t->expires = now + ms;
+        if (res == TIMER_COARSE) {
+                t->expires = (t->expires + TIMER_COARSE_TICKS - 1) &
+                             ~((uint64_t) TIMER_COARSE_TICKS - 1);
+        }
+
+        timer_enqueue(w, t);
+        w->pending++;
+
+        if (w->fd != -1 && !w->running && t->expires < w->armed_tick) {
+                timer_rearm(w);
+        }
+}
+
+/**
+ * @fn void timer_cancel(struct timer *t)
+ * @brief Disarms t if it is pending, O(1)
+ * @param t the timer
+ * @details The timerfd is left armed; an early wakeup finds nothing due
+ *          and re-arms for the real next expiry.
+ */
+void timer_cancel(struct timer *t)
+{
+        struct timer_wheel *w = NULL;
+
+        if (t == NULL || t->wheel == NULL) {
+                return;
+        }
+
+        w = t->wheel;
+        timer_unlink(w, t);
+        w->pending--;
+}
+
+#endif//__TIMER_C
@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * timer.h - Hierarchical timer wheel for supervisor timeouts
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __TIMER_H
+#define __TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * The wheel ticks in milliseconds. Level 0 has 256 slots of one tick each,
+ * every further level has 64 slots, each covering a full rotation of the
+ * level below it. Five levels cover 2^32 ms (~49 days); longer timeouts are
+ * clamped to that.
+ */
+#define TIMER_L0_BITS 8
+#define TIMER_LN_BITS 6
+#define TIMER_L0_SIZE (1 << TIMER_L0_BITS)
+#define TIMER_LN_SIZE (1 << TIMER_LN_BITS)
+#define TIMER_LEVELS 5
+#define TIMER_MAX_TICKS 0xffffffffULL
+
+/* Coarse timers are rounded up to a full level 0 rotation (256 ms) */
+#define TIMER_COARSE_TICKS TIMER_L0_SIZE
+
+enum timer_resolution
+{
+        TIMER_FINE = 0,
+        TIMER_COARSE
+};
+
+struct timer;
+typedef void (*timer_cb)(struct timer *t, void *data);
+
+struct timer
+{
+        struct timer *next;
+        struct timer **pprev;
+        struct timer_wheel *wheel;
+        uint64_t expires;
+        uint16_t slot;
+        uint8_t level;
+        timer_cb callback;
+        void *data;
+};
+
+struct timer_slot
+{
+        struct timer *head;
+};
+
+struct timer_wheel
+{
+        uint64_t current;
+        uint64_t base_ns;
+        uint64_t armed_tick;
+        size_t pending;
+        int fd;
+        bool running;
+        struct timer_slot l0[TIMER_L0_SIZE];
+        struct timer_slot ln[TIMER_LEVELS - 1][TIMER_LN_SIZE];
+        uint64_t l0_map[TIMER_L0_SIZE / 64];
+        uint64_t ln_map[TIMER_LEVELS - 1];
+};
+
+extern struct timer_wheel supervisor_timers;
+
+bool timer_wheel_init(struct timer_wheel *w, bool use_timerfd);
+void timer_wheel_release(struct timer_wheel *w);
+uint64_t timer_wheel_now(struct timer_wheel *w);
+void timer_wheel_advance(struct timer_wheel *w, uint64_t now);
+bool timer_wheel_next(struct timer_wheel *w, uint64_t *next);
+void timer_wheel_handle(struct timer_wheel *w);
+
+void timer_init(struct timer *t, timer_cb callback, void *data);
+void timer_add(struct timer_wheel *w, struct timer *t, uint64_t ms,
+               enum timer_resolution res);
+void timer_cancel(struct timer *t);
+
+static inline bool timer_is_armed(const struct timer *t)
+{
+        return t == NULL ? false : t->wheel != NULL;
+}
+
+#endif//__TIMER_H
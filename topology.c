@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * topology.c - CPU and NUMA topology discovery
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __TOPOLOGY_C
+#define __TOPOLOGY_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <linux/limits.h>
+
+#include "topology.h"
+
+#define TOPOLOGY_LIST_MAX 4096
+
+/**
+ * @var struct cpu_topology topology
+ * @brief The topology of the machine, filled by topology_load()
+ */
+struct cpu_topology topology;
+
+static bool topology_read_list(const char *path, char *buffer, size_t size)
+{
+        FILE *f = NULL;
+        bool ok = false;
+
+        f = fopen(path, "re");
+        if (f == NULL) {
+                return false;
+        }
+
+        ok = fgets(buffer, (int) size, f) != NULL;
+        fclose(f);
+
+        return ok;
+}
+
+/**
+ * @fn static bool topology_parse_ranges(const char *list, unsigned max,
+ *                                       void (*set)(unsigned, void *),
+ *                                       void *data)
+ * @brief Walks a sysfs style list such as "0-3,8,10-11"
+ * @return false on syntax errors or values of max and above
+ */
+static bool topology_parse_ranges(const char *list, unsigned max,
+                                  void (*set)(unsigned, void *), void *data)
+{
+        const char *ptr = list;
+        char *end = NULL;
+        unsigned long first = 0;
+        unsigned long last = 0;
+        unsigned long i = 0;
+
+        while (*ptr != '\0' && *ptr != '\n') {
+                first = strtoul(ptr, &end, 10);
+                if (end == ptr) {
+                        return false;
+                }
+                last = first;
+                ptr = end;
+                if (*ptr == '-') {
+                        ptr++;
+                        last = strtoul(ptr, &end, 10);
+                        if (end == ptr) {
+                                return false;
+                        }
+                        ptr = end;
+                }
+                if (last < first || last >= max) {
+                        return false;
+                }
+
+                for (i = first; i <= last; i++) {
+                        set((unsigned) i, data);
+                }
+
+                if (*ptr == ',') {
+                        ptr++;
+                }
+                else if (*ptr != '\0' && *ptr != '\n') {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+static void topology_set_cpu(unsigned cpu, void *data)
+{
+        CPU_SET(cpu, (cpu_set_t *) data);
+}
+
+static void topology_set_node(unsigned node, void *data)
+{
+        *(uint64_t *) data |= 1ULL << node;
+}
+
+/**
+ * @fn bool topology_parse_cpulist(const char *list, cpu_set_t *set)
+ * @brief Parses a CPU list such as "0-3,8" into set
+ * @return true on success or false on a malformed list
+ */
+bool topology_parse_cpulist(const char *list, cpu_set_t *set)
+{
+        CPU_ZERO(set);
+        return topology_parse_ranges(list, CPU_SETSIZE, topology_set_cpu, set);
+}
+
+/**
+ * @fn bool topology_parse_nodelist(const char *list, uint64_t *mask)
+ * @brief Parses a NUMA node list such as "0-1" into a node mask
+ * @return true on success or false on a malformed list
+ */
+bool topology_parse_nodelist(const char *list, uint64_t *mask)
+{
+        *mask = 0;
+        return topology_parse_ranges(list, TOPOLOGY_MAX_NODES,
+                                     topology_set_node, mask);
+}
+
+/**
+ * @fn size_t topology_format_cpulist(const cpu_set_t *set, char *buffer,
+ *                                    size_t size)
+ * @brief Formats set back into the "0-3,8" list syntax
+ * @return the length of the list, truncated to fit size
+ */
+size_t topology_format_cpulist(const cpu_set_t *set, char *buffer,
+                               size_t size)
+{
+        size_t length = 0;
+        unsigned first = 0;
+        unsigned cpu = 0;
+        int ret = 0;
+
+        buffer[0] = '\0';
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (!CPU_ISSET(cpu, set)) {
+                        continue;
+                }
+                first = cpu;
+                while (cpu + 1 < CPU_SETSIZE && CPU_ISSET(cpu + 1, set)) {
+                        cpu++;
+                }
+
+                if (first == cpu) {
+                        ret = snprintf(buffer + length, size - length,
+                                       "%s%u", length ? "," : "", cpu);
+                }
+                else {
+                        ret = snprintf(buffer + length, size - length,
+                                       "%s%u-%u", length ? "," : "", first,
+                                       cpu);
+                }
+                if (ret < 0 || (size_t) ret >= size - length) {
+                        break;
+                }
+                length += (size_t) ret;
+        }
+
+        return length;
+}
+
+/**
+ * @fn bool topology_load()
+ * @brief Reads the online CPUs and NUMA nodes from sysfs
+ * @return true on success or false if even the CPUs are unknown
+ * @details Later calls are no-ops, the topology is only read at boot.
+ */
+bool topology_load()
+{
+        char path[PATH_MAX];
+        char list[TOPOLOGY_LIST_MAX];
+        unsigned node = 0;
+
+        if (topology.loaded) {
+                return true;
+        }
+
+        memset(&topology, 0, sizeof(topology));
+        if (!topology_read_list(TOPOLOGY_SYS_CPU "/online", list,
+                                sizeof(list)) ||
+            !topology_parse_cpulist(list, &topology.online)) {
+                /* no sysfs: at least what we may run on */
+                if (sched_getaffinity(0, sizeof(cpu_set_t),
+                                      &topology.online) != 0) {
+                        return false;
+                }
+        }
+        topology.cpu_count = (unsigned) CPU_COUNT(&topology.online);
+
+        if (!topology_read_list(TOPOLOGY_SYS_NODE "/online", list,
+                                sizeof(list)) ||
+            !topology_parse_nodelist(list, &topology.node_mask) ||
+            topology.node_mask == 0) {
+                topology.node_mask = 1;
+        }
+
+        for (node = 0; node < TOPOLOGY_MAX_NODES; node++) {
+                if (!(topology.node_mask & (1ULL << node))) {
+                        continue;
+                }
+                topology.node_count++;
+
+                snprintf(path, sizeof(path), TOPOLOGY_SYS_NODE
+                         "/node%u/cpulist", node);
+                if (!topology_read_list(path, list, sizeof(list)) ||
+                    !topology_parse_cpulist(list, &topology.node_cpus[node])) {
+                        topology.node_cpus[node] = topology.online;
+                }
+        }
+
+        topology.loaded = true;
+        return true;
+}
+
+#endif//__TOPOLOGY_C
@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * topology.h - CPU and NUMA topology discovery
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __TOPOLOGY_H
+#define __TOPOLOGY_H
+
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TOPOLOGY_SYS_CPU "/sys/devices/system/cpu"
+#define TOPOLOGY_SYS_NODE "/sys/devices/system/node"
+/* Node masks are a single word, as handed to set_mempolicy(2) */
+#define TOPOLOGY_MAX_NODES 64
+
+/*
+ * Read once from sysfs at boot. Machines without NUMA support report a
+ * single node 0 holding every online CPU.
+ */
+struct cpu_topology
+{
+        cpu_set_t online;
+        unsigned cpu_count;
+        uint64_t node_mask;
+        unsigned node_count;
+        cpu_set_t node_cpus[TOPOLOGY_MAX_NODES];
+        bool loaded;
+};
+
+extern struct cpu_topology topology;
+
+bool topology_load();
+bool topology_parse_cpulist(const char *list, cpu_set_t *set);
+bool topology_parse_nodelist(const char *list, uint64_t *mask);
+size_t topology_format_cpulist(const cpu_set_t *set, char *buffer,
+                               size_t size);
+
+#endif//__TOPOLOGY_H
@@ -0,0 +1,508 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * uevent.c - Kernel device events, device waits and coldplug
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __UEVENT_C
+#define __UEVENT_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include <linux/limits.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+
+#include "control.h"
+#include "cyrenit.h"
+#include "evloop.h"
+#include "kcmdline.h"
+#include "memstat.h"
+#include "par.h"
+#include "uevent.h"
+
+/* the kernel's own multicast group, as opposed to udev's */
+#define UEVENT_GROUP_KERNEL 1
+#define UEVENT_WAIT_ALLOC_STEP 8
+
+static int uevent_socket = -1;
+static struct uevent_wait **uevent_waits = NULL;
+static size_t uevent_wait_count = 0;
+static size_t uevent_wait_allocated = 0;
+static uint64_t uevent_events = 0;
+static uint64_t uevent_overruns = 0;
+static size_t uevent_coldplugged = 0;
+
+static void uevent_command(int argc, char **argv,
+                           struct control_reply *reply);
+
+/**
+ * @fn bool uevent_device_present(const char *device)
+ * @brief Tells whether a device, named as in uevent.h, exists
+ * @details Anything that names no device in either way (UUID=... and the
+ *          like) cannot be waited for and is taken as present.
+ */
+bool uevent_device_present(const char *device)
+{
+        char path[PATH_MAX];
+        const char *name = strchr(device, ':');
+        const char *c = NULL;
+
+        if (strncmp(device, "/dev/", 5) == STRCMP_EQUAL) {
+                return access(device, F_OK) == 0;
+        }
+        if (name == NULL || name == device || name[1] == '\0') {
+                return true;
+        }
+        for (c = device; c < name; c++) {
+                if (!isalnum((unsigned char) *c) && *c != '_') {
+                        return true;
+                }
+        }
+
+        snprintf(path, sizeof(path), UEVENT_CLASS_DIR "/%.*s/%s",
+                 (int) (name - device), device, name + 1);
+        return access(path, F_OK) == 0;
+}
+
+/**
+ * @fn bool uevent_open()
+ * @brief Opens the uevent socket, if it is not open yet
+ * @details Events are queued in the socket from here on, until
+ *          uevent_init() hands it to the event loop.
+ */
+bool uevent_open()
+{
+        struct sockaddr_nl addr;
+        int size = UEVENT_RCVBUF;
+
+        if (uevent_socket != -1) {
+                return true;
+        }
+
+        uevent_socket = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK |
+                               SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+        if (uevent_socket == -1) {
+                perror("cyrenit: failed to create the uevent socket");
+                return false;
+        }
+
+        /* past rmem_max only with CAP_NET_ADMIN */
+        if (setsockopt(uevent_socket, SOL_SOCKET, SO_RCVBUFFORCE, &size,
+                       sizeof(size)) != 0) {
+                setsockopt(uevent_socket, SOL_SOCKET, SO_RCVBUF, &size,
+                           sizeof(size));
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = UEVENT_GROUP_KERNEL;
+        if (bind(uevent_socket, (struct sockaddr *) &addr,
+                 sizeof(addr)) != 0) {
+                perror("cyrenit: failed to bind the uevent socket");
+                close(uevent_socket);
+                uevent_socket = -1;
+                return false;
+        }
+
+        return true;
+}
+
+static void uevent_wait_free(struct uevent_wait *wait)
+{
+        timer_cancel(&wait->timeout);
+        mem_free(MEM_EVENTS, wait->device);
+        mem_free(MEM_EVENTS, wait);
+}
+
+static void uevent_wait_remove(size_t index)
+{
+        memmove(&uevent_waits[index], &uevent_waits[index + 1],
+                (uevent_wait_count - index - 1) * sizeof(struct uevent_wait *));
+        uevent_wait_count--;
+}
+
+/* Takes the wait out before calling it, fn may wait again */
+static void uevent_wait_fire(size_t index, bool present)
+{
+        struct uevent_wait *wait = uevent_waits[index];
+
+        uevent_wait_remove(index);
+        timer_cancel(&wait->timeout);
+        wait->fn(wait->device, present, wait->data);
+        uevent_wait_free(wait);
+}
+
+static void uevent_check_waits()
+{
+        size_t i = 0;
+
+        while (i < uevent_wait_count) {
+                if (!uevent_device_present(uevent_waits[i]->device)) {
+                        i++;
+                        continue;
+                }
+                uevent_wait_fire(i, true);
+                i = 0; // the callback may have changed the list
+        }
+}
+
+/* "remove@/devices/..." changes nothing a wait is looking for */
+static bool uevent_is_remove(const char *message)
+{
+        return strncmp(message, "remove@", 7) == STRCMP_EQUAL;
+}
+
+/**
+ * @fn static void uevent_handle(int fd, uint32_t events, void *data)
+ * @brief Drains the uevent socket and checks the waits again
+ * @details Messages not sent by the kernel itself are dropped. When the
+ *          socket overran, events were lost and every wait is checked.
+ */
+static void uevent_handle(int fd, uint32_t events, void *data)
+{
+        char message[UEVENT_MSG_MAX + 1];
+        struct sockaddr_nl addr;
+        struct iovec iov = { message, UEVENT_MSG_MAX };
+        struct msghdr msg;
+        bool check = false;
+        ssize_t length = 0;
+
+        (void) events;
+        (void) data;
+
+        for (;;) {
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_name = &addr;
+                msg.msg_namelen = sizeof(addr);
+                msg.msg_iov = &iov;
+                msg.msg_iovlen = 1;
+
+                length = recvmsg(fd, &msg, MSG_DONTWAIT);
+                if (length < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (length < 0 && errno == ENOBUFS) {
+                        uevent_overruns++;
+                        check = true;
+                        continue;
+                }
+                if (length <= 0) {
+                        break;
+                }
+                if (addr.nl_pid != 0) {
+                        continue;
+                }
+
+                message[length] = '\0';
+                uevent_events++;
+                check = check || !uevent_is_remove(message);
+        }
+
+        if (check) {
+                uevent_check_waits();
+        }
+}
+
+/**
+ * @fn bool uevent_init()
+ * @brief Hands the uevent socket to the event loop
+ * @return true on success or false on failure
+ * @details Opens it first if bootstrap did not. Waits whose device already
+ *          appeared in the meantime are reported.
+ */
+bool uevent_init()
+{
+        if (!uevent_open()) {
+                return false;
+        }
+
+        control_register("devices", "list device waits and uevent counts",
+                         uevent_command);
+        if (!evloop_add(uevent_socket, EVLOOP_IN, uevent_handle, NULL)) {
+                return false;
+        }
+        uevent_check_waits();
+
+        return true;
+}
+
+struct uevent_coldplug_ctx
+{
+        atomic_size_t triggered;
+};
+
+/**
+ * @fn static void uevent_coldplug_dir(struct par_queue *q, void *item,
+ *                                     void *ctx)
+ * @brief Triggers "add" for the device of a directory of /sys/devices
+ * @details Its subdirectories are queued for the other workers. Symbolic
+ *          links (subsystem, driver...) are not followed.
+ */
+static void uevent_coldplug_dir(struct par_queue *q, void *item, void *ctx)
+{
+        struct uevent_coldplug_ctx *cc = ctx;
+        struct dirent *ent = NULL;
+        char *path = item;
+        char *child = NULL;
+        DIR *dir = NULL;
+        int fd = -1;
+
+        dir = opendir(path);
+        if (dir == NULL) {
+                free(path);
+                return;
+        }
+
+        fd = openat(dirfd(dir), "uevent", O_WRONLY | O_CLOEXEC);
+        if (fd != -1) {
+                if (write(fd, "add", 3) == 3) {
+                        atomic_fetch_add(&cc->triggered, 1);
+                }
+                close(fd);
+        }
+
+        while ((ent = readdir(dir)) != NULL) {
+                if (ent->d_type != DT_DIR || ent->d_name[0] == '.') {
+                        continue;
+                }
+                if (asprintf(&child, "%s/%s", path, ent->d_name) == -1) {
+                        continue;
+                }
+                if (!par_push(q, child)) {
+                        free(child);
+                }
+        }
+
+        closedir(dir);
+        free(path);
+}
+
+/**
+ * @fn size_t uevent_coldplug()
+ * @brief Replays the "add" events of the devices found before boot
+ * @return the number of devices triggered
+ * @details Walks /sys/devices from parallel workers, writing "add" to every
+ *          uevent file. The events land in the uevent socket, opened
+ *          first so none is missed.
+ */
+size_t uevent_coldplug()
+{
+        struct uevent_coldplug_ctx ctx;
+        struct timespec start;
+        struct timespec end;
+        void *items[1] = { NULL };
+
+        uevent_open();
+        atomic_init(&ctx.triggered, 0);
+        items[0] = strdup(UEVENT_SYSFS_DEVICES);
+        if (items[0] == NULL) {
+                return 0;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        par_run(uevent_coldplug_dir, &ctx, items, 1, par_workers());
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        uevent_coldplugged = atomic_load(&ctx.triggered);
+        fprintf(stdout, "cyrenit: coldplugged %zu devices in %ld us\n",
+                uevent_coldplugged,
+                (long) ((end.tv_sec - start.tv_sec) * 1000000 +
+                        (end.tv_nsec - start.tv_nsec) / 1000));
+
+        return uevent_coldplugged;
+}
+
+/**
+ * @fn unsigned uevent_root_timeout()
+ * @brief How long to wait for the root= device, in ms (0: forever)
+ * @details UEVENT_ROOT_TIMEOUT_MS unless the kernel command line has
+ *          rootwait (forever) or rootwait=<seconds>.
+ */
+unsigned uevent_root_timeout()
+{
+        char value[KCMDLINE_MAX];
+        char *end = NULL;
+        unsigned long seconds = 0;
+
+        if (kcmdline_get("rootwait", value, sizeof(value))) {
+                seconds = strtoul(value, &end, 10);
+                if (end != value && *end == '\0') {
+                        return (unsigned) (seconds * 1000);
+                }
+        }
+        if (kcmdline_has("rootwait")) {
+                return 0;
+        }
+
+        return UEVENT_ROOT_TIMEOUT_MS;
+}
+
+static uint64_t uevent_now_ms()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+/**
+ * @fn bool uevent_wait_sync(const char *device, unsigned timeout_ms)
+ * @brief Blocks until device appears, for what must happen before the
+ *        event loop runs (the root file system)
+ * @param timeout_ms 0 to wait forever
+ * @return true if the device is there
+ * @details Sleeps on the uevent socket; the events it drains are handled
+ *          as the event loop would.
+ */
+bool uevent_wait_sync(const char *device, unsigned timeout_ms)
+{
+        uint64_t deadline = uevent_now_ms() + timeout_ms;
+        uint64_t now = 0;
+        struct pollfd pfd;
+
+        if (uevent_device_present(device)) {
+                return true;
+        }
+        if (!uevent_open()) {
+                return false;
+        }
+
+        fprintf(stdout, "cyrenit: waiting for %s\n", device);
+        pfd.fd = uevent_socket;
+        pfd.events = POLLIN;
+        while (!uevent_device_present(device)) {
+                now = uevent_now_ms();
+                if (timeout_ms != 0 && now >= deadline) {
+                        return false;
+                }
+                if (poll(&pfd, 1, timeout_ms == 0 ? -1 :
+                                  (int) (deadline - now)) > 0) {
+                        uevent_handle(uevent_socket, POLLIN, NULL);
+                }
+        }
+
+        return true;
+}
+
+static void uevent_wait_timeout(struct timer *t, void *data)
+{
+        size_t i = 0;
+
+        (void) t;
+
+        for (i = 0; i < uevent_wait_count; i++) {
+                if (uevent_waits[i] == data) {
+                        uevent_wait_fire(i, false);
+                        return;
+                }
+        }
+}
+
+/**
+ * @fn bool uevent_wait(const char *device, unsigned timeout_ms,
+ *                      uevent_fn fn, void *data)
+ * @brief Calls fn once device appears or timeout_ms runs out
+ * @return true if the wait was set up, or device is already there and fn
+ *         was called; false on failure, fn is then never called
+ */
+bool uevent_wait(const char *device, unsigned timeout_ms, uevent_fn fn,
+                 void *data)
+{
+        struct uevent_wait **new_waits = NULL;
+        struct uevent_wait *wait = NULL;
+
+        if (uevent_device_present(device)) {
+                fn(device, true, data);
+                return true;
+        }
+
+        if (uevent_wait_count >= uevent_wait_allocated) {
+                new_waits = mem_reallocarray(MEM_EVENTS, uevent_waits,
+                                             uevent_wait_allocated +
+                                             UEVENT_WAIT_ALLOC_STEP,
+                                             sizeof(struct uevent_wait *));
+                if (new_waits == NULL) {
+                        return false;
+                }
+                uevent_waits = new_waits;
+                uevent_wait_allocated += UEVENT_WAIT_ALLOC_STEP;
+        }
+
+        wait = mem_calloc(MEM_EVENTS, 1, sizeof(struct uevent_wait));
+        if (wait == NULL) {
+                return false;
+        }
+        wait->device = mem_strdup(MEM_EVENTS, device);
+        if (wait->device == NULL) {
+                mem_free(MEM_EVENTS, wait);
+                return false;
+        }
+        wait->fn = fn;
+        wait->data = data;
+        timer_init(&wait->timeout, uevent_wait_timeout, wait);
+        if (timeout_ms != 0) {
+                timer_add(&supervisor_timers, &wait->timeout, timeout_ms,
+                          TIMER_COARSE);
+        }
+        uevent_waits[uevent_wait_count++] = wait;
+
+        return true;
+}
+
+/**
+ * @fn void uevent_cancel(void *data)
+ * @brief Drops every wait set up with data, without calling them
+ */
+void uevent_cancel(void *data)
+{
+        size_t i = 0;
+
+        while (i < uevent_wait_count) {
+                if (uevent_waits[i]->data != data) {
+                        i++;
+                        continue;
+                }
+                uevent_wait_free(uevent_waits[i]);
+                uevent_wait_remove(i);
+        }
+}
+
+static void uevent_command(int argc, char **argv,
+                           struct control_reply *reply)
+{
+        size_t i = 0;
+
+        if (argc != 1) {
+                control_reply_error(reply, "usage: %s", argv[0]);
+                return;
+        }
+
+        control_reply_printf(reply, "events=%llu overruns=%llu "
+                             "coldplugged=%zu\n",
+                             (unsigned long long) uevent_events,
+                             (unsigned long long) uevent_overruns,
+                             uevent_coldplugged);
+        for (i = 0; i < uevent_wait_count; i++) {
+                control_reply_printf(reply, "waiting for %s\n",
+                                     uevent_waits[i]->device);
+        }
+}
+
+#endif//__UEVENT_C
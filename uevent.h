@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * uevent.h - Kernel device events, device waits and coldplug
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __UEVENT_H
+#define __UEVENT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "timer.h"
+
+#define UEVENT_MSG_MAX 8192
+/* coldplug sends a burst of thousands of events at once */
+#define UEVENT_RCVBUF (16 * 1024 * 1024)
+#define UEVENT_SYSFS_DEVICES "/sys/devices"
+#define UEVENT_CLASS_DIR "/sys/class"
+/* how long services and mounts wait for a device by default */
+#define UEVENT_WAIT_TIMEOUT_MS 90000
+/* how long the root= device is waited for, see uevent_root_timeout() */
+#define UEVENT_ROOT_TIMEOUT_MS 30000
+
+/*
+ * Devices are named either by their node, "/dev/sda1", or as
+ * "<subsystem>:<name>" for what has none, e.g. "net:eth0" for a NIC
+ * (/sys/class/net/eth0). devtmpfs creates the node before the kernel sends
+ * the event, so a device is there as soon as its path exists: waits are
+ * checked again on every event instead of being polled.
+ *
+ * A wait calls fn once, with present set, when the device shows up, or
+ * with present clear when timeout_ms (0: never) runs out first. A device
+ * already there is reported right away.
+ */
+typedef void (*uevent_fn)(const char *device, bool present, void *data);
+
+struct uevent_wait
+{
+        char *device;
+        uevent_fn fn;
+        void *data;
+        struct timer timeout;
+};
+
+bool uevent_device_present(const char *device);
+bool uevent_open();
+bool uevent_init();
+size_t uevent_coldplug();
+unsigned uevent_root_timeout();
+bool uevent_wait_sync(const char *device, unsigned timeout_ms);
+bool uevent_wait(const char *device, unsigned timeout_ms, uevent_fn fn,
+                 void *data);
+void uevent_cancel(void *data);
+
+#endif//__UEVENT_H
@@ -0,0 +1,491 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * uring.c - io_uring backend of the event loop
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __URING_C
+#define __URING_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "evloop.h"
+#include "memstat.h"
+#include "uring.h"
+
+/* The poll heading a reader chain, its completion only reports failures */
+#define URING_TAG_POLL 1ULL
+#define URING_PROBE_OPS 256
+
+/*
+ * Every watch has one op. Polls are one-shot and re-armed after the
+ * callback, which keeps epoll's level triggered semantics; the re-arms of
+ * a whole iteration go to the kernel with the next wait. Readers are a
+ * poll linked to a read into the op's buffer.
+ *
+ * An op whose watch went away while the kernel still owns it is marked
+ * stale and freed when its last completion arrives.
+ */
+struct uring_op
+{
+        int fd;
+        bool reader;
+        bool armed;
+        bool dispatching;
+        bool stale;
+        char buffer[];
+};
+
+struct uring
+{
+        int fd;
+        unsigned sq_entries;
+        unsigned sq_tail;
+        unsigned pending;
+        unsigned *sq_head;
+        unsigned *sq_ktail;
+        unsigned *sq_mask;
+        unsigned *sq_array;
+        struct io_uring_sqe *sqes;
+        unsigned *cq_head;
+        unsigned *cq_tail;
+        unsigned *cq_mask;
+        struct io_uring_cqe *cqes;
+        void *sq_ring;
+        void *cq_ring;
+        size_t sq_ring_size;
+        size_t cq_ring_size;
+        size_t sqes_size;
+};
+
+static struct uring ring = { .fd = -1 };
+
+static bool uring_supported(int fd, const struct io_uring_params *params)
+{
+        static const uint8_t needed[] = {
+                IORING_OP_POLL_ADD,
+                IORING_OP_READ,
+                IORING_OP_ASYNC_CANCEL,
+        };
+        const uint32_t features = IORING_FEAT_SINGLE_MMAP |
+                                  IORING_FEAT_NODROP |
+                                  IORING_FEAT_CQE_SKIP;
+        struct io_uring_probe *probe = NULL;
+        bool ok = true;
+        size_t i = 0;
+
+        if ((params->features & features) != features) {
+                return false;
+        }
+
+        probe = mem_calloc(MEM_EVENTS, 1, sizeof(struct io_uring_probe) +
+                           URING_PROBE_OPS *
+                           sizeof(struct io_uring_probe_op));
+        if (probe == NULL) {
+                return false;
+        }
+
+        if (syscall(SYS_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+                    URING_PROBE_OPS) != 0) {
+                mem_free(MEM_EVENTS, probe);
+                return false;
+        }
+
+        for (i = 0; i < sizeof(needed); i++) {
+                if (needed[i] > probe->last_op ||
+                    !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED)) {
+                        ok = false;
+                }
+        }
+
+        mem_free(MEM_EVENTS, probe);
+        return ok;
+}
+
+static void uring_unmap()
+{
+        if (ring.sqes != NULL) {
+                munmap(ring.sqes, ring.sqes_size);
+        }
+        if (ring.sq_ring != NULL) {
+                munmap(ring.sq_ring, ring.sq_ring_size);
+        }
+        if (ring.fd != -1) {
+                close(ring.fd);
+        }
+        memset(&ring, 0, sizeof(ring));
+        ring.fd = -1;
+}
+
+/**
+ * @fn static bool uring_init()
+ * @brief Sets up the ring and maps its queues
+ * @return true on success or false if io_uring is unusable here
+ * @details COOP_TASKRUN is only a hint, rings are retried without it.
+ */
+static bool uring_init()
+{
+        struct io_uring_params params;
+        uint8_t *sq = NULL;
+        uint8_t *cq = NULL;
+
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+        params.cq_entries = URING_ENTRIES * 2;
+        ring.fd = (int) syscall(SYS_io_uring_setup, URING_ENTRIES, &params);
+        if (ring.fd == -1 && errno == EINVAL) {
+                memset(&params, 0, sizeof(params));
+                params.flags = IORING_SETUP_CQSIZE;
+                params.cq_entries = URING_ENTRIES * 2;
+                ring.fd = (int) syscall(SYS_io_uring_setup, URING_ENTRIES,
+                                        &params);
+        }
+        if (ring.fd == -1) {
+                return false;
+        }
+
+        if (!uring_supported(ring.fd, &params)) {
+                uring_unmap();
+                return false;
+        }
+
+        /* SINGLE_MMAP: both rings share one mapping */
+        ring.sq_ring_size = params.sq_off.array +
+                            params.sq_entries * sizeof(unsigned);
+        ring.cq_ring_size = params.cq_off.cqes +
+                            params.cq_entries * sizeof(struct io_uring_cqe);
+        if (ring.cq_ring_size > ring.sq_ring_size) {
+                ring.sq_ring_size = ring.cq_ring_size;
+        }
+        ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring.fd,
+                            IORING_OFF_SQ_RING);
+        if (ring.sq_ring == MAP_FAILED) {
+                ring.sq_ring = NULL;
+                uring_unmap();
+                return false;
+        }
+        ring.cq_ring = ring.sq_ring;
+
+        ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+        if (ring.sqes == MAP_FAILED) {
+                ring.sqes = NULL;
+                uring_unmap();
+                return false;
+        }
+
+        sq = ring.sq_ring;
+        cq = ring.cq_ring;
+        ring.sq_entries = params.sq_entries;
+        ring.sq_head = (unsigned *) (sq + params.sq_off.head);
+        ring.sq_ktail = (unsigned *) (sq + params.sq_off.tail);
+        ring.sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+        ring.sq_array = (unsigned *) (sq + params.sq_off.array);
+        ring.cq_head = (unsigned *) (cq + params.cq_off.head);
+        ring.cq_tail = (unsigned *) (cq + params.cq_off.tail);
+        ring.cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+        ring.cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+        ring.sq_tail = *ring.sq_ktail;
+
+        return true;
+}
+
+/**
+ * @fn static int uring_enter(unsigned wait)
+ * @brief Submits the queued entries, waiting for wait completions
+ * @return what io_uring_enter(2) returned
+ */
+static int uring_enter(unsigned wait)
+{
+        int ret = 0;
+
+        __atomic_store_n(ring.sq_ktail, ring.sq_tail, __ATOMIC_RELEASE);
+        ret = (int) syscall(SYS_io_uring_enter, ring.fd, ring.pending, wait,
+                            wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (ret > 0) {
+                ring.pending -= (unsigned) ret;
+        }
+
+        return ret;
+}
+
+/**
+ * @fn static struct io_uring_sqe *uring_get_sqes(unsigned count)
+ * @brief Queues count consecutive, zeroed submission entries
+ * @return the first of them, or NULL if the queue stays full
+ * @details Entries meant to be linked must come from a single call, a
+ *          flush in between would break the chain.
+ */
+static struct io_uring_sqe *uring_get_sqes(unsigned count)
+{
+        struct io_uring_sqe *sqe = NULL;
+        unsigned head = 0;
+        unsigned index = 0;
+        unsigned i = 0;
+
+        head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+        if (ring.sq_tail + count - head > ring.sq_entries) {
+                uring_enter(0);
+                head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+                if (ring.sq_tail + count - head > ring.sq_entries) {
+                        return NULL;
+                }
+        }
+
+        /* the array is the identity, chained entries stay adjacent */
+        index = ring.sq_tail & *ring.sq_mask;
+        if (index + count > ring.sq_entries) {
+                for (i = 0; index + i < ring.sq_entries; i++) {
+                        ring.sq_array[index + i] = index + i;
+                        sqe = &ring.sqes[index + i];
+                        memset(sqe, 0, sizeof(struct io_uring_sqe));
+                        sqe->opcode = IORING_OP_NOP;
+                        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+                }
+                ring.sq_tail += i;
+                ring.pending += i;
+                return uring_get_sqes(count);
+        }
+
+        for (i = 0; i < count; i++) {
+                ring.sq_array[index + i] = index + i;
+                memset(&ring.sqes[index + i], 0, sizeof(struct io_uring_sqe));
+        }
+        ring.sq_tail += count;
+        ring.pending += count;
+
+        return &ring.sqes[index];
+}
+
+static bool uring_arm(struct uring_op *op, uint32_t events)
+{
+        struct io_uring_sqe *sqe = NULL;
+
+        sqe = uring_get_sqes(op->reader ? 2 : 1);
+        if (sqe == NULL) {
+                return false;
+        }
+
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = op->fd;
+        sqe->poll32_events = op->reader ? POLLIN : events;
+        sqe->user_data = (uint64_t) (uintptr_t) op;
+        if (op->reader) {
+                sqe->flags = IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+                sqe->user_data |= URING_TAG_POLL;
+
+                sqe++;
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = op->fd;
+                sqe->addr = (uint64_t) (uintptr_t) op->buffer;
+                sqe->len = EVLOOP_READ_SIZE;
+                sqe->off = (uint64_t) -1;
+                sqe->user_data = (uint64_t) (uintptr_t) op;
+        }
+
+        op->armed = true;
+        return true;
+}
+
+static void uring_cancel(struct uring_op *op)
+{
+        struct io_uring_sqe *sqe = NULL;
+
+        op->stale = true;
+        sqe = uring_get_sqes(1);
+        if (sqe == NULL) {
+                return; //leaks op until its completion comes on its own
+        }
+
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t) (uintptr_t) op;
+        if (op->reader) {
+                sqe->addr |= URING_TAG_POLL;
+        }
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+}
+
+static struct uring_op *uring_op_create(int fd, bool reader)
+{
+        struct uring_op *op = NULL;
+
+        op = mem_calloc(MEM_EVENTS, 1, sizeof(struct uring_op) +
+                        (reader ? EVLOOP_READ_SIZE : 0));
+        if (op == NULL) {
+                return NULL;
+        }
+
+        op->fd = fd;
+        op->reader = reader;
+        return op;
+}
+
+static bool uring_add(int fd, struct ev_watch *w)
+{
+        struct uring_op *op = NULL;
+
+        op = uring_op_create(fd, w->read_callback != NULL);
+        if (op == NULL) {
+                return false;
+        }
+
+        if (!uring_arm(op, w->events)) {
+                mem_free(MEM_EVENTS, op);
+                return false;
+        }
+
+        w->op = op;
+        return true;
+}
+
+static bool uring_modify(int fd, struct ev_watch *w)
+{
+        struct uring_op *op = w->op;
+
+        /* in its callback: re-armed with the new events on return */
+        if (!op->armed) {
+                return true;
+        }
+
+        if (!uring_add(fd, w)) {
+                w->op = op;
+                return false;
+        }
+        uring_cancel(op);
+
+        return true;
+}
+
+static void uring_del(int fd, struct ev_watch *w)
+{
+        struct uring_op *op = w->op;
+
+        (void) fd;
+        if (op->armed) {
+                uring_cancel(op);
+        }
+        else if (op->dispatching) {
+                op->stale = true;
+        }
+        else {
+                mem_free(MEM_EVENTS, op);
+        }
+        w->op = NULL;
+}
+
+/**
+ * @fn static void uring_complete(uint64_t user_data, int32_t res)
+ * @brief Hands a completion to the watch it belongs to and re-arms it
+ */
+static void uring_complete(uint64_t user_data, int32_t res)
+{
+        struct uring_op *op = NULL;
+        struct ev_watch *w = NULL;
+        bool rearm = true;
+
+        if (user_data == 0 || (user_data & URING_TAG_POLL)) {
+                return; //the read of a failed chain completes as well
+        }
+
+        op = (struct uring_op *) (uintptr_t) user_data;
+        op->armed = false;
+        if (op->stale) {
+                mem_free(MEM_EVENTS, op);
+                return;
+        }
+
+        w = evloop_watch(op->fd);
+        op->dispatching = true;
+        if (!op->reader) {
+                if (res >= 0) {
+                        evloop_dispatch(op->fd, (uint32_t) res);
+                }
+                else {
+                        rearm = res == -ECANCELED || res == -EINTR;
+                }
+        }
+        else if (res == -EAGAIN || res == -ECANCELED || res == -EINTR) {
+                /* nothing read, the poll woke up for nothing or was cut */
+        }
+        else {
+                w->read_callback(op->fd, op->buffer, res, w->data);
+                rearm = res > 0;
+        }
+        op->dispatching = false;
+
+        if (op->stale) {
+                mem_free(MEM_EVENTS, op);
+                return;
+        }
+
+        w = evloop_watch(op->fd);
+        if (rearm && w != NULL && !uring_arm(op, w->events)) {
+                fprintf(stderr, "cyrenit: io_uring submission queue full, "
+                        "fd %d is no longer watched\n", op->fd);
+        }
+}
+
+/**
+ * @fn static bool uring_wait()
+ * @brief Submits every pending entry and waits for a completion, all in a
+ *        single system call, then dispatches what completed
+ * @return true on success or false on failure
+ */
+MEM_HOT
+static bool uring_wait()
+{
+        struct io_uring_cqe *cqe = NULL;
+        uint64_t user_data = 0;
+        unsigned head = 0;
+        unsigned tail = 0;
+        int32_t res = 0;
+
+        if (uring_enter(1) == -1 && errno != EINTR && errno != EBUSY &&
+            errno != EAGAIN) {
+                perror("cyrenit: io_uring_enter failed");
+                return false;
+        }
+
+        head = *ring.cq_head;
+        tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+                cqe = &ring.cqes[head & *ring.cq_mask];
+                user_data = cqe->user_data;
+                res = cqe->res;
+                head++;
+                __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+                uring_complete(user_data, res);
+        }
+
+        return true;
+}
+
+const struct evloop_backend uring_backend = {
+        .name = "io_uring",
+        .init = uring_init,
+        .add = uring_add,
+        .modify = uring_modify,
+        .del = uring_del,
+        .wait = uring_wait,
+};
+
+#endif//__URING_C
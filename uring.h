@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * uring.h - io_uring backend of the event loop
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __URING_H
+#define __URING_H
+
+#include "evloop.h"
+
+/* Submission queue size; the completion queue is twice as large */
+#define URING_ENTRIES 256
+
+/*
+ * Talks to the kernel through the raw system calls, there is no liburing
+ * in the initcpio. init() fails, and evloop.c falls back to epoll, on
+ * kernels without the operations and features listed in uring.c.
+ */
+extern const struct evloop_backend uring_backend;
+
+#endif//__URING_H
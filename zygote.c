@@ -0,0 +1,283 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * zygote.c - Pre-initialized fork servers for frequently spawned services
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __ZYGOTE_C
+#define __ZYGOTE_C
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "evloop.h"
+#include "proc.h"
+#include "zygote.h"
+
+#define ZYGOTE_FD_SIZE 16
+/* ZYGOTE_CMD, the socket and the image come before the service's argv */
+#define ZYGOTE_EXTRA_ARGS 3
+
+/**
+ * @fn void zygote_init(struct zygote *z)
+ * @brief Initialises a zygote without starting it
+ */
+void zygote_init(struct zygote *z)
+{
+        z->pid = -1;
+        z->pidfd = -1;
+        z->fd = -1;
+        z->seq = 0;
+        z->pending = false;
+        timer_init(&z->timeout, NULL, NULL);
+}
+
+/* Drops a zygote that broke, handing a pending request to a plain fork */
+static void zygote_fail(struct process *proc)
+{
+        bool pending = proc->zygote.pending;
+
+        zygote_stop(proc);
+        if (pending) {
+                process_spawned(proc, -1);
+        }
+}
+
+static void zygote_timeout(struct timer *t, void *data)
+{
+        struct process *proc = data;
+
+        (void) t;
+        fprintf(stderr, "cyrenit: zygote %d of %s did not answer in %d ms\n",
+                proc->zygote.pid, proc->exec_image, ZYGOTE_TIMEOUT_MS);
+        zygote_fail(proc);
+}
+
+/* Answers of the zygote, or its end of the socket hanging up */
+static void zygote_handle(int fd, uint32_t events, void *data)
+{
+        struct process *proc = data;
+        struct zygote *z = &proc->zygote;
+        struct zygote_reply reply;
+        ssize_t ret = 0;
+
+        (void) events;
+        ret = recv(fd, &reply, sizeof(reply), MSG_DONTWAIT);
+        if (ret == -1 && (errno == EAGAIN || errno == EINTR)) {
+                return;
+        }
+        if (ret != (ssize_t) sizeof(reply)) {
+                zygote_fail(proc);
+                return;
+        }
+        if (!z->pending || reply.seq != z->seq) {
+                return;
+        }
+
+        z->pending = false;
+        timer_cancel(&z->timeout);
+        if (reply.pid < 0) {
+                errno = -reply.pid;
+                process_spawned(proc, -1);
+                return;
+        }
+        process_spawned(proc, reply.pid);
+}
+
+/**
+ * @fn bool zygote_start(struct process *proc)
+ * @brief Forks the zygote of proc and sets it up as the service would be
+ * @return true on success or false on failure
+ */
+bool zygote_start(struct process *proc)
+{
+        char fd_arg[ZYGOTE_FD_SIZE];
+        char **argv = NULL;
+        char **envp = NULL;
+        size_t argc = 0;
+        size_t i = 0;
+        pid_t pid = 0;
+        int fds[2] = { -1, -1 };
+
+        if (proc == NULL || proc->exec_image == NULL) {
+                return false;
+        }
+
+        argc = proc->argv == NULL ? 1 : proc->arg_counter;
+        argv = calloc(argc + ZYGOTE_EXTRA_ARGS + 1, sizeof(char *));
+        if (argv == NULL) {
+                return false;
+        }
+
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0) {
+                free(argv);
+                return false;
+        }
+
+        snprintf(fd_arg, sizeof(fd_arg), "%d", fds[1]);
+        argv[0] = ZYGOTE_CMD;
+        argv[1] = fd_arg;
+        argv[2] = proc->exec_image;
+        for (i = 0; i < argc; i++) {
+                argv[ZYGOTE_EXTRA_ARGS + i] = proc->argv == NULL ?
+                                              proc->exec_image :
+                                              proc->argv[i];
+        }
+
+        envp = proc->env_dynamic || proc->environment == NULL ?
+               environ : proc->environment;
+
+        fflush(stdout);
+        pid = fork();
+        if (pid == -1) {
+                close(fds[0]);
+                close(fds[1]);
+                free(argv);
+                return false;
+        }
+
+        if (pid == 0) {
+                close(fds[0]);
+                if (!process_setup_child(proc)) {
+                        _exit(EXIT_FAILURE);
+                }
+                fcntl(fds[1], F_SETFD, 0);
+                execve(ZYGOTE_BINARY, argv, envp);
+                _exit(EXIT_FAILURE);
+        }
+
+        free(argv);
+        close(fds[1]);
+        proc->zygote.pid = pid;
+        proc->zygote.pidfd = (int) syscall(SYS_pidfd_open, pid, 0);
+        proc->zygote.fd = fds[0];
+        timer_init(&proc->zygote.timeout, zygote_timeout, proc);
+        if (!evloop_add(fds[0], EVLOOP_IN, zygote_handle, proc)) {
+                zygote_stop(proc);
+                return false;
+        }
+
+        fprintf(stdout, "cyrenit[%d]: started zygote %d for %s\n", getpid(),
+                pid, proc->exec_image);
+        return true;
+}
+
+/**
+ * @fn void zygote_stop(struct process *proc)
+ * @brief Kills the zygote of proc, it is reaped as any unknown child
+ * @details A pending request is dropped. Without a pidfd the zygote is
+ *          left to exit on its own once it sees the socket closed.
+ */
+void zygote_stop(struct process *proc)
+{
+        struct zygote *z = &proc->zygote;
+
+        timer_cancel(&z->timeout);
+        if (z->fd != -1) {
+                evloop_del(z->fd);
+                close(z->fd);
+        }
+        if (z->pidfd != -1) {
+                syscall(SYS_pidfd_send_signal, z->pidfd, SIGKILL, NULL, 0);
+                close(z->pidfd);
+        }
+        zygote_init(z);
+}
+
+/**
+ * @fn bool zygote_spawn(struct process *proc)
+ * @brief Asks the zygote of proc, starting it if needed, for a new instance
+ * @return true if the request went out, the pid then reaches
+ *         process_spawned() from the loop
+ * @details A zygote that does not answer within ZYGOTE_TIMEOUT_MS is
+ *          killed, and process_spawned() gets -1 to fork it directly.
+ */
+bool zygote_spawn(struct process *proc)
+{
+        struct zygote *z = &proc->zygote;
+        struct zygote_request request;
+
+        if (z->pending) {
+                return false;
+        }
+        if (z->fd == -1 && !zygote_start(proc)) {
+                return false;
+        }
+
+        request.seq = ++z->seq;
+        if (send(z->fd, &request, sizeof(request), MSG_NOSIGNAL) !=
+            (ssize_t) sizeof(request)) {
+                zygote_stop(proc);
+                return false;
+        }
+
+        z->pending = true;
+        timer_add(&supervisor_timers, &z->timeout, ZYGOTE_TIMEOUT_MS,
+                  TIMER_FINE);
+        return true;
+}
+
+/**
+ * @fn int zygote_main(int argc, char **argv)
+ * @brief Main loop of a zygote, run as ZYGOTE_CMD <socket> <image> <argv>
+ * @details Exits when PID 1 closes its end of the socket, e.g. on
+ *          re-exec. Clones are raw clone(2) calls: the child does nothing
+ *          but exec, so none of the libc fork bookkeeping is needed.
+ */
+int zygote_main(int argc, char **argv)
+{
+        struct zygote_request request;
+        struct zygote_reply reply;
+        ssize_t ret = 0;
+        long pid = 0;
+        int fd = -1;
+
+        if (argc < ZYGOTE_EXTRA_ARGS + 1) {
+                return EXIT_FAILURE;
+        }
+
+        fd = atoi(argv[1]);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        for (;;) {
+                ret = recv(fd, &request, sizeof(request), 0);
+                if (ret < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (ret != (ssize_t) sizeof(request)) {
+                        return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+                }
+
+                pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL,
+                              NULL, NULL);
+                if (pid == 0) {
+                        setsid();
+                        execve(argv[2], argv + ZYGOTE_EXTRA_ARGS, environ);
+                        _exit(127);
+                }
+
+                reply.seq = request.seq;
+                reply.pid = pid < 0 ? -errno : (int32_t) pid;
+                if (send(fd, &reply, sizeof(reply), MSG_NOSIGNAL) !=
+                    (ssize_t) sizeof(reply)) {
+                        return EXIT_FAILURE;
+                }
+        }
+}
+
+#endif//__ZYGOTE_C
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * zygote.h - Pre-initialized fork servers for frequently spawned services
+ *
+ * Copyright (C) 2025, Ágatha Isabelle Moreira Guedes <code@agatha.dev>
+ *
+ * This file is part of Cyrenit. It is licensed under the GNU GPL, version 3 or
+ * any later version. See the LICENSE file accompanying this project for full
+ * details.
+ */
+
+#ifndef __ZYGOTE_H
+#define __ZYGOTE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "timer.h"
+
+#define ZYGOTE_CMD "cyrenit-zygote"
+#define ZYGOTE_BINARY "/proc/self/exe"
+#define ZYGOTE_TIMEOUT_MS 1000
+
+/*
+ * A zygote is forked once per service, gets the log pipe, cgroup,
+ * execution attributes, credentials and environment of the service and
+ * then re-executes cyrenit as ZYGOTE_CMD, leaving it with a small, clean
+ * address space. For every request on its socket it clones a child with
+ * CLONE_PARENT, so the child is PID 1's and reaped as any other service,
+ * and the child only has to exec the service.
+ *
+ * PID 1 does not wait for the answer: it arrives on the event loop, which
+ * hands the child's pid to process_spawned(). The zygote is only signaled
+ * through its pidfd, so a pid reused after it died is never hit.
+ */
+struct zygote
+{
+        pid_t pid;
+        int pidfd;
+        int fd;
+        uint32_t seq;
+        /* a request is waiting for its answer */
+        bool pending;
+        struct timer timeout;
+};
+
+struct zygote_request
+{
+        uint32_t seq;
+};
+
+struct zygote_reply
+{
+        uint32_t seq;
+        int32_t pid; /* -errno on failure */
+};
+
+struct process;
+
+void zygote_init(struct zygote *z);
+bool zygote_start(struct process *proc);
+bool zygote_spawn(struct process *proc);
+void zygote_stop(struct process *proc);
+int zygote_main(int argc, char **argv);
+
+#endif//__ZYGOTE_H